@@ -0,0 +1,597 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Bit error rate tester. A PRBS goes out on the port as fast as it will take
+ * it, and whatever comes back, usually through a loopback plug, is checked
+ * against a second generator that synchronises itself to the received data */
+
+#include "bert.h"
+#include "sellerie-enums.h"
+#include "transfer-rate.h"
+
+#include <glib/gi18n.h>
+
+#include <string.h>
+
+#define BERT_NOTIFY_INTERVAL (G_USEC_PER_SEC / 10)
+#define BERT_RATE_WINDOW (3 * G_USEC_PER_SEC)
+#define BERT_CHUNK_SIZE 4096
+
+// After seeding the receive generator this many bytes have to match before
+// the tester counts itself locked
+#define BERT_LOCK_BYTES 16
+
+// Once locked, loss of sync is decided per block: a bit slip or a lost byte
+// makes nearly every byte wrong, even a bad link far less than half of them
+#define BERT_SLIP_BLOCK 64
+#define BERT_SLIP_THRESHOLD (BERT_SLIP_BLOCK / 2)
+
+typedef enum { BERT_HUNTING, BERT_CHECKING, BERT_LOCKED } BertSync;
+
+struct _GtBert {
+    GObject parent_instance;
+    GtSerialPort *port;
+    GtPrbsPattern pattern;
+
+    GTask *task;
+    GSource *cancel_source;
+    GCancellable *write_cancellable;
+    gulong data_handler;
+    gboolean writing;
+    gboolean stopping;
+    GError *error;
+
+    GtPrbs tx;
+    GtPrbs rx;
+    BertSync sync;
+    guint8 seed[4];
+    gsize seed_fill;
+    guint matched;
+    guint block_fill;
+    guint block_bad;
+
+    GtBertStats stats;
+    GtTransferRate rate;
+    gint64 start_time;
+    gint64 last_notify;
+    guint notify_id;
+};
+
+G_DEFINE_TYPE (GtBert, gt_bert, G_TYPE_OBJECT)
+
+enum {
+    PROP_0,
+    PROP_SERIAL_PORT,
+    PROP_PATTERN,
+    PROP_LOCKED,
+    PROP_BYTES_PER_SECOND,
+    N_PROPS
+};
+
+static GParamSpec *properties[N_PROPS];
+
+static void
+gt_bert_dispose (GObject *object)
+{
+    GtBert *self = (GtBert *)object;
+
+    g_clear_signal_handler (&self->data_handler, self->port);
+    g_clear_handle_id (&self->notify_id, g_source_remove);
+
+    if (self->cancel_source != NULL) {
+        g_source_destroy (self->cancel_source);
+        g_clear_pointer (&self->cancel_source, g_source_unref);
+    }
+
+    G_OBJECT_CLASS (gt_bert_parent_class)->dispose (object);
+}
+
+static void
+gt_bert_finalize (GObject *object)
+{
+    GtBert *self = (GtBert *)object;
+
+    g_clear_error (&self->error);
+    g_clear_object (&self->write_cancellable);
+    g_clear_object (&self->port);
+
+    G_OBJECT_CLASS (gt_bert_parent_class)->finalize (object);
+}
+
+static void
+gt_bert_get_property (GObject *object,
+                      guint prop_id,
+                      GValue *value,
+                      GParamSpec *pspec)
+{
+    GtBert *self = GT_BERT (object);
+
+    switch (prop_id) {
+    case PROP_PATTERN:
+        g_value_set_enum (value, self->pattern);
+        break;
+    case PROP_LOCKED:
+        g_value_set_boolean (value, self->sync == BERT_LOCKED);
+        break;
+    case PROP_BYTES_PER_SECOND:
+        g_value_set_double (value, gt_transfer_rate_get_current (&self->rate));
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gt_bert_set_property (GObject *object,
+                      guint prop_id,
+                      const GValue *value,
+                      GParamSpec *pspec)
+{
+    GtBert *self = GT_BERT (object);
+
+    switch (prop_id) {
+    case PROP_SERIAL_PORT:
+        self->port = GT_SERIAL_PORT (g_value_dup_object (value));
+        break;
+    case PROP_PATTERN:
+        self->pattern = g_value_get_enum (value);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gt_bert_class_init (GtBertClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    object_class->dispose = gt_bert_dispose;
+    object_class->finalize = gt_bert_finalize;
+    object_class->get_property = gt_bert_get_property;
+    object_class->set_property = gt_bert_set_property;
+
+    properties[PROP_SERIAL_PORT] = g_param_spec_object (
+        "serial-port",
+        "serial-port",
+        "serial-port",
+        GT_TYPE_SERIAL_PORT,
+        G_PARAM_STATIC_STRINGS | G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY);
+
+    properties[PROP_PATTERN] = g_param_spec_enum (
+        "pattern",
+        "pattern",
+        "Bit sequence to send and expect back",
+        GT_TYPE_PRBS_PATTERN,
+        GT_PRBS_PATTERN_PRBS15,
+        G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+
+    properties[PROP_LOCKED] =
+        g_param_spec_boolean ("locked",
+                              "locked",
+                              "Whether the received data follows the pattern",
+                              FALSE,
+                              G_PARAM_STATIC_STRINGS | G_PARAM_READABLE);
+
+    properties[PROP_BYTES_PER_SECOND] =
+        g_param_spec_double ("bytes-per-second",
+                             "bytes-per-second",
+                             "Receive throughput over the last few seconds",
+                             0.0,
+                             G_MAXDOUBLE,
+                             0.0,
+                             G_PARAM_STATIC_STRINGS | G_PARAM_READABLE);
+
+    g_object_class_install_properties (object_class, N_PROPS, properties);
+}
+
+static void
+gt_bert_init (GtBert *self)
+{
+}
+
+GtBert *
+gt_bert_new (GtSerialPort *port, GtPrbsPattern pattern)
+{
+    return g_object_new (
+        GT_TYPE_BERT, "serial-port", port, "pattern", pattern, NULL);
+}
+
+// internal functions
+
+static void
+gt_bert_notify (GtBert *self)
+{
+    self->last_notify = g_get_monotonic_time ();
+    g_object_notify_by_pspec (G_OBJECT (self),
+                              properties[PROP_BYTES_PER_SECOND]);
+}
+
+static gboolean
+on_notify_timeout (gpointer user_data)
+{
+    GtBert *self = GT_BERT (user_data);
+
+    self->notify_id = 0;
+    gt_bert_notify (self);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+gt_bert_report (GtBert *self)
+{
+    gint64 now = g_get_monotonic_time ();
+    gint64 due = self->last_notify + BERT_NOTIFY_INTERVAL;
+
+    gt_transfer_rate_add (&self->rate, now, self->stats.bytes_received);
+
+    if (now >= due) {
+        g_clear_handle_id (&self->notify_id, g_source_remove);
+        gt_bert_notify (self);
+    } else if (self->notify_id == 0) {
+        self->notify_id =
+            g_timeout_add ((due - now) / 1000 + 1, on_notify_timeout, self);
+    }
+}
+
+static void
+gt_bert_set_sync (GtBert *self, BertSync sync)
+{
+    gboolean was_locked = self->sync == BERT_LOCKED;
+
+    self->sync = sync;
+    self->matched = 0;
+    self->block_fill = 0;
+    self->block_bad = 0;
+
+    if (was_locked != (sync == BERT_LOCKED))
+        g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_LOCKED]);
+}
+
+static inline guint
+count_bits (guint64 x)
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll (x);
+#else
+    x = x - ((x >> 1) & G_GUINT64_CONSTANT (0x5555555555555555));
+    x = (x & G_GUINT64_CONSTANT (0x3333333333333333)) +
+        ((x >> 2) & G_GUINT64_CONSTANT (0x3333333333333333));
+    x = (x + (x >> 4)) & G_GUINT64_CONSTANT (0x0f0f0f0f0f0f0f0f);
+
+    return (x * G_GUINT64_CONSTANT (0x0101010101010101)) >> 56;
+#endif
+}
+
+static void
+gt_bert_count_errors (GtBert *self, guint64 difference)
+{
+    self->stats.bit_errors += count_bits (difference);
+
+    for (; difference != 0; difference >>= 8) {
+        if ((difference & 0xff) != 0) {
+            self->stats.byte_errors++;
+            self->block_bad++;
+        }
+    }
+}
+
+// Look for the pattern one byte at a time: seed the generator from the last
+// few bytes, then see whether the following ones agree with it
+static gsize
+gt_bert_hunt (GtBert *self, const guint8 *data, gsize length)
+{
+    gsize seed_length = gt_prbs_get_seed_length (&self->rx);
+    gsize i;
+
+    for (i = 0; i < length; i++) {
+        if (self->sync == BERT_CHECKING) {
+            guint8 expected;
+
+            gt_prbs_fill (&self->rx, &expected, 1);
+            if (expected != data[i]) {
+                gt_bert_set_sync (self, BERT_HUNTING);
+            } else if (++self->matched == BERT_LOCK_BYTES) {
+                gt_bert_set_sync (self, BERT_LOCKED);
+
+                return i + 1;
+            }
+        }
+
+        if (self->seed_fill == seed_length) {
+            memmove (self->seed, self->seed + 1, seed_length - 1);
+            self->seed_fill--;
+        }
+        self->seed[self->seed_fill++] = data[i];
+
+        if (self->sync == BERT_HUNTING && self->seed_fill == seed_length &&
+            gt_prbs_seed (&self->rx, self->seed)) {
+            gt_bert_set_sync (self, BERT_CHECKING);
+        }
+    }
+
+    return length;
+}
+
+// Compare up to the end of the current slip block, eight bytes at a time
+static gsize
+gt_bert_compare (GtBert *self, const guint8 *data, gsize length)
+{
+    guint8 expected[BERT_SLIP_BLOCK];
+    gsize n = MIN (length, BERT_SLIP_BLOCK - self->block_fill);
+    gsize i = 0;
+
+    gt_prbs_fill (&self->rx, expected, n);
+
+    for (; i + 8 <= n; i += 8) {
+        guint64 received;
+        guint64 wanted;
+
+        memcpy (&received, data + i, 8);
+        memcpy (&wanted, expected + i, 8);
+        if (received != wanted)
+            gt_bert_count_errors (self, received ^ wanted);
+    }
+
+    for (; i < n; i++) {
+        if (data[i] != expected[i])
+            gt_bert_count_errors (self, data[i] ^ expected[i]);
+    }
+
+    self->stats.bits_compared += 8 * n;
+    self->block_fill += n;
+
+    if (self->block_fill == BERT_SLIP_BLOCK) {
+        if (self->block_bad >= BERT_SLIP_THRESHOLD) {
+            self->stats.slips++;
+            self->seed_fill = 0;
+            gt_bert_set_sync (self, BERT_HUNTING);
+        } else {
+            self->block_fill = 0;
+            self->block_bad = 0;
+        }
+    }
+
+    return n;
+}
+
+static void
+on_data_available (GtSerialPort *port, GBytes *data, gpointer user_data)
+{
+    GtBert *self = GT_BERT (user_data);
+    gsize length = 0;
+    const guint8 *bytes = g_bytes_get_data (data, &length);
+
+    self->stats.bytes_received += length;
+
+    while (length > 0) {
+        gsize used = self->sync == BERT_LOCKED
+                         ? gt_bert_compare (self, bytes, length)
+                         : gt_bert_hunt (self, bytes, length);
+
+        bytes += used;
+        length -= used;
+    }
+
+    gt_bert_report (self);
+}
+
+static void
+gt_bert_fill_stats (GtBert *self, GtBertStats *stats)
+{
+    gint64 now = g_get_monotonic_time ();
+
+    *stats = self->stats;
+    stats->locked = self->sync == BERT_LOCKED;
+    stats->elapsed = self->start_time > 0 ? now - self->start_time : 0;
+    stats->rx_rate = gt_transfer_rate_get_current (&self->rate);
+    if (stats->elapsed > 0)
+        stats->tx_rate = (gdouble)stats->bytes_sent * G_USEC_PER_SEC /
+                         (gdouble)stats->elapsed;
+}
+
+static void
+gt_bert_complete (GtBert *self)
+{
+    GTask *task = g_steal_pointer (&self->task);
+    GtBertStats *stats = g_new0 (GtBertStats, 1);
+
+    gt_bert_fill_stats (self, stats);
+    g_clear_handle_id (&self->notify_id, g_source_remove);
+    gt_bert_notify (self);
+
+    if (g_task_return_error_if_cancelled (task)) {
+        g_free (stats);
+    } else if (self->error != NULL) {
+        g_task_return_error (task, g_steal_pointer (&self->error));
+        g_free (stats);
+    } else {
+        g_task_return_pointer (task, stats, g_free);
+    }
+
+    g_object_unref (task);
+}
+
+// Stop listening and sending; the task completes once the write in flight
+// has come back
+static void
+gt_bert_halt (GtBert *self, GError *error)
+{
+    if (self->stopping) {
+        g_clear_error (&error);
+
+        return;
+    }
+
+    self->stopping = TRUE;
+    self->error = error;
+
+    g_clear_signal_handler (&self->data_handler, self->port);
+
+    if (self->cancel_source != NULL) {
+        g_source_destroy (self->cancel_source);
+        g_clear_pointer (&self->cancel_source, g_source_unref);
+    }
+
+    g_cancellable_cancel (self->write_cancellable);
+
+    if (!self->writing)
+        gt_bert_complete (self);
+}
+
+static void
+gt_bert_send_next (GtBert *self);
+
+static void
+on_write_done (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+    GtBert *self = GT_BERT (user_data);
+    GError *error = NULL;
+    gsize written =
+        gt_serial_port_write_bytes_finish (GT_SERIAL_PORT (source), res, &error);
+
+    self->writing = FALSE;
+    self->stats.bytes_sent += written;
+
+    if (self->stopping) {
+        g_clear_error (&error);
+        gt_bert_complete (self);
+    } else if (error != NULL) {
+        gt_bert_halt (self, error);
+    } else {
+        gt_bert_report (self);
+        gt_bert_send_next (self);
+    }
+
+    g_object_unref (self);
+}
+
+static void
+gt_bert_send_next (GtBert *self)
+{
+    guint8 *chunk = g_malloc (BERT_CHUNK_SIZE);
+
+    gt_prbs_fill (&self->tx, chunk, BERT_CHUNK_SIZE);
+
+    GBytes *bytes = g_bytes_new_take (chunk, BERT_CHUNK_SIZE);
+    self->writing = TRUE;
+    gt_serial_port_write_bytes_async (self->port,
+                                      bytes,
+                                      self->write_cancellable,
+                                      on_write_done,
+                                      g_object_ref (self));
+    g_bytes_unref (bytes);
+}
+
+static gboolean
+on_cancelled (GCancellable *cancellable, gpointer user_data)
+{
+    gt_bert_halt (GT_BERT (user_data), NULL);
+
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * gt_bert_start:
+ * @self: a #GtBert
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: called once the test has ended
+ * @user_data: data for @callback
+ *
+ * Starts sending the pattern and checking what is received until
+ * gt_bert_stop() is called or the port fails.
+ */
+void
+gt_bert_start (GtBert *self,
+               GCancellable *cancellable,
+               GAsyncReadyCallback callback,
+               gpointer user_data)
+{
+    g_return_if_fail (self->task == NULL && !self->stopping);
+
+    self->task = g_task_new (self, cancellable, callback, user_data);
+    g_task_set_source_tag (self->task, gt_bert_start);
+
+    gt_prbs_init (&self->tx, self->pattern);
+    gt_prbs_init (&self->rx, self->pattern);
+
+    self->start_time = g_get_monotonic_time ();
+    gt_transfer_rate_init (&self->rate, self->start_time, BERT_RATE_WINDOW);
+    self->write_cancellable = g_cancellable_new ();
+
+    self->data_handler = g_signal_connect (self->port,
+                                           "data-available",
+                                           G_CALLBACK (on_data_available),
+                                           self);
+
+    if (cancellable != NULL) {
+        self->cancel_source = g_cancellable_source_new (cancellable);
+        g_source_set_callback (
+            self->cancel_source, G_SOURCE_FUNC (on_cancelled), self, NULL);
+        g_source_attach (self->cancel_source, NULL);
+    }
+
+    gt_bert_send_next (self);
+}
+
+gboolean
+gt_bert_finish (GtBert *self,
+                GAsyncResult *res,
+                GtBertStats *stats,
+                GError **error)
+{
+    g_return_val_if_fail (g_task_is_valid (res, self), FALSE);
+
+    GtBertStats *result = g_task_propagate_pointer (G_TASK (res), error);
+    if (result == NULL)
+        return FALSE;
+
+    if (stats != NULL)
+        *stats = *result;
+    g_free (result);
+
+    return TRUE;
+}
+
+/**
+ * gt_bert_stop:
+ * @self: a #GtBert
+ *
+ * Ends a running test. The task completes with the final counts.
+ */
+void
+gt_bert_stop (GtBert *self)
+{
+    if (self->task == NULL)
+        return;
+
+    gt_bert_halt (self, NULL);
+}
+
+/**
+ * gt_bert_get_stats:
+ * @self: a #GtBert
+ * @stats: (out): the counts so far
+ *
+ * Reads the current counts, for example on notify::bytes-per-second.
+ */
+void
+gt_bert_get_stats (GtBert *self, GtBertStats *stats)
+{
+    gt_bert_fill_stats (self, stats);
+}
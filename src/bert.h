@@ -0,0 +1,66 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "prbs.h"
+#include "serial-port.h"
+
+#include <gio/gio.h>
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define GT_TYPE_BERT (gt_bert_get_type ())
+
+G_DECLARE_FINAL_TYPE (GtBert, gt_bert, GT, BERT, GObject)
+
+typedef struct {
+    guint64 bytes_sent;
+    guint64 bytes_received;
+    /* Only bits received while locked to the pattern are compared */
+    guint64 bits_compared;
+    guint64 bit_errors;
+    guint64 byte_errors;
+    guint slips;
+    gboolean locked;
+    gint64 elapsed;
+    gdouble tx_rate;
+    gdouble rx_rate;
+} GtBertStats;
+
+GtBert *
+gt_bert_new (GtSerialPort *port, GtPrbsPattern pattern);
+
+void
+gt_bert_start (GtBert *self,
+               GCancellable *cancellable,
+               GAsyncReadyCallback callback,
+               gpointer user_data);
+gboolean
+gt_bert_finish (GtBert *self,
+                GAsyncResult *res,
+                GtBertStats *stats,
+                GError **error);
+
+void
+gt_bert_stop (GtBert *self);
+
+void
+gt_bert_get_stats (GtBert *self, GtBertStats *stats);
+
+G_END_DECLS
@@ -20,6 +20,7 @@
 
 #include "buffer.h"
 #include "i18n.h"
+#include "sellerie-enums.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -32,7 +33,9 @@
 
 typedef struct {
     char *buffer;
-    gboolean cr_received;
+    /* One direction tag per byte in buffer, GtBufferDirection values */
+    guint8 *directions;
+    gboolean cr_received[2];
     unsigned int pointer;
     char *current_buffer;
     gboolean overlapped;
@@ -49,16 +52,26 @@ struct _GtBufferClass {
 
 enum {
     SIGNAL_NEW_BUFFER,
+    SIGNAL_RAW_DATA,
     SIGNAL_CLEARED,
     SIGNAL_COUNT,
 } GtBufferSignals;
 
 static guint SIGNALS[SIGNAL_COUNT] = {0};
 
+/* Details of the buffer-updated signal. "new" is data that was just put into
+ * the buffer, "replay" is data re-emitted by gt_buffer_write() */
+static GQuark quark_new;
+static GQuark quark_replay;
+
 G_DEFINE_TYPE_WITH_PRIVATE (GtBuffer, gt_buffer, G_TYPE_OBJECT)
 
 typedef struct {
-    const char *file_name;
+    GOutputStream *stream;
+    GtBufferExportMode mode;
+    GtBufferDirection direction;
+    gboolean tagged;
+    gboolean at_line_start;
     gboolean result;
     GError **error;
 } GtBufferSaveClosure;
@@ -74,15 +87,32 @@ gt_buffer_class_init (GtBufferClass *klass)
 
     SIGNALS[SIGNAL_NEW_BUFFER] = g_signal_new ("buffer-updated",
                                                GT_TYPE_BUFFER,
-                                               G_SIGNAL_RUN_FIRST,
+                                               G_SIGNAL_RUN_FIRST |
+                                                   G_SIGNAL_DETAILED,
                                                0,
                                                NULL,
                                                NULL,
                                                NULL,
                                                G_TYPE_NONE,
-                                               2,
+                                               3,
                                                G_TYPE_POINTER,
-                                               G_TYPE_UINT);
+                                               G_TYPE_UINT,
+                                               GT_TYPE_BUFFER_DIRECTION);
+
+    /* Emitted with the data as passed to gt_buffer_put_chars(), before any
+     * CR/LF translation */
+    SIGNALS[SIGNAL_RAW_DATA] = g_signal_new ("raw-data",
+                                             GT_TYPE_BUFFER,
+                                             G_SIGNAL_RUN_FIRST,
+                                             0,
+                                             NULL,
+                                             NULL,
+                                             NULL,
+                                             G_TYPE_NONE,
+                                             3,
+                                             G_TYPE_POINTER,
+                                             G_TYPE_UINT,
+                                             GT_TYPE_BUFFER_DIRECTION);
 
     SIGNALS[SIGNAL_CLEARED] = g_signal_new ("cleared",
                                             GT_TYPE_BUFFER,
@@ -95,6 +125,9 @@ gt_buffer_class_init (GtBufferClass *klass)
                                             0);
 
     object_class->finalize = gt_buffer_finalize;
+
+    quark_new = g_quark_from_static_string ("new");
+    quark_replay = g_quark_from_static_string ("replay");
 }
 
 static void
@@ -102,6 +135,7 @@ gt_buffer_init (GtBuffer *self)
 {
     GtBufferPrivate *priv = gt_buffer_get_instance_private (self);
     priv->buffer = g_malloc0 (BUFFER_SIZE);
+    priv->directions = g_malloc0 (BUFFER_SIZE);
     priv->current_buffer = priv->buffer;
 }
 
@@ -113,6 +147,7 @@ gt_buffer_finalize (GObject *object)
     GObjectClass *object_class = NULL;
 
     g_clear_pointer (&priv->buffer, g_free);
+    g_clear_pointer (&priv->directions, g_free);
 
     object_class = G_OBJECT_CLASS (gt_buffer_parent_class);
     object_class->finalize (object);
@@ -125,13 +160,16 @@ gt_buffer_new (void)
 }
 
 void
-gt_buffer_put_bytes (GtBuffer *self, GBytes *bytes, gboolean crlf_auto)
+gt_buffer_put_bytes (GtBuffer *self,
+                     GBytes *bytes,
+                     GtBufferDirection direction,
+                     gboolean crlf_auto)
 {
     gsize size = 0;
     gconstpointer data = g_bytes_get_data (bytes, &size);
 
     gt_buffer_put_chars (
-        self, (const char *)data, (unsigned int)size, crlf_auto);
+        self, (const char *)data, (unsigned int)size, direction, crlf_auto);
 
     g_bytes_unref (bytes);
 }
@@ -140,15 +178,21 @@ void
 gt_buffer_put_chars (GtBuffer *self,
                      const char *chars,
                      unsigned int size,
+                     GtBufferDirection direction,
                      gboolean crlf_auto)
 {
     GtBufferPrivate *priv = gt_buffer_get_instance_private (self);
     const char *characters = NULL;
     /* BUFFER_RECEPTION*2 for worst case scenario, all \n or \r chars */
     char out_buffer[BUFFER_RECEPTION * 2];
+    /* Keep the CR state per direction, otherwise echoed input breaks up
+     * CR LF pairs of the received data */
+    gboolean *cr_received = &priv->cr_received[direction];
 
     g_return_if_fail (self != NULL);
 
+    g_signal_emit (self, SIGNALS[SIGNAL_RAW_DATA], 0, chars, size, direction);
+
     /* If the auto CR LF mode on, read the buffer to add \r before \n */
     if (crlf_auto) {
         unsigned int i, out_size = 0;
@@ -156,27 +200,27 @@ gt_buffer_put_chars (GtBuffer *self,
         for (i = 0; i < size; i++) {
             if (chars[i] == '\r') {
                 /* If the previous character was a CR too, insert a newline */
-                if (priv->cr_received) {
+                if (*cr_received) {
                     out_buffer[out_size] = '\n';
                     out_size++;
                 }
-                priv->cr_received = TRUE;
+                *cr_received = TRUE;
             } else {
                 if (chars[i] == '\n') {
                     /* If we get a newline without a CR first, insert a CR */
-                    if (!priv->cr_received) {
+                    if (!*cr_received) {
                         out_buffer[out_size] = '\r';
                         out_size++;
                     }
                 } else {
                     /* If we receive a normal char, and the previous one was a
                        CR insert a newline */
-                    if (priv->cr_received) {
+                    if (*cr_received) {
                         out_buffer[out_size] = '\n';
                         out_size++;
                     }
                 }
-                priv->cr_received = FALSE;
+                *cr_received = FALSE;
             }
             out_buffer[out_size] = chars[i];
             out_size++;
@@ -195,18 +239,28 @@ gt_buffer_put_chars (GtBuffer *self,
 
     if ((size + priv->pointer) >= BUFFER_SIZE) {
         memcpy (priv->current_buffer, characters, BUFFER_SIZE - priv->pointer);
+        memset (priv->directions + priv->pointer,
+                direction,
+                BUFFER_SIZE - priv->pointer);
         chars = characters + BUFFER_SIZE - priv->pointer;
         priv->pointer = size - (BUFFER_SIZE - priv->pointer);
         memcpy (priv->buffer, chars, priv->pointer);
+        memset (priv->directions, direction, priv->pointer);
         priv->current_buffer = priv->buffer + priv->pointer;
         priv->overlapped = TRUE;
     } else {
         memcpy (priv->current_buffer, characters, size);
+        memset (priv->directions + priv->pointer, direction, size);
         priv->pointer += size;
         priv->current_buffer += size;
     }
 
-    g_signal_emit (self, SIGNALS[SIGNAL_NEW_BUFFER], 0, characters, size);
+    g_signal_emit (self,
+                   SIGNALS[SIGNAL_NEW_BUFFER],
+                   quark_new,
+                   characters,
+                   size,
+                   direction);
 }
 
 void
@@ -216,34 +270,122 @@ gt_buffer_clear (GtBuffer *self)
 
     priv->overlapped = FALSE;
     memset (priv->buffer, 0, BUFFER_SIZE);
+    memset (priv->directions, 0, BUFFER_SIZE);
     priv->current_buffer = priv->buffer;
     priv->pointer = 0;
-    priv->cr_received = FALSE;
+    priv->cr_received[GT_BUFFER_DIRECTION_RX] = FALSE;
+    priv->cr_received[GT_BUFFER_DIRECTION_TX] = FALSE;
+}
+
+/* Call func for every run of bytes with the same direction in [start, end) */
+static void
+gt_buffer_foreach_run (GtBuffer *self,
+                       unsigned int start,
+                       unsigned int end,
+                       GtBufferFunc func,
+                       gpointer user_data)
+{
+    GtBufferPrivate *priv = gt_buffer_get_instance_private (self);
+    unsigned int run_start = start;
+    unsigned int i;
+
+    for (i = start + 1; i <= end; i++) {
+        if (i == end || priv->directions[i] != priv->directions[run_start]) {
+            func (priv->buffer + run_start,
+                  i - run_start,
+                  (GtBufferDirection)priv->directions[run_start],
+                  user_data);
+            run_start = i;
+        }
+    }
 }
 
 void
-gt_buffer_write (GtBuffer *self)
+gt_buffer_foreach (GtBuffer *self, GtBufferFunc func, gpointer user_data)
 {
     GtBufferPrivate *priv = gt_buffer_get_instance_private (self);
 
-    /* Write the second half of the ringbuffer first (contains start of data) */
+    /* Walk the second half of the ringbuffer first (contains start of data) */
     if (priv->overlapped) {
-        g_signal_emit (self,
-                       SIGNALS[SIGNAL_NEW_BUFFER],
-                       0,
-                       priv->current_buffer,
-                       BUFFER_SIZE - priv->pointer);
+        gt_buffer_foreach_run (
+            self, priv->pointer, BUFFER_SIZE, func, user_data);
     }
-    g_signal_emit (
-        self, SIGNALS[SIGNAL_NEW_BUFFER], 0, priv->buffer, priv->pointer);
+
+    gt_buffer_foreach_run (self, 0, priv->pointer, func, user_data);
+}
+
+static void
+gt_buffer_emit_run (const char *data,
+                    unsigned int size,
+                    GtBufferDirection direction,
+                    gpointer user_data)
+{
+    g_signal_emit (GT_BUFFER (user_data),
+                   SIGNALS[SIGNAL_NEW_BUFFER],
+                   quark_replay,
+                   data,
+                   size,
+                   direction);
+}
+
+void
+gt_buffer_write (GtBuffer *self)
+{
+    gt_buffer_foreach (self, gt_buffer_emit_run, self);
+}
+
+static void
+gt_buffer_save_run (const char *data,
+                    unsigned int size,
+                    GtBufferDirection direction,
+                    gpointer user_data)
+{
+    GtBufferSaveClosure *closure = (GtBufferSaveClosure *)user_data;
+
+    if (!closure->result || size == 0)
+        return;
+
+    if (closure->mode == GT_BUFFER_EXPORT_MODE_RX &&
+        direction != GT_BUFFER_DIRECTION_RX)
+        return;
+
+    if (closure->mode == GT_BUFFER_EXPORT_MODE_TAGGED &&
+        (!closure->tagged || direction != closure->direction)) {
+        const char *tag = gt_buffer_direction_to_tag (direction);
+
+        if (!closure->at_line_start) {
+            closure->result = g_output_stream_write_all (
+                closure->stream, "\n", 1, NULL, NULL, closure->error);
+        }
+
+        if (closure->result) {
+            closure->result = g_output_stream_write_all (closure->stream,
+                                                         tag,
+                                                         strlen (tag),
+                                                         NULL,
+                                                         NULL,
+                                                         closure->error);
+        }
+
+        closure->tagged = TRUE;
+    }
+
+    if (!closure->result)
+        return;
+
+    closure->result = g_output_stream_write_all (
+        closure->stream, data, size, NULL, NULL, closure->error);
+    closure->direction = direction;
+    closure->at_line_start = data[size - 1] == '\n';
 }
 
 gboolean
-gt_buffer_write_to_file (GtBuffer *self, const char *file_name, GError **error)
+gt_buffer_write_to_file (GtBuffer *self,
+                         const char *file_name,
+                         GtBufferExportMode mode,
+                         GError **error)
 {
-    GtBufferPrivate *priv = gt_buffer_get_instance_private (self);
     g_autoptr (GFile) file = g_file_new_for_commandline_arg (file_name);
-    gboolean retval = TRUE;
 
     g_autoptr (GFileIOStream) stream = g_file_replace_readwrite (
         file, NULL, FALSE, G_FILE_CREATE_REPLACE_DESTINATION, NULL, error);
@@ -252,23 +394,22 @@ gt_buffer_write_to_file (GtBuffer *self, const char *file_name, GError **error)
         return FALSE;
     }
 
-    GOutputStream *os = g_io_stream_get_output_stream (G_IO_STREAM (stream));
+    GtBufferSaveClosure closure = {
+        .stream = g_io_stream_get_output_stream (G_IO_STREAM (stream)),
+        .mode = mode,
+        .direction = GT_BUFFER_DIRECTION_RX,
+        .tagged = FALSE,
+        .at_line_start = TRUE,
+        .result = TRUE,
+        .error = error};
 
-    /* Write the second half of the ringbuffer first (contains start of data) */
-    if (priv->overlapped) {
-        retval = g_output_stream_write_all (os,
-                                            priv->current_buffer,
-                                            BUFFER_SIZE - priv->pointer,
-                                            NULL,
-                                            NULL,
-                                            error);
-    }
-
-    if (!retval)
-        return retval;
+    gt_buffer_foreach (self, gt_buffer_save_run, &closure);
 
-    retval = g_output_stream_write_all (
-        os, priv->buffer, priv->pointer, NULL, NULL, error);
+    return closure.result;
+}
 
-    return retval;
+const char *
+gt_buffer_direction_to_tag (GtBufferDirection direction)
+{
+    return direction == GT_BUFFER_DIRECTION_TX ? "[TX] " : "[RX] ";
 }
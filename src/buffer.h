@@ -29,17 +29,41 @@ G_DECLARE_FINAL_TYPE (GtBuffer, gt_buffer, GT, BUFFER, GObject)
 
 typedef struct _GtBuffer GtBuffer;
 
-typedef void (*GtBufferFunc) (char *, unsigned int, gpointer);
+typedef enum _GtBufferDirection {
+    GT_BUFFER_DIRECTION_RX,
+    GT_BUFFER_DIRECTION_TX
+} GtBufferDirection;
+
+typedef enum _GtBufferExportMode {
+    GT_BUFFER_EXPORT_MODE_ALL,
+    GT_BUFFER_EXPORT_MODE_RX,
+    GT_BUFFER_EXPORT_MODE_TAGGED
+} GtBufferExportMode;
+
+typedef void (*GtBufferFunc) (const char *,
+                              unsigned int,
+                              GtBufferDirection,
+                              gpointer);
 
 GtBuffer *gt_buffer_new (void);
 
 void
-gt_buffer_put_bytes (GtBuffer *, GBytes *, gboolean);
+gt_buffer_put_bytes (GtBuffer *, GBytes *, GtBufferDirection, gboolean);
 void
-gt_buffer_put_chars (GtBuffer *, const char *, unsigned int, gboolean);
+gt_buffer_put_chars (GtBuffer *,
+                     const char *,
+                     unsigned int,
+                     GtBufferDirection,
+                     gboolean);
 void gt_buffer_clear (GtBuffer *);
 void gt_buffer_write (GtBuffer *);
-gboolean gt_buffer_write_to_file (GtBuffer *, const char *, GError **);
+void gt_buffer_foreach (GtBuffer *, GtBufferFunc, gpointer);
+gboolean gt_buffer_write_to_file (GtBuffer *,
+                                  const char *,
+                                  GtBufferExportMode,
+                                  GError **);
+
+const char *gt_buffer_direction_to_tag (GtBufferDirection direction);
 
 G_END_DECLS
 
@@ -0,0 +1,415 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "capture.h"
+
+#include <string.h>
+
+#include <gio/gio.h>
+#include <glib/gi18n.h>
+
+/* Write a SYNC record at least every this many bytes or microseconds */
+#define GT_CAPTURE_SYNC_BYTES (1024 * 1024)
+#define GT_CAPTURE_SYNC_INTERVAL (10 * G_USEC_PER_SEC)
+
+/* magic, version, monotonic time, wall time, distance to previous sync */
+#define GT_CAPTURE_SYNC_PAYLOAD_SIZE (GT_CAPTURE_MAGIC_LEN + 1 + 8 + 8 + 8)
+
+#define GT_CAPTURE_DIRECTION_BIT 0x80
+
+struct _GtCaptureReader {
+    GMappedFile *file;
+    const guint8 *data;
+    gsize size;
+    gsize pos;
+
+    gint64 timestamp;
+    gboolean have_sync;
+    gint64 sync_timestamp;
+    gint64 sync_wall_time;
+};
+
+static void
+gt_capture_put_varint (GString *out, guint64 value)
+{
+    do {
+        guint8 byte = value & 0x7F;
+
+        value >>= 7;
+        if (value != 0)
+            byte |= 0x80;
+
+        g_string_append_c (out, (char)byte);
+    } while (value != 0);
+}
+
+static void
+gt_capture_put_u64 (GString *out, guint64 value)
+{
+    guint64 le = GUINT64_TO_LE (value);
+
+    g_string_append_len (out, (const char *)&le, sizeof (le));
+}
+
+void
+gt_capture_encoder_reset (GtCaptureEncoder *encoder)
+{
+    memset (encoder, 0, sizeof (GtCaptureEncoder));
+}
+
+static void
+gt_capture_put_sync (GString *out,
+                     gint64 timestamp,
+                     gint64 wall_time,
+                     guint64 distance)
+{
+    g_string_append_c (out, GT_CAPTURE_EVENT_SYNC);
+    gt_capture_put_varint (out, 0);
+    gt_capture_put_varint (out, GT_CAPTURE_SYNC_PAYLOAD_SIZE);
+    g_string_append_len (out, GT_CAPTURE_MAGIC, GT_CAPTURE_MAGIC_LEN);
+    g_string_append_c (out, GT_CAPTURE_VERSION);
+    gt_capture_put_u64 (out, (guint64)timestamp);
+    gt_capture_put_u64 (out, (guint64)wall_time);
+    gt_capture_put_u64 (out, distance);
+}
+
+static void
+gt_capture_encode_sync (GtCaptureEncoder *encoder,
+                        GString *out,
+                        gint64 timestamp)
+{
+    guint64 distance = 0;
+
+    if (encoder->synced)
+        distance = encoder->offset - encoder->last_sync_offset;
+
+    gt_capture_put_sync (out, timestamp, g_get_real_time (), distance);
+
+    encoder->synced = TRUE;
+    encoder->last_sync_offset = encoder->offset;
+    encoder->last_sync_timestamp = timestamp;
+    encoder->last_timestamp = timestamp;
+}
+
+/* Append a SYNC record for timestamp without touching the encoder. Records
+ * encoded after timestamp decode on their own behind it, which is what a new
+ * log segment needs to start with */
+void
+gt_capture_encode_resync (GString *out, gint64 timestamp)
+{
+    gint64 wall_time =
+        g_get_real_time () - (g_get_monotonic_time () - timestamp);
+
+    gt_capture_put_sync (out, timestamp, wall_time, 0);
+}
+
+/* Append one record for event to out. Timestamps are monotonic clock
+ * microseconds, a SYNC record is put in front if one is due */
+void
+gt_capture_encode (GtCaptureEncoder *encoder,
+                   GString *out,
+                   GtCaptureEvent event,
+                   GtBufferDirection direction,
+                   gint64 timestamp,
+                   const guint8 *payload,
+                   gsize length)
+{
+    gsize start = out->len;
+    guint8 tag = event & 0x7F;
+
+    if (!encoder->synced ||
+        encoder->offset - encoder->last_sync_offset >= GT_CAPTURE_SYNC_BYTES ||
+        timestamp - encoder->last_sync_timestamp >= GT_CAPTURE_SYNC_INTERVAL) {
+        gt_capture_encode_sync (encoder, out, timestamp);
+        encoder->offset += out->len - start;
+        start = out->len;
+    }
+
+    if (direction == GT_BUFFER_DIRECTION_TX)
+        tag |= GT_CAPTURE_DIRECTION_BIT;
+
+    g_string_append_c (out, (char)tag);
+    gt_capture_put_varint (
+        out, (guint64)MAX (timestamp - encoder->last_timestamp, 0));
+    gt_capture_put_varint (out, length);
+    g_string_append_len (out, (const char *)payload, length);
+
+    encoder->last_timestamp = MAX (timestamp, encoder->last_timestamp);
+    encoder->offset += out->len - start;
+}
+
+const char *
+gt_capture_event_to_string (GtCaptureEvent event)
+{
+    switch (event) {
+    case GT_CAPTURE_EVENT_SYNC:
+        return "SYNC";
+    case GT_CAPTURE_EVENT_DATA:
+        return "DATA";
+    case GT_CAPTURE_EVENT_MODEM_LINES:
+        return "LINES";
+    case GT_CAPTURE_EVENT_BREAK:
+        return "BREAK";
+    case GT_CAPTURE_EVENT_FRAMING_ERROR:
+        return "FRAMING";
+    case GT_CAPTURE_EVENT_PARITY_ERROR:
+        return "PARITY";
+    case GT_CAPTURE_EVENT_OVERRUN:
+        return "OVERRUN";
+    default:
+        return "UNKNOWN";
+    }
+}
+
+GtCaptureReader *
+gt_capture_reader_new (const char *file_name, GError **error)
+{
+    GMappedFile *file = g_mapped_file_new (file_name, FALSE, error);
+
+    if (file == NULL)
+        return NULL;
+
+    GtCaptureReader *reader = g_new0 (GtCaptureReader, 1);
+    reader->file = file;
+    reader->data = (const guint8 *)g_mapped_file_get_contents (file);
+    reader->size = g_mapped_file_get_length (file);
+
+    return reader;
+}
+
+void
+gt_capture_reader_free (GtCaptureReader *reader)
+{
+    g_clear_pointer (&reader->file, g_mapped_file_unref);
+    g_free (reader);
+}
+
+void
+gt_capture_reader_rewind (GtCaptureReader *reader)
+{
+    reader->pos = 0;
+    reader->timestamp = 0;
+    reader->have_sync = FALSE;
+}
+
+static gboolean
+gt_capture_get_varint (GtCaptureReader *reader, guint64 *value)
+{
+    guint shift = 0;
+
+    *value = 0;
+    while (reader->pos < reader->size && shift < 64) {
+        guint8 byte = reader->data[reader->pos++];
+
+        *value |= (guint64)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+            return TRUE;
+
+        shift += 7;
+    }
+
+    return FALSE;
+}
+
+static guint64
+gt_capture_get_u64 (const guint8 *data)
+{
+    guint64 value;
+
+    memcpy (&value, data, sizeof (value));
+
+    return GUINT64_FROM_LE (value);
+}
+
+static gboolean
+gt_capture_is_sync (const guint8 *payload, gsize length)
+{
+    return length >= GT_CAPTURE_SYNC_PAYLOAD_SIZE &&
+           memcmp (payload, GT_CAPTURE_MAGIC, GT_CAPTURE_MAGIC_LEN) == 0;
+}
+
+/* Read the next record. Returns FALSE without setting error at the end of
+ * the capture. The payload points into the mapped file and is valid until
+ * the reader is freed */
+gboolean
+gt_capture_reader_next (GtCaptureReader *reader,
+                        GtCaptureRecord *record,
+                        GError **error)
+{
+    guint64 delta = 0;
+    guint64 length = 0;
+    guint8 tag = 0;
+
+    if (reader->pos >= reader->size)
+        return FALSE;
+
+    record->offset = reader->pos;
+    tag = reader->data[reader->pos++];
+
+    if (!gt_capture_get_varint (reader, &delta) ||
+        !gt_capture_get_varint (reader, &length) ||
+        length > reader->size - reader->pos) {
+        g_set_error (error,
+                     G_IO_ERROR,
+                     G_IO_ERROR_PARTIAL_INPUT,
+                     _ ("Truncated capture record at offset %" G_GSIZE_FORMAT),
+                     record->offset);
+        reader->pos = reader->size;
+
+        return FALSE;
+    }
+
+    record->event = tag & 0x7F;
+    record->direction = (tag & GT_CAPTURE_DIRECTION_BIT)
+                            ? GT_BUFFER_DIRECTION_TX
+                            : GT_BUFFER_DIRECTION_RX;
+    record->payload = reader->data + reader->pos;
+    record->length = length;
+    reader->pos += length;
+
+    if (record->event == GT_CAPTURE_EVENT_SYNC) {
+        if (!gt_capture_is_sync (record->payload, record->length)) {
+            g_set_error (error,
+                         G_IO_ERROR,
+                         G_IO_ERROR_INVALID_DATA,
+                         _ ("Invalid sync record at offset %" G_GSIZE_FORMAT),
+                         record->offset);
+
+            return FALSE;
+        }
+
+        reader->have_sync = TRUE;
+        reader->sync_timestamp = (gint64)gt_capture_get_u64 (
+            record->payload + GT_CAPTURE_MAGIC_LEN + 1);
+        reader->sync_wall_time = (gint64)gt_capture_get_u64 (
+            record->payload + GT_CAPTURE_MAGIC_LEN + 1 + 8);
+        reader->timestamp = reader->sync_timestamp;
+    } else {
+        reader->timestamp += (gint64)delta;
+    }
+
+    record->timestamp = reader->timestamp;
+    record->wall_time =
+        reader->have_sync
+            ? reader->sync_wall_time + reader->timestamp - reader->sync_timestamp
+            : 0;
+
+    return TRUE;
+}
+
+/* Whether a complete SYNC record starts at offset */
+static gboolean
+gt_capture_sync_at (GtCaptureReader *reader, gsize offset)
+{
+    const guint8 *p = reader->data + offset;
+
+    return offset < reader->size &&
+           reader->size - offset >= 3 + GT_CAPTURE_SYNC_PAYLOAD_SIZE &&
+           p[0] == GT_CAPTURE_EVENT_SYNC && p[1] == 0 &&
+           p[2] == GT_CAPTURE_SYNC_PAYLOAD_SIZE &&
+           gt_capture_is_sync (p + 3, GT_CAPTURE_SYNC_PAYLOAD_SIZE);
+}
+
+/* Find the closest SYNC record starting before end */
+static gboolean
+gt_capture_find_sync_before (GtCaptureReader *reader,
+                             gsize end,
+                             gsize *offset)
+{
+    while (end-- > 0) {
+        if (gt_capture_sync_at (reader, end)) {
+            *offset = end;
+
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/* Follow the distance stored in the SYNC record at offset back to the one
+ * before. The distance counts from the start of the capture session, so it
+ * is off in rotated segments, appended or cut files. Only trust it if it
+ * lands on a SYNC record and scan backwards otherwise */
+static gboolean
+gt_capture_previous_sync (GtCaptureReader *reader,
+                          gsize offset,
+                          gsize *previous)
+{
+    guint64 distance = gt_capture_get_u64 (reader->data + offset + 3 +
+                                           GT_CAPTURE_MAGIC_LEN + 1 + 8 + 8);
+
+    if (distance > 0 && distance <= offset &&
+        gt_capture_sync_at (reader, offset - distance)) {
+        *previous = offset - distance;
+
+        return TRUE;
+    }
+
+    return gt_capture_find_sync_before (reader, offset, previous);
+}
+
+/* Position the reader on the last SYNC record at or before wall_time, or on
+ * the first one if they are all later. Walks back from the end of the
+ * capture along the SYNC records. Returns FALSE if the capture has no SYNC
+ * record at all */
+gboolean
+gt_capture_reader_seek (GtCaptureReader *reader, gint64 wall_time)
+{
+    gsize offset = 0;
+    gsize previous = 0;
+
+    if (!gt_capture_find_sync_before (reader, reader->size, &offset))
+        return FALSE;
+
+    while ((gint64)gt_capture_get_u64 (reader->data + offset + 3 +
+                                       GT_CAPTURE_MAGIC_LEN + 1 + 8) >
+               wall_time &&
+           gt_capture_previous_sync (reader, offset, &previous)) {
+        offset = previous;
+    }
+
+    gt_capture_reader_rewind (reader);
+    reader->pos = offset;
+
+    return TRUE;
+}
+
+/* Captures always start with a SYNC record, anything else is likely a plain
+ * log file */
+gboolean
+gt_capture_reader_is_capture (GtCaptureReader *reader)
+{
+    return reader->size >= 3 + GT_CAPTURE_SYNC_PAYLOAD_SIZE &&
+           reader->data[0] == GT_CAPTURE_EVENT_SYNC && reader->data[1] == 0 &&
+           reader->data[2] == GT_CAPTURE_SYNC_PAYLOAD_SIZE &&
+           gt_capture_is_sync (reader->data + 3, GT_CAPTURE_SYNC_PAYLOAD_SIZE);
+}
+
+/* How much of the capture has been read, between 0.0 and 1.0 */
+gdouble
+gt_capture_reader_get_fraction (GtCaptureReader *reader)
+{
+    if (reader->size == 0)
+        return 1.0;
+
+    return (gdouble)reader->pos / reader->size;
+}
@@ -0,0 +1,133 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "buffer.h"
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Binary capture format
+ *
+ * A capture is a sequence of records:
+ *
+ *   u8      tag: event type in the low 7 bits, direction (1 = TX) in bit 7
+ *   varint  microseconds since the previous record (monotonic clock)
+ *   varint  payload length
+ *   u8[]    payload
+ *
+ * Varints are unsigned LEB128. Every capture session and every rotated
+ * segment of it starts with a SYNC record, which is repeated periodically.
+ * Its payload carries the capture magic, the format version, the absolute
+ * monotonic and wall clock time and the distance in bytes back to the
+ * previous SYNC record, so readers can seek by time and resynchronize on a
+ * damaged or rotated file.
+ */
+
+#define GT_CAPTURE_MAGIC "\x89SLCAP\r\n"
+#define GT_CAPTURE_MAGIC_LEN 8
+#define GT_CAPTURE_VERSION 1
+
+/* Maximum encoded size of a record header */
+#define GT_CAPTURE_MAX_HEADER_SIZE (1 + 10 + 10)
+
+typedef enum _GtCaptureEvent {
+    GT_CAPTURE_EVENT_SYNC = 0,
+    /* Data sent or received on the line */
+    GT_CAPTURE_EVENT_DATA = 1,
+    /* Modem control lines changed, payload is the TIOCM_* bits as u32 LE */
+    GT_CAPTURE_EVENT_MODEM_LINES = 2,
+    /* A break condition was sent or received */
+    GT_CAPTURE_EVENT_BREAK = 3,
+    /* Received bytes with framing or parity errors, payload are the bytes.
+     * Reserved, the serial port currently ignores these errors */
+    GT_CAPTURE_EVENT_FRAMING_ERROR = 4,
+    GT_CAPTURE_EVENT_PARITY_ERROR = 5,
+    GT_CAPTURE_EVENT_OVERRUN = 6
+} GtCaptureEvent;
+
+typedef struct _GtCaptureRecord {
+    GtCaptureEvent event;
+    GtBufferDirection direction;
+    /* Monotonic timestamp in microseconds */
+    gint64 timestamp;
+    /* Wall clock time in microseconds since the epoch, 0 if unknown */
+    gint64 wall_time;
+    /* Offset of the record in the capture */
+    gsize offset;
+    const guint8 *payload;
+    gsize length;
+} GtCaptureRecord;
+
+/* Encoder state, one per capture file */
+typedef struct _GtCaptureEncoder {
+    gint64 last_timestamp;
+    guint64 offset;
+    guint64 last_sync_offset;
+    gint64 last_sync_timestamp;
+    gboolean synced;
+} GtCaptureEncoder;
+
+void
+gt_capture_encoder_reset (GtCaptureEncoder *encoder);
+
+void
+gt_capture_encode_resync (GString *out, gint64 timestamp);
+
+void
+gt_capture_encode (GtCaptureEncoder *encoder,
+                   GString *out,
+                   GtCaptureEvent event,
+                   GtBufferDirection direction,
+                   gint64 timestamp,
+                   const guint8 *payload,
+                   gsize length);
+
+const char *
+gt_capture_event_to_string (GtCaptureEvent event);
+
+typedef struct _GtCaptureReader GtCaptureReader;
+
+GtCaptureReader *
+gt_capture_reader_new (const char *file_name, GError **error);
+
+void
+gt_capture_reader_free (GtCaptureReader *reader);
+
+gboolean
+gt_capture_reader_next (GtCaptureReader *reader,
+                        GtCaptureRecord *record,
+                        GError **error);
+
+gboolean
+gt_capture_reader_seek (GtCaptureReader *reader, gint64 wall_time);
+
+void
+gt_capture_reader_rewind (GtCaptureReader *reader);
+
+gboolean
+gt_capture_reader_is_capture (GtCaptureReader *reader);
+
+gdouble
+gt_capture_reader_get_fraction (GtCaptureReader *reader);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GtCaptureReader, gt_capture_reader_free)
+
+G_END_DECLS
@@ -21,6 +21,7 @@
 
 #include "cmdline.h"
 #include "i18n.h"
+#include "logging.h"
 #include "sellerie-enums.h"
 #include "term_config.h"
 #include "util.h"
@@ -89,6 +90,37 @@ on_flow_parse (const gchar *name,
 
 char *default_file = NULL;
 char *config_port = NULL;
+char *replay_file = NULL;
+double replay_speed = 1.0;
+gboolean profile_startup = FALSE;
+gboolean headless = FALSE;
+char *headless_output = NULL;
+char *log_file = NULL;
+GtLoggingFormat log_format = GT_LOGGING_FORMAT_RAW;
+char **headless_macros = NULL;
+
+static gboolean
+on_log_format_parse (const gchar *name,
+                     const gchar *value,
+                     gpointer data,
+                     GError **error)
+{
+    int val = gt_get_value_by_nick (GT_TYPE_LOGGING_FORMAT, value, -1);
+
+    if (val == -1) {
+        g_set_error (error,
+                     G_OPTION_ERROR,
+                     G_OPTION_ERROR_FAILED,
+                     _ ("Invalid log format (rendered, raw, capture): %s"),
+                     value);
+
+        return FALSE;
+    }
+
+    log_format = val;
+
+    return TRUE;
+}
 
 static GOptionEntry entries[] = {
     {
@@ -184,6 +216,79 @@ static GOptionEntry entries[] = {
      &config.rs485_rts_time_after_transmit,
      N_ ("For RS485, TIME in ms after transmit with RTS on"),
      "TIME"},
+    {"tx-rate",
+     0,
+     0,
+     G_OPTION_ARG_INT,
+     &config.tx_rate,
+     N_ ("Send at most RATE characters per second (default unlimited)"),
+     "RATE"},
+    {"tx-gap",
+     0,
+     0,
+     G_OPTION_ARG_INT,
+     &config.tx_gap,
+     N_ ("Keep the line idle for GAP microseconds after each character"),
+     "GAP"},
+    {"replay",
+     0,
+     0,
+     G_OPTION_ARG_FILENAME,
+     &replay_file,
+     N_ ("Replay a capture or log FILE as received data"),
+     "FILE"},
+    {"replay-speed",
+     0,
+     0,
+     G_OPTION_ARG_DOUBLE,
+     &replay_speed,
+     N_ ("Replay at FACTOR times the recorded speed, 0 for maximum speed"),
+     "FACTOR"},
+    {"headless",
+     0,
+     0,
+     G_OPTION_ARG_NONE,
+     &headless,
+     N_ ("Run without a window, bridging the port to standard input and "
+         "output"),
+     NULL},
+    {"output",
+     0,
+     0,
+     G_OPTION_ARG_FILENAME,
+     &headless_output,
+     N_ ("In headless mode, write received data to FILE instead of standard "
+         "output"),
+     "FILE"},
+    {"log",
+     0,
+     0,
+     G_OPTION_ARG_FILENAME,
+     &log_file,
+     N_ ("In headless mode, log the session to FILE"),
+     "FILE"},
+    {"log-format",
+     0,
+     0,
+     G_OPTION_ARG_CALLBACK,
+     on_log_format_parse,
+     N_ ("Log FORMAT (rendered|raw|capture, default raw)"),
+     "FORMAT"},
+    {"macro",
+     0,
+     0,
+     G_OPTION_ARG_STRING_ARRAY,
+     &headless_macros,
+     N_ ("In headless mode, run the macro bound to SHORTCUT once the port is "
+         "open"),
+     "SHORTCUT"},
+    {"profile-startup",
+     0,
+     0,
+     G_OPTION_ARG_NONE,
+     &profile_startup,
+     N_ ("Print how long each startup phase takes"),
+     NULL},
     {NULL}};
 
 void
@@ -0,0 +1,40 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+// Table-driven checksums used by the transfer protocols and macro templates.
+// CRC-16 starts at 0 (0xffff for CRC-16/CCITT-FALSE), CRC-16/Modbus at 0xffff,
+// CRC-32 at 0xffffffff and is complemented when done.
+
+#define GT_CRC16_MODBUS_INIT 0xffffU
+#define GT_CRC32_INIT 0xffffffffU
+
+guint16
+gt_crc16_update (guint16 crc, const guint8 *data, gsize length);
+
+guint16
+gt_crc16_modbus_update (guint16 crc, const guint8 *data, gsize length);
+
+guint32
+gt_crc32_update (guint32 crc, const guint8 *data, gsize length);
+
+G_END_DECLS
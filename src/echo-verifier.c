@@ -0,0 +1,285 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "echo-verifier.h"
+
+#include <string.h>
+
+/* How far ahead in the sent data a lost echo is looked for, and how many
+ * received bytes have to agree before the comparison moves there */
+#define ECHO_VERIFIER_RESYNC_WINDOW 256
+#define ECHO_VERIFIER_RESYNC_CONFIRM 4
+
+GtEchoVerifier *
+gt_echo_verifier_new (gsize window)
+{
+    GtEchoVerifier *self = g_new0 (GtEchoVerifier, 1);
+
+    self->size = MAX (window, 1);
+    self->ring = g_malloc (self->size);
+    self->first_error = -1;
+    self->held = g_byte_array_new ();
+
+    return self;
+}
+
+void
+gt_echo_verifier_free (GtEchoVerifier *self)
+{
+    g_byte_array_unref (self->held);
+    g_free (self->ring);
+    g_free (self);
+}
+
+/**
+ * gt_echo_verifier_sent:
+ * @self: a #GtEchoVerifier
+ * @data: bytes written to the device
+ * @length: number of bytes
+ *
+ * Remembers transmitted bytes. If the echo lags behind by more than the
+ * window, the oldest bytes are given up on and counted as dropped.
+ */
+void
+gt_echo_verifier_sent (GtEchoVerifier *self, const guint8 *data, gsize length)
+{
+    self->sent += length;
+
+    // Only the last window full can ever be compared
+    if (length > self->size) {
+        self->dropped += length - self->size;
+        data += length - self->size;
+        length = self->size;
+    }
+
+    if (self->pending + length > self->size) {
+        gsize overflow = self->pending + length - self->size;
+        self->dropped += overflow;
+        self->pending -= overflow;
+    }
+
+    while (length > 0) {
+        gsize chunk = MIN (length, self->size - self->head);
+
+        memcpy (self->ring + self->head, data, chunk);
+        self->head = (self->head + chunk) % self->size;
+        self->pending += chunk;
+        data += chunk;
+        length -= chunk;
+    }
+}
+
+static guint8
+gt_echo_verifier_peek (GtEchoVerifier *self, gsize index)
+{
+    gsize tail = (self->head + self->size - self->pending) % self->size;
+
+    return self->ring[(tail + index) % self->size];
+}
+
+/* Whether data agrees with the outstanding bytes from index on, as far as
+ * both go */
+static gboolean
+gt_echo_verifier_agrees (GtEchoVerifier *self,
+                         gsize index,
+                         const guint8 *data,
+                         gsize length)
+{
+    length = MIN (length, self->pending - index);
+
+    for (gsize i = 0; i < length; i++) {
+        if (gt_echo_verifier_peek (self, index + i) != data[i])
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* The following helpers look at data[0], which differs from the oldest
+ * outstanding byte, and at most ECHO_VERIFIER_RESYNC_CONFIRM bytes after */
+
+/* The bytes after it are in step, so it was corrupted on the way */
+static gboolean
+gt_echo_verifier_is_bad_byte (GtEchoVerifier *self,
+                              const guint8 *data,
+                              gsize length)
+{
+    length = MIN (length, ECHO_VERIFIER_RESYNC_CONFIRM);
+
+    return length < 2 ||
+           gt_echo_verifier_agrees (self, 1, data + 1, length - 1);
+}
+
+/* The received bytes show up a little further on in what was sent, so the
+ * echo of the bytes in between was lost. Returns how many to skip */
+static gsize
+gt_echo_verifier_find_lost (GtEchoVerifier *self,
+                            const guint8 *data,
+                            gsize length)
+{
+    gsize limit = MIN (self->pending, ECHO_VERIFIER_RESYNC_WINDOW + 1);
+
+    length = MIN (length, ECHO_VERIFIER_RESYNC_CONFIRM);
+    for (gsize skip = 1; skip < limit; skip++) {
+        if (gt_echo_verifier_agrees (self, skip, data, length))
+            return skip;
+    }
+
+    return 0;
+}
+
+/* What was sent shows up a little further on in the received bytes, so
+ * the line added bytes. Returns how many received bytes to skip */
+static gsize
+gt_echo_verifier_find_extra (GtEchoVerifier *self,
+                             const guint8 *data,
+                             gsize length)
+{
+    gsize confirm = MIN (self->pending, ECHO_VERIFIER_RESYNC_CONFIRM);
+
+    for (gsize extra = 1;
+         extra + confirm <= length && extra <= ECHO_VERIFIER_RESYNC_WINDOW;
+         extra++) {
+        if (gt_echo_verifier_agrees (self, 0, data + extra, confirm))
+            return extra;
+    }
+
+    return 0;
+}
+
+/* Compare as much of data as can be decided on and return how much that
+ * was. After a mismatch, a few received bytes are needed to tell a bad byte
+ * from lost echo; unless finishing, that waits for more data */
+static gsize
+gt_echo_verifier_compare (GtEchoVerifier *self,
+                          const guint8 *data,
+                          gsize length,
+                          gboolean finish)
+{
+    gsize consumed = 0;
+
+    while (consumed < length && self->pending > 0) {
+        gsize tail = (self->head + self->size - self->pending) % self->size;
+        gsize chunk =
+            MIN (MIN (length - consumed, self->pending), self->size - tail);
+        const guint8 *expected = self->ring + tail;
+        const guint8 *p = data + consumed;
+        gsize matched = chunk;
+
+        // Matching runs are the common case and go through memcmp
+        if (memcmp (expected, p, chunk) != 0) {
+            matched = 0;
+            while (expected[matched] == p[matched])
+                matched++;
+        }
+
+        self->compared += matched;
+        self->pending -= matched;
+        consumed += matched;
+
+        if (matched == chunk)
+            continue;
+
+        p = data + consumed;
+        if (!finish && length - consumed <= ECHO_VERIFIER_RESYNC_CONFIRM &&
+            length - consumed < self->pending)
+            break;
+
+        gsize available = length - consumed;
+        gsize skip = 0;
+
+        if (!gt_echo_verifier_is_bad_byte (self, p, available)) {
+            skip = gt_echo_verifier_find_lost (self, p, available);
+            if (skip > 0) {
+                self->skipped += skip;
+                self->resyncs++;
+                self->pending -= skip;
+
+                continue;
+            }
+
+            skip = gt_echo_verifier_find_extra (self, p, available);
+            if (skip > 0) {
+                self->unexpected += skip;
+                self->resyncs++;
+                consumed += skip;
+
+                continue;
+            }
+        }
+
+        if (self->first_error < 0)
+            self->first_error = (gint64)(self->sent - self->pending);
+        self->errors++;
+        self->compared++;
+        self->pending--;
+        consumed++;
+    }
+
+    // Nothing left to compare against
+    if (self->pending == 0) {
+        self->unexpected += length - consumed;
+        consumed = length;
+    }
+
+    return consumed;
+}
+
+/**
+ * gt_echo_verifier_received:
+ * @self: a #GtEchoVerifier
+ * @data: bytes read from the device
+ * @length: number of bytes
+ *
+ * Compares received bytes against the oldest outstanding sent bytes. Sent
+ * bytes that are skipped to get back in step count as missing, not as
+ * errors. Data arriving while nothing is outstanding is counted as
+ * unexpected.
+ */
+void
+gt_echo_verifier_received (GtEchoVerifier *self,
+                           const guint8 *data,
+                           gsize length)
+{
+    gsize consumed = 0;
+
+    if (self->held->len == 0) {
+        consumed = gt_echo_verifier_compare (self, data, length, FALSE);
+        g_byte_array_append (self->held, data + consumed, length - consumed);
+
+        return;
+    }
+
+    g_byte_array_append (self->held, data, length);
+    consumed = gt_echo_verifier_compare (
+        self, self->held->data, self->held->len, FALSE);
+    g_byte_array_remove_range (self->held, 0, consumed);
+}
+
+/**
+ * gt_echo_verifier_finish:
+ * @self: a #GtEchoVerifier
+ *
+ * Decides on received bytes that were held back after a mismatch, once no
+ * more echo is going to come.
+ */
+void
+gt_echo_verifier_finish (GtEchoVerifier *self)
+{
+    gt_echo_verifier_compare (self, self->held->data, self->held->len, TRUE);
+    g_byte_array_set_size (self->held, 0);
+}
@@ -0,0 +1,67 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Compares what comes back from an echoing device against what was sent.
+ * Sent bytes are kept in a fixed ring until their echo arrives; every byte is
+ * touched once on either side. After a mismatch, the comparison gets back
+ * in step over lost or added bytes instead of counting everything after
+ * as bad. */
+typedef struct {
+    guint8 *ring;
+    gsize size;
+    gsize head;
+    gsize pending;
+
+    guint64 sent;
+    guint64 compared;
+    guint64 errors;
+    gint64 first_error;
+    guint64 dropped;
+    guint64 unexpected;
+    /* Bytes whose echo never came, and how often the comparison had to get
+     * back in step over lost or added bytes */
+    guint64 skipped;
+    guint64 resyncs;
+
+    /* Received bytes after a mismatch, until there are enough to decide */
+    GByteArray *held;
+} GtEchoVerifier;
+
+GtEchoVerifier *
+gt_echo_verifier_new (gsize window);
+
+void
+gt_echo_verifier_free (GtEchoVerifier *self);
+
+void
+gt_echo_verifier_sent (GtEchoVerifier *self, const guint8 *data, gsize length);
+
+void
+gt_echo_verifier_received (GtEchoVerifier *self,
+                           const guint8 *data,
+                           gsize length);
+
+void
+gt_echo_verifier_finish (GtEchoVerifier *self);
+
+G_END_DECLS
@@ -0,0 +1,692 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "file-receive.h"
+#include "transfer-rate.h"
+
+#include <glib/gi18n.h>
+
+#include <string.h>
+
+// Same reporting cadence as for sending files
+#define FILE_RECEIVE_NOTIFY_INTERVAL (G_USEC_PER_SEC / 10)
+#define FILE_RECEIVE_RATE_WINDOW (3 * G_USEC_PER_SEC)
+
+// Received chunks are handed to a worker thread that does all the disk I/O
+// and the checksumming, so a slow disk never holds up the serial port or the
+// UI. An empty chunk tells the worker that the capture is over.
+struct _GtFileReceive {
+    GObject parent_instance;
+    GtSerialPort *port;
+    GFile *file;
+
+    // Stop conditions
+    guint64 max_bytes;
+    guint idle_timeout;
+    GBytes *terminator;
+    gint checksum_type;
+    gchar *expected_checksum;
+
+    GTask *task;
+    GAsyncQueue *queue;
+    GSource *cancel_source;
+    gulong data_handler;
+    guint idle_id;
+    gint64 last_data;
+    gboolean stopping;
+    GtFileReceiveStop reason;
+
+    // Data held back because it might be the start of the terminator
+    GByteArray *tail;
+    guint64 received;
+
+    // Statistics
+    GtTransferRate rate;
+    gint64 start_time;
+    gint64 last_notify;
+    guint notify_id;
+};
+
+G_DEFINE_TYPE (GtFileReceive, gt_file_receive, G_TYPE_OBJECT)
+
+enum {
+    PROP_0,
+    PROP_FILE,
+    PROP_SERIAL_PORT,
+    PROP_MAX_BYTES,
+    PROP_IDLE_TIMEOUT,
+    PROP_TERMINATOR,
+    PROP_CHECKSUM_TYPE,
+    PROP_EXPECTED_CHECKSUM,
+    PROP_BYTES_RECEIVED,
+    PROP_BYTES_PER_SECOND,
+    N_PROPS
+};
+
+static GParamSpec *properties[N_PROPS];
+
+static void
+gt_file_receive_halt (GtFileReceive *self, GtFileReceiveStop reason);
+
+static void
+gt_file_receive_dispose (GObject *object)
+{
+    GtFileReceive *self = (GtFileReceive *)object;
+
+    g_clear_signal_handler (&self->data_handler, self->port);
+    g_clear_handle_id (&self->idle_id, g_source_remove);
+    g_clear_handle_id (&self->notify_id, g_source_remove);
+
+    if (self->cancel_source != NULL) {
+        g_source_destroy (self->cancel_source);
+        g_clear_pointer (&self->cancel_source, g_source_unref);
+    }
+
+    G_OBJECT_CLASS (gt_file_receive_parent_class)->dispose (object);
+}
+
+static void
+gt_file_receive_finalize (GObject *object)
+{
+    GtFileReceive *self = (GtFileReceive *)object;
+
+    g_clear_pointer (&self->queue, g_async_queue_unref);
+    g_clear_pointer (&self->tail, g_byte_array_unref);
+    g_clear_pointer (&self->terminator, g_bytes_unref);
+    g_clear_pointer (&self->expected_checksum, g_free);
+    g_clear_object (&self->port);
+    g_clear_object (&self->file);
+
+    G_OBJECT_CLASS (gt_file_receive_parent_class)->finalize (object);
+}
+
+static void
+gt_file_receive_get_property (GObject *object,
+                              guint prop_id,
+                              GValue *value,
+                              GParamSpec *pspec)
+{
+    GtFileReceive *self = GT_FILE_RECEIVE (object);
+
+    switch (prop_id) {
+    case PROP_MAX_BYTES:
+        g_value_set_uint64 (value, self->max_bytes);
+        break;
+    case PROP_IDLE_TIMEOUT:
+        g_value_set_uint (value, self->idle_timeout);
+        break;
+    case PROP_TERMINATOR:
+        g_value_set_boxed (value, self->terminator);
+        break;
+    case PROP_CHECKSUM_TYPE:
+        g_value_set_int (value, self->checksum_type);
+        break;
+    case PROP_EXPECTED_CHECKSUM:
+        g_value_set_string (value, self->expected_checksum);
+        break;
+    case PROP_BYTES_RECEIVED:
+        g_value_set_uint64 (value, self->received);
+        break;
+    case PROP_BYTES_PER_SECOND:
+        g_value_set_double (value, gt_transfer_rate_get_current (&self->rate));
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gt_file_receive_set_property (GObject *object,
+                              guint prop_id,
+                              const GValue *value,
+                              GParamSpec *pspec)
+{
+    GtFileReceive *self = GT_FILE_RECEIVE (object);
+
+    switch (prop_id) {
+    case PROP_FILE:
+        self->file = G_FILE (g_value_dup_object (value));
+        break;
+    case PROP_SERIAL_PORT:
+        self->port = GT_SERIAL_PORT (g_value_dup_object (value));
+        break;
+    case PROP_MAX_BYTES:
+        self->max_bytes = g_value_get_uint64 (value);
+        break;
+    case PROP_IDLE_TIMEOUT:
+        self->idle_timeout = g_value_get_uint (value);
+        break;
+    case PROP_TERMINATOR:
+        g_clear_pointer (&self->terminator, g_bytes_unref);
+        self->terminator = g_value_dup_boxed (value);
+        if (self->terminator != NULL &&
+            g_bytes_get_size (self->terminator) == 0)
+            g_clear_pointer (&self->terminator, g_bytes_unref);
+        break;
+    case PROP_CHECKSUM_TYPE:
+        self->checksum_type = g_value_get_int (value);
+        break;
+    case PROP_EXPECTED_CHECKSUM:
+        g_free (self->expected_checksum);
+        self->expected_checksum = g_value_dup_string (value);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gt_file_receive_class_init (GtFileReceiveClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    object_class->dispose = gt_file_receive_dispose;
+    object_class->finalize = gt_file_receive_finalize;
+    object_class->get_property = gt_file_receive_get_property;
+    object_class->set_property = gt_file_receive_set_property;
+
+    properties[PROP_FILE] = g_param_spec_object (
+        "file",
+        "file",
+        "file",
+        G_TYPE_FILE,
+        G_PARAM_STATIC_STRINGS | G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY);
+
+    properties[PROP_SERIAL_PORT] = g_param_spec_object (
+        "serial-port",
+        "serial-port",
+        "serial-port",
+        GT_TYPE_SERIAL_PORT,
+        G_PARAM_STATIC_STRINGS | G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY);
+
+    properties[PROP_MAX_BYTES] =
+        g_param_spec_uint64 ("max-bytes",
+                             "max-bytes",
+                             "Stop after this many bytes, 0 for no limit",
+                             0,
+                             G_MAXUINT64,
+                             0,
+                             G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE);
+
+    properties[PROP_IDLE_TIMEOUT] = g_param_spec_uint (
+        "idle-timeout",
+        "idle-timeout",
+        "Stop when no data arrived for this many milliseconds, 0 for never",
+        0,
+        G_MAXUINT,
+        0,
+        G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE);
+
+    properties[PROP_TERMINATOR] = g_param_spec_boxed (
+        "terminator",
+        "terminator",
+        "Stop at this byte sequence; it is not written to the file",
+        G_TYPE_BYTES,
+        G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE);
+
+    properties[PROP_CHECKSUM_TYPE] =
+        g_param_spec_int ("checksum-type",
+                          "checksum-type",
+                          "GChecksumType to compute, -1 for none",
+                          -1,
+                          G_MAXINT,
+                          -1,
+                          G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE);
+
+    properties[PROP_EXPECTED_CHECKSUM] = g_param_spec_string (
+        "expected-checksum",
+        "expected-checksum",
+        "Hex digest the received data has to match",
+        NULL,
+        G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE);
+
+    properties[PROP_BYTES_RECEIVED] =
+        g_param_spec_uint64 ("bytes-received",
+                             "bytes-received",
+                             "Number of bytes written to the file so far",
+                             0,
+                             G_MAXUINT64,
+                             0,
+                             G_PARAM_STATIC_STRINGS | G_PARAM_READABLE);
+
+    properties[PROP_BYTES_PER_SECOND] =
+        g_param_spec_double ("bytes-per-second",
+                             "bytes-per-second",
+                             "Throughput over the last few seconds",
+                             0.0,
+                             G_MAXDOUBLE,
+                             0.0,
+                             G_PARAM_STATIC_STRINGS | G_PARAM_READABLE);
+
+    g_object_class_install_properties (object_class, N_PROPS, properties);
+}
+
+static void
+gt_file_receive_init (GtFileReceive *self)
+{
+    self->checksum_type = -1;
+    self->tail = g_byte_array_new ();
+}
+
+GtFileReceive *
+gt_file_receive_new (GtSerialPort *port, GFile *file)
+{
+    return g_object_new (
+        GT_TYPE_FILE_RECEIVE, "serial-port", port, "file", file, NULL);
+}
+
+// internal functions
+
+static void
+gt_file_receive_notify (GtFileReceive *self)
+{
+    self->last_notify = g_get_monotonic_time ();
+
+    g_object_freeze_notify (G_OBJECT (self));
+    g_object_notify_by_pspec (G_OBJECT (self),
+                              properties[PROP_BYTES_RECEIVED]);
+    g_object_notify_by_pspec (G_OBJECT (self),
+                              properties[PROP_BYTES_PER_SECOND]);
+    g_object_thaw_notify (G_OBJECT (self));
+}
+
+static gboolean
+on_notify_timeout (gpointer user_data)
+{
+    GtFileReceive *self = GT_FILE_RECEIVE (user_data);
+
+    self->notify_id = 0;
+    gt_file_receive_notify (self);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+gt_file_receive_report (GtFileReceive *self)
+{
+    gint64 now = g_get_monotonic_time ();
+    gint64 due = self->last_notify + FILE_RECEIVE_NOTIFY_INTERVAL;
+
+    gt_transfer_rate_add (&self->rate, now, self->received);
+
+    if (now >= due) {
+        g_clear_handle_id (&self->notify_id, g_source_remove);
+        gt_file_receive_notify (self);
+    } else if (self->notify_id == 0) {
+        self->notify_id =
+            g_timeout_add ((due - now) / 1000 + 1, on_notify_timeout, self);
+    }
+}
+
+// Queue a range of received data for the worker, cut to the byte limit
+static void
+gt_file_receive_write (GtFileReceive *self,
+                       GBytes *bytes,
+                       gsize offset,
+                       gsize length)
+{
+    if (self->max_bytes > 0)
+        length = MIN (length, self->max_bytes - self->received);
+
+    if (length == 0)
+        return;
+
+    g_async_queue_push (self->queue,
+                        g_bytes_new_from_bytes (bytes, offset, length));
+    self->received += length;
+    gt_file_receive_report (self);
+
+    if (self->max_bytes > 0 && self->received >= self->max_bytes)
+        gt_file_receive_halt (self, GT_FILE_RECEIVE_STOP_BYTE_COUNT);
+}
+
+// Hand out the first @length held back bytes
+static void
+gt_file_receive_write_tail (GtFileReceive *self, gsize length)
+{
+    if (length == 0)
+        return;
+
+    GBytes *bytes = g_bytes_new (self->tail->data, length);
+    g_byte_array_remove_range (self->tail, 0, length);
+    gt_file_receive_write (self, bytes, 0, length);
+    g_bytes_unref (bytes);
+}
+
+static gssize
+find_sequence (const guint8 *haystack,
+               gsize length,
+               const guint8 *needle,
+               gsize needle_length)
+{
+    const guint8 *p = haystack;
+    const guint8 *end = haystack + length;
+
+    while ((gsize)(end - p) >= needle_length) {
+        p = memchr (p, needle[0], end - p - needle_length + 1);
+        if (p == NULL)
+            return -1;
+
+        if (memcmp (p, needle, needle_length) == 0)
+            return p - haystack;
+
+        p++;
+    }
+
+    return -1;
+}
+
+static void
+gt_file_receive_scan (GtFileReceive *self, GBytes *data)
+{
+    gsize terminator_length = 0;
+    const guint8 *terminator =
+        g_bytes_get_data (self->terminator, &terminator_length);
+    gsize size = 0;
+    const guint8 *bytes = g_bytes_get_data (data, &size);
+
+    g_byte_array_append (self->tail, bytes, size);
+
+    gssize match = find_sequence (
+        self->tail->data, self->tail->len, terminator, terminator_length);
+    if (match >= 0) {
+        gt_file_receive_write_tail (self, match);
+        g_byte_array_set_size (self->tail, 0);
+        gt_file_receive_halt (self, GT_FILE_RECEIVE_STOP_TERMINATOR);
+
+        return;
+    }
+
+    // Everything but a possible start of the terminator can go out
+    if (self->tail->len >= terminator_length)
+        gt_file_receive_write_tail (
+            self, self->tail->len - (terminator_length - 1));
+}
+
+static gboolean
+on_idle_timeout (gpointer user_data)
+{
+    GtFileReceive *self = GT_FILE_RECEIVE (user_data);
+    gint64 remaining = self->last_data +
+                       (gint64)self->idle_timeout * 1000 -
+                       g_get_monotonic_time ();
+
+    self->idle_id = 0;
+
+    // Data came in since the timeout was set up, so wait for the rest
+    if (remaining > 0) {
+        self->idle_id =
+            g_timeout_add (remaining / 1000 + 1, on_idle_timeout, self);
+
+        return G_SOURCE_REMOVE;
+    }
+
+    gt_file_receive_halt (self, GT_FILE_RECEIVE_STOP_IDLE);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+on_data_available (GtSerialPort *port, GBytes *data, gpointer user_data)
+{
+    GtFileReceive *self = GT_FILE_RECEIVE (user_data);
+
+    if (g_bytes_get_size (data) == 0)
+        return;
+
+    // The idle timeout only starts with the first byte, so there is time to
+    // get the other side going after starting the capture
+    self->last_data = g_get_monotonic_time ();
+    if (self->idle_timeout > 0 && self->idle_id == 0)
+        self->idle_id =
+            g_timeout_add (self->idle_timeout, on_idle_timeout, self);
+
+    if (self->terminator != NULL)
+        gt_file_receive_scan (self, data);
+    else
+        gt_file_receive_write (self, data, 0, g_bytes_get_size (data));
+}
+
+// Stop listening and tell the worker to finish the file
+static void
+gt_file_receive_halt (GtFileReceive *self, GtFileReceiveStop reason)
+{
+    if (self->stopping)
+        return;
+
+    self->stopping = TRUE;
+    self->reason = reason;
+
+    g_clear_signal_handler (&self->data_handler, self->port);
+    g_clear_handle_id (&self->idle_id, g_source_remove);
+
+    if (self->cancel_source != NULL) {
+        g_source_destroy (self->cancel_source);
+        g_clear_pointer (&self->cancel_source, g_source_unref);
+    }
+
+    // Without a terminator showing up the held back bytes are plain data
+    gt_file_receive_write_tail (self, self->tail->len);
+
+    g_async_queue_push (self->queue, g_bytes_new (NULL, 0));
+}
+
+static gboolean
+on_cancelled (GCancellable *cancellable, gpointer user_data)
+{
+    gt_file_receive_halt (GT_FILE_RECEIVE (user_data),
+                          GT_FILE_RECEIVE_STOP_MANUAL);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+gt_file_receive_worker (GTask *task,
+                        gpointer source_object,
+                        gpointer task_data,
+                        GCancellable *cancellable)
+{
+    GtFileReceive *self = GT_FILE_RECEIVE (source_object);
+    GAsyncQueue *queue = task_data;
+    GChecksum *checksum = NULL;
+    GError *error = NULL;
+
+    GFileOutputStream *stream = g_file_replace (self->file,
+                                                NULL,
+                                                FALSE,
+                                                G_FILE_CREATE_REPLACE_DESTINATION,
+                                                NULL,
+                                                &error);
+
+    if (self->checksum_type >= 0)
+        checksum = g_checksum_new ((GChecksumType)self->checksum_type);
+
+    while (stream != NULL) {
+        GBytes *chunk = g_async_queue_pop (queue);
+        gsize size = 0;
+        const guint8 *data = g_bytes_get_data (chunk, &size);
+
+        if (size == 0) {
+            g_bytes_unref (chunk);
+            break;
+        }
+
+        if (!g_output_stream_write_all (
+                G_OUTPUT_STREAM (stream), data, size, NULL, NULL, &error)) {
+            g_bytes_unref (chunk);
+            break;
+        }
+
+        if (checksum != NULL)
+            g_checksum_update (checksum, data, size);
+
+        g_bytes_unref (chunk);
+    }
+
+    if (stream != NULL) {
+        g_output_stream_close (
+            G_OUTPUT_STREAM (stream), NULL, error == NULL ? &error : NULL);
+        g_object_unref (stream);
+    }
+
+    if (error != NULL) {
+        g_clear_pointer (&checksum, g_checksum_free);
+        g_task_return_error (task, error);
+
+        return;
+    }
+
+    char *digest = NULL;
+    if (checksum != NULL) {
+        digest = g_strdup (g_checksum_get_string (checksum));
+        g_checksum_free (checksum);
+    }
+
+    g_task_return_pointer (task, digest, g_free);
+}
+
+static void
+on_worker_done (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+    GtFileReceive *self = GT_FILE_RECEIVE (source);
+    GError *error = NULL;
+    g_autofree char *digest =
+        g_task_propagate_pointer (G_TASK (res), &error);
+
+    // A failed write ends the worker early; stop feeding it
+    gt_file_receive_halt (self, GT_FILE_RECEIVE_STOP_MANUAL);
+
+    GTask *task = g_steal_pointer (&self->task);
+    gint64 now = g_get_monotonic_time ();
+    GtFileReceiveStats *stats = g_new0 (GtFileReceiveStats, 1);
+
+    stats->bytes = self->received;
+    stats->elapsed = now - self->start_time;
+    stats->average_rate = gt_transfer_rate_get_average (&self->rate, now);
+    stats->peak_rate =
+        MAX (gt_transfer_rate_get_peak (&self->rate), stats->average_rate);
+    stats->reason = self->reason;
+    if (digest != NULL)
+        g_strlcpy (stats->checksum, digest, sizeof (stats->checksum));
+
+    g_clear_handle_id (&self->notify_id, g_source_remove);
+    gt_file_receive_notify (self);
+
+    if (g_task_return_error_if_cancelled (task)) {
+        g_clear_error (&error);
+        g_free (stats);
+    } else if (error != NULL) {
+        g_task_return_error (task, error);
+        g_free (stats);
+    } else if (self->expected_checksum != NULL && digest != NULL &&
+               g_ascii_strcasecmp (self->expected_checksum, digest) != 0) {
+        g_task_return_new_error (task,
+                                 G_IO_ERROR,
+                                 G_IO_ERROR_INVALID_DATA,
+                                 _ ("Checksum mismatch: expected %s, got %s"),
+                                 self->expected_checksum,
+                                 digest);
+        g_free (stats);
+    } else {
+        g_task_return_pointer (task, stats, g_free);
+    }
+
+    g_object_unref (task);
+}
+
+/**
+ * gt_file_receive_start:
+ * @self: a #GtFileReceive
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: called once the capture is complete
+ * @user_data: data for @callback
+ *
+ * Starts writing everything received on the port to the file until one of
+ * the configured stop conditions is met or gt_file_receive_stop() is called.
+ * Cancelling keeps what was received so far, but the task fails with
+ * %G_IO_ERROR_CANCELLED.
+ */
+void
+gt_file_receive_start (GtFileReceive *self,
+                       GCancellable *cancellable,
+                       GAsyncReadyCallback callback,
+                       gpointer user_data)
+{
+    g_return_if_fail (self->task == NULL && !self->stopping);
+
+    self->task = g_task_new (self, cancellable, callback, user_data);
+    g_task_set_source_tag (self->task, gt_file_receive_start);
+
+    self->start_time = g_get_monotonic_time ();
+    gt_transfer_rate_init (
+        &self->rate, self->start_time, FILE_RECEIVE_RATE_WINDOW);
+    self->queue = g_async_queue_new_full ((GDestroyNotify)g_bytes_unref);
+
+    self->data_handler = g_signal_connect (self->port,
+                                           "data-available",
+                                           G_CALLBACK (on_data_available),
+                                           self);
+
+    if (cancellable != NULL) {
+        self->cancel_source = g_cancellable_source_new (cancellable);
+        g_source_set_callback (
+            self->cancel_source, G_SOURCE_FUNC (on_cancelled), self, NULL);
+        g_source_attach (self->cancel_source, NULL);
+    }
+
+    GTask *worker = g_task_new (self, NULL, on_worker_done, NULL);
+    g_task_set_task_data (worker,
+                          g_async_queue_ref (self->queue),
+                          (GDestroyNotify)g_async_queue_unref);
+    g_task_run_in_thread (worker, gt_file_receive_worker);
+    g_object_unref (worker);
+}
+
+gboolean
+gt_file_receive_finish (GtFileReceive *self,
+                        GAsyncResult *res,
+                        GtFileReceiveStats *stats,
+                        GError **error)
+{
+    g_return_val_if_fail (g_task_is_valid (res, self), FALSE);
+
+    GtFileReceiveStats *result = g_task_propagate_pointer (G_TASK (res), error);
+    if (result == NULL)
+        return FALSE;
+
+    if (stats != NULL)
+        *stats = *result;
+    g_free (result);
+
+    return TRUE;
+}
+
+/**
+ * gt_file_receive_stop:
+ * @self: a #GtFileReceive
+ *
+ * Ends a running capture. The task completes once everything received so far
+ * is on disk.
+ */
+void
+gt_file_receive_stop (GtFileReceive *self)
+{
+    if (self->task == NULL)
+        return;
+
+    gt_file_receive_halt (self, GT_FILE_RECEIVE_STOP_MANUAL);
+}
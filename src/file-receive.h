@@ -0,0 +1,65 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "serial-port.h"
+
+#include <gio/gio.h>
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define GT_TYPE_FILE_RECEIVE (gt_file_receive_get_type ())
+
+G_DECLARE_FINAL_TYPE (GtFileReceive, gt_file_receive, GT, FILE_RECEIVE, GObject)
+
+typedef enum {
+    GT_FILE_RECEIVE_STOP_MANUAL,
+    GT_FILE_RECEIVE_STOP_BYTE_COUNT,
+    GT_FILE_RECEIVE_STOP_IDLE,
+    GT_FILE_RECEIVE_STOP_TERMINATOR,
+} GtFileReceiveStop;
+
+typedef struct {
+    guint64 bytes;
+    gint64 elapsed;
+    gdouble average_rate;
+    gdouble peak_rate;
+    GtFileReceiveStop reason;
+    /* Hex digest of the received data, empty if no checksum was requested */
+    gchar checksum[129];
+} GtFileReceiveStats;
+
+GtFileReceive *
+gt_file_receive_new (GtSerialPort *port, GFile *file);
+
+void
+gt_file_receive_start (GtFileReceive *self,
+                       GCancellable *cancellable,
+                       GAsyncReadyCallback callback,
+                       gpointer user_data);
+gboolean
+gt_file_receive_finish (GtFileReceive *self,
+                        GAsyncResult *res,
+                        GtFileReceiveStats *stats,
+                        GError **error);
+
+void
+gt_file_receive_stop (GtFileReceive *self);
+
+G_END_DECLS
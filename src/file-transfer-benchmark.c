@@ -0,0 +1,321 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Measure raw file transfer throughput on a pseudo-terminal pair */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "file-transfer.h"
+#include "serial-port.h"
+
+#include <errno.h>
+#include <pty.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <glib-unix.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+/* Unpaced, the port may wait for the next chunk at most this share of the
+ * transfer */
+#define BENCHMARK_MAX_STARVED 0.01
+
+static gint size_mib = 16;
+static gint baud_rate = 115200;
+static gint read_ahead = 4;
+static gint tx_rate = 0;
+
+static GOptionEntry entries[] = {
+    {"size",
+     's',
+     0,
+     G_OPTION_ARG_INT,
+     &size_mib,
+     "Size of the transferred file in MiB (default 16)",
+     "MIB"},
+    {"baud",
+     'b',
+     0,
+     G_OPTION_ARG_INT,
+     &baud_rate,
+     "Baud rate to configure and to compare against (default 115200)",
+     "BAUD"},
+    {"read-ahead",
+     'r',
+     0,
+     G_OPTION_ARG_INT,
+     &read_ahead,
+     "Number of chunks read ahead of the port (default 4)",
+     "N"},
+    {"tx-rate",
+     't',
+     0,
+     G_OPTION_ARG_INT,
+     &tx_rate,
+     "Pace the port to RATE characters per second and check that the "
+     "transfer keeps to it (default unpaced)",
+     "RATE"},
+    {NULL}};
+
+typedef struct {
+    GMainLoop *loop;
+    gsize expected;
+    gsize received;
+    gboolean transfer_done;
+    GtFileTransferStats stats;
+    GError *error;
+} Benchmark;
+
+static void
+benchmark_check_done (Benchmark *self)
+{
+    if (self->error != NULL ||
+        (self->transfer_done && self->received >= self->expected))
+        g_main_loop_quit (self->loop);
+}
+
+static gboolean
+on_master_readable (gint fd, GIOCondition condition, gpointer user_data)
+{
+    Benchmark *self = user_data;
+    guint8 buffer[65536];
+
+    ssize_t result = read (fd, buffer, sizeof (buffer));
+    if (result < 0) {
+        if (errno == EAGAIN || errno == EINTR)
+            return G_SOURCE_CONTINUE;
+
+        g_set_error (&self->error,
+                     G_IO_ERROR,
+                     g_io_error_from_errno (errno),
+                     "Failed to read from the pty master: %s",
+                     g_strerror (errno));
+        benchmark_check_done (self);
+
+        return G_SOURCE_REMOVE;
+    }
+
+    self->received += result;
+    benchmark_check_done (self);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+on_transfer_done (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+    Benchmark *self = user_data;
+
+    self->transfer_done = TRUE;
+    gt_file_transfer_finish (
+        GT_FILE_TRANSFER (source), res, &self->stats, &self->error);
+    benchmark_check_done (self);
+}
+
+static char *
+benchmark_create_file (gsize size, GError **error)
+{
+    char *path = NULL;
+    int fd = g_file_open_tmp ("sellerie-benchmark-XXXXXX", &path, error);
+    if (fd < 0)
+        return NULL;
+
+    guint32 block[4096];
+    gsize written = 0;
+    GRand *rand = g_rand_new_with_seed (0x5e11e);
+
+    while (written < size) {
+        gsize i;
+        for (i = 0; i < G_N_ELEMENTS (block); i++)
+            block[i] = g_rand_int (rand);
+
+        gsize chunk = MIN (sizeof (block), size - written);
+        if (write (fd, block, chunk) != (ssize_t)chunk) {
+            g_set_error (error,
+                         G_IO_ERROR,
+                         g_io_error_from_errno (errno),
+                         "Failed to write benchmark file: %s",
+                         g_strerror (errno));
+            break;
+        }
+        written += chunk;
+    }
+
+    g_rand_free (rand);
+    close (fd);
+
+    if (written < size) {
+        g_unlink (path);
+        g_free (path);
+
+        return NULL;
+    }
+
+    return path;
+}
+
+int
+main (int argc, char *argv[])
+{
+    g_autoptr (GOptionContext) context = NULL;
+    g_autoptr (GError) error = NULL;
+    int master = -1, slave = -1;
+    char name[256];
+
+    context = g_option_context_new (NULL);
+    g_option_context_set_summary (
+        context,
+        "Send a file through GtFileTransfer into a pseudo-terminal and check "
+        "that the read-ahead keeps the port busy, or with --tx-rate that the "
+        "transfer keeps to the paced rate.");
+    g_option_context_add_main_entries (context, entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        g_printerr ("%s\n", error->message);
+
+        return EXIT_FAILURE;
+    }
+
+    if (size_mib <= 0 || baud_rate <= 0 || read_ahead < 1 || read_ahead > 64 ||
+        tx_rate < 0) {
+        g_printerr ("Invalid arguments\n");
+
+        return EXIT_FAILURE;
+    }
+
+    if (openpty (&master, &slave, name, NULL, NULL) < 0) {
+        g_printerr ("Failed to open a pty pair: %s\n", g_strerror (errno));
+
+        return EXIT_FAILURE;
+    }
+
+    // Do not let the line discipline of the reading side mangle the data
+    struct termios termios_p;
+    tcgetattr (master, &termios_p);
+    cfmakeraw (&termios_p);
+    tcsetattr (master, TCSANOW, &termios_p);
+    g_unix_set_fd_nonblocking (master, TRUE, NULL);
+
+    gsize size = (gsize)size_mib * 1024 * 1024;
+    g_autofree char *path = benchmark_create_file (size, &error);
+    if (path == NULL) {
+        g_printerr ("%s\n", error->message);
+
+        return EXIT_FAILURE;
+    }
+
+    GtSerialPortConfiguration config = {0};
+    g_strlcpy (config.port, name, sizeof (config.port));
+    config.vitesse = baud_rate;
+    config.bits = 8;
+    config.stops = 1;
+    config.parity = GT_SERIAL_PORT_PARITY_NONE;
+    config.flow = GT_SERIAL_PORT_FLOW_CONTROL_NONE;
+    config.car = -1;
+    config.tx_rate = tx_rate;
+
+    GtSerialPort *port = gt_serial_port_new ();
+    if (!gt_serial_port_config (port, &config)) {
+        GError *port_error = gt_serial_port_get_last_error (port);
+        g_printerr ("Failed to open %s: %s\n",
+                    name,
+                    port_error != NULL ? port_error->message : "unknown");
+        g_unlink (path);
+
+        return EXIT_FAILURE;
+    }
+
+    Benchmark benchmark = {0};
+    benchmark.loop = g_main_loop_new (NULL, FALSE);
+    benchmark.expected = size;
+
+    guint watch =
+        g_unix_fd_add (master, G_IO_IN, on_master_readable, &benchmark);
+
+    GFile *file = g_file_new_for_path (path);
+    GtFileTransfer *transfer = g_object_new (GT_TYPE_FILE_TRANSFER,
+                                             "file",
+                                             file,
+                                             "serial-port",
+                                             port,
+                                             "read-ahead",
+                                             (guint)read_ahead,
+                                             NULL);
+
+    gint64 start = g_get_monotonic_time ();
+    gt_file_transfer_start (transfer, NULL, on_transfer_done, &benchmark);
+    g_main_loop_run (benchmark.loop);
+    gint64 elapsed = g_get_monotonic_time () - start;
+
+    g_source_remove (watch);
+    g_object_unref (transfer);
+    g_object_unref (file);
+    gt_serial_port_close_and_unlock (port);
+    g_object_unref (port);
+    g_main_loop_unref (benchmark.loop);
+    close (slave);
+    close (master);
+    g_unlink (path);
+
+    if (benchmark.error != NULL) {
+        g_printerr ("Transfer failed: %s\n", benchmark.error->message);
+        g_error_free (benchmark.error);
+
+        return EXIT_FAILURE;
+    }
+
+    // 8N1 puts ten bits on the wire for every byte
+    double seconds = (double)MAX (elapsed, 1) / G_USEC_PER_SEC;
+    double throughput = (double)benchmark.received / seconds;
+    double line_rate = (double)baud_rate / 10.0;
+
+    g_print ("%" G_GSIZE_FORMAT " bytes in %.3f s, %.0f bytes/s, "
+             "%.1f%% of %d baud (read-ahead %d)\n",
+             benchmark.received,
+             seconds,
+             throughput,
+             100.0 * throughput / line_rate,
+             baud_rate,
+             read_ahead);
+    g_print ("Sender reported %.0f bytes/s average, %.0f bytes/s peak\n",
+             benchmark.stats.average_rate,
+             benchmark.stats.peak_rate);
+
+    if (tx_rate > 0) {
+        // A paced transfer has to hit the configured rate, not exceed it
+        double deviation = (throughput - tx_rate) / tx_rate;
+
+        g_print ("%.2f%% off the paced rate of %d characters/s\n",
+                 100.0 * deviation,
+                 tx_rate);
+
+        return ABS (deviation) <= 0.02 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // A pty drains as fast as we write, so the line rate says nothing about
+    // the transfer. What matters is whether the port ever waits for the disk
+    double starved = (double)benchmark.stats.starved_time /
+                     (double)MAX (benchmark.stats.elapsed, 1);
+
+    g_print ("Port starved for data %.2f%% of the time\n", 100.0 * starved);
+
+    return starved <= BENCHMARK_MAX_STARVED ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -16,68 +16,125 @@
  */
 
 #include "file-transfer.h"
+#include "echo-verifier.h"
 #include "serial-port.h"
+#include "transfer-rate.h"
 
 #include <glib/gi18n.h>
 
-#define FILE_TRANSFER_BUFFER_SIZE 8192
+#include <string.h>
 
+// Chunks are read ahead of the serial port so that the UART never waits for
+// the disk. The chunk size is large enough to keep a fast port busy for a few
+// milliseconds between two wake-ups.
+#define FILE_TRANSFER_CHUNK_SIZE (64 * 1024)
+#define FILE_TRANSFER_DEFAULT_READ_AHEAD 4
+
+// Progress is reported at most at 10 Hz; the rate is averaged over 3 s
+#define FILE_TRANSFER_NOTIFY_INTERVAL (G_USEC_PER_SEC / 10)
+#define FILE_TRANSFER_RATE_WINDOW (3 * G_USEC_PER_SEC)
+
+// Echo verification remembers this much unanswered data and, once all is
+// sent, waits until the echo has been quiet for this long
+#define FILE_TRANSFER_ECHO_WINDOW (1024 * 1024)
+#define FILE_TRANSFER_ECHO_TIMEOUT 2000
+
+// In the line-paced modes the transfer waits after every line, either for a
+// fixed delay or until the wait character is received. A single source per
+// transfer handles both, so there is no per-line source or signal churn: the
+// delay is a ready time and the wait character flag is set by a
+// "data-available" handler that stays connected for the whole transfer.
 typedef struct {
     GSource source;
 
     int wait_char;
     gpointer object;
-    guint callback;
+    gulong callback;
 
+    gboolean armed;
     gboolean wait_char_found;
-} SignalWaitSource;
+} PaceSource;
 
 static gboolean
-signal_wait_source_prepare (GSource *source, gint *timeout)
+pace_source_prepare (GSource *source, gint *timeout)
 {
-    SignalWaitSource *self = (SignalWaitSource *)source;
+    PaceSource *self = (PaceSource *)source;
     *timeout = -1;
 
-    return self->wait_char_found;
+    return self->armed && self->wait_char_found;
 }
 
 static gboolean
-signal_wait_source_dispatch (GSource *source,
-                             GSourceFunc callback,
-                             gpointer user_data)
+pace_source_dispatch (GSource *source, GSourceFunc callback, gpointer user_data)
 {
+    g_source_set_ready_time (source, -1);
+
     return callback (user_data);
 }
 
 static void
-signal_wait_source_finalize (GSource *source)
+pace_source_finalize (GSource *source)
 {
-    SignalWaitSource *self = (SignalWaitSource *)source;
+    PaceSource *self = (PaceSource *)source;
 
-    g_signal_handler_disconnect (self->object, self->callback);
+    if (self->callback != 0)
+        g_signal_handler_disconnect (self->object, self->callback);
 }
 
-static GSourceFuncs signal_wait_source_funcs = {signal_wait_source_prepare,
-                                                NULL,
-                                                signal_wait_source_dispatch,
-                                                signal_wait_source_finalize,
-                                                NULL,
-                                                NULL};
+static GSourceFuncs pace_source_funcs = {pace_source_prepare,
+                                         NULL,
+                                         pace_source_dispatch,
+                                         pace_source_finalize,
+                                         NULL,
+                                         NULL};
 
 struct _GtFileTransfer {
     GObject parent_instance;
     GFile *file;
+    // Data to send instead of a file, e.g. a paste
+    GBytes *bytes;
     GtSerialPort *port;
-    GFileInputStream *stream;
+    GInputStream *stream;
     gsize size;
     gsize written;
     gint wait_character;
     guint wait_delay;
-    gulong callback;
-    gulong timeout_source;
 
     gboolean waiting;
-    GBytes *residual;
+    GSource *pace;
+
+    // Chunk being sent line by line and the offsets of its line ends
+    GBytes *current;
+    GArray *line_ends;
+    guint line;
+    gsize offset;
+
+    // Read-ahead pipeline
+    GTask *task;
+    GQueue chunks;
+    guint read_ahead;
+    gboolean reading;
+    gboolean writing;
+    gboolean eof;
+    GError *read_error;
+
+    // Statistics
+    GtTransferRate rate;
+    gint64 start_time;
+    gint64 last_notify;
+    guint notify_id;
+    gint64 stall_start;
+    gint64 starve_start;
+    GtFileTransferStats stats;
+
+    // Echo verification
+    gboolean verify;
+    GtEchoVerifier *verifier;
+    gulong sent_handler;
+    gulong echo_handler;
+    guint echo_timeout_id;
+    gint64 last_echo;
+    gboolean draining;
 };
 
 G_DEFINE_TYPE (GtFileTransfer, gt_file_transfer, G_TYPE_OBJECT)
@@ -85,14 +142,19 @@ G_DEFINE_TYPE (GtFileTransfer, gt_file_transfer, G_TYPE_OBJECT)
 enum {
     PROP_0,
     PROP_FILE,
+    PROP_BYTES,
     PROP_SERIAL_PORT,
     PROP_PROGRESS,
     PROP_WAIT_CHARACTER,
     PROP_DELAY,
+    PROP_READ_AHEAD,
+    PROP_BYTES_PER_SECOND,
+    PROP_ETA,
+    PROP_VERIFY,
     N_PROPS
 };
 
-enum { SIGNAL_PROGRESS, N_SIGNALS };
+enum { SIGNAL_PROGRESS, SIGNAL_SENT, N_SIGNALS };
 
 static GParamSpec *properties[N_PROPS];
 static guint signals[N_SIGNALS] = {0};
@@ -102,20 +164,33 @@ gt_file_transfer_send_chunk (GtFileTransfer *self,
                              GBytes *data,
                              gpointer user_data);
 
+static void
+gt_file_transfer_send_line (GtFileTransfer *self, gpointer user_data);
+
 static void
 gt_file_transfer_continue (GtFileTransfer *self, gpointer user_data);
 
 static void
 on_serial_data_ready (GtSerialPort *port, GBytes *data, gpointer user_data);
 
+static void
+gt_file_transfer_fill (GtFileTransfer *self);
+
 static void
 gt_file_transfer_dispose (GObject *object)
 {
     GtFileTransfer *self = (GtFileTransfer *)object;
 
-    if (self->callback != 0) {
-        g_signal_handler_disconnect (self->port, self->callback);
-        self->callback = 0;
+    if (self->pace != NULL) {
+        g_source_destroy (self->pace);
+        g_clear_pointer (&self->pace, g_source_unref);
+    }
+
+    g_clear_handle_id (&self->notify_id, g_source_remove);
+    g_clear_handle_id (&self->echo_timeout_id, g_source_remove);
+    if (self->port != NULL) {
+        g_clear_signal_handler (&self->sent_handler, self->port);
+        g_clear_signal_handler (&self->echo_handler, self->port);
     }
 
     G_OBJECT_CLASS (gt_file_transfer_parent_class)->dispose (object);
@@ -126,9 +201,15 @@ gt_file_transfer_finalize (GObject *object)
 {
     GtFileTransfer *self = (GtFileTransfer *)object;
 
+    g_queue_clear_full (&self->chunks, (GDestroyNotify)g_bytes_unref);
+    g_clear_pointer (&self->current, g_bytes_unref);
+    g_clear_pointer (&self->line_ends, g_array_unref);
+    g_clear_error (&self->read_error);
+    g_clear_pointer (&self->verifier, gt_echo_verifier_free);
     g_clear_object (&self->stream);
     g_clear_object (&self->port);
     g_clear_object (&self->file);
+    g_clear_pointer (&self->bytes, g_bytes_unref);
 
     G_OBJECT_CLASS (gt_file_transfer_parent_class)->finalize (object);
 }
@@ -149,6 +230,18 @@ gt_file_transfer_get_property (GObject *object,
         else
             g_value_set_double (value, 0.0);
         break;
+    case PROP_BYTES_PER_SECOND:
+        g_value_set_double (value, gt_transfer_rate_get_current (&self->rate));
+        break;
+    case PROP_ETA: {
+        gint64 eta = gt_transfer_rate_get_eta (
+            &self->rate, self->size - MIN (self->written, self->size));
+        g_value_set_double (
+            value, eta < 0 ? -1.0 : (gdouble)eta / G_USEC_PER_SEC);
+    } break;
+    case PROP_VERIFY:
+        g_value_set_boolean (value, self->verify);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -166,6 +259,9 @@ gt_file_transfer_set_property (GObject *object,
     case PROP_FILE:
         self->file = G_FILE (g_value_dup_object (value));
         break;
+    case PROP_BYTES:
+        self->bytes = g_value_dup_boxed (value);
+        break;
     case PROP_SERIAL_PORT:
         self->port = GT_SERIAL_PORT (g_value_dup_object (value));
         break;
@@ -175,6 +271,12 @@ gt_file_transfer_set_property (GObject *object,
     case PROP_DELAY:
         self->wait_delay = g_value_get_uint (value);
         break;
+    case PROP_READ_AHEAD:
+        self->read_ahead = g_value_get_uint (value);
+        break;
+    case PROP_VERIFY:
+        self->verify = g_value_get_boolean (value);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -201,12 +303,31 @@ gt_file_transfer_class_init (GtFileTransferClass *klass)
                                              1,
                                              G_TYPE_DOUBLE);
 
+    // Emitted with what went to the device from this transfer only, as it
+    // goes out
+    signals[SIGNAL_SENT] = g_signal_new ("sent",
+                                         G_TYPE_FROM_CLASS (klass),
+                                         G_SIGNAL_RUN_LAST,
+                                         0,
+                                         NULL,
+                                         NULL,
+                                         NULL,
+                                         G_TYPE_NONE,
+                                         1,
+                                         G_TYPE_BYTES);
+
     properties[PROP_FILE] = g_param_spec_object (
         "file",
         "file",
         "file",
         G_TYPE_FILE,
         G_PARAM_STATIC_STRINGS | G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY);
+    properties[PROP_BYTES] = g_param_spec_boxed (
+        "bytes",
+        "bytes",
+        "Data to send instead of the contents of a file",
+        G_TYPE_BYTES,
+        G_PARAM_STATIC_STRINGS | G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY);
     properties[PROP_SERIAL_PORT] = g_param_spec_object (
         "serial-port",
         "serial-port",
@@ -240,6 +361,40 @@ gt_file_transfer_class_init (GtFileTransferClass *klass)
         0,
         G_PARAM_STATIC_STRINGS | G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY);
 
+    properties[PROP_READ_AHEAD] = g_param_spec_uint (
+        "read-ahead",
+        "read-ahead",
+        "Number of file chunks to keep queued ahead of the serial port",
+        1,
+        64,
+        FILE_TRANSFER_DEFAULT_READ_AHEAD,
+        G_PARAM_STATIC_STRINGS | G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY);
+
+    properties[PROP_BYTES_PER_SECOND] =
+        g_param_spec_double ("bytes-per-second",
+                             "bytes-per-second",
+                             "Throughput over the last few seconds",
+                             0.0,
+                             G_MAXDOUBLE,
+                             0.0,
+                             G_PARAM_STATIC_STRINGS | G_PARAM_READABLE);
+
+    properties[PROP_ETA] =
+        g_param_spec_double ("eta",
+                             "eta",
+                             "Estimated seconds left, -1 if unknown",
+                             -1.0,
+                             G_MAXDOUBLE,
+                             -1.0,
+                             G_PARAM_STATIC_STRINGS | G_PARAM_READABLE);
+
+    properties[PROP_VERIFY] = g_param_spec_boolean (
+        "verify",
+        "verify",
+        "Compare the data echoed by the device against what was sent",
+        FALSE,
+        G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE | G_PARAM_CONSTRUCT);
+
     g_object_class_install_properties (object_class, N_PROPS, properties);
 }
 
@@ -247,6 +402,15 @@ static void
 gt_file_transfer_init (GtFileTransfer *self)
 {
     self->size = 0;
+    self->read_ahead = FILE_TRANSFER_DEFAULT_READ_AHEAD;
+    g_queue_init (&self->chunks);
+    self->line_ends = g_array_new (FALSE, FALSE, sizeof (gsize));
+}
+
+GFile *
+gt_file_transfer_get_file (GtFileTransfer *self)
+{
+    return self->file;
 }
 
 // internal functions
@@ -254,18 +418,235 @@ gt_file_transfer_init (GtFileTransfer *self)
 static void
 on_file_input_ready (GObject *source, GAsyncResult *res, gpointer user_data);
 
+static void
+gt_file_transfer_notify (GtFileTransfer *self)
+{
+    self->last_notify = g_get_monotonic_time ();
+
+    g_object_freeze_notify (G_OBJECT (self));
+    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_PROGRESS]);
+    g_object_notify_by_pspec (G_OBJECT (self),
+                              properties[PROP_BYTES_PER_SECOND]);
+    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_ETA]);
+    g_object_thaw_notify (G_OBJECT (self));
+}
+
+static gboolean
+on_notify_timeout (gpointer user_data)
+{
+    GtFileTransfer *self = GT_FILE_TRANSFER (user_data);
+
+    self->notify_id = 0;
+    gt_file_transfer_notify (self);
+
+    return G_SOURCE_REMOVE;
+}
+
+// Record the progress and tell listeners about it, but not more often than
+// FILE_TRANSFER_NOTIFY_INTERVAL. A throttled update is delivered late instead
+// of being dropped, so the last state is always shown
+static void
+gt_file_transfer_report (GtFileTransfer *self)
+{
+    gint64 now = g_get_monotonic_time ();
+    gint64 due = self->last_notify + FILE_TRANSFER_NOTIFY_INTERVAL;
+
+    gt_transfer_rate_add (&self->rate, now, self->written);
+
+    if (now >= due) {
+        g_clear_handle_id (&self->notify_id, g_source_remove);
+        gt_file_transfer_notify (self);
+    } else if (self->notify_id == 0) {
+        self->notify_id = g_timeout_add ((due - now) / 1000 + 1,
+                                         on_notify_timeout,
+                                         self);
+    }
+}
+
+// Return the task exactly once. Reads and writes may still be in flight; their
+// callbacks notice that self->task is gone and drop their reference.
+static void
+gt_file_transfer_complete (GtFileTransfer *self, GError *error)
+{
+    GTask *task = g_steal_pointer (&self->task);
+
+    if (task == NULL) {
+        g_clear_error (&error);
+        return;
+    }
+
+    g_queue_clear_full (&self->chunks, (GDestroyNotify)g_bytes_unref);
+    g_clear_pointer (&self->current, g_bytes_unref);
+
+    if (self->pace != NULL) {
+        g_source_destroy (self->pace);
+        g_clear_pointer (&self->pace, g_source_unref);
+    }
+
+    g_clear_handle_id (&self->echo_timeout_id, g_source_remove);
+    g_clear_signal_handler (&self->sent_handler, self->port);
+    g_clear_signal_handler (&self->echo_handler, self->port);
+
+    gint64 now = g_get_monotonic_time ();
+    GtFileTransferStats *stats = &self->stats;
+
+    stats->echo_first_error = -1;
+    if (self->verifier != NULL) {
+        // Whatever is still outstanding never came back
+        gt_echo_verifier_finish (self->verifier);
+        stats->echo_compared = self->verifier->compared;
+        stats->echo_errors = self->verifier->errors;
+        stats->echo_first_error = self->verifier->first_error;
+        stats->echo_missing = self->verifier->dropped +
+                              self->verifier->skipped +
+                              self->verifier->pending;
+        stats->echo_resyncs = self->verifier->resyncs;
+    }
+
+    stats->bytes = self->written;
+    stats->elapsed = now - self->start_time;
+    stats->average_rate = gt_transfer_rate_get_average (&self->rate, now);
+    stats->peak_rate =
+        MAX (gt_transfer_rate_get_peak (&self->rate), stats->average_rate);
+
+    g_clear_handle_id (&self->notify_id, g_source_remove);
+    gt_file_transfer_notify (self);
+
+    g_debug ("Transfer done: %" G_GUINT64_FORMAT " bytes in %" G_GINT64_FORMAT
+             " us, %.0f B/s average, %.0f B/s peak, %u stalls",
+             stats->bytes,
+             stats->elapsed,
+             stats->average_rate,
+             stats->peak_rate,
+             stats->stalls);
+
+    if (error != NULL) {
+        g_task_return_error (task, error);
+    } else {
+        GtFileTransferStats *result = g_new (GtFileTransferStats, 1);
+        *result = *stats;
+        g_task_return_pointer (task, result, g_free);
+    }
+
+    g_object_unref (task);
+}
+
+static void
+on_data_sent (GtSerialPort *port, GBytes *data, gpointer user_data)
+{
+    GtFileTransfer *self = GT_FILE_TRANSFER (user_data);
+    gsize size = 0;
+    const guint8 *bytes = g_bytes_get_data (data, &size);
+
+    // Anything else going out at the same time is not ours
+    if (gt_serial_port_get_sending_tag (port) != self)
+        return;
+
+    if (self->verifier != NULL)
+        gt_echo_verifier_sent (self->verifier, bytes, size);
+    g_signal_emit (self, signals[SIGNAL_SENT], 0, data);
+}
+
+static void
+on_echo_received (GtSerialPort *port, GBytes *data, gpointer user_data)
+{
+    GtFileTransfer *self = GT_FILE_TRANSFER (user_data);
+    gsize size = 0;
+    const guint8 *bytes = g_bytes_get_data (data, &size);
+
+    gt_echo_verifier_received (self->verifier, bytes, size);
+    self->last_echo = g_get_monotonic_time ();
+
+    if (!self->draining)
+        return;
+
+    GError *error = NULL;
+    if (g_cancellable_set_error_if_cancelled (
+            g_task_get_cancellable (self->task), &error))
+        gt_file_transfer_complete (self, error);
+    else if (self->verifier->pending == 0)
+        gt_file_transfer_complete (self, NULL);
+}
+
+static gboolean
+on_echo_timeout (gpointer user_data)
+{
+    GtFileTransfer *self = GT_FILE_TRANSFER (user_data);
+    gint64 remaining = self->last_echo +
+                       FILE_TRANSFER_ECHO_TIMEOUT * 1000 -
+                       g_get_monotonic_time ();
+
+    self->echo_timeout_id = 0;
+
+    if (remaining > 0) {
+        self->echo_timeout_id =
+            g_timeout_add (remaining / 1000 + 1, on_echo_timeout, self);
+
+        return G_SOURCE_REMOVE;
+    }
+
+    GError *error = NULL;
+    g_cancellable_set_error_if_cancelled (g_task_get_cancellable (self->task),
+                                          &error);
+
+    g_debug ("Giving up on %" G_GSIZE_FORMAT " bytes of echo",
+             self->verifier->pending);
+    gt_file_transfer_complete (self, error);
+
+    return G_SOURCE_REMOVE;
+}
+
+// Everything is sent; with echo verification, wait for the echo to catch up
+// before finishing, as long as it keeps coming
+static void
+gt_file_transfer_drain_echo (GtFileTransfer *self)
+{
+    if (self->verifier == NULL || self->verifier->pending == 0) {
+        gt_file_transfer_complete (self, NULL);
+
+        return;
+    }
+
+    self->draining = TRUE;
+    self->last_echo = g_get_monotonic_time ();
+    self->echo_timeout_id =
+        g_timeout_add (FILE_TRANSFER_ECHO_TIMEOUT, on_echo_timeout, self);
+}
+
 static gboolean
-on_delay_timeout (gpointer user_data)
+on_pace_ready (gpointer user_data)
 {
     GTask *task = G_TASK (user_data);
     GtFileTransfer *self = GT_FILE_TRANSFER (g_task_get_source_object (task));
-    self->waiting = FALSE;
+    PaceSource *pace = (PaceSource *)self->pace;
+    GError *error = NULL;
 
-    g_debug ("output delay timeout: %lu", g_get_monotonic_time ());
+    if (g_cancellable_set_error_if_cancelled (g_task_get_cancellable (task),
+                                              &error)) {
+        gt_file_transfer_complete (self, error);
 
-    gt_file_transfer_continue (self, user_data);
+        return G_SOURCE_REMOVE;
+    }
 
-    return G_SOURCE_REMOVE;
+    // Woken up without reason, e.g. the wait character arrived while no line
+    // was outstanding
+    if (!pace->armed ||
+        (self->wait_character != -1 && !pace->wait_char_found))
+        return G_SOURCE_CONTINUE;
+
+    g_debug ("output pacing done: %" G_GINT64_FORMAT, g_get_monotonic_time ());
+
+    if (self->wait_character != -1) {
+        self->stats.stalls++;
+        self->stats.stall_time += g_get_monotonic_time () - self->stall_start;
+    }
+
+    pace->armed = FALSE;
+    pace->wait_char_found = FALSE;
+    self->waiting = FALSE;
+    gt_file_transfer_continue (self, task);
+
+    return G_SOURCE_CONTINUE;
 }
 
 static void
@@ -280,80 +661,118 @@ on_serial_port_write_ready (GObject *source,
     gsize size = gt_serial_port_write_bytes_finish (
         GT_SERIAL_PORT (source), res, &error);
 
+    if (self->task != task) {
+        g_clear_error (&error);
+        g_object_unref (task);
+        return;
+    }
+
     if (error != NULL) {
-        g_task_return_error (task, error);
-        g_object_unref (G_OBJECT (task));
+        gt_file_transfer_complete (self, error);
+        g_object_unref (task);
         return;
     }
 
     if (size == 0) {
-        g_task_return_new_error (
-            task,
-            G_IO_ERROR,
-            G_IO_ERROR_UNKNOWN,
-            _ ("Failed to write anything to the serial port"));
-        g_object_unref (G_OBJECT (task));
+        gt_file_transfer_complete (
+            self,
+            g_error_new_literal (
+                G_IO_ERROR,
+                G_IO_ERROR_UNKNOWN,
+                _ ("Failed to write anything to the serial port")));
+        g_object_unref (task);
         return;
     }
 
-    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_PROGRESS]);
+    gt_file_transfer_report (self);
 
     if (!self->waiting) {
         gt_file_transfer_continue (self, task);
+        g_object_unref (task);
 
         return;
     }
 
-    GSource *wait_source = NULL;
-    if (self->wait_character != -1) {
-        wait_source =
-            g_source_new (&signal_wait_source_funcs, sizeof (SignalWaitSource));
-        SignalWaitSource *source = (SignalWaitSource *)wait_source;
-        source->wait_char_found = FALSE;
-        source->wait_char = self->wait_character;
-        source->object = self->port;
-        source->callback = g_signal_connect (G_OBJECT (self->port),
-                                             "data-available",
-                                             G_CALLBACK (on_serial_data_ready),
-                                             wait_source);
-
-        g_debug ("=> %u", source->callback);
-    } else if (self->wait_delay != 0) {
-        wait_source = g_timeout_source_new (self->wait_delay);
-    } else {
-        g_assert_not_reached ();
-    }
+    // Wait for the reply or the delay before the next line
+    PaceSource *pace = (PaceSource *)self->pace;
+    pace->armed = TRUE;
+    self->stall_start = g_get_monotonic_time ();
+    if (self->wait_character == -1)
+        g_source_set_ready_time (self->pace,
+                                 g_get_monotonic_time () +
+                                     (gint64)self->wait_delay * 1000);
+    g_object_unref (task);
+}
 
-    GSource *cancellable_source =
-        g_cancellable_source_new (g_task_get_cancellable (task));
-    g_source_set_dummy_callback (cancellable_source);
-    g_source_add_child_source (wait_source, cancellable_source);
-    g_task_attach_source (task, wait_source, on_delay_timeout);
-    g_source_unref (wait_source);
-    g_source_unref (cancellable_source);
+// Keep up to read_ahead chunks queued. Only one read is in flight at a time,
+// but it runs while the serial port is busy writing the previous chunk.
+static void
+gt_file_transfer_fill (GtFileTransfer *self)
+{
+    if (self->task == NULL || self->reading || self->eof ||
+        self->read_error != NULL)
+        return;
+
+    if (g_queue_get_length (&self->chunks) >= self->read_ahead)
+        return;
+
+    self->reading = TRUE;
+    g_input_stream_read_bytes_async (G_INPUT_STREAM (self->stream),
+                                     FILE_TRANSFER_CHUNK_SIZE,
+                                     g_task_get_priority (self->task),
+                                     g_task_get_cancellable (self->task),
+                                     on_file_input_ready,
+                                     g_object_ref (self->task));
 }
 
+// Called whenever the serial side is idle and may take the next chunk
 static void
 gt_file_transfer_continue (GtFileTransfer *self, gpointer user_data)
 {
-    // We have left-over data from the previous write due to a mode where we
-    // have to obey the LF. Short-cut to send the data without reading from the
-    // file
-    if (self->residual != NULL) {
-        GBytes *data = self->residual;
-        self->residual = NULL;
+    self->writing = FALSE;
+
+    if (self->task == NULL)
+        return;
+
+    if (self->read_error != NULL) {
+        gt_file_transfer_complete (self, g_steal_pointer (&self->read_error));
+
+        return;
+    }
+
+    // We are in the middle of a chunk in a mode where we have to obey the LF.
+    // Send its next line without reading from the file
+    if (self->current != NULL) {
+        gt_file_transfer_send_line (self, user_data);
+
+        return;
+    }
+
+    GBytes *data = g_queue_pop_head (&self->chunks);
+    if (data != NULL) {
+        if (self->starve_start != 0) {
+            self->stats.starved_time +=
+                g_get_monotonic_time () - self->starve_start;
+            self->starve_start = 0;
+        }
+
         gt_file_transfer_send_chunk (self, data, user_data);
+        gt_file_transfer_fill (self);
+
+        return;
+    }
+
+    if (self->eof) {
+        g_debug ("Finishing task because there's no data left to send");
+        gt_file_transfer_drain_echo (self);
 
         return;
     }
 
-    g_input_stream_read_bytes_async (
-        G_INPUT_STREAM (self->stream),
-        FILE_TRANSFER_BUFFER_SIZE,
-        g_task_get_priority (G_TASK (user_data)),
-        g_task_get_cancellable (G_TASK (user_data)),
-        on_file_input_ready,
-        user_data);
+    // The disk fell behind; on_file_input_ready resumes sending
+    if (self->starve_start == 0)
+        self->starve_start = g_get_monotonic_time ();
+    gt_file_transfer_fill (self);
 }
 
 static void
@@ -366,13 +785,69 @@ on_file_input_ready (GObject *source, GAsyncResult *res, gpointer user_data)
     GBytes *data =
         g_input_stream_read_bytes_finish (G_INPUT_STREAM (source), res, &error);
 
-    if (error != NULL) {
-        g_task_return_error (task, error);
-        g_object_unref (G_OBJECT (task));
+    self->reading = FALSE;
+
+    if (self->task != task) {
+        g_clear_error (&error);
+        g_clear_pointer (&data, g_bytes_unref);
+        g_object_unref (task);
         return;
     }
 
-    gt_file_transfer_send_chunk (self, data, user_data);
+    if (error != NULL) {
+        self->read_error = error;
+    } else if (g_bytes_get_size (data) == 0) {
+        self->eof = TRUE;
+        g_bytes_unref (data);
+    } else {
+        g_queue_push_tail (&self->chunks, data);
+        gt_file_transfer_fill (self);
+    }
+
+    if (!self->writing)
+        gt_file_transfer_continue (self, task);
+
+    g_object_unref (task);
+}
+
+// Write the next line of the current chunk, without slicing the chunk
+static void
+gt_file_transfer_send_line (GtFileTransfer *self, gpointer user_data)
+{
+    GTask *task = G_TASK (user_data);
+    gsize end = g_array_index (self->line_ends, gsize, self->line);
+    gsize start = self->offset;
+    GBytes *data = g_bytes_ref (self->current);
+    const guint8 *bytes = (const guint8 *)g_bytes_get_data (data, NULL);
+
+    // Only a complete line has to wait for the reply; a chunk ending in the
+    // middle of a line continues with the next chunk right away
+    self->waiting = bytes[end - 1] == LINE_FEED;
+    if (self->waiting && self->wait_character != -1) {
+        PaceSource *pace = (PaceSource *)self->pace;
+        pace->wait_char_found = FALSE;
+        pace->armed = FALSE;
+    }
+
+    self->offset = end;
+    if (++self->line == self->line_ends->len) {
+        g_clear_pointer (&self->current, g_bytes_unref);
+        g_array_set_size (self->line_ends, 0);
+        self->line = 0;
+        self->offset = 0;
+    }
+
+    self->writing = TRUE;
+    self->written += end - start;
+    gt_serial_port_write_range_async (self->port,
+                                      data,
+                                      start,
+                                      end - start,
+                                      self,
+                                      g_task_get_cancellable (task),
+                                      on_serial_port_write_ready,
+                                      g_object_ref (task));
+    g_bytes_unref (data);
 }
 
 static void
@@ -382,46 +857,42 @@ gt_file_transfer_send_chunk (GtFileTransfer *self,
 {
     GTask *task = G_TASK (user_data);
 
-    // Reading done
-    gsize size = 0;
-    const guint8 *bytes = (const guint8 *)g_bytes_get_data (data, &size);
-    if (g_bytes_get_size (data) == 0) {
-        g_debug ("FInishing task because there's no data left to send");
+    if (self->pace == NULL) {
+        self->writing = TRUE;
+        self->written += g_bytes_get_size (data);
+        gt_serial_port_write_range_async (self->port,
+                                          data,
+                                          0,
+                                          g_bytes_get_size (data),
+                                          self,
+                                          g_task_get_cancellable (task),
+                                          on_serial_port_write_ready,
+                                          g_object_ref (task));
         g_bytes_unref (data);
-        g_task_return_boolean (task, TRUE);
-        g_object_unref (G_OBJECT (task));
+
         return;
     }
 
-    if (self->wait_character != -1 || self->wait_delay != 0) {
-        gsize lf_position = 0, old_size = size;
-        while (lf_position < size && bytes[lf_position++] != LINE_FEED) {
-        }
+    // Index all line ends of the chunk once; the last entry covers a trailing
+    // partial line
+    gsize size = 0;
+    const guint8 *bytes = (const guint8 *)g_bytes_get_data (data, &size);
+    const guint8 *p = bytes;
+    const guint8 *end = bytes + size;
 
-        if (lf_position + 1 < size) {
-            GBytes *old_residual = self->residual;
-            self->residual = g_bytes_new_from_bytes (
-                data, lf_position + 1, size - lf_position - 1);
-            size = lf_position + 1;
-            GBytes *old_data = data;
-            data = g_bytes_new_from_bytes (data, 0, size);
-            g_bytes_unref (old_residual);
-            g_bytes_unref (old_data);
-        }
+    g_array_set_size (self->line_ends, 0);
+    while (p < end) {
+        const guint8 *lf = memchr (p, LINE_FEED, end - p);
+        gsize line_end = lf != NULL ? (gsize)(lf - bytes) + 1 : size;
 
-        // Check if the buffer ends on a line-feed, so we have to wait for
-        // something later on
-        self->waiting =
-            lf_position < old_size && bytes[lf_position] == LINE_FEED;
+        g_array_append_val (self->line_ends, line_end);
+        p = bytes + line_end;
     }
 
-    self->written += size;
-    gt_serial_port_write_bytes_async (self->port,
-                                      data,
-                                      g_task_get_cancellable (task),
-                                      on_serial_port_write_ready,
-                                      task);
-    g_bytes_unref (data);
+    self->current = data;
+    self->line = 0;
+    self->offset = 0;
+    gt_file_transfer_send_line (self, user_data);
 }
 
 static void
@@ -430,38 +901,66 @@ on_read_file_done (GObject *source, GAsyncResult *res, gpointer user_data)
     GTask *task = G_TASK (user_data);
     GError *error = NULL;
     GtFileTransfer *self = GT_FILE_TRANSFER (g_task_get_source_object (task));
-    self->stream = g_file_read_finish (G_FILE (source), res, &error);
+    GFileInputStream *stream = g_file_read_finish (G_FILE (source), res, &error);
+
+    if (self->task != task) {
+        g_clear_error (&error);
+        g_clear_object (&stream);
+        g_object_unref (task);
+        return;
+    }
 
     if (error != NULL) {
-        g_task_return_error (task, error);
-        g_object_unref (G_OBJECT (task));
+        gt_file_transfer_complete (self, error);
+        g_object_unref (task);
         return;
     }
 
-    gt_file_transfer_continue (self, user_data);
+    self->stream = G_INPUT_STREAM (stream);
+    gt_file_transfer_fill (self);
+    g_object_unref (task);
 }
 
 static void
 on_serial_data_ready (GtSerialPort *port, GBytes *data, gpointer user_data)
 {
-    SignalWaitSource *self = (SignalWaitSource *)user_data;
+    PaceSource *self = (PaceSource *)user_data;
 
-    // Should not happen
-    if (self->wait_char == -1) {
+    if (self->wait_char_found)
         return;
-    }
 
     gsize size = 0;
     const guint8 *bytes = (const guint8 *)g_bytes_get_data (data, &size);
-    gsize char_position = 0;
-    while (char_position < size) {
-        if (bytes[char_position++] == self->wait_char) {
-            self->wait_char_found = TRUE;
-            break;
-        }
+    if (memchr (bytes, self->wait_char, size) != NULL) {
+        self->wait_char_found = TRUE;
+        g_main_context_wakeup (g_source_get_context ((GSource *)self));
     }
 }
 
+static void
+gt_file_transfer_setup_pacing (GtFileTransfer *self, GTask *task)
+{
+    if (self->wait_character == -1 && self->wait_delay == 0)
+        return;
+
+    self->pace = g_source_new (&pace_source_funcs, sizeof (PaceSource));
+    PaceSource *pace = (PaceSource *)self->pace;
+    pace->wait_char = self->wait_character;
+    pace->object = self->port;
+    if (self->wait_character != -1)
+        pace->callback = g_signal_connect (G_OBJECT (self->port),
+                                           "data-available",
+                                           G_CALLBACK (on_serial_data_ready),
+                                           pace);
+
+    GSource *cancellable_source =
+        g_cancellable_source_new (g_task_get_cancellable (task));
+    g_source_set_dummy_callback (cancellable_source);
+    g_source_add_child_source (self->pace, cancellable_source);
+    g_task_attach_source (task, self->pace, on_pace_ready);
+    g_source_unref (cancellable_source);
+}
+
 static void
 on_file_info_done (GObject *source, GAsyncResult *res, gpointer user_data)
 {
@@ -469,13 +968,21 @@ on_file_info_done (GObject *source, GAsyncResult *res, gpointer user_data)
     GError *error = NULL;
     GFileInfo *info = g_file_query_info_finish (G_FILE (source), res, &error);
 
-    if (info == NULL) {
-        g_task_return_error (task, error);
-        g_object_unref (G_OBJECT (task));
+    GtFileTransfer *self = GT_FILE_TRANSFER (g_task_get_source_object (task));
+
+    // Cancelled through the pace source meanwhile
+    if (self->task != task) {
+        g_clear_error (&error);
+        g_clear_object (&info);
+        g_object_unref (task);
         return;
     }
 
-    GtFileTransfer *self = GT_FILE_TRANSFER (g_task_get_source_object (task));
+    if (info == NULL) {
+        gt_file_transfer_complete (self, error);
+        g_object_unref (task);
+        return;
+    }
 
     self->size = g_file_info_get_size (info);
     g_object_unref (info);
@@ -493,30 +1000,68 @@ gt_file_transfer_start (GtFileTransfer *self,
                         GAsyncReadyCallback callback,
                         gpointer user_data)
 {
-    g_autofree char *path = g_file_get_path (self->file);
+    g_autofree char *path = self->file != NULL ? g_file_get_path (self->file)
+                                               : g_strdup ("(memory)");
     g_autofree char *task_name = g_strdup_printf ("Transferring file %s", path);
 
     g_debug ("Starting file transfer of %s", path);
 
+    g_return_if_fail (self->task == NULL);
+    g_return_if_fail ((self->file == NULL) != (self->bytes == NULL));
+
     GTask *task = g_task_new (self, cancellable, callback, user_data);
     g_task_set_name (task, task_name);
-    g_file_query_info_async (self->file,
-                             G_FILE_ATTRIBUTE_STANDARD_SIZE,
-                             G_FILE_QUERY_INFO_NONE,
-                             g_task_get_priority (task),
-                             g_task_get_cancellable (task),
-                             on_file_info_done,
-                             task);
+    self->task = task;
+    self->start_time = g_get_monotonic_time ();
+    gt_transfer_rate_init (
+        &self->rate, self->start_time, FILE_TRANSFER_RATE_WINDOW);
+    gt_file_transfer_setup_pacing (self, task);
+
+    if (self->verify ||
+        g_signal_has_handler_pending (self, signals[SIGNAL_SENT], 0, FALSE))
+        self->sent_handler = g_signal_connect (
+            self->port, "data-sent", G_CALLBACK (on_data_sent), self);
+
+    if (self->verify) {
+        self->verifier = gt_echo_verifier_new (FILE_TRANSFER_ECHO_WINDOW);
+        self->echo_handler = g_signal_connect (self->port,
+                                               "data-available",
+                                               G_CALLBACK (on_echo_received),
+                                               self);
+    }
 
-    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_PROGRESS]);
+    if (self->bytes != NULL) {
+        self->size = g_bytes_get_size (self->bytes);
+        self->stream = g_memory_input_stream_new_from_bytes (self->bytes);
+        gt_file_transfer_fill (self);
+    } else {
+        g_file_query_info_async (self->file,
+                                 G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                                 G_FILE_QUERY_INFO_NONE,
+                                 g_task_get_priority (task),
+                                 g_task_get_cancellable (task),
+                                 on_file_info_done,
+                                 g_object_ref (task));
+    }
+
+    gt_file_transfer_notify (self);
 }
 
 gboolean
 gt_file_transfer_finish (GtFileTransfer *self,
                          GAsyncResult *res,
+                         GtFileTransferStats *stats,
                          GError **error)
 {
     g_return_val_if_fail (g_task_is_valid (G_TASK (res), self), FALSE);
 
-    return g_task_propagate_boolean (G_TASK (res), error);
+    g_autofree GtFileTransferStats *result =
+        g_task_propagate_pointer (G_TASK (res), error);
+    if (result == NULL)
+        return FALSE;
+
+    if (stats != NULL)
+        *stats = *result;
+
+    return TRUE;
 }
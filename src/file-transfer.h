@@ -27,6 +27,26 @@ G_BEGIN_DECLS
 G_DECLARE_FINAL_TYPE (
     GtFileTransfer, gt_file_transfer, GT, FILE_TRANSFER, GObject)
 
+typedef struct {
+    guint64 bytes;
+    gint64 elapsed;
+    gdouble average_rate;
+    gdouble peak_rate;
+    guint stalls;
+    gint64 stall_time;
+    /* Time the port sat idle because the next chunk was not read yet */
+    gint64 starved_time;
+    /* Echo verification, all zero unless enabled */
+    guint64 echo_compared;
+    guint64 echo_errors;
+    gint64 echo_first_error; /* offset of the first bad byte, -1 if none */
+    guint64 echo_missing;
+    guint64 echo_resyncs; /* times it got back in step over lost or added data */
+} GtFileTransferStats;
+
+GFile *
+gt_file_transfer_get_file (GtFileTransfer *self);
+
 void
 gt_file_transfer_start (GtFileTransfer *self,
                         GCancellable *cancellable,
@@ -35,6 +55,7 @@ gt_file_transfer_start (GtFileTransfer *self,
 gboolean
 gt_file_transfer_finish (GtFileTransfer *self,
                          GAsyncResult *res,
+                         GtFileTransferStats *stats,
                          GError **error);
 
 G_END_DECLS
@@ -20,10 +20,12 @@
 #endif
 
 #include "cmdline.h"
+#include "headless.h"
 #include "logging.h"
 #include "main-window.h"
 #include "parsecfg.h"
 #include "serial-port.h"
+#include "startup-profile.h"
 #include "term_config.h"
 #include "macro-manager.h"
 
@@ -37,6 +39,14 @@ extern struct configuration_port config;
 
 extern char *default_file;
 extern char *config_port;
+extern char *replay_file;
+extern double replay_speed;
+extern gboolean profile_startup;
+extern gboolean headless;
+extern char *headless_output;
+extern char *log_file;
+extern GtLoggingFormat log_format;
+extern char **headless_macros;
 GtSerialPort *serial_port;
 GtkWidget *Fenetre;
 GtkWidget *display;
@@ -51,6 +61,20 @@ on_gtk_application_local_options (GApplication *app,
     }
     Verify_configuration ();
 
+    gt_startup_profile_set_enabled (profile_startup);
+    gt_startup_profile_mark ("command line parsed");
+
+    if (headless) {
+        GtHeadlessOptions headless_options = {
+            .output = headless_output,
+            .log_file = log_file,
+            .log_format = log_format,
+            .macros = (const char *const *)headless_macros,
+        };
+
+        return gt_headless_run (&headless_options);
+    }
+
     return -1;
 }
 
@@ -65,6 +89,22 @@ on_gtk_application_startup (GApplication *app, gpointer user_data)
     gtk_application_set_menubar (GTK_APPLICATION (app), menu_model);
 
     g_object_unref (builder);
+    gt_startup_profile_mark ("menus built");
+}
+
+static gboolean
+on_first_frame (GtkWidget *widget, GdkFrameClock *clock, gpointer user_data)
+{
+    gt_startup_profile_mark ("first frame");
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+on_first_data (GtSerialPort *port, GBytes *bytes, gpointer user_data)
+{
+    g_signal_handlers_disconnect_by_func (port, on_first_data, user_data);
+    gt_startup_profile_finish ("first byte received");
 }
 
 static void
@@ -73,6 +113,7 @@ on_gtk_application_activate (GApplication *app, gpointer user_data)
     GtkWidget *main_window = gt_main_window_new (GTK_APPLICATION (app));
 
     Fenetre = main_window;
+    gt_startup_profile_mark ("main window built");
 
     gtk_application_add_window (GTK_APPLICATION (app),
                                 GTK_WINDOW (main_window));
@@ -82,12 +123,42 @@ on_gtk_application_activate (GApplication *app, gpointer user_data)
     display = GT_MAIN_WINDOW (main_window)->display;
     GT_MAIN_WINDOW (main_window)->default_raw_file = default_file;
 
-    update_vte_config ();
+    if (profile_startup) {
+        g_signal_connect (
+            serial_port, "data-available", G_CALLBACK (on_first_data), NULL);
+        gtk_widget_add_tick_callback (main_window, on_first_frame, NULL, NULL);
+    }
 
+    // Open the port first, so it is already reading while the window maps
     gt_serial_port_config (GT_MAIN_WINDOW (main_window)->serial_port, &config);
+    gt_startup_profile_mark ("port opened");
+
+    update_vte_config ();
 
     gtk_window_present (GTK_WINDOW (main_window));
     gtk_widget_show (main_window);
+    gt_startup_profile_mark ("window presented");
+
+    if (replay_file != NULL) {
+        gt_main_window_start_replay (
+            GT_MAIN_WINDOW (main_window), replay_file, replay_speed);
+    }
+}
+
+/* GTK cannot be initialized without a display, so this has to be known
+ * before GApplication gets to parse the options */
+static gboolean
+is_headless (int argc, char *argv[])
+{
+    for (int i = 1; i < argc; i++) {
+        if (g_str_equal (argv[i], "--"))
+            break;
+
+        if (g_str_equal (argv[i], "--headless"))
+            return TRUE;
+    }
+
+    return FALSE;
 }
 
 int
@@ -97,6 +168,8 @@ main (int argc, char *argv[])
     GtkApplication *app = NULL;
     int status;
 
+    gt_startup_profile_mark ("main");
+
     config_file = g_strdup_printf ("%s/.gtktermrc", getenv ("HOME"));
     gt_config_set_file_path (config_file);
     g_free (config_file);
@@ -105,13 +178,19 @@ main (int argc, char *argv[])
     bind_textdomain_codeset (PACKAGE, "UTF-8");
     textdomain (PACKAGE);
 
-    gtk_init ();
+    if (!is_headless (argc, argv)) {
+        gtk_init ();
+        gt_startup_profile_mark ("GTK initialized");
+    }
 
     app = gtk_application_new ("org.jensge.Sellerie", G_APPLICATION_NON_UNIQUE);
-    g_object_set (G_OBJECT (gt_macro_manager_get_default ()), "app", app, NULL);
+    if (gtk_is_initialized ())
+        g_object_set (
+            G_OBJECT (gt_macro_manager_get_default ()), "app", app, NULL);
     add_option_group (G_APPLICATION (app));
 
     Check_configuration_file ();
+    gt_startup_profile_mark ("configuration loaded");
 
     g_signal_connect (
         app, "activate", G_CALLBACK (on_gtk_application_activate), NULL);
@@ -0,0 +1,413 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Headless mode: the serial engine on a plain GMainLoop, without GTK.
+ *
+ * Received data is copied to standard output, or a file, as it arrives.
+ * Standard input is sent to the port once the macros given on the command
+ * line have run. The session goes on after the end of the input, until
+ * SIGINT or SIGTERM, the port failing or the reader going away.
+ *
+ * Sellerie has no trigger engine yet, so there are no triggers to run here.
+ * Once it does, they belong next to the macros. */
+
+#include "headless.h"
+
+#include "buffer.h"
+#include "macro-manager.h"
+#include "macro-script.h"
+#include "macro-template.h"
+#include "serial-port.h"
+#include "startup-profile.h"
+#include "term_config.h"
+
+#include <gio/gio.h>
+#include <gio/gunixinputstream.h>
+#include <gio/gunixoutputstream.h>
+#include <glib-unix.h>
+#include <glib/gi18n.h>
+
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define HEADLESS_READ_SIZE 4096
+
+extern struct configuration_port config;
+
+typedef struct {
+    GMainLoop *loop;
+    GtSerialPort *port;
+    GtBuffer *buffer;
+    GtLogging *logger;
+    GOutputStream *output;
+    GInputStream *input;
+    GCancellable *cancellable;
+    const char *const *macros;
+    // Asynchronous operations still to call back
+    guint pending;
+    gboolean got_data;
+    int status;
+} GtHeadless;
+
+static void
+gt_headless_read_input (GtHeadless *self);
+
+static void
+gt_headless_run_next_macro (GtHeadless *self);
+
+static void
+gt_headless_quit (GtHeadless *self, int status, const char *message)
+{
+    if (message != NULL)
+        g_printerr ("%s\n", message);
+
+    // Keep the first failure
+    if (self->status == EXIT_SUCCESS)
+        self->status = status;
+    g_main_loop_quit (self->loop);
+}
+
+static void
+on_data_available (GtSerialPort *port, GBytes *bytes, gpointer user_data)
+{
+    GtHeadless *self = user_data;
+    g_autoptr (GError) error = NULL;
+    gsize size;
+    const char *data = g_bytes_get_data (bytes, &size);
+
+    if (!self->got_data) {
+        self->got_data = TRUE;
+        gt_startup_profile_finish ("first byte received");
+    }
+
+    gt_buffer_put_bytes (
+        self->buffer, bytes, GT_BUFFER_DIRECTION_RX, config.crlfauto);
+
+    // Blocking on purpose, a slow reader holds us back like it would cat
+    if (g_output_stream_write_all (
+            self->output, data, size, NULL, NULL, &error))
+        return;
+
+    // Our reader is gone, e.g. the end of "| head"
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_BROKEN_PIPE)) {
+        gt_headless_quit (self, EXIT_SUCCESS, NULL);
+
+        return;
+    }
+
+    gt_headless_quit (self, EXIT_FAILURE, error->message);
+}
+
+static void
+on_data_sent (GtSerialPort *port, GBytes *bytes, gpointer user_data)
+{
+    GtHeadless *self = user_data;
+
+    if (config.echo)
+        gt_buffer_put_bytes (
+            self->buffer, bytes, GT_BUFFER_DIRECTION_TX, config.crlfauto);
+}
+
+static void
+on_status_changed (GObject *object, GParamSpec *pspec, gpointer user_data)
+{
+    GtHeadless *self = user_data;
+    GError *error = gt_serial_port_get_last_error (self->port);
+
+    if (gt_serial_port_get_status (self->port) != GT_SERIAL_PORT_STATE_ERROR)
+        return;
+
+    g_autofree char *msg =
+        g_strdup_printf (_ ("Serial port went to error: %s"),
+                         error != NULL ? error->message : _ ("Unknown"));
+    gt_headless_quit (self, EXIT_FAILURE, msg);
+}
+
+static void
+on_logging_error (GtLogging *logger, GError *error, gpointer user_data)
+{
+    g_printerr (_ ("Logging stopped: %s\n"), error->message);
+}
+
+static gboolean
+on_quit_signal (gpointer user_data)
+{
+    gt_headless_quit (user_data, EXIT_SUCCESS, NULL);
+
+    return G_SOURCE_CONTINUE;
+}
+
+/* Returns TRUE if the operation should go on */
+static gboolean
+gt_headless_complete (GtHeadless *self, GError *error)
+{
+    self->pending--;
+
+    if (error == NULL)
+        return !g_cancellable_is_cancelled (self->cancellable);
+
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        gt_headless_quit (self, EXIT_FAILURE, error->message);
+
+    return FALSE;
+}
+
+static void
+on_input_sent (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+    GtHeadless *self = user_data;
+    g_autoptr (GError) error = NULL;
+
+    gt_serial_port_write_bytes_finish (GT_SERIAL_PORT (source), result, &error);
+    if (gt_headless_complete (self, error))
+        gt_headless_read_input (self);
+}
+
+static void
+on_input_read (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+    GtHeadless *self = user_data;
+    g_autoptr (GError) error = NULL;
+    g_autoptr (GBytes) bytes = g_input_stream_read_bytes_finish (
+        G_INPUT_STREAM (source), result, &error);
+
+    if (!gt_headless_complete (self, error))
+        return;
+
+    // End of input, keep listening to the port
+    if (g_bytes_get_size (bytes) == 0)
+        return;
+
+    self->pending++;
+    gt_serial_port_write_bytes_async (
+        self->port, bytes, self->cancellable, on_input_sent, self);
+}
+
+static void
+gt_headless_read_input (GtHeadless *self)
+{
+    self->pending++;
+    g_input_stream_read_bytes_async (self->input,
+                                     HEADLESS_READ_SIZE,
+                                     G_PRIORITY_DEFAULT,
+                                     self->cancellable,
+                                     on_input_read,
+                                     self);
+}
+
+static void
+on_macro_sent (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+    GtHeadless *self = user_data;
+    g_autoptr (GError) error = NULL;
+
+    gt_serial_port_write_bytes_finish (GT_SERIAL_PORT (source), result, &error);
+    if (gt_headless_complete (self, error))
+        gt_headless_run_next_macro (self);
+}
+
+static void
+on_macro_script_done (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+    GtHeadless *self = user_data;
+    g_autoptr (GError) error = NULL;
+
+    gt_macro_script_run_finish (result, &error);
+    if (gt_headless_complete (self, error))
+        gt_headless_run_next_macro (self);
+}
+
+static GtMacro *
+gt_headless_find_macro (const char *shortcut)
+{
+    GListModel *model =
+        gt_macro_manager_get_model (gt_macro_manager_get_default ());
+
+    for (guint i = 0; i < g_list_model_get_n_items (model); i++) {
+        g_autoptr (GtMacro) macro = g_list_model_get_item (model, i);
+
+        if (g_strcmp0 (gt_macro_get_shortcut (macro), shortcut) == 0)
+            return g_steal_pointer (&macro);
+    }
+
+    return NULL;
+}
+
+/* Runs the macros from the command line one after the other, then starts
+ * forwarding standard input */
+static void
+gt_headless_run_next_macro (GtHeadless *self)
+{
+    while (self->macros != NULL && *self->macros != NULL) {
+        const char *shortcut = *self->macros++;
+        g_autoptr (GtMacro) macro = gt_headless_find_macro (shortcut);
+        g_autoptr (GBytes) bytes = NULL;
+
+        if (macro == NULL) {
+            g_autofree char *msg =
+                g_strdup_printf (_ ("No macro bound to %s"), shortcut);
+            gt_headless_quit (self, EXIT_FAILURE, msg);
+
+            return;
+        }
+
+        if (gt_macro_get_script (macro) != NULL) {
+            self->pending++;
+            gt_macro_script_run_async (gt_macro_get_script (macro),
+                                       self->port,
+                                       self->cancellable,
+                                       on_macro_script_done,
+                                       self);
+
+            return;
+        }
+
+        GtMacroTemplate *template = gt_macro_get_template (macro);
+        if (template != NULL) {
+            if (gt_macro_template_get_n_inputs (template) > 0) {
+                g_autofree char *msg = g_strdup_printf (
+                    _ ("Macro %s asks for input and cannot run headless"),
+                    shortcut);
+                gt_headless_quit (self, EXIT_FAILURE, msg);
+
+                return;
+            }
+            bytes = gt_macro_template_render (template, NULL);
+        } else if (gt_macro_get_bytes (macro) != NULL) {
+            bytes = g_bytes_ref (gt_macro_get_bytes (macro));
+        } else {
+            continue;
+        }
+
+        self->pending++;
+        gt_serial_port_write_bytes_async (
+            self->port, bytes, self->cancellable, on_macro_sent, self);
+
+        return;
+    }
+
+    gt_headless_read_input (self);
+}
+
+static GOutputStream *
+gt_headless_open_output (const char *path, GError **error)
+{
+    if (path == NULL)
+        return g_unix_output_stream_new (STDOUT_FILENO, FALSE);
+
+    g_autoptr (GFile) file = g_file_new_for_commandline_arg (path);
+
+    return G_OUTPUT_STREAM (g_file_replace (
+        file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, error));
+}
+
+int
+gt_headless_run (const GtHeadlessOptions *options)
+{
+    GtHeadless *self = g_new0 (GtHeadless, 1);
+    g_autoptr (GError) error = NULL;
+    guint sigint, sigterm;
+    int status;
+
+    self->status = EXIT_SUCCESS;
+    self->loop = g_main_loop_new (NULL, FALSE);
+    self->cancellable = g_cancellable_new ();
+    self->macros = options->macros;
+    self->buffer = gt_buffer_new ();
+    self->logger = gt_logging_new (self->buffer);
+    self->port = gt_serial_port_new ();
+    self->input = g_unix_input_stream_new (STDIN_FILENO, FALSE);
+
+    // Report a closed pipe as an error from write() instead of dying
+    signal (SIGPIPE, SIG_IGN);
+    sigint = g_unix_signal_add (SIGINT, on_quit_signal, self);
+    sigterm = g_unix_signal_add (SIGTERM, on_quit_signal, self);
+
+    g_signal_connect (
+        self->logger, "error", G_CALLBACK (on_logging_error), self);
+    g_signal_connect (self->port,
+                      "data-available",
+                      G_CALLBACK (on_data_available),
+                      self);
+    g_signal_connect (
+        self->port, "data-sent", G_CALLBACK (on_data_sent), self);
+    self->output = gt_headless_open_output (options->output, &error);
+    if (self->output == NULL) {
+        g_printerr ("%s\n", error->message);
+        self->status = EXIT_FAILURE;
+        goto out;
+    }
+
+    if (options->log_file != NULL &&
+        !gt_logging_start (
+            self->logger, options->log_file, options->log_format, &error)) {
+        g_printerr ("%s\n", error->message);
+        self->status = EXIT_FAILURE;
+        goto out;
+    }
+
+    if (!gt_serial_port_config (self->port, &config)) {
+        GError *port_error = gt_serial_port_get_last_error (self->port);
+
+        g_printerr (_ ("Cannot open %s: %s\n"),
+                    config.port,
+                    port_error != NULL ? port_error->message : _ ("Unknown"));
+        self->status = EXIT_FAILURE;
+        goto out;
+    }
+    gt_startup_profile_mark ("port opened");
+
+    g_signal_connect (self->port,
+                      "notify::status",
+                      G_CALLBACK (on_status_changed),
+                      self);
+
+    gt_headless_run_next_macro (self);
+    if (self->status == EXIT_SUCCESS)
+        g_main_loop_run (self->loop);
+
+out:
+    g_source_remove (sigint);
+    g_source_remove (sigterm);
+
+    // Let whatever is still in flight see the cancellation
+    g_cancellable_cancel (self->cancellable);
+    while (self->pending > 0)
+        g_main_context_iteration (NULL, TRUE);
+
+    g_signal_handlers_disconnect_by_data (self->port, self);
+    g_signal_handlers_disconnect_by_data (self->logger, self);
+
+    gt_logging_stop (self->logger);
+    if (self->output != NULL)
+        g_output_stream_close (self->output, NULL, NULL);
+    gt_serial_port_close_and_unlock (self->port);
+
+    status = self->status;
+
+    g_clear_object (&self->output);
+    g_object_unref (self->input);
+    g_object_unref (self->port);
+    g_object_unref (self->logger);
+    g_object_unref (self->buffer);
+    g_object_unref (self->cancellable);
+    g_main_loop_unref (self->loop);
+    g_free (self);
+
+    return status;
+}
@@ -0,0 +1,38 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "logging.h"
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct {
+    // Where received data goes, standard output if NULL
+    const char *output;
+    const char *log_file;
+    GtLoggingFormat log_format;
+    // Shortcuts of the macros to run once the port is open
+    const char *const *macros;
+} GtHeadlessOptions;
+
+int
+gt_headless_run (const GtHeadlessOptions *options);
+
+G_END_DECLS
@@ -0,0 +1,99 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Parser for hexadecimal input such as "AA BB CC", "0xAA,0xBB", "AABBCC"
+ * or "aa:bb;cc". Bytes are runs of digit pairs, optionally prefixed with
+ * "0x"; a lone digit is a byte of its own. Anything in between has to be a
+ * separator. The text is classified through a lookup table in a single pass.
+ */
+
+#include "hex-parser.h"
+
+#include <gio/gio.h>
+#include <glib/gi18n.h>
+
+#include <string.h>
+
+#define HEX_DIGIT 0x10
+#define HEX_SEPARATOR 0x20
+
+#define DIGIT(c, v) [c] = HEX_DIGIT | (v)
+
+static const guint8 hex_table[256] = {
+    DIGIT ('0', 0x0),  DIGIT ('1', 0x1),  DIGIT ('2', 0x2),
+    DIGIT ('3', 0x3),  DIGIT ('4', 0x4),  DIGIT ('5', 0x5),
+    DIGIT ('6', 0x6),  DIGIT ('7', 0x7),  DIGIT ('8', 0x8),
+    DIGIT ('9', 0x9),  DIGIT ('a', 0xa),  DIGIT ('b', 0xb),
+    DIGIT ('c', 0xc),  DIGIT ('d', 0xd),  DIGIT ('e', 0xe),
+    DIGIT ('f', 0xf),  DIGIT ('A', 0xa),  DIGIT ('B', 0xb),
+    DIGIT ('C', 0xc),  DIGIT ('D', 0xd),  DIGIT ('E', 0xe),
+    DIGIT ('F', 0xf),  [' '] = HEX_SEPARATOR, ['\t'] = HEX_SEPARATOR,
+    ['\n'] = HEX_SEPARATOR, ['\r'] = HEX_SEPARATOR, [','] = HEX_SEPARATOR,
+    [';'] = HEX_SEPARATOR, [':'] = HEX_SEPARATOR, ['-'] = HEX_SEPARATOR};
+
+#undef DIGIT
+
+static GBytes *
+hex_parse_error (const char *text, const guchar *p, guint8 *out, GError **error)
+{
+    g_set_error (error,
+                 G_IO_ERROR,
+                 G_IO_ERROR_INVALID_DATA,
+                 _ ("Unexpected character at position %ld"),
+                 (long)((const char *)p - text) + 1);
+    g_free (out);
+
+    return NULL;
+}
+
+GBytes *
+gt_hex_parse (const char *text, GError **error)
+{
+    const guchar *p = (const guchar *)text;
+    // A byte needs at least two characters, or one and a separator
+    guint8 *out = g_malloc (strlen (text) / 2 + 1);
+    gsize length = 0;
+
+    while (*p != '\0') {
+        if (hex_table[*p] & HEX_SEPARATOR) {
+            p++;
+            continue;
+        }
+
+        if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+            p += 2;
+
+        const guchar *start = p;
+        while (hex_table[*p] & HEX_DIGIT) {
+            if (hex_table[p[1]] & HEX_DIGIT) {
+                out[length++] =
+                    (hex_table[p[0]] & 0x0f) << 4 | (hex_table[p[1]] & 0x0f);
+                p += 2;
+            } else if (p == start) {
+                out[length++] = hex_table[*p++] & 0x0f;
+            } else {
+                // Odd number of digits in a run
+                return hex_parse_error (text, p, out, error);
+            }
+        }
+
+        if (p == start || (*p != '\0' && !(hex_table[*p] & HEX_SEPARATOR)))
+            return hex_parse_error (text, p, out, error);
+    }
+
+    return g_bytes_new_take (g_realloc (out, length), length);
+}
@@ -26,6 +26,7 @@ struct _GtInfobar {
     GtkInfoBar *info_bar;
     GtkProgressBar *progress;
     GtkLabel *label;
+    GtkButton *button1;
 };
 
 G_DEFINE_TYPE (GtInfobar, gt_infobar, GTK_TYPE_BOX)
@@ -34,6 +35,10 @@ enum { PROP_0, PROP_PROGRESS, N_PROPS };
 
 static GParamSpec *properties[N_PROPS];
 
+enum { SIGNAL_RESPONSE, SIGNAL_CLOSE, N_SIGNALS };
+
+static guint signals[N_SIGNALS];
+
 GtkWidget *
 gt_infobar_new (void)
 {
@@ -87,8 +92,10 @@ gt_infobar_class_init (GtInfobarClass *klass)
 
     gtk_widget_class_set_template_from_resource (
         widget_class, "/org/jensge/Sellerie/transfer-infobar.ui");
+    gtk_widget_class_bind_template_child (widget_class, GtInfobar, info_bar);
     gtk_widget_class_bind_template_child (widget_class, GtInfobar, progress);
     gtk_widget_class_bind_template_child (widget_class, GtInfobar, label);
+    gtk_widget_class_bind_template_child (widget_class, GtInfobar, button1);
 
     object_class->finalize = gt_infobar_finalize;
     object_class->get_property = gt_infobar_get_property;
@@ -103,12 +110,52 @@ gt_infobar_class_init (GtInfobarClass *klass)
                              0.0,
                              G_PARAM_STATIC_STRINGS | G_PARAM_WRITABLE);
     g_object_class_install_properties (object_class, N_PROPS, properties);
+
+    // Forwarded from the embedded GtkInfoBar
+    signals[SIGNAL_RESPONSE] = g_signal_new ("response",
+                                             G_TYPE_FROM_CLASS (klass),
+                                             G_SIGNAL_RUN_LAST,
+                                             0,
+                                             NULL,
+                                             NULL,
+                                             NULL,
+                                             G_TYPE_NONE,
+                                             1,
+                                             G_TYPE_INT);
+    signals[SIGNAL_CLOSE] = g_signal_new ("close",
+                                          G_TYPE_FROM_CLASS (klass),
+                                          G_SIGNAL_RUN_LAST,
+                                          0,
+                                          NULL,
+                                          NULL,
+                                          NULL,
+                                          G_TYPE_NONE,
+                                          0);
+}
+
+static void
+on_info_bar_response (GtkInfoBar *bar, gint response_id, gpointer user_data)
+{
+    g_signal_emit (user_data, signals[SIGNAL_RESPONSE], 0, response_id);
+}
+
+static void
+on_info_bar_close (GtkInfoBar *bar, gpointer user_data)
+{
+    g_signal_emit (user_data, signals[SIGNAL_CLOSE], 0);
 }
 
 static void
 gt_infobar_init (GtInfobar *self)
 {
     gtk_widget_init_template (GTK_WIDGET (self));
+
+    g_signal_connect (self->info_bar,
+                      "response",
+                      G_CALLBACK (on_info_bar_response),
+                      self);
+    g_signal_connect (
+        self->info_bar, "close", G_CALLBACK (on_info_bar_close), self);
 }
 
 void
@@ -122,3 +169,16 @@ gt_infobar_set_label (GtInfobar *self, const char *message)
 {
     gtk_label_set_text (self->label, message);
 }
+
+void
+gt_infobar_set_detail (GtInfobar *self, const char *detail)
+{
+    gtk_progress_bar_set_text (self->progress, detail);
+    gtk_progress_bar_set_show_text (self->progress, detail != NULL);
+}
+
+void
+gt_infobar_set_action_label (GtInfobar *self, const char *label)
+{
+    gtk_button_set_label (self->button1, label);
+}
@@ -31,6 +31,8 @@ G_DECLARE_FINAL_TYPE (GtInfobar, gt_infobar, GT, INFOBAR, GtkBox)
 GtkWidget *gt_infobar_new (void);
 void gt_infobar_set_label (GtInfobar *, const char *);
 void gt_infobar_set_progress (GtInfobar *, double);
+void gt_infobar_set_detail (GtInfobar *, const char *);
+void gt_infobar_set_action_label (GtInfobar *, const char *);
 
 G_END_DECLS
 
@@ -0,0 +1,874 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "log-writer.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glib/gi18n.h>
+#include <glib/gstdio.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/* The writer thread wakes up once this much data is pending, or after
+ * LOG_WRITER_FLUSH_INTERVAL at the latest */
+#define LOG_WRITER_FLUSH_THRESHOLD (64 * 1024)
+#define LOG_WRITER_FLUSH_INTERVAL (500 * G_TIME_SPAN_MILLISECOND)
+
+/* Pending data above this means the disk does not keep up */
+#define LOG_WRITER_BACKPRESSURE_LIMIT (8 * 1024 * 1024)
+
+struct _GtLogWriter {
+    GObject parent_instance;
+
+    GMainContext *context;
+    GThread *thread;
+    FILE *file;
+    char *file_name;
+
+    /* Everything below is protected by mutex. The main thread appends to
+     * front, the writer thread swaps it with back and writes that out */
+    GMutex mutex;
+    GCond cond;
+    GString *front;
+    GString *back;
+    /* What the data in front and back needs in front of it when it starts
+     * a new segment, see gt_log_writer_set_header_func() */
+    GString *front_header;
+    GString *back_header;
+    GtLogWriterHeaderFunc header_func;
+    gpointer header_data;
+    gboolean quit;
+    gboolean flush_requested;
+    gboolean truncate_requested;
+    GError *error;
+    gint64 sync_interval;
+    guint64 rotate_size;
+    gint64 rotate_interval;
+    char *rotate_pattern;
+    GtLogCompression compression;
+
+    /* Only touched on the writer thread */
+    guint64 segment_size;
+    GDateTime *segment_start;
+    gint64 next_rotation;
+    GThreadPool *compressor;
+
+    /* Only touched on the main thread */
+    gboolean backpressure;
+};
+
+typedef struct {
+    GtLogWriter *self;
+    char *path;
+    GtLogCompression compression;
+    GError *error;
+} GtLogWriterCompressJob;
+
+G_DEFINE_TYPE (GtLogWriter, gt_log_writer, G_TYPE_OBJECT)
+
+enum { PROP_0, PROP_BACKPRESSURE, N_PROPS };
+
+static GParamSpec *properties[N_PROPS];
+
+enum { SIGNAL_ERROR, SIGNAL_COUNT };
+
+static guint SIGNALS[SIGNAL_COUNT];
+
+static gpointer
+gt_log_writer_thread (gpointer user_data);
+
+static void
+gt_log_writer_dispose (GObject *object)
+{
+    gt_log_writer_close (GT_LOG_WRITER (object));
+
+    G_OBJECT_CLASS (gt_log_writer_parent_class)->dispose (object);
+}
+
+static void
+gt_log_writer_finalize (GObject *object)
+{
+    GtLogWriter *self = GT_LOG_WRITER (object);
+
+    g_clear_pointer (&self->file_name, g_free);
+    g_clear_pointer (&self->rotate_pattern, g_free);
+    g_clear_pointer (&self->segment_start, g_date_time_unref);
+    g_clear_pointer (&self->context, g_main_context_unref);
+    g_string_free (self->front, TRUE);
+    g_string_free (self->back, TRUE);
+    g_string_free (self->front_header, TRUE);
+    g_string_free (self->back_header, TRUE);
+    g_clear_error (&self->error);
+    g_mutex_clear (&self->mutex);
+    g_cond_clear (&self->cond);
+
+    G_OBJECT_CLASS (gt_log_writer_parent_class)->finalize (object);
+}
+
+static void
+gt_log_writer_get_property (GObject *object,
+                            guint prop_id,
+                            GValue *value,
+                            GParamSpec *pspec)
+{
+    GtLogWriter *self = GT_LOG_WRITER (object);
+
+    switch (prop_id) {
+    case PROP_BACKPRESSURE:
+        g_value_set_boolean (value, self->backpressure);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gt_log_writer_class_init (GtLogWriterClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    object_class->dispose = gt_log_writer_dispose;
+    object_class->finalize = gt_log_writer_finalize;
+    object_class->get_property = gt_log_writer_get_property;
+
+    properties[PROP_BACKPRESSURE] =
+        g_param_spec_boolean ("backpressure",
+                              "backpressure",
+                              "backpressure",
+                              FALSE,
+                              G_PARAM_STATIC_STRINGS | G_PARAM_READABLE |
+                                  G_PARAM_EXPLICIT_NOTIFY);
+
+    g_object_class_install_properties (object_class, N_PROPS, properties);
+
+    SIGNALS[SIGNAL_ERROR] = g_signal_new ("error",
+                                          GT_TYPE_LOG_WRITER,
+                                          G_SIGNAL_RUN_FIRST,
+                                          0,
+                                          NULL,
+                                          NULL,
+                                          NULL,
+                                          G_TYPE_NONE,
+                                          1,
+                                          G_TYPE_ERROR);
+}
+
+static void
+gt_log_writer_init (GtLogWriter *self)
+{
+    g_mutex_init (&self->mutex);
+    g_cond_init (&self->cond);
+    self->front = g_string_sized_new (LOG_WRITER_FLUSH_THRESHOLD);
+    self->back = g_string_sized_new (LOG_WRITER_FLUSH_THRESHOLD);
+    self->front_header = g_string_new (NULL);
+    self->back_header = g_string_new (NULL);
+    self->context = g_main_context_ref_thread_default ();
+    self->rotate_pattern = g_strdup (GT_LOG_WRITER_DEFAULT_ROTATE_PATTERN);
+}
+
+static void
+gt_log_writer_start_segment (GtLogWriter *self)
+{
+    struct stat st;
+
+    // Appending to an existing file counts towards the size limit
+    if (fstat (fileno (self->file), &st) == 0)
+        self->segment_size = st.st_size;
+    else
+        self->segment_size = 0;
+
+    g_clear_pointer (&self->segment_start, g_date_time_unref);
+    self->segment_start = g_date_time_new_now_local ();
+    self->next_rotation = 0;
+}
+
+GtLogWriter *
+gt_log_writer_new (const char *file_name, GError **error)
+{
+    FILE *file = fopen (file_name, "a");
+
+    if (file == NULL) {
+        g_set_error (error,
+                     G_IO_ERROR,
+                     g_io_error_from_errno (errno),
+                     _ ("Cannot open file %s: %m\n"),
+                     file_name);
+
+        return NULL;
+    }
+
+    GtLogWriter *self = g_object_new (GT_TYPE_LOG_WRITER, NULL);
+    self->file = file;
+    self->file_name = g_strdup (file_name);
+    gt_log_writer_start_segment (self);
+    self->thread = g_thread_new ("log-writer", gt_log_writer_thread, self);
+
+    return self;
+}
+
+/* Called on the main thread */
+static void
+gt_log_writer_update_backpressure (GtLogWriter *self)
+{
+    gboolean backpressure;
+
+    g_mutex_lock (&self->mutex);
+    backpressure = self->front->len >= LOG_WRITER_BACKPRESSURE_LIMIT;
+    g_mutex_unlock (&self->mutex);
+
+    if (backpressure != self->backpressure) {
+        self->backpressure = backpressure;
+        g_object_notify_by_pspec (G_OBJECT (self),
+                                  properties[PROP_BACKPRESSURE]);
+    }
+}
+
+static gboolean
+on_writer_state_changed (gpointer user_data)
+{
+    GtLogWriter *self = GT_LOG_WRITER (user_data);
+    GError *error = NULL;
+
+    g_mutex_lock (&self->mutex);
+    error = g_steal_pointer (&self->error);
+    g_mutex_unlock (&self->mutex);
+
+    if (error != NULL) {
+        g_signal_emit (self, SIGNALS[SIGNAL_ERROR], 0, error);
+        g_error_free (error);
+    }
+
+    gt_log_writer_update_backpressure (self);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Called on the writer thread */
+static void
+gt_log_writer_notify_main (GtLogWriter *self)
+{
+    g_main_context_invoke_full (self->context,
+                                G_PRIORITY_DEFAULT,
+                                on_writer_state_changed,
+                                g_object_ref (self),
+                                g_object_unref);
+}
+
+/* Called on the writer thread */
+static void
+gt_log_writer_take_error (GtLogWriter *self, GError *error)
+{
+    g_mutex_lock (&self->mutex);
+    // Only keep the first error until the main thread picked it up
+    if (self->error == NULL) {
+        self->error = error;
+        gt_log_writer_notify_main (self);
+    } else {
+        g_error_free (error);
+    }
+    g_mutex_unlock (&self->mutex);
+}
+
+static gboolean
+gt_log_writer_compress_gzip (const char *path, GError **error)
+{
+    g_autoptr (GFile) source = g_file_new_for_path (path);
+    g_autofree char *target_path = g_strconcat (path, ".gz", NULL);
+    g_autoptr (GFile) target = g_file_new_for_path (target_path);
+
+    g_autoptr (GFileInputStream) in = g_file_read (source, NULL, error);
+    if (in == NULL)
+        return FALSE;
+
+    g_autoptr (GFileOutputStream) out = g_file_replace (
+        target, NULL, FALSE, G_FILE_CREATE_NONE, NULL, error);
+    if (out == NULL)
+        return FALSE;
+
+    g_autoptr (GZlibCompressor) compressor =
+        g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1);
+    g_autoptr (GOutputStream) stream = g_converter_output_stream_new (
+        G_OUTPUT_STREAM (out), G_CONVERTER (compressor));
+
+    return g_output_stream_splice (stream,
+                                   G_INPUT_STREAM (in),
+                                   G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+                                       G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                                   NULL,
+                                   error) >= 0;
+}
+
+#ifdef HAVE_ZSTD
+static gboolean
+gt_log_writer_compress_zstd (const char *path, GError **error)
+{
+    g_autofree char *target_path = g_strconcat (path, ".zst", NULL);
+    size_t in_size = ZSTD_CStreamInSize ();
+    size_t out_size = ZSTD_CStreamOutSize ();
+    g_autofree char *in_buffer = g_malloc (in_size);
+    g_autofree char *out_buffer = g_malloc (out_size);
+    gboolean result = FALSE;
+    FILE *in = NULL;
+    FILE *out = NULL;
+    ZSTD_CCtx *cctx = NULL;
+    size_t n_read = 0;
+
+    in = fopen (path, "rb");
+    if (in == NULL)
+        goto io_error;
+
+    out = fopen (target_path, "wb");
+    if (out == NULL)
+        goto io_error;
+
+    cctx = ZSTD_createCCtx ();
+    if (cctx == NULL) {
+        g_set_error (error,
+                     G_IO_ERROR,
+                     G_IO_ERROR_FAILED,
+                     _ ("Failed to compress %s: %s"),
+                     path,
+                     g_strerror (ENOMEM));
+        goto out;
+    }
+
+    do {
+        gboolean last = FALSE;
+        ZSTD_inBuffer input = {in_buffer, 0, 0};
+
+        n_read = fread (in_buffer, 1, in_size, in);
+        if (ferror (in))
+            goto io_error;
+
+        last = n_read < in_size;
+        input.size = n_read;
+
+        for (;;) {
+            ZSTD_outBuffer output = {out_buffer, out_size, 0};
+            size_t remaining = ZSTD_compressStream2 (
+                cctx, &output, &input, last ? ZSTD_e_end : ZSTD_e_continue);
+
+            if (ZSTD_isError (remaining)) {
+                g_set_error (error,
+                             G_IO_ERROR,
+                             G_IO_ERROR_FAILED,
+                             _ ("Failed to compress %s: %s"),
+                             path,
+                             ZSTD_getErrorName (remaining));
+                goto out;
+            }
+
+            if (fwrite (out_buffer, 1, output.pos, out) != output.pos)
+                goto io_error;
+
+            if (last ? remaining == 0 : input.pos == input.size)
+                break;
+        }
+    } while (n_read == in_size);
+
+    if (fclose (g_steal_pointer (&out)) != 0)
+        goto io_error;
+
+    result = TRUE;
+    goto out;
+
+io_error:
+    g_set_error (error,
+                 G_IO_ERROR,
+                 g_io_error_from_errno (errno),
+                 _ ("Failed to compress %s: %s"),
+                 path,
+                 g_strerror (errno));
+
+out:
+    g_clear_pointer (&cctx, ZSTD_freeCCtx);
+    g_clear_pointer (&in, fclose);
+    g_clear_pointer (&out, fclose);
+
+    return result;
+}
+#endif
+
+gboolean
+gt_log_compression_is_supported (GtLogCompression compression)
+{
+#ifndef HAVE_ZSTD
+    if (compression == GT_LOG_COMPRESSION_ZSTD)
+        return FALSE;
+#endif
+
+    return TRUE;
+}
+
+static void
+gt_log_writer_compress_job_free (gpointer data)
+{
+    GtLogWriterCompressJob *job = data;
+
+    // Might be the last reference if the writer was closed meanwhile, which
+    // is why this runs on the main context
+    g_object_unref (job->self);
+    g_clear_error (&job->error);
+    g_free (job->path);
+    g_free (job);
+}
+
+/* Main context. Unlike errors of the writer thread, this can come after
+ * gt_log_writer_close(), so it is emitted right here */
+static gboolean
+on_compress_done (gpointer data)
+{
+    GtLogWriterCompressJob *job = data;
+
+    if (job->error != NULL)
+        g_signal_emit (job->self, SIGNALS[SIGNAL_ERROR], 0, job->error);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Runs on the compressor pool */
+static void
+gt_log_writer_compress (gpointer data, gpointer user_data)
+{
+    GtLogWriterCompressJob *job = data;
+    GError *error = NULL;
+    gboolean result = FALSE;
+
+    switch (job->compression) {
+#ifdef HAVE_ZSTD
+    case GT_LOG_COMPRESSION_ZSTD:
+        result = gt_log_writer_compress_zstd (job->path, &error);
+        break;
+#endif
+    default:
+        result = gt_log_writer_compress_gzip (job->path, &error);
+        break;
+    }
+
+    // Only remove the segment if the compressed copy is complete
+    if (result && g_unlink (job->path) < 0) {
+        g_set_error (&error,
+                     G_IO_ERROR,
+                     g_io_error_from_errno (errno),
+                     _ ("Failed to remove %s: %s"),
+                     job->path,
+                     g_strerror (errno));
+    }
+
+    // An idle source rather than g_main_context_invoke(), which would run
+    // the callback right here if nobody owns the context at the moment
+    GSource *source = g_idle_source_new ();
+
+    job->error = error;
+    g_source_set_callback (
+        source, on_compress_done, job, gt_log_writer_compress_job_free);
+    g_source_attach (source, job->self->context);
+    g_source_unref (source);
+}
+
+/* Writer thread. Computes the next wall clock boundary for interval based
+ * rotation, so hourly logs rotate on the full hour */
+static gint64
+gt_log_writer_next_boundary (GDateTime *start, gint64 interval)
+{
+    gint64 local = g_date_time_to_unix (start) +
+                   g_date_time_get_utc_offset (start) / G_TIME_SPAN_SECOND;
+
+    return (local / interval + 1) * interval -
+           g_date_time_get_utc_offset (start) / G_TIME_SPAN_SECOND;
+}
+
+static gboolean
+gt_log_writer_rotation_due (GtLogWriter *self,
+                            guint64 rotate_size,
+                            gint64 rotate_interval,
+                            gsize pending)
+{
+    if (rotate_size > 0 && self->segment_size > 0 &&
+        self->segment_size + pending > rotate_size)
+        return TRUE;
+
+    if (rotate_interval > 0) {
+        if (self->next_rotation == 0)
+            self->next_rotation = gt_log_writer_next_boundary (
+                self->segment_start, rotate_interval);
+
+        if (g_get_real_time () / G_USEC_PER_SEC >= self->next_rotation)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* Writer thread. Move the current file out of the way and continue in a
+ * fresh one. Nothing is lost since the data not yet written is still in the
+ * back buffer and goes to the new file, behind its header */
+static gboolean
+gt_log_writer_rotate (GtLogWriter *self,
+                      const char *pattern,
+                      GtLogCompression compression,
+                      GError **error)
+{
+    g_autofree char *suffix = g_date_time_format (self->segment_start, pattern);
+    g_autofree char *rotated = NULL;
+    FILE *file = NULL;
+    guint i = 0;
+
+    if (suffix == NULL) {
+        g_set_error (error,
+                     G_IO_ERROR,
+                     G_IO_ERROR_INVAL,
+                     _ ("Invalid log rotation pattern %s"),
+                     pattern);
+
+        return FALSE;
+    }
+
+    rotated = g_strdup_printf ("%s.%s", self->file_name, suffix);
+    while (g_file_test (rotated, G_FILE_TEST_EXISTS)) {
+        g_free (rotated);
+        rotated = g_strdup_printf ("%s.%s-%u", self->file_name, suffix, ++i);
+    }
+
+    if (fflush (self->file) != 0 || g_rename (self->file_name, rotated) < 0)
+        goto out;
+
+    // Keep the renamed file open until the new one exists, so a failure
+    // leaves us writing to the old segment instead of nowhere
+    file = fopen (self->file_name, "a");
+    if (file == NULL)
+        goto out;
+
+    fclose (self->file);
+    self->file = file;
+    gt_log_writer_start_segment (self);
+
+    if (compression != GT_LOG_COMPRESSION_NONE) {
+        GtLogWriterCompressJob *job = g_new0 (GtLogWriterCompressJob, 1);
+
+        if (self->compressor == NULL)
+            self->compressor = g_thread_pool_new (
+                gt_log_writer_compress, NULL, 1, FALSE, NULL);
+
+        job->self = g_object_ref (self);
+        job->path = g_steal_pointer (&rotated);
+        job->compression = compression;
+        g_thread_pool_push (self->compressor, job, NULL);
+    }
+
+    return TRUE;
+
+out:
+    g_set_error (error,
+                 G_IO_ERROR,
+                 g_io_error_from_errno (errno),
+                 _ ("Failed to rotate log file %s: %s"),
+                 self->file_name,
+                 g_strerror (errno));
+
+    return FALSE;
+}
+
+static gboolean
+gt_log_writer_write_out (GtLogWriter *self,
+                         GString *data,
+                         gboolean truncate,
+                         gboolean sync,
+                         GError **error)
+{
+    gsize written = 0;
+
+    if (truncate) {
+        // The file is in append mode, so the next write goes to offset 0
+        if (fflush (self->file) != 0 || ftruncate (fileno (self->file), 0) < 0)
+            goto out;
+
+        gt_log_writer_start_segment (self);
+    }
+
+    while (written < data->len) {
+        gsize n =
+            fwrite (data->str + written, 1, data->len - written, self->file);
+
+        if (n == 0)
+            goto out;
+
+        written += n;
+    }
+    self->segment_size += written;
+
+    if (fflush (self->file) != 0)
+        goto out;
+
+    if (sync && fsync (fileno (self->file)) < 0)
+        goto out;
+
+    return TRUE;
+
+out:
+    g_set_error (error,
+                 G_IO_ERROR,
+                 g_io_error_from_errno (errno),
+                 _ ("Failed to log data to %s: %s"),
+                 self->file_name,
+                 g_strerror (errno));
+
+    return FALSE;
+}
+
+static gpointer
+gt_log_writer_thread (gpointer user_data)
+{
+    GtLogWriter *self = GT_LOG_WRITER (user_data);
+    gint64 last_sync = g_get_monotonic_time ();
+    gboolean done = FALSE;
+
+    g_mutex_lock (&self->mutex);
+    while (!done) {
+        gint64 deadline = g_get_monotonic_time () + LOG_WRITER_FLUSH_INTERVAL;
+        gboolean truncate = FALSE;
+        gboolean sync = FALSE;
+        gboolean relieved = FALSE;
+        guint64 rotate_size = 0;
+        gint64 rotate_interval = 0;
+        g_autofree char *rotate_pattern = NULL;
+        GtLogCompression compression = GT_LOG_COMPRESSION_NONE;
+        GString *tmp = NULL;
+        GError *error = NULL;
+
+        while (!self->quit && !self->flush_requested &&
+               !self->truncate_requested &&
+               self->front->len < LOG_WRITER_FLUSH_THRESHOLD) {
+            if (!g_cond_wait_until (&self->cond, &self->mutex, deadline))
+                break;
+        }
+
+        // Exit after the data that was appended before closing is written
+        done = self->quit;
+
+        relieved = self->front->len >= LOG_WRITER_BACKPRESSURE_LIMIT;
+        tmp = self->front;
+        self->front = self->back;
+        self->back = tmp;
+        tmp = self->front_header;
+        self->front_header = self->back_header;
+        self->back_header = tmp;
+
+        truncate = self->truncate_requested;
+        self->truncate_requested = FALSE;
+        self->flush_requested = FALSE;
+
+        if (self->sync_interval > 0 &&
+            g_get_monotonic_time () - last_sync >= self->sync_interval) {
+            sync = TRUE;
+        }
+
+        rotate_size = self->rotate_size;
+        rotate_interval = self->rotate_interval;
+        rotate_pattern = g_strdup (self->rotate_pattern);
+        compression = self->compression;
+        g_mutex_unlock (&self->mutex);
+
+        if (self->back->len > 0 && !truncate &&
+            gt_log_writer_rotation_due (
+                self, rotate_size, rotate_interval, self->back->len)) {
+            GError *rotate_error = NULL;
+
+            // Keep logging to the current file and try again at the next
+            // size or time limit instead of on every write
+            if (!gt_log_writer_rotate (
+                    self, rotate_pattern, compression, &rotate_error)) {
+                gt_log_writer_take_error (self, rotate_error);
+                self->segment_size = 0;
+                self->next_rotation = 0;
+                g_date_time_unref (self->segment_start);
+                self->segment_start = g_date_time_new_now_local ();
+            } else if (self->back_header->len > 0) {
+                g_string_prepend_len (self->back,
+                                      self->back_header->str,
+                                      self->back_header->len);
+            }
+        }
+
+        if (self->back->len > 0 || truncate || sync) {
+            gt_log_writer_write_out (self, self->back, truncate, sync, &error);
+            if (sync)
+                last_sync = g_get_monotonic_time ();
+        }
+        g_string_truncate (self->back, 0);
+
+        if (error != NULL)
+            gt_log_writer_take_error (self, error);
+
+        g_mutex_lock (&self->mutex);
+        if (!done && relieved)
+            gt_log_writer_notify_main (self);
+    }
+    g_mutex_unlock (&self->mutex);
+
+    return NULL;
+}
+
+void
+gt_log_writer_append (GtLogWriter *self, const char *data, gsize size)
+{
+    gboolean wake = FALSE;
+
+    g_return_if_fail (GT_IS_LOG_WRITER (self));
+
+    if (self->thread == NULL || size == 0)
+        return;
+
+    g_mutex_lock (&self->mutex);
+    if (self->front->len == 0 && self->header_func != NULL) {
+        g_string_truncate (self->front_header, 0);
+        self->header_func (self->front_header, self->header_data);
+    }
+    g_string_append_len (self->front, data, size);
+    wake = self->front->len >= LOG_WRITER_FLUSH_THRESHOLD;
+    if (wake)
+        g_cond_signal (&self->cond);
+    g_mutex_unlock (&self->mutex);
+
+    if (wake && !self->backpressure)
+        gt_log_writer_update_backpressure (self);
+}
+
+void
+gt_log_writer_flush (GtLogWriter *self)
+{
+    g_return_if_fail (GT_IS_LOG_WRITER (self));
+
+    g_mutex_lock (&self->mutex);
+    self->flush_requested = TRUE;
+    g_cond_signal (&self->cond);
+    g_mutex_unlock (&self->mutex);
+}
+
+void
+gt_log_writer_truncate (GtLogWriter *self)
+{
+    g_return_if_fail (GT_IS_LOG_WRITER (self));
+
+    g_mutex_lock (&self->mutex);
+    g_string_truncate (self->front, 0);
+    self->truncate_requested = TRUE;
+    g_cond_signal (&self->cond);
+    g_mutex_unlock (&self->mutex);
+
+    gt_log_writer_update_backpressure (self);
+}
+
+/* Write out everything that is pending, stop the thread and close the file.
+ * This blocks until the data is on disk, but not for the compression of
+ * rotated segments, which finishes in the background. Its errors are still
+ * emitted as "error" on the main context afterwards. */
+void
+gt_log_writer_close (GtLogWriter *self)
+{
+    g_return_if_fail (GT_IS_LOG_WRITER (self));
+
+    if (self->thread == NULL)
+        return;
+
+    g_mutex_lock (&self->mutex);
+    self->quit = TRUE;
+    g_cond_signal (&self->cond);
+    g_mutex_unlock (&self->mutex);
+
+    g_thread_join (g_steal_pointer (&self->thread));
+    g_clear_pointer (&self->file, fclose);
+
+    // Queued compressions still run, the pool goes away after the last
+    // one. Each job holds a reference that it drops on the main context
+    if (self->compressor != NULL)
+        g_thread_pool_free (g_steal_pointer (&self->compressor), FALSE, FALSE);
+
+    if (self->error != NULL) {
+        g_signal_emit (self, SIGNALS[SIGNAL_ERROR], 0, self->error);
+        g_clear_error (&self->error);
+    }
+}
+
+/* fsync() the log file at most every seconds, 0 disables syncing */
+void
+gt_log_writer_set_sync_interval (GtLogWriter *self, guint seconds)
+{
+    g_return_if_fail (GT_IS_LOG_WRITER (self));
+
+    g_mutex_lock (&self->mutex);
+    self->sync_interval = seconds * G_TIME_SPAN_SECOND;
+    g_mutex_unlock (&self->mutex);
+}
+
+/* Rotate the log once it grows beyond max_size bytes and/or on every
+ * interval seconds of wall clock time, 0 disables either. Rotated segments
+ * are renamed to the log file name plus pattern, formatted with
+ * g_date_time_format() for the time the segment was started */
+void
+gt_log_writer_set_rotation (GtLogWriter *self,
+                            guint64 max_size,
+                            guint interval,
+                            const char *pattern,
+                            GtLogCompression compression)
+{
+    g_return_if_fail (GT_IS_LOG_WRITER (self));
+
+    g_mutex_lock (&self->mutex);
+    self->rotate_size = max_size;
+    self->rotate_interval = interval;
+    g_free (self->rotate_pattern);
+    self->rotate_pattern = g_strdup (
+        pattern != NULL ? pattern : GT_LOG_WRITER_DEFAULT_ROTATE_PATTERN);
+    self->compression = compression;
+    g_mutex_unlock (&self->mutex);
+}
+
+/* Formats that cannot be read from the middle set func to provide what the
+ * data needs to be understood on its own. It is called on the main thread
+ * whenever data is appended to an empty buffer, and what it appends to
+ * header goes in front of that data if it is the first in a new segment */
+void
+gt_log_writer_set_header_func (GtLogWriter *self,
+                               GtLogWriterHeaderFunc func,
+                               gpointer user_data)
+{
+    g_return_if_fail (GT_IS_LOG_WRITER (self));
+
+    g_mutex_lock (&self->mutex);
+    self->header_func = func;
+    self->header_data = user_data;
+    g_mutex_unlock (&self->mutex);
+}
+
+gboolean
+gt_log_writer_get_backpressure (GtLogWriter *self)
+{
+    g_return_val_if_fail (GT_IS_LOG_WRITER (self), FALSE);
+
+    return self->backpressure;
+}
@@ -0,0 +1,75 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define GT_TYPE_LOG_WRITER (gt_log_writer_get_type ())
+
+G_DECLARE_FINAL_TYPE (GtLogWriter, gt_log_writer, GT, LOG_WRITER, GObject)
+
+typedef enum _GtLogCompression {
+    GT_LOG_COMPRESSION_NONE,
+    GT_LOG_COMPRESSION_GZIP,
+    GT_LOG_COMPRESSION_ZSTD
+} GtLogCompression;
+
+#define GT_LOG_WRITER_DEFAULT_ROTATE_PATTERN "%Y%m%d-%H%M%S"
+
+typedef void (*GtLogWriterHeaderFunc) (GString *header, gpointer user_data);
+
+GtLogWriter *
+gt_log_writer_new (const char *file_name, GError **error);
+
+void
+gt_log_writer_append (GtLogWriter *self, const char *data, gsize size);
+
+void
+gt_log_writer_flush (GtLogWriter *self);
+
+void
+gt_log_writer_truncate (GtLogWriter *self);
+
+void
+gt_log_writer_close (GtLogWriter *self);
+
+void
+gt_log_writer_set_sync_interval (GtLogWriter *self, guint seconds);
+
+void
+gt_log_writer_set_rotation (GtLogWriter *self,
+                            guint64 max_size,
+                            guint interval,
+                            const char *pattern,
+                            GtLogCompression compression);
+
+void
+gt_log_writer_set_header_func (GtLogWriter *self,
+                               GtLogWriterHeaderFunc func,
+                               gpointer user_data);
+
+gboolean
+gt_log_writer_get_backpressure (GtLogWriter *self);
+
+gboolean
+gt_log_compression_is_supported (GtLogCompression compression);
+
+G_END_DECLS
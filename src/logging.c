@@ -20,33 +20,185 @@
 #endif
 
 #include "logging.h"
+#include "capture.h"
+#include "log-writer.h"
+#include "sellerie-enums.h"
 
-#include <errno.h>
-#include <stdio.h>
+#include <string.h>
 
 #include <gio/gio.h>
 #include <glib/gi18n.h>
 
-#define MAX_WRITE_ATTEMPTS 5
-
 struct _GtLogging {
     GObject parent_instance;
     gboolean active;
     gchar *LoggingFileName;
-    FILE *LoggingFile;
     gchar *logfile_default;
+
+    /* Does the actual file I/O on a separate thread */
+    GtLogWriter *writer;
+    guint sync_interval;
+    guint64 rotate_size;
+    guint rotate_interval;
+    gchar *rotate_pattern;
+    GtLogCompression compression;
+
+    GtBuffer *buffer;
+    GtLoggingFormat format;
+    gboolean hex;
+
+    /* Direction of the last logged data, TX data is tagged in the log */
+    GtBufferDirection direction;
+    gboolean at_line_start;
+
+    GtCaptureEncoder encoder;
+    /* Timestamp the last encoded record is relative to */
+    gint64 record_base;
 };
 
 G_DEFINE_TYPE (GtLogging, gt_logging, G_TYPE_OBJECT)
 
-enum { PROP_0, PROP_ACTIVE, N_PROPS };
+enum {
+    PROP_0,
+    PROP_ACTIVE,
+    PROP_BUFFER,
+    PROP_HEX,
+    PROP_SYNC_INTERVAL,
+    PROP_BACKPRESSURE,
+    N_PROPS
+};
 
 static GParamSpec *properties[N_PROPS];
 
+enum { SIGNAL_ERROR, SIGNAL_COUNT };
+
+static guint SIGNALS[SIGNAL_COUNT];
+
+static void
+gt_logging_report_error (GtLogging *self, GError *error);
+
+static void
+on_buffer_updated (GtLogging *self,
+                   gpointer data,
+                   guint size,
+                   GtBufferDirection direction,
+                   gpointer user_data)
+{
+    static const char hex_digits[] = "0123456789ABCDEF";
+    const guchar *bytes = data;
+    g_autofree char *hex = NULL;
+    GError *error = NULL;
+    guint i;
+
+    if (!self->active || self->format != GT_LOGGING_FORMAT_RENDERED)
+        return;
+
+    if (!self->hex) {
+        gt_logging_log (self, data, size, direction, &error);
+        gt_logging_report_error (self, error);
+
+        return;
+    }
+
+    /* Same rendering as the hex view, "XX " per byte */
+    hex = g_malloc (size * 3);
+    for (i = 0; i < size; i++) {
+        hex[i * 3] = hex_digits[bytes[i] >> 4];
+        hex[i * 3 + 1] = hex_digits[bytes[i] & 0x0F];
+        hex[i * 3 + 2] = ' ';
+    }
+
+    gt_logging_log (self, hex, size * 3, direction, &error);
+    gt_logging_report_error (self, error);
+}
+
+static void
+on_raw_data (GtLogging *self,
+             gpointer data,
+             guint size,
+             GtBufferDirection direction,
+             gpointer user_data)
+{
+    GError *error = NULL;
+
+    if (!self->active)
+        return;
+
+    if (self->format == GT_LOGGING_FORMAT_CAPTURE) {
+        gt_logging_log_event (
+            self, GT_CAPTURE_EVENT_DATA, direction, data, size);
+
+        return;
+    }
+
+    if (self->format != GT_LOGGING_FORMAT_RAW)
+        return;
+
+    gt_logging_log (self, data, size, direction, &error);
+    gt_logging_report_error (self, error);
+}
+
 GtLogging *
-gt_logging_new (void)
+gt_logging_new (GtBuffer *buffer)
+{
+    return g_object_new (GT_TYPE_LOGGING, "buffer", buffer, NULL);
+}
+
+static void
+on_writer_error (GtLogging *self, GError *error, gpointer user_data)
+{
+    g_signal_emit (self, SIGNALS[SIGNAL_ERROR], 0, error);
+}
+
+static void
+on_writer_backpressure (GtLogging *self, GParamSpec *pspec, gpointer user_data)
+{
+    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_BACKPRESSURE]);
+}
+
+/* A capture segment that starts in the middle of the stream needs a SYNC
+ * record to restart the timestamps from */
+static void
+on_writer_header (GString *header, gpointer user_data)
+{
+    GtLogging *self = GT_LOGGING (user_data);
+
+    gt_capture_encode_resync (header, self->record_base);
+}
+
+static void
+gt_logging_close_writer (GtLogging *self)
+{
+    gboolean backpressure = FALSE;
+
+    if (self->writer == NULL)
+        return;
+
+    gt_log_writer_close (self->writer);
+    backpressure = gt_log_writer_get_backpressure (self->writer);
+    // Errors keep coming while rotated segments are still being compressed
+    g_signal_handlers_disconnect_by_func (
+        self->writer, on_writer_backpressure, self);
+    g_clear_object (&self->writer);
+
+    if (backpressure)
+        g_object_notify_by_pspec (G_OBJECT (self),
+                                  properties[PROP_BACKPRESSURE]);
+}
+
+static void
+gt_logging_dispose (GObject *object)
 {
-    return g_object_new (GT_TYPE_LOGGING, NULL);
+    GtLogging *self = (GtLogging *)object;
+
+    gt_logging_close_writer (self);
+
+    if (self->buffer != NULL) {
+        g_signal_handlers_disconnect_by_data (self->buffer, self);
+        g_clear_object (&self->buffer);
+    }
+
+    G_OBJECT_CLASS (gt_logging_parent_class)->dispose (object);
 }
 
 static void
@@ -55,12 +207,31 @@ gt_logging_finalize (GObject *object)
     GtLogging *self = (GtLogging *)object;
 
     g_clear_pointer (&self->LoggingFileName, g_free);
-    g_clear_pointer (&self->LoggingFile, fclose);
     g_clear_pointer (&self->logfile_default, g_free);
+    g_clear_pointer (&self->rotate_pattern, g_free);
 
     G_OBJECT_CLASS (gt_logging_parent_class)->finalize (object);
 }
 
+static void
+gt_logging_constructed (GObject *object)
+{
+    GtLogging *self = (GtLogging *)object;
+
+    G_OBJECT_CLASS (gt_logging_parent_class)->constructed (object);
+
+    if (self->buffer == NULL)
+        return;
+
+    /* Only log new data, not the buffer being replayed into the view */
+    g_signal_connect_swapped (self->buffer,
+                              "buffer-updated::new",
+                              G_CALLBACK (on_buffer_updated),
+                              self);
+    g_signal_connect_swapped (
+        self->buffer, "raw-data", G_CALLBACK (on_raw_data), self);
+}
+
 static void
 gt_logging_get_property (GObject *object,
                          guint prop_id,
@@ -73,6 +244,20 @@ gt_logging_get_property (GObject *object,
     case PROP_ACTIVE:
         g_value_set_boolean (value, self->active);
         break;
+    case PROP_BUFFER:
+        g_value_set_object (value, self->buffer);
+        break;
+    case PROP_HEX:
+        g_value_set_boolean (value, self->hex);
+        break;
+    case PROP_SYNC_INTERVAL:
+        g_value_set_uint (value, self->sync_interval);
+        break;
+    case PROP_BACKPRESSURE:
+        g_value_set_boolean (value,
+                             self->writer != NULL &&
+                                 gt_log_writer_get_backpressure (self->writer));
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -90,6 +275,18 @@ gt_logging_set_property (GObject *object,
     case PROP_ACTIVE:
         self->active = g_value_get_boolean (value);
         break;
+    case PROP_BUFFER:
+        self->buffer = g_value_dup_object (value);
+        break;
+    case PROP_HEX:
+        self->hex = g_value_get_boolean (value);
+        break;
+    case PROP_SYNC_INTERVAL:
+        self->sync_interval = g_value_get_uint (value);
+        if (self->writer != NULL)
+            gt_log_writer_set_sync_interval (self->writer,
+                                             self->sync_interval);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -100,7 +297,9 @@ gt_logging_class_init (GtLoggingClass *klass)
 {
     GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
+    object_class->dispose = gt_logging_dispose;
     object_class->finalize = gt_logging_finalize;
+    object_class->constructed = gt_logging_constructed;
     object_class->get_property = gt_logging_get_property;
     object_class->set_property = gt_logging_set_property;
 
@@ -111,19 +310,78 @@ gt_logging_class_init (GtLoggingClass *klass)
         FALSE,
         G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE | G_PARAM_CONSTRUCT);
 
+    properties[PROP_BUFFER] = g_param_spec_object (
+        "buffer",
+        "buffer",
+        "buffer",
+        GT_TYPE_BUFFER,
+        G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+
+    properties[PROP_HEX] =
+        g_param_spec_boolean ("hex",
+                              "hex",
+                              "hex",
+                              FALSE,
+                              G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE);
+
+    /* Seconds between fsync() calls on the log file, 0 to never sync */
+    properties[PROP_SYNC_INTERVAL] =
+        g_param_spec_uint ("sync-interval",
+                           "sync-interval",
+                           "sync-interval",
+                           0,
+                           G_MAXUINT,
+                           0,
+                           G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE);
+
+    /* TRUE while the disk does not keep up with the logged data */
+    properties[PROP_BACKPRESSURE] =
+        g_param_spec_boolean ("backpressure",
+                              "backpressure",
+                              "backpressure",
+                              FALSE,
+                              G_PARAM_STATIC_STRINGS | G_PARAM_READABLE);
+
     g_object_class_install_properties (object_class, N_PROPS, properties);
+
+    /* Emitted if writing data that came in through the buffer failed */
+    SIGNALS[SIGNAL_ERROR] = g_signal_new ("error",
+                                          GT_TYPE_LOGGING,
+                                          G_SIGNAL_RUN_FIRST,
+                                          0,
+                                          NULL,
+                                          NULL,
+                                          NULL,
+                                          G_TYPE_NONE,
+                                          1,
+                                          G_TYPE_ERROR);
 }
 
 static void
 gt_logging_init (GtLogging *self)
 {
     self->LoggingFileName = NULL;
-    self->LoggingFile = NULL;
     self->logfile_default = NULL;
+    self->format = GT_LOGGING_FORMAT_RENDERED;
+    self->direction = GT_BUFFER_DIRECTION_RX;
+    self->at_line_start = TRUE;
+}
+
+static void
+gt_logging_report_error (GtLogging *self, GError *error)
+{
+    if (error == NULL)
+        return;
+
+    g_signal_emit (self, SIGNALS[SIGNAL_ERROR], 0, error);
+    g_error_free (error);
 }
 
 gboolean
-gt_logging_start (GtLogging *self, const gchar *filename, GError **error)
+gt_logging_start (GtLogging *self,
+                  const gchar *filename,
+                  GtLoggingFormat format,
+                  GError **error)
 {
     gboolean previous_active = self->active;
 
@@ -133,23 +391,41 @@ gt_logging_start (GtLogging *self, const gchar *filename, GError **error)
         return FALSE;
     }
 
-    g_clear_pointer (&self->LoggingFile, fclose);
+    gt_logging_close_writer (self);
     self->active = FALSE;
 
     g_clear_pointer (&self->LoggingFileName, g_free);
     self->LoggingFileName = g_strdup (filename);
 
-    self->LoggingFile = fopen (self->LoggingFileName, "a");
-    if (self->LoggingFile == NULL) {
-        g_set_error (error,
-                     G_IO_ERROR,
-                     g_io_error_from_errno (errno),
-                     _ ("Cannot open file %s: %m\n"),
-                     self->LoggingFileName);
+    self->writer = gt_log_writer_new (self->LoggingFileName, error);
+    if (self->writer == NULL) {
         g_clear_pointer (&self->LoggingFileName, g_free);
     } else {
+        gt_log_writer_set_sync_interval (self->writer, self->sync_interval);
+        gt_log_writer_set_rotation (self->writer,
+                                    self->rotate_size,
+                                    self->rotate_interval,
+                                    self->rotate_pattern,
+                                    self->compression);
+        g_signal_connect_object (self->writer,
+                                 "error",
+                                 G_CALLBACK (on_writer_error),
+                                 self,
+                                 G_CONNECT_SWAPPED);
+        g_signal_connect_swapped (self->writer,
+                                  "notify::backpressure",
+                                  G_CALLBACK (on_writer_backpressure),
+                                  self);
+
         g_clear_pointer (&self->logfile_default, g_free);
         self->logfile_default = g_strdup (self->LoggingFileName);
+        self->format = format;
+        if (format == GT_LOGGING_FORMAT_CAPTURE)
+            gt_log_writer_set_header_func (
+                self->writer, on_writer_header, self);
+        gt_capture_encoder_reset (&self->encoder);
+        self->direction = GT_BUFFER_DIRECTION_RX;
+        self->at_line_start = TRUE;
         self->active = TRUE;
     }
 
@@ -162,21 +438,25 @@ gt_logging_start (GtLogging *self, const gchar *filename, GError **error)
 void
 gt_logging_pause_resume (GtLogging *self)
 {
-    if (self->LoggingFile == NULL) {
+    if (self->writer == NULL) {
         return;
     }
 
+    // Make sure everything up to the pause is written out
+    if (self->active)
+        gt_log_writer_flush (self->writer);
+
     self->active = !self->active;
 }
 
 void
 gt_logging_stop (GtLogging *self)
 {
-    if (self->LoggingFile == NULL) {
+    if (self->writer == NULL) {
         return;
     }
 
-    g_clear_pointer (&self->LoggingFile, fclose);
+    gt_logging_close_writer (self);
     g_clear_pointer (&self->LoggingFileName, g_free);
 
     self->active = FALSE;
@@ -186,58 +466,108 @@ gt_logging_stop (GtLogging *self)
 gboolean
 gt_logging_clear (GtLogging *self, GError **error)
 {
-    if (self->LoggingFile == NULL) {
+    if (self->writer == NULL) {
         return FALSE;
     }
 
-    // Reopening with "w" will truncate the file
-    self->LoggingFile = freopen (self->LoggingFileName, "w", self->LoggingFile);
+    // Drops pending data and truncates the file on the writer thread
+    gt_log_writer_truncate (self->writer);
+    gt_capture_encoder_reset (&self->encoder);
 
-    if (self->LoggingFile == NULL) {
-        g_set_error (error,
-                     G_IO_ERROR,
-                     g_io_error_from_errno (errno),
-                     _ ("Cannot open file %s: %m\n"),
-                     self->LoggingFileName);
-        g_clear_pointer (&self->LoggingFileName, g_free);
-
-        return FALSE;
-    }
+    self->direction = GT_BUFFER_DIRECTION_RX;
+    self->at_line_start = TRUE;
 
     return TRUE;
 }
 
-gboolean
-gt_logging_log (GtLogging *self, const char *chars, size_t size, GError **error)
+/* See gt_log_writer_set_rotation(), a NULL pattern uses the default one */
+void
+gt_logging_set_rotation (GtLogging *self,
+                         guint64 max_size,
+                         guint interval,
+                         const char *pattern,
+                         GtLogCompression compression)
 {
-    guint writeAttempts = 0;
-    guint bytesWritten = 0;
+    self->rotate_size = max_size;
+    self->rotate_interval = interval;
+    g_free (self->rotate_pattern);
+    self->rotate_pattern = g_strdup (pattern);
+    self->compression = compression;
+
+    if (self->writer != NULL)
+        gt_log_writer_set_rotation (
+            self->writer, max_size, interval, pattern, compression);
+}
+
+void
+gt_logging_flush (GtLogging *self)
+{
+    if (self->writer != NULL)
+        gt_log_writer_flush (self->writer);
+}
 
+gboolean
+gt_logging_log (GtLogging *self,
+                const char *chars,
+                size_t size,
+                GtBufferDirection direction,
+                GError **error)
+{
     /* if we are not logging exit */
-    if (self->LoggingFile == NULL || self->active == FALSE) {
+    if (self->writer == NULL || self->active == FALSE) {
         return FALSE;
     }
 
-    while (bytesWritten < size) {
-        if (writeAttempts < MAX_WRITE_ATTEMPTS) {
-            bytesWritten += fwrite (&chars[bytesWritten],
-                                    1,
-                                    size - bytesWritten,
-                                    self->LoggingFile);
-        } else {
-            g_set_error (error,
-                         G_IO_ERROR,
-                         g_io_error_from_errno (errno),
-                         _ ("Failed to log data: %m\n"));
-            return FALSE;
-        }
+    if (size == 0) {
+        return TRUE;
+    }
+
+    /* Put a direction tag in front of the data whenever the direction
+     * changes. A log without any sent data stays untagged */
+    if (direction != self->direction) {
+        const char *tag = gt_buffer_direction_to_tag (direction);
+
+        if (!self->at_line_start)
+            gt_log_writer_append (self->writer, "\n", 1);
+
+        gt_log_writer_append (self->writer, tag, strlen (tag));
+
+        self->direction = direction;
     }
 
-    fflush (self->LoggingFile);
+    gt_log_writer_append (self->writer, chars, size);
+    self->at_line_start = chars[size - 1] == '\n';
 
     return TRUE;
 }
 
+/* Record an event in a capture log. Other log formats have no place for
+ * events besides data, so nothing is logged for them */
+void
+gt_logging_log_event (GtLogging *self,
+                      GtCaptureEvent event,
+                      GtBufferDirection direction,
+                      const guint8 *payload,
+                      gsize length)
+{
+    if (self->writer == NULL || !self->active ||
+        self->format != GT_LOGGING_FORMAT_CAPTURE) {
+        return;
+    }
+
+    g_autoptr (GString) out =
+        g_string_sized_new (length + 2 * GT_CAPTURE_MAX_HEADER_SIZE + 64);
+    self->record_base = self->encoder.last_timestamp;
+    gt_capture_encode (&self->encoder,
+                       out,
+                       event,
+                       direction,
+                       g_get_monotonic_time (),
+                       payload,
+                       length);
+    gt_log_writer_append (self->writer, out->str, out->len);
+}
+
 const char *
 gt_logging_get_default_file (GtLogging *self)
 {
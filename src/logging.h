@@ -18,6 +18,10 @@
 #ifndef GT_LOGGING_H
 #define GT_LOGGING_H
 
+#include "buffer.h"
+#include "capture.h"
+#include "log-writer.h"
+
 #include <glib-object.h>
 
 G_BEGIN_DECLS
@@ -26,12 +30,21 @@ G_BEGIN_DECLS
 
 G_DECLARE_FINAL_TYPE (GtLogging, gt_logging, GT, LOGGING, GObject)
 
-GtLogging *gt_logging_new (void);
-gboolean gt_logging_start(GtLogging *logger, const char *file_name, GError **error);
+typedef enum _GtLoggingFormat {
+    GT_LOGGING_FORMAT_RENDERED,
+    GT_LOGGING_FORMAT_RAW,
+    GT_LOGGING_FORMAT_CAPTURE
+} GtLoggingFormat;
+
+GtLogging *gt_logging_new (GtBuffer *buffer);
+gboolean gt_logging_start(GtLogging *logger, const char *file_name, GtLoggingFormat format, GError **error);
 void gt_logging_pause_resume(GtLogging *logger);
 void gt_logging_stop(GtLogging *logger);
 gboolean gt_logging_clear(GtLogging *self, GError **error);
-gboolean gt_logging_log(GtLogging *logger, const char *chars, size_t size, GError **error);
+gboolean gt_logging_log(GtLogging *logger, const char *chars, size_t size, GtBufferDirection direction, GError **error);
+void gt_logging_flush(GtLogging *logger);
+void gt_logging_set_rotation(GtLogging *logger, guint64 max_size, guint interval, const char *pattern, GtLogCompression compression);
+void gt_logging_log_event(GtLogging *logger, GtCaptureEvent event, GtBufferDirection direction, const guint8 *payload, gsize length);
 const char *gt_logging_get_default_file(GtLogging *logger);
 G_END_DECLS
 
@@ -37,7 +37,7 @@ build_macro_list (GtkTreeModel *model,
                   GtkTreeIter *iter,
                   gpointer data)
 {
-    GtMacroManager *manager = GT_MACRO_MANAGER (data);
+    GPtrArray *macros = data;
     g_autofree char *shortcut;
     g_autofree char *action;
 
@@ -49,7 +49,11 @@ build_macro_list (GtkTreeModel *model,
                         &(action),
                         -1);
 
-    gt_macro_manager_add (manager, shortcut, action, "");
+    g_ptr_array_add (macros,
+                     g_strconcat (shortcut != NULL ? shortcut : "",
+                                  "::",
+                                  action != NULL ? action : "",
+                                  NULL));
 
     return FALSE;
 }
@@ -58,12 +62,15 @@ void
 gt_macro_manager_save (GtkButton *button, gpointer pointer)
 {
     GtMacroEditor *self = GT_MACRO_EDITOR (pointer);
-
-    gt_macro_manager_clear (self->macro_manager);
+    g_autoptr (GPtrArray) macros = g_ptr_array_new_with_free_func (g_free);
 
     gtk_tree_model_foreach (gtk_tree_view_get_model (self->treeview),
                             build_macro_list,
-                            self->macro_manager);
+                            macros);
+    g_ptr_array_add (macros, NULL);
+
+    gt_macro_manager_set_from_strings (self->macro_manager,
+                                       (const char *const *)macros->pdata);
 }
 
 
@@ -234,7 +241,17 @@ show_help (GtkButton *button, gpointer pointer)
            "The hexadecimal data should not begin with a letter (eg. use \\0FF "
            "and not \\FF)\nExamples :\n\t\"Hello\\n\" sends \"Hello\" followed "
            "by a Line Feed\n\t\"Hello\\0A\" does the same thing but the LF is "
-           "entered in hexadecimal"));
+           "entered in hexadecimal\n\n"
+           "An action starting with \"script:\" is a small script instead, "
+           "with commands separated by \";\": send \"text\", "
+           "expect \"text\" [timeout in ms], delay ms and "
+           "repeat count { ... }\nExample :\n\tscript: repeat 10 { "
+           "send \"AT\\r\"; expect \"OK\" 500; delay 20 }\n\n"
+           "Placeholders turn an action into a template: ${seq[:1|2|4]} "
+           "counter, ${input[:prompt]} asked for on sending, ${begin} "
+           "checksum start, ${crc16-modbus}, ${crc-ccitt}, ${xor} and "
+           "${sum}\nExample :\n\t\\01\\03${seq:2}\\00\\01"
+           "${crc16-modbus}"));
 
     gtk_window_set_modal (GTK_WINDOW (dialog), TRUE);
     gtk_widget_show (dialog);
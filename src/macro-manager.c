@@ -16,6 +16,10 @@ struct _GtMacro {
     char *action;
     char *id;
     GBytes *data;
+    GtMacroScript *script;
+    GtMacroTemplate *template;
+    // Where the manager last put this macro in its model
+    guint position;
 };
 
 
@@ -42,6 +46,8 @@ gt_macro_finalize (GObject *object)
     GtMacro *self = GT_MACRO (object);
 
     g_clear_pointer (&self->data, g_bytes_unref);
+    g_clear_pointer (&self->script, gt_macro_script_unref);
+    g_clear_pointer (&self->template, gt_macro_template_unref);
     g_clear_pointer (&self->shortcut, g_free);
     g_clear_pointer (&self->id, g_free);
     g_clear_pointer (&self->action, g_free);
@@ -50,7 +56,7 @@ gt_macro_finalize (GObject *object)
     G_OBJECT_CLASS (gt_macro_parent_class)->finalize (object);
 }
 
-static GBytes *
+GBytes *
 gt_macro_parse_data (const char *string)
 {
     size_t length = strlen (string);
@@ -129,10 +135,57 @@ gt_macro_parse_data (const char *string)
     return g_byte_array_free_to_bytes (bytes);
 }
 
-static gboolean
-gt_macro_has_id (GtMacro *self, GtMacro *other)
+static GtMacro *
+gt_macro_new (char *shortcut, char *action, char *description)
 {
-    return g_str_equal (self->id, other->id);
+    GtMacro *macro = g_object_new (GT_TYPE_MACRO, NULL);
+
+    macro->id = g_uuid_string_random ();
+    macro->shortcut = shortcut;
+    macro->description = description;
+    macro->action = action;
+
+    if (action != NULL && g_str_has_prefix (action, GT_MACRO_SCRIPT_PREFIX)) {
+        g_autoptr (GError) error = NULL;
+
+        macro->script = gt_macro_script_compile (
+            action + strlen (GT_MACRO_SCRIPT_PREFIX), &error);
+        if (macro->script == NULL)
+            g_warning ("Failed to compile macro \"%s\": %s",
+                       action,
+                       error->message);
+    } else if (action != NULL && gt_macro_template_detect (action)) {
+        g_autoptr (GError) error = NULL;
+
+        macro->template = gt_macro_template_compile (action, &error);
+        // Keep macros that happen to contain "${" working as plain data
+        if (macro->template == NULL) {
+            g_warning ("Failed to compile macro \"%s\": %s",
+                       action,
+                       error->message);
+            macro->data = gt_macro_parse_data (action);
+        }
+    } else if (action != NULL) {
+        macro->data = gt_macro_parse_data (action);
+    }
+
+    return macro;
+}
+
+static GtMacro *
+gt_macro_new_from_string (const char *macro_string)
+{
+    char **parts = g_strsplit (macro_string, "::", 2);
+    if (g_strv_length (parts) != 2) {
+        g_warning ("Failed to parse macro \"%s\"", macro_string);
+        g_strfreev (parts);
+        return NULL;
+    }
+
+    GtMacro *macro = gt_macro_new (parts[0], parts[1], g_strdup (""));
+    g_free (parts);
+
+    return macro;
 }
 
 char *
@@ -165,10 +218,24 @@ gt_macro_get_bytes (GtMacro *self)
     return self->data;
 }
 
+GtMacroScript *
+gt_macro_get_script (GtMacro *self)
+{
+    return self->script;
+}
+
+GtMacroTemplate *
+gt_macro_get_template (GtMacro *self)
+{
+    return self->template;
+}
+
 struct _GtMacroManager {
     GObject parent_class;
 
     GListStore *model;
+    // id -> macro, for the macros in the model
+    GHashTable *index;
     GtkApplication *app;
 };
 
@@ -214,6 +281,7 @@ static void
 gt_macro_manager_init (GtMacroManager *self)
 {
     self->model = g_list_store_new (GT_TYPE_MACRO);
+    self->index = g_hash_table_new (g_str_hash, g_str_equal);
 }
 
 G_DEFINE_TYPE (GtMacroManager, gt_macro_manager, G_TYPE_OBJECT)
@@ -225,6 +293,7 @@ gt_macro_manager_dispose (GObject *object)
 
     g_object_remove_weak_pointer (G_OBJECT (self->app), (gpointer *)&self->app);
     self->app = NULL;
+    g_clear_pointer (&self->index, g_hash_table_unref);
     g_clear_object (&self->model);
     g_clear_object (&self->app);
     G_OBJECT_CLASS (gt_macro_manager_parent_class)->dispose (object);
@@ -289,123 +358,207 @@ gt_macro_manager_get_model (GtMacroManager *self)
     return G_LIST_MODEL (self->model);
 }
 
-const char *
-gt_macro_manager_add_empty (GtMacroManager *self)
+static void
+gt_macro_manager_set_accel (GtMacroManager *self,
+                            GtMacro *macro,
+                            const char *shortcut)
 {
-    GtMacro *macro = g_object_new (GT_TYPE_MACRO, NULL);
-    macro->id = g_uuid_string_random ();
+    g_autofree char *action = g_strconcat ("main.macro::", macro->id, NULL);
+    const char *shortcuts[] = {shortcut, NULL};
 
-    g_list_store_append (self->model, macro);
+    if (self->app != NULL)
+        gtk_application_set_accels_for_action (self->app, action, shortcuts);
+}
 
-    g_autofree char *action = g_strconcat ("main.macro::", macro->id, NULL);
-    const char *shortcuts[] = {macro->shortcut, NULL};
+// Macros without a shortcut never had an accelerator, so there is nothing
+// to install or take down for them
+static void
+gt_macro_manager_install_accels (GtMacroManager *self,
+                                 GtMacro **macros,
+                                 guint n_macros,
+                                 gboolean install)
+{
+    for (guint i = 0; i < n_macros; i++) {
+        const char *shortcut = macros[i]->shortcut;
 
-    gtk_application_set_accels_for_action (self->app, action, shortcuts);
+        if (shortcut == NULL || *shortcut == '\0')
+            continue;
+
+        gt_macro_manager_set_accel (
+            self, macros[i], install ? shortcut : NULL);
+    }
+}
+
+static void
+gt_macro_manager_remove_accels (GtMacroManager *self)
+{
+    GHashTableIter iter;
+    gpointer macro;
+
+    g_hash_table_iter_init (&iter, self->index);
+    while (g_hash_table_iter_next (&iter, NULL, &macro))
+        gt_macro_manager_install_accels (
+            self, (GtMacro **)&macro, 1, FALSE);
+}
+
+static const char *
+gt_macro_manager_append (GtMacroManager *self, GtMacro *macro)
+{
+    macro->position = g_list_model_get_n_items (G_LIST_MODEL (self->model));
+    g_hash_table_insert (self->index, macro->id, macro);
+    g_list_store_append (self->model, macro);
+    gt_macro_manager_install_accels (self, &macro, 1, TRUE);
+    g_object_unref (macro);
 
     return macro->id;
 }
 
+const char *
+gt_macro_manager_add_empty (GtMacroManager *self)
+{
+    return gt_macro_manager_append (self, gt_macro_new (NULL, NULL, NULL));
+}
+
 const char *
 gt_macro_manager_add (GtMacroManager *self,
                       const char *shortcut,
                       const char *data,
                       const char *description)
 {
-    GtMacro *macro = g_object_new (GT_TYPE_MACRO, NULL);
-    macro->id = g_uuid_string_random ();
-    macro->shortcut = g_strdup (shortcut);
-    macro->description = g_strdup (description);
-    macro->action = g_strdup (data);
-    macro->data = gt_macro_parse_data (data);
-
-    g_list_store_append (self->model, macro);
-
-    g_autofree char *action = g_strconcat ("main.macro::", macro->id, NULL);
-    const char *shortcuts[] = {macro->shortcut, NULL};
-
-    gtk_application_set_accels_for_action (self->app, action, shortcuts);
-
-    return macro->id;
+    return gt_macro_manager_append (
+        self,
+        gt_macro_new (
+            g_strdup (shortcut), g_strdup (data), g_strdup (description)));
 }
 
 const char *
 gt_macro_manager_add_from_string (GtMacroManager *self,
                                   const char *macro_string)
 {
+    GtMacro *macro = gt_macro_new_from_string (macro_string);
 
-    char **parts = g_strsplit (macro_string, "::", 2);
-    if (g_strv_length (parts) != 2) {
-        g_warning ("Failed to parse macro \"%s\"", macro_string);
-        g_strfreev (parts);
+    if (macro == NULL)
+        return NULL;
+
+    return gt_macro_manager_append (self, macro);
+}
+
+// Macros that were never given both a shortcut and an action cannot have
+// come from a macro string, so they are never reused
+static char *
+gt_macro_manager_reuse_key (GtMacro *macro)
+{
+    if (macro->shortcut == NULL || macro->action == NULL)
         return NULL;
+
+    return gt_macro_to_string (macro);
+}
+
+/**
+ * gt_macro_manager_set_from_strings:
+ * @self: a #GtMacroManager
+ * @macros: (array zero-terminated=1): macros in "shortcut::data" form
+ *
+ * Replaces all macros at once, for loading a profile. The model changes in a
+ * single splice. Macros that are already present keep their object and their
+ * accelerator, so only added and dropped macros touch the application's
+ * accelerators. GTK has no call to set several actions' accelerators at once.
+ */
+void
+gt_macro_manager_set_from_strings (GtMacroManager *self,
+                                   const char *const *macros)
+{
+    g_autoptr (GPtrArray) items = g_ptr_array_new_with_free_func (g_object_unref);
+    g_autoptr (GPtrArray) added = g_ptr_array_new ();
+    g_autoptr (GHashTable) current =
+        g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    GHashTable *index = g_hash_table_new (g_str_hash, g_str_equal);
+    GHashTableIter iter;
+    gpointer value;
+
+    g_hash_table_iter_init (&iter, self->index);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        char *key = gt_macro_manager_reuse_key (value);
+
+        if (key != NULL)
+            g_hash_table_insert (current, key, value);
     }
 
-    GtMacro *macro = g_object_new (GT_TYPE_MACRO, NULL);
-    macro->id = g_uuid_string_random ();
+    for (guint i = 0; macros != NULL && macros[i] != NULL; i++) {
+        GtMacro *macro = g_hash_table_lookup (current, macros[i]);
 
-    macro->shortcut = parts[0];
-    macro->description = g_strdup ("");
-    macro->action = parts[1];
-    macro->data = gt_macro_parse_data (parts[1]);
+        if (macro != NULL) {
+            g_hash_table_remove (current, macros[i]);
+            g_object_ref (macro);
+        } else {
+            macro = gt_macro_new_from_string (macros[i]);
+            if (macro == NULL)
+                continue;
+            g_ptr_array_add (added, macro);
+        }
 
-    g_free (parts);
+        macro->position = items->len;
+        g_ptr_array_add (items, macro);
+        g_hash_table_insert (index, macro->id, macro);
+    }
 
-    g_list_store_append (self->model, macro);
+    g_hash_table_iter_init (&iter, self->index);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        GtMacro *macro = value;
 
-    g_autofree char *action = g_strconcat ("main.macro::", macro->id, NULL);
-    const char *shortcuts[] = {macro->shortcut, NULL};
+        if (!g_hash_table_contains (index, macro->id))
+            gt_macro_manager_install_accels (self, &macro, 1, FALSE);
+    }
 
-    gtk_application_set_accels_for_action (self->app, action, shortcuts);
+    g_hash_table_unref (self->index);
+    self->index = index;
 
-    return macro->id;
+    g_list_store_splice (self->model,
+                         0,
+                         g_list_model_get_n_items (G_LIST_MODEL (self->model)),
+                         items->pdata,
+                         items->len);
+    gt_macro_manager_install_accels (
+        self, (GtMacro **)added->pdata, added->len, TRUE);
 }
 
 void
 gt_macro_manager_remove (GtMacroManager *self, const char *id)
 {
-    guint position;
-    g_autoptr (GtMacro) macro = g_object_new (GT_TYPE_MACRO, NULL);
-    macro->id = id;
+    GtMacro *macro = g_hash_table_lookup (self->index, id);
+    guint n_items = g_list_model_get_n_items (G_LIST_MODEL (self->model));
 
-    if (g_list_store_find_with_equal_func (
-            self->model, macro, (GEqualFunc)gt_macro_has_id, &position)) {
-        g_list_store_remove (self->model, position);
-    }
+    if (macro == NULL)
+        return;
+
+    gt_macro_manager_install_accels (self, &macro, 1, FALSE);
+    g_hash_table_remove (self->index, id);
 
-    macro->id = NULL;
+    // Macros are only appended or spliced in whole, so removals can only have
+    // moved this one towards the front of its recorded position
+    for (guint i = MIN (macro->position + 1, n_items); i > 0; i--) {
+        g_autoptr (GtMacro) item =
+            g_list_model_get_item (G_LIST_MODEL (self->model), i - 1);
+
+        if (item == macro) {
+            g_list_store_remove (self->model, i - 1);
+            break;
+        }
+    }
 }
 
 void
 gt_macro_manager_clear (GtMacroManager *self)
 {
-    while (g_list_model_get_n_items (G_LIST_MODEL (self->model)) > 0) {
-        g_autoptr (GtMacro) macro =
-            g_list_model_get_item (G_LIST_MODEL (self->model), 0);
-        g_autofree char *action = g_strconcat ("main.macro::", macro->id, NULL);
-        const char *accels[] = {NULL};
-        gtk_application_set_accels_for_action(self->app, action, accels);
-        g_list_store_remove (self->model, 0);
-    }
+    gt_macro_manager_remove_accels (self);
+    g_hash_table_remove_all (self->index);
+    g_list_store_remove_all (self->model);
 }
 
 GtMacro *
 gt_macro_manager_get (GtMacroManager *self, const char *id)
 {
-    guint position;
-
-    g_print ("Trying to find macro with id %s\n", id);
-    g_autoptr (GtMacro) macro = g_object_new (GT_TYPE_MACRO, NULL);
-    macro->id = id;
-
-    if (g_list_store_find_with_equal_func (self->model,
-                                           macro,
-                                           (GEqualFunc)gt_macro_has_id,
-                                           &position)) {
-        macro->id = NULL;
-        return g_list_model_get_item (G_LIST_MODEL (self->model), position);
-    }
-
-    macro->id = NULL;
+    GtMacro *macro = g_hash_table_lookup (self->index, id);
 
-    return NULL;
+    return macro != NULL ? g_object_ref (macro) : NULL;
 }
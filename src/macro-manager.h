@@ -6,6 +6,9 @@
 #include <glib-object.h>
 #include <gio/gio.h>
 
+#include "macro-script.h"
+#include "macro-template.h"
+
 G_BEGIN_DECLS
 
 #define GT_TYPE_MACRO_MANAGER (gt_macro_manager_get_type ())
@@ -32,6 +35,15 @@ gt_macro_get_description (GtMacro *self);
 GBytes *
 gt_macro_get_bytes (GtMacro *self);
 
+GtMacroScript *
+gt_macro_get_script (GtMacro *self);
+
+GtMacroTemplate *
+gt_macro_get_template (GtMacro *self);
+
+GBytes *
+gt_macro_parse_data (const char *string);
+
 GtMacroManager *
 gt_macro_manager_get_default ();
 
@@ -54,6 +66,10 @@ gt_macro_manager_add (GtMacroManager *self,
 const char *
 gt_macro_manager_add_empty (GtMacroManager *manager);
 
+void
+gt_macro_manager_set_from_strings (GtMacroManager *self,
+                                   const char *const *macros);
+
 void
 gt_macro_manager_remove (GtMacroManager *self, const char *id);
 
@@ -0,0 +1,650 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Macro scripts, for command/response sequences like
+ *
+ *   script: repeat 100 { send "AT\r"; expect "OK" 500; delay 20 }
+ *
+ * The source is compiled once into a flat instruction list. Running it is
+ * event driven: every instruction that has to wait for the port, incoming
+ * data or time returns to the main loop, and the callback that ends the wait
+ * carries on right away. */
+
+#include "macro-script.h"
+#include "macro-manager.h"
+
+#include <glib/gi18n.h>
+
+#include <string.h>
+
+#define SCRIPT_EXPECT_TIMEOUT 1000
+
+// Received data kept around for expect, including data that came in before
+// the expect was reached
+#define SCRIPT_RX_LIMIT 4096
+
+typedef enum {
+    SCRIPT_OP_SEND,
+    SCRIPT_OP_EXPECT,
+    SCRIPT_OP_DELAY,
+    SCRIPT_OP_REPEAT,
+    SCRIPT_OP_NEXT
+} ScriptOp;
+
+typedef struct {
+    ScriptOp op;
+    // Timeout or delay in ms, repeat count, or the loop start for NEXT
+    guint value;
+    GBytes *bytes;
+    char *text;
+} ScriptInstruction;
+
+struct _GtMacroScript {
+    grefcount ref_count;
+    GArray *code;
+};
+
+static void
+script_instruction_clear (ScriptInstruction *instruction)
+{
+    g_clear_pointer (&instruction->bytes, g_bytes_unref);
+    g_clear_pointer (&instruction->text, g_free);
+}
+
+GtMacroScript *
+gt_macro_script_ref (GtMacroScript *self)
+{
+    g_ref_count_inc (&self->ref_count);
+
+    return self;
+}
+
+void
+gt_macro_script_unref (GtMacroScript *self)
+{
+    if (g_ref_count_dec (&self->ref_count)) {
+        g_array_unref (self->code);
+        g_free (self);
+    }
+}
+
+// compiler
+
+static void
+skip_blanks (const char **p)
+{
+    while (**p == ' ' || **p == '\t' || **p == '\r')
+        (*p)++;
+}
+
+static char *
+read_word (const char **p)
+{
+    const char *start = *p;
+
+    while (g_ascii_isalpha (**p))
+        (*p)++;
+
+    return g_strndup (start, *p - start);
+}
+
+static gboolean
+read_number (const char **p, guint *value)
+{
+    char *end = NULL;
+
+    skip_blanks (p);
+    if (!g_ascii_isdigit (**p))
+        return FALSE;
+
+    guint64 number = g_ascii_strtoull (*p, &end, 10);
+    if (number > G_MAXUINT)
+        return FALSE;
+
+    *value = (guint)number;
+    *p = end;
+
+    return TRUE;
+}
+
+// A double-quoted string with the usual macro escapes; \" is a quote
+static char *
+read_string (const char **p)
+{
+    skip_blanks (p);
+    if (**p != '"')
+        return NULL;
+
+    GString *text = g_string_new (NULL);
+
+    for ((*p)++; **p != '"'; (*p)++) {
+        if (**p == '\0' || **p == '\n') {
+            g_string_free (text, TRUE);
+
+            return NULL;
+        }
+
+        if (**p == '\\' && (*p)[1] == '"') {
+            g_string_append_c (text, '"');
+            (*p)++;
+        } else if (**p == '\\' && (*p)[1] == '\\') {
+            g_string_append (text, "\\\\");
+            (*p)++;
+        } else {
+            g_string_append_c (text, **p);
+        }
+    }
+    (*p)++;
+
+    return g_string_free (text, FALSE);
+}
+
+static gboolean
+compile_statement (const char **p, GArray *code, GArray *loops, GError **error)
+{
+    g_autofree char *word = read_word (p);
+    ScriptInstruction instruction = {0};
+
+    if (g_str_equal (word, "send") || g_str_equal (word, "expect")) {
+        instruction.op =
+            word[0] == 's' ? SCRIPT_OP_SEND : SCRIPT_OP_EXPECT;
+        instruction.text = read_string (p);
+        if (instruction.text == NULL) {
+            g_set_error (error,
+                         G_IO_ERROR,
+                         G_IO_ERROR_INVALID_ARGUMENT,
+                         _ ("Expected a quoted string after “%s”"),
+                         word);
+
+            return FALSE;
+        }
+        instruction.bytes = gt_macro_parse_data (instruction.text);
+
+        if (instruction.op == SCRIPT_OP_EXPECT) {
+            gsize length = g_bytes_get_size (instruction.bytes);
+            if (length == 0 || length > SCRIPT_RX_LIMIT) {
+                g_set_error (error,
+                             G_IO_ERROR,
+                             G_IO_ERROR_INVALID_ARGUMENT,
+                             _ ("Cannot expect “%s”"),
+                             instruction.text);
+                script_instruction_clear (&instruction);
+
+                return FALSE;
+            }
+
+            if (!read_number (p, &instruction.value))
+                instruction.value = SCRIPT_EXPECT_TIMEOUT;
+        }
+    } else if (g_str_equal (word, "delay")) {
+        instruction.op = SCRIPT_OP_DELAY;
+        if (!read_number (p, &instruction.value)) {
+            g_set_error_literal (error,
+                                 G_IO_ERROR,
+                                 G_IO_ERROR_INVALID_ARGUMENT,
+                                 _ ("Expected milliseconds after “delay”"));
+
+            return FALSE;
+        }
+    } else if (g_str_equal (word, "repeat")) {
+        instruction.op = SCRIPT_OP_REPEAT;
+        if (!read_number (p, &instruction.value) || instruction.value == 0) {
+            g_set_error_literal (error,
+                                 G_IO_ERROR,
+                                 G_IO_ERROR_INVALID_ARGUMENT,
+                                 _ ("Expected a count after “repeat”"));
+
+            return FALSE;
+        }
+
+        skip_blanks (p);
+        if (**p != '{') {
+            g_set_error_literal (error,
+                                 G_IO_ERROR,
+                                 G_IO_ERROR_INVALID_ARGUMENT,
+                                 _ ("Expected “{” after the repeat count"));
+
+            return FALSE;
+        }
+        (*p)++;
+
+        g_array_append_val (loops, code->len);
+    } else {
+        g_set_error (error,
+                     G_IO_ERROR,
+                     G_IO_ERROR_INVALID_ARGUMENT,
+                     _ ("Unknown macro script command “%s”"),
+                     word);
+
+        return FALSE;
+    }
+
+    g_array_append_val (code, instruction);
+
+    return TRUE;
+}
+
+static gboolean
+compile_loop_end (GArray *code, GArray *loops, GError **error)
+{
+    if (loops->len == 0) {
+        g_set_error_literal (error,
+                             G_IO_ERROR,
+                             G_IO_ERROR_INVALID_ARGUMENT,
+                             _ ("Unexpected “}”"));
+
+        return FALSE;
+    }
+
+    guint start = g_array_index (loops, guint, loops->len - 1);
+    g_array_set_size (loops, loops->len - 1);
+
+    // Every run through the body has to wait for something at least once,
+    // otherwise the loop would hold up the main loop
+    if (code->len == start + 1) {
+        g_set_error_literal (error,
+                             G_IO_ERROR,
+                             G_IO_ERROR_INVALID_ARGUMENT,
+                             _ ("Empty repeat block"));
+
+        return FALSE;
+    }
+
+    ScriptInstruction instruction = {SCRIPT_OP_NEXT, start + 1, NULL, NULL};
+    g_array_append_val (code, instruction);
+
+    return TRUE;
+}
+
+/**
+ * gt_macro_script_compile:
+ * @source: the script, without %GT_MACRO_SCRIPT_PREFIX
+ * @error: return location for a #GError
+ *
+ * Statements are separated by newlines or semicolons:
+ *
+ * - `send "text"` sends text, with the same escapes as plain macros
+ * - `expect "text" [ms]` waits up to ms, 1000 by default, until text was
+ *   received
+ * - `delay ms` pauses
+ * - `repeat n { ... }` runs the statements in the block n times
+ *
+ * Returns: (transfer full) (nullable): the compiled script
+ */
+GtMacroScript *
+gt_macro_script_compile (const char *source, GError **error)
+{
+    g_autoptr (GArray) code =
+        g_array_new (FALSE, TRUE, sizeof (ScriptInstruction));
+    g_autoptr (GArray) loops = g_array_new (FALSE, FALSE, sizeof (guint));
+    const char *p = source;
+
+    g_array_set_clear_func (code, (GDestroyNotify)script_instruction_clear);
+
+    while (TRUE) {
+        while (g_ascii_isspace (*p) || *p == ';')
+            p++;
+
+        if (*p == '\0')
+            break;
+
+        guint open_loops = loops->len;
+
+        if (*p == '}') {
+            p++;
+            if (!compile_loop_end (code, loops, error))
+                return NULL;
+        } else if (!compile_statement (&p, code, loops, error)) {
+            return NULL;
+        }
+
+        // The "{" of a repeat already ends the statement
+        if (loops->len > open_loops)
+            continue;
+
+        skip_blanks (&p);
+        if (*p != '\0' && *p != ';' && *p != '\n' && *p != '}') {
+            g_set_error (error,
+                         G_IO_ERROR,
+                         G_IO_ERROR_INVALID_ARGUMENT,
+                         _ ("Unexpected “%c” in macro script"),
+                         *p);
+
+            return NULL;
+        }
+    }
+
+    if (loops->len > 0) {
+        g_set_error_literal (error,
+                             G_IO_ERROR,
+                             G_IO_ERROR_INVALID_ARGUMENT,
+                             _ ("Missing “}”"));
+
+        return NULL;
+    }
+
+    GtMacroScript *self = g_new0 (GtMacroScript, 1);
+    g_ref_count_init (&self->ref_count);
+    self->code = g_steal_pointer (&code);
+
+    return self;
+}
+
+// interpreter
+
+typedef struct {
+    GtMacroScript *script;
+    GtSerialPort *port;
+    guint pc;
+    // Remaining runs of the enclosing repeat blocks, innermost last
+    GArray *loops;
+
+    GByteArray *rx;
+    gsize scanned;
+    gboolean expecting;
+
+    gulong data_handler;
+    GSource *wait;
+    GSource *cancel_source;
+    gboolean done;
+} ScriptRun;
+
+static void
+script_run_clear_sources (ScriptRun *run)
+{
+    g_clear_signal_handler (&run->data_handler, run->port);
+
+    if (run->wait != NULL) {
+        g_source_destroy (run->wait);
+        g_clear_pointer (&run->wait, g_source_unref);
+    }
+
+    if (run->cancel_source != NULL) {
+        g_source_destroy (run->cancel_source);
+        g_clear_pointer (&run->cancel_source, g_source_unref);
+    }
+}
+
+static void
+script_run_free (ScriptRun *run)
+{
+    script_run_clear_sources (run);
+    g_array_unref (run->loops);
+    g_byte_array_unref (run->rx);
+    g_object_unref (run->port);
+    gt_macro_script_unref (run->script);
+    g_free (run);
+}
+
+static void
+script_run_complete (GTask *task, GError *error)
+{
+    ScriptRun *run = g_task_get_task_data (task);
+
+    run->done = TRUE;
+    script_run_clear_sources (run);
+
+    if (error != NULL)
+        g_task_return_error (task, error);
+    else
+        g_task_return_boolean (task, TRUE);
+
+    g_object_unref (task);
+}
+
+static void
+script_run_wait (GTask *task, guint ms, GSourceFunc callback)
+{
+    ScriptRun *run = g_task_get_task_data (task);
+
+    run->wait = g_timeout_source_new (ms);
+    g_source_set_callback (run->wait, callback, task, NULL);
+    g_source_attach (run->wait, g_task_get_context (task));
+}
+
+// Look for @pattern in what was received, only scanning new data
+static gboolean
+script_run_match (ScriptRun *run, GBytes *pattern)
+{
+    gsize length = 0;
+    const guint8 *needle = g_bytes_get_data (pattern, &length);
+    const guint8 *data = run->rx->data;
+    const guint8 *end = data + run->rx->len;
+    const guint8 *p =
+        data + (run->scanned >= length ? run->scanned - length + 1 : 0);
+
+    while ((gsize)(end - p) >= length) {
+        p = memchr (p, needle[0], end - p - length + 1);
+        if (p == NULL)
+            break;
+
+        if (memcmp (p, needle, length) == 0) {
+            g_byte_array_remove_range (run->rx, 0, p - data + length);
+            run->scanned = 0;
+
+            return TRUE;
+        }
+
+        p++;
+    }
+
+    run->scanned = run->rx->len;
+
+    return FALSE;
+}
+
+static void
+on_send_done (GObject *source, GAsyncResult *res, gpointer user_data);
+
+static gboolean
+on_delay_done (gpointer user_data);
+
+static gboolean
+on_expect_timeout (gpointer user_data);
+
+static void
+script_run_continue (GTask *task)
+{
+    ScriptRun *run = g_task_get_task_data (task);
+    GArray *code = run->script->code;
+
+    while (run->pc < code->len) {
+        ScriptInstruction *instruction =
+            &g_array_index (code, ScriptInstruction, run->pc);
+
+        switch (instruction->op) {
+        case SCRIPT_OP_SEND:
+            run->pc++;
+            gt_serial_port_write_bytes_async (run->port,
+                                              instruction->bytes,
+                                              g_task_get_cancellable (task),
+                                              on_send_done,
+                                              g_object_ref (task));
+            return;
+        case SCRIPT_OP_EXPECT:
+            if (script_run_match (run, instruction->bytes)) {
+                run->pc++;
+                break;
+            }
+
+            run->expecting = TRUE;
+            script_run_wait (task, instruction->value, on_expect_timeout);
+            return;
+        case SCRIPT_OP_DELAY:
+            run->pc++;
+            script_run_wait (task, instruction->value, on_delay_done);
+            return;
+        case SCRIPT_OP_REPEAT:
+            g_array_append_val (run->loops, instruction->value);
+            run->pc++;
+            break;
+        case SCRIPT_OP_NEXT: {
+            guint *remaining =
+                &g_array_index (run->loops, guint, run->loops->len - 1);
+
+            if (--(*remaining) > 0) {
+                run->pc = instruction->value;
+            } else {
+                g_array_set_size (run->loops, run->loops->len - 1);
+                run->pc++;
+            }
+        } break;
+        }
+    }
+
+    script_run_complete (task, NULL);
+}
+
+static void
+on_send_done (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+    GTask *task = G_TASK (user_data);
+    ScriptRun *run = g_task_get_task_data (task);
+    GError *error = NULL;
+
+    gt_serial_port_write_bytes_finish (GT_SERIAL_PORT (source), res, &error);
+
+    if (run->done)
+        g_clear_error (&error);
+    else if (error != NULL)
+        script_run_complete (task, error);
+    else
+        script_run_continue (task);
+
+    g_object_unref (task);
+}
+
+static gboolean
+on_delay_done (gpointer user_data)
+{
+    GTask *task = G_TASK (user_data);
+    ScriptRun *run = g_task_get_task_data (task);
+
+    g_clear_pointer (&run->wait, g_source_unref);
+    script_run_continue (task);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+on_expect_timeout (gpointer user_data)
+{
+    GTask *task = G_TASK (user_data);
+    ScriptRun *run = g_task_get_task_data (task);
+    ScriptInstruction *instruction =
+        &g_array_index (run->script->code, ScriptInstruction, run->pc);
+
+    g_clear_pointer (&run->wait, g_source_unref);
+    script_run_complete (task,
+                         g_error_new (G_IO_ERROR,
+                                      G_IO_ERROR_TIMED_OUT,
+                                      _ ("Timed out waiting for “%s”"),
+                                      instruction->text));
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+on_data_available (GtSerialPort *port, GBytes *data, gpointer user_data)
+{
+    GTask *task = G_TASK (user_data);
+    ScriptRun *run = g_task_get_task_data (task);
+    gsize size = 0;
+    const guint8 *bytes = g_bytes_get_data (data, &size);
+
+    g_byte_array_append (run->rx, bytes, size);
+    if (run->rx->len > SCRIPT_RX_LIMIT) {
+        guint excess = run->rx->len - SCRIPT_RX_LIMIT;
+
+        g_byte_array_remove_range (run->rx, 0, excess);
+        run->scanned -= MIN (run->scanned, excess);
+    }
+
+    if (!run->expecting)
+        return;
+
+    ScriptInstruction *instruction =
+        &g_array_index (run->script->code, ScriptInstruction, run->pc);
+    if (!script_run_match (run, instruction->bytes))
+        return;
+
+    run->expecting = FALSE;
+    run->pc++;
+    g_source_destroy (run->wait);
+    g_clear_pointer (&run->wait, g_source_unref);
+    script_run_continue (task);
+}
+
+static gboolean
+on_cancelled (GCancellable *cancellable, gpointer user_data)
+{
+    GError *error = NULL;
+
+    g_cancellable_set_error_if_cancelled (cancellable, &error);
+    script_run_complete (G_TASK (user_data), error);
+
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * gt_macro_script_run_async:
+ * @self: a compiled #GtMacroScript
+ * @port: the port to talk to
+ * @cancellable: (nullable): a #GCancellable to stop the script
+ * @callback: called when the script has ended
+ * @user_data: data for @callback
+ *
+ * Runs the script on the thread-default main context. It fails on the first
+ * expect that times out or on a write error.
+ */
+void
+gt_macro_script_run_async (GtMacroScript *self,
+                           GtSerialPort *port,
+                           GCancellable *cancellable,
+                           GAsyncReadyCallback callback,
+                           gpointer user_data)
+{
+    GTask *task = g_task_new (NULL, cancellable, callback, user_data);
+    g_task_set_source_tag (task, gt_macro_script_run_async);
+
+    ScriptRun *run = g_new0 (ScriptRun, 1);
+    run->script = gt_macro_script_ref (self);
+    run->port = g_object_ref (port);
+    run->loops = g_array_new (FALSE, FALSE, sizeof (guint));
+    run->rx = g_byte_array_new ();
+    g_task_set_task_data (task, run, (GDestroyNotify)script_run_free);
+
+    run->data_handler = g_signal_connect (
+        port, "data-available", G_CALLBACK (on_data_available), task);
+
+    if (cancellable != NULL) {
+        run->cancel_source = g_cancellable_source_new (cancellable);
+        g_source_set_callback (
+            run->cancel_source, G_SOURCE_FUNC (on_cancelled), task, NULL);
+        g_source_attach (run->cancel_source, g_task_get_context (task));
+    }
+
+    script_run_continue (task);
+}
+
+gboolean
+gt_macro_script_run_finish (GAsyncResult *result, GError **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+
+    return g_task_propagate_boolean (G_TASK (result), error);
+}
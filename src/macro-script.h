@@ -0,0 +1,52 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "serial-port.h"
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* Macro actions starting with this are scripts rather than plain data */
+#define GT_MACRO_SCRIPT_PREFIX "script:"
+
+typedef struct _GtMacroScript GtMacroScript;
+
+GtMacroScript *
+gt_macro_script_compile (const char *source, GError **error);
+
+GtMacroScript *
+gt_macro_script_ref (GtMacroScript *self);
+
+void
+gt_macro_script_unref (GtMacroScript *self);
+
+void
+gt_macro_script_run_async (GtMacroScript *self,
+                           GtSerialPort *port,
+                           GCancellable *cancellable,
+                           GAsyncReadyCallback callback,
+                           gpointer user_data);
+
+gboolean
+gt_macro_script_run_finish (GAsyncResult *result, GError **error);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GtMacroScript, gt_macro_script_unref)
+
+G_END_DECLS
@@ -0,0 +1,428 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Macro templates, for binary frames that change from one send to the next:
+ *
+ *   \02${begin}${seq:2}\10\00${input:Register}${crc16-modbus}\03
+ *
+ * Placeholders are
+ *
+ *   ${seq[:width[:le|be]]}  a counter of 1, 2 or 4 bytes, bumped on every send
+ *   ${input[:prompt]}       data asked for when the macro is fired
+ *   ${begin}                where the next checksum starts, default is the
+ *                           start of the macro
+ *   ${crc16-modbus[:le|be]} CRC-16/Modbus, low byte first by default
+ *   ${crc-ccitt[:le|be]}    CRC-16/CCITT-FALSE, high byte first by default
+ *   ${xor}, ${sum}          8 bit XOR and sum of the bytes
+ *
+ * The template is compiled once into a byte image with room for the counters
+ * and checksums plus a list of fields to patch in. Checksums over fixed bytes
+ * are worked out up front, either completely or up to the first field that
+ * changes, so rendering only runs the CRC over the bytes that differ. */
+
+#include "macro-template.h"
+#include "macro-manager.h"
+#include "crc.h"
+
+#include <glib/gi18n.h>
+
+#include <string.h>
+
+typedef enum {
+    FIELD_INPUT,
+    FIELD_COUNTER,
+    FIELD_BEGIN,
+    FIELD_CRC16_MODBUS,
+    FIELD_CRC_CCITT,
+    FIELD_XOR,
+    FIELD_SUM
+} FieldKind;
+
+typedef struct {
+    FieldKind kind;
+    // Where the field goes in the image and how many bytes it takes there;
+    // inputs and ranges take none
+    gsize offset;
+    guint width;
+    gboolean little_endian;
+    // Counter value or index of the prompt for inputs
+    guint32 value;
+    // Checksums: the field whose bytes the precomputed state runs up to
+    guint resume;
+    guint32 state;
+} TemplateField;
+
+struct _GtMacroTemplate {
+    grefcount ref_count;
+    GBytes *image;
+    GArray *fields;
+    GPtrArray *prompts;
+};
+
+GtMacroTemplate *
+gt_macro_template_ref (GtMacroTemplate *self)
+{
+    g_ref_count_inc (&self->ref_count);
+
+    return self;
+}
+
+void
+gt_macro_template_unref (GtMacroTemplate *self)
+{
+    if (g_ref_count_dec (&self->ref_count)) {
+        g_clear_pointer (&self->image, g_bytes_unref);
+        g_array_unref (self->fields);
+        g_ptr_array_unref (self->prompts);
+        g_free (self);
+    }
+}
+
+static gboolean
+field_is_checksum (FieldKind kind)
+{
+    return kind >= FIELD_CRC16_MODBUS;
+}
+
+static guint32
+checksum_init (FieldKind kind)
+{
+    switch (kind) {
+    case FIELD_CRC16_MODBUS:
+        return GT_CRC16_MODBUS_INIT;
+    case FIELD_CRC_CCITT:
+        return 0xffff;
+    default:
+        return 0;
+    }
+}
+
+static guint32
+checksum_update (FieldKind kind,
+                 guint32 state,
+                 const guint8 *data,
+                 gsize length)
+{
+    switch (kind) {
+    case FIELD_CRC16_MODBUS:
+        return gt_crc16_modbus_update ((guint16)state, data, length);
+    case FIELD_CRC_CCITT:
+        return gt_crc16_update ((guint16)state, data, length);
+    case FIELD_XOR:
+        while (length-- > 0)
+            state ^= *data++;
+        return state;
+    case FIELD_SUM:
+        while (length-- > 0)
+            state += *data++;
+        return state & 0xff;
+    default:
+        g_assert_not_reached ();
+    }
+}
+
+static void
+put_number (guint8 *dest, guint32 value, guint width, gboolean little_endian)
+{
+    for (guint i = 0; i < width; i++) {
+        guint shift = little_endian ? i : width - 1 - i;
+        dest[i] = (value >> (8 * shift)) & 0xff;
+    }
+}
+
+gboolean
+gt_macro_template_detect (const char *source)
+{
+    return strstr (source, "${") != NULL;
+}
+
+// compiler
+
+static gboolean
+parse_byte_order (const char *spec, gboolean *little_endian)
+{
+    if (spec == NULL)
+        return TRUE;
+
+    if (g_str_equal (spec, "le"))
+        *little_endian = TRUE;
+    else if (g_str_equal (spec, "be"))
+        *little_endian = FALSE;
+    else
+        return FALSE;
+
+    return TRUE;
+}
+
+static gboolean
+compile_field (GtMacroTemplate *self,
+               GByteArray *image,
+               const char *spec,
+               GError **error)
+{
+    TemplateField field = {0};
+    g_auto (GStrv) parts = NULL;
+
+    field.offset = image->len;
+
+    if (g_str_equal (spec, "input") || g_str_has_prefix (spec, "input:")) {
+        field.kind = FIELD_INPUT;
+        field.value = self->prompts->len;
+        g_ptr_array_add (self->prompts,
+                         g_strdup (spec[5] == ':' && spec[6] != '\0'
+                                       ? spec + 6
+                                       : _ ("Input")));
+        g_array_append_val (self->fields, field);
+
+        return TRUE;
+    }
+
+    parts = g_strsplit (spec, ":", 3);
+
+    if (g_str_equal (parts[0], "begin") && parts[1] == NULL) {
+        field.kind = FIELD_BEGIN;
+        g_array_append_val (self->fields, field);
+
+        return TRUE;
+    }
+
+    if (g_str_equal (parts[0], "seq")) {
+        field.kind = FIELD_COUNTER;
+        field.width = 1;
+        if (parts[1] != NULL) {
+            field.width = (guint)g_ascii_strtoull (parts[1], NULL, 10);
+            if (field.width != 1 && field.width != 2 && field.width != 4)
+                goto invalid;
+        }
+        if (parts[1] != NULL &&
+            !parse_byte_order (parts[2], &field.little_endian))
+            goto invalid;
+    } else {
+        if (g_str_equal (parts[0], "crc16-modbus")) {
+            field.kind = FIELD_CRC16_MODBUS;
+            field.width = 2;
+            field.little_endian = TRUE;
+        } else if (g_str_equal (parts[0], "crc-ccitt")) {
+            field.kind = FIELD_CRC_CCITT;
+            field.width = 2;
+        } else if (g_str_equal (parts[0], "xor")) {
+            field.kind = FIELD_XOR;
+            field.width = 1;
+        } else if (g_str_equal (parts[0], "sum")) {
+            field.kind = FIELD_SUM;
+            field.width = 1;
+        } else {
+            g_set_error (error,
+                         G_IO_ERROR,
+                         G_IO_ERROR_INVALID_ARGUMENT,
+                         _ ("Unknown macro placeholder “%s”"),
+                         parts[0]);
+
+            return FALSE;
+        }
+
+        if ((parts[1] != NULL && parts[2] != NULL) ||
+            !parse_byte_order (parts[1], &field.little_endian))
+            goto invalid;
+
+        // Find where the range starts and the first field in it that changes
+        // from one render to the next
+        gsize start = 0;
+        guint i;
+
+        field.resume = self->fields->len;
+        for (i = self->fields->len; i > 0; i--) {
+            TemplateField *other =
+                &g_array_index (self->fields, TemplateField, i - 1);
+
+            if (other->kind == FIELD_BEGIN) {
+                start = other->offset;
+                break;
+            }
+            field.resume = i - 1;
+        }
+
+        gsize end = field.resume < self->fields->len
+                        ? g_array_index (
+                              self->fields, TemplateField, field.resume)
+                              .offset
+                        : image->len;
+
+        field.state = checksum_update (field.kind,
+                                       checksum_init (field.kind),
+                                       image->data + start,
+                                       end - start);
+
+        // Nothing in the range changes, so neither does the checksum
+        if (field.resume == self->fields->len) {
+            guint8 buffer[2];
+
+            put_number (
+                buffer, field.state, field.width, field.little_endian);
+            g_byte_array_append (image, buffer, field.width);
+
+            return TRUE;
+        }
+    }
+
+    g_array_append_val (self->fields, field);
+    g_byte_array_set_size (image, image->len + field.width);
+    memset (image->data + field.offset, 0, field.width);
+
+    return TRUE;
+
+invalid:
+    g_set_error (error,
+                 G_IO_ERROR,
+                 G_IO_ERROR_INVALID_ARGUMENT,
+                 _ ("Invalid macro placeholder “%s”"),
+                 spec);
+
+    return FALSE;
+}
+
+static void
+append_literal (GByteArray *image, const char *text, gsize length)
+{
+    g_autofree char *literal = g_strndup (text, length);
+    g_autoptr (GBytes) bytes = gt_macro_parse_data (literal);
+    gsize size;
+    const guint8 *data = g_bytes_get_data (bytes, &size);
+
+    g_byte_array_append (image, data, size);
+}
+
+GtMacroTemplate *
+gt_macro_template_compile (const char *source, GError **error)
+{
+    g_autoptr (GtMacroTemplate) self = g_new0 (GtMacroTemplate, 1);
+    GByteArray *image = g_byte_array_new ();
+    const char *p = source;
+
+    g_ref_count_init (&self->ref_count);
+    self->fields = g_array_new (FALSE, FALSE, sizeof (TemplateField));
+    self->prompts = g_ptr_array_new_with_free_func (g_free);
+
+    while (*p != '\0') {
+        const char *open = strstr (p, "${");
+
+        if (open == NULL) {
+            append_literal (image, p, strlen (p));
+            break;
+        }
+
+        append_literal (image, p, open - p);
+
+        const char *close = strchr (open + 2, '}');
+        if (close == NULL) {
+            g_set_error_literal (error,
+                                 G_IO_ERROR,
+                                 G_IO_ERROR_INVALID_ARGUMENT,
+                                 _ ("Missing “}” after “${”"));
+            g_byte_array_unref (image);
+
+            return NULL;
+        }
+
+        g_autofree char *spec = g_strndup (open + 2, close - open - 2);
+        if (!compile_field (self, image, spec, error)) {
+            g_byte_array_unref (image);
+
+            return NULL;
+        }
+
+        p = close + 1;
+    }
+
+    self->image = g_byte_array_free_to_bytes (image);
+
+    return g_steal_pointer (&self);
+}
+
+// renderer
+
+guint
+gt_macro_template_get_n_inputs (GtMacroTemplate *self)
+{
+    return self->prompts->len;
+}
+
+const char *
+gt_macro_template_get_input_prompt (GtMacroTemplate *self, guint index)
+{
+    g_return_val_if_fail (index < self->prompts->len, NULL);
+
+    return g_ptr_array_index (self->prompts, index);
+}
+
+// Inputs take the usual macro escapes. Every call bumps the counters.
+GBytes *
+gt_macro_template_render (GtMacroTemplate *self, const char *const *inputs)
+{
+    gsize size;
+    const guint8 *image = g_bytes_get_data (self->image, &size);
+    g_autofree gsize *positions = g_new (gsize, self->fields->len);
+    GByteArray *out = g_byte_array_sized_new (size);
+    gsize copied = 0;
+    guint i;
+
+    g_return_val_if_fail (self->prompts->len == 0 || inputs != NULL, NULL);
+
+    for (i = 0; i < self->fields->len; i++) {
+        TemplateField *field = &g_array_index (self->fields, TemplateField, i);
+
+        g_byte_array_append (out, image + copied, field->offset - copied);
+        copied = field->offset;
+        positions[i] = out->len;
+
+        if (field->kind == FIELD_INPUT) {
+            g_autoptr (GBytes) bytes =
+                gt_macro_parse_data (inputs[field->value]);
+            gsize length;
+            const guint8 *data = g_bytes_get_data (bytes, &length);
+
+            g_byte_array_append (out, data, length);
+
+            continue;
+        }
+
+        if (field->kind == FIELD_BEGIN)
+            continue;
+
+        guint32 value;
+
+        if (field_is_checksum (field->kind)) {
+            gsize from = positions[field->resume];
+
+            value = checksum_update (
+                field->kind, field->state, out->data + from, out->len - from);
+        } else {
+            value = field->value++;
+        }
+
+        g_byte_array_set_size (out, out->len + field->width);
+        put_number (out->data + positions[i],
+                    value,
+                    field->width,
+                    field->little_endian);
+        copied += field->width;
+    }
+
+    g_byte_array_append (out, image + copied, size - copied);
+
+    return g_byte_array_free_to_bytes (out);
+}
@@ -0,0 +1,49 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GtMacroTemplate GtMacroTemplate;
+
+gboolean
+gt_macro_template_detect (const char *source);
+
+GtMacroTemplate *
+gt_macro_template_compile (const char *source, GError **error);
+
+GtMacroTemplate *
+gt_macro_template_ref (GtMacroTemplate *self);
+
+void
+gt_macro_template_unref (GtMacroTemplate *self);
+
+guint
+gt_macro_template_get_n_inputs (GtMacroTemplate *self);
+
+const char *
+gt_macro_template_get_input_prompt (GtMacroTemplate *self, guint index);
+
+GBytes *
+gt_macro_template_render (GtMacroTemplate *self, const char *const *inputs);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GtMacroTemplate, gt_macro_template_unref)
+
+G_END_DECLS
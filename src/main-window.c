@@ -27,6 +27,13 @@
 #include "term_config.h"
 #include "view-config.h"
 #include "macro-manager.h"
+#include "file-receive.h"
+#include "modem-transfer.h"
+#include "transfer-queue.h"
+#include "bert.h"
+#include "periodic-sender.h"
+#include "hex-parser.h"
+#include "sellerie-enums.h"
 
 #include <stdlib.h>
 
@@ -43,6 +50,13 @@
 
 extern GtSerialPortConfiguration config;
 
+#define LOG_ROTATE_SIZE (100 * 1000 * 1000)
+
+// Terminal input longer than this is a paste and goes out as a transfer
+#define PASTE_DIRECT_MAX 64
+// Pastes from this size on show their progress
+#define PASTE_PROGRESS_MIN 4096
+
 G_DEFINE_TYPE (GtMainWindow, gt_main_window, GTK_TYPE_APPLICATION_WINDOW)
 
 enum { PROP_0, N_PROPS };
@@ -90,12 +104,16 @@ on_send_hexadecimal (GtkWidget *widget, gpointer pointer);
 
 static void
 on_vte_commit (VteTerminal *widget, gchar *text, guint length, gpointer ptr);
+static void
+gt_main_window_start_paste (GtMainWindow *self);
 
 static void
-on_display_updated (GtMainWindow *self,
-                    gchar *text,
-                    guint length,
-                    gpointer user_data);
+on_logging_error (GtMainWindow *self, GError *error, gpointer user_data);
+
+static void
+on_logging_backpressure (GtMainWindow *self,
+                         GParamSpec *pspec,
+                         gpointer user_data);
 
 static void
 on_action_about (GSimpleAction *action,
@@ -198,6 +216,26 @@ static void
 on_save_raw_file (GSimpleAction *action,
                   GVariant *parameter,
                   gpointer user_data);
+static void
+on_receive_file (GSimpleAction *action,
+                 GVariant *parameter,
+                 gpointer user_data);
+static void
+on_send_modem (GSimpleAction *action,
+               GVariant *parameter,
+               gpointer user_data);
+static void
+on_receive_modem (GSimpleAction *action,
+                  GVariant *parameter,
+                  gpointer user_data);
+static void
+on_bert (GSimpleAction *action, GVariant *parameter, gpointer user_data);
+static void
+on_replay (GSimpleAction *action, GVariant *parameter, gpointer user_data);
+static void
+on_replay_stop (GSimpleAction *action,
+                GVariant *parameter,
+                gpointer user_data);
 
 static void
 on_config_terminal (GSimpleAction *action,
@@ -208,6 +246,10 @@ on_config_macros (GSimpleAction *action,
                   GVariant *parameter,
                   gpointer user_data);
 static void
+on_periodic_macro (GSimpleAction *action,
+                   GVariant *parameter,
+                   gpointer user_data);
+static void
 on_config_profile_select (GSimpleAction *action,
                           GVariant *parameter,
                           gpointer user_data);
@@ -225,6 +267,12 @@ static const GActionEntry actions[] = {
     {"clear", on_clear_buffer},
     {"send-file", on_send_raw_file},
     {"save-file", on_save_raw_file},
+    {"receive-file", on_receive_file},
+    {"send-modem", on_send_modem, "s"},
+    {"receive-modem", on_receive_modem, "s"},
+    {"bert", on_bert, "s"},
+    {"replay", on_replay},
+    {"replay-stop", on_replay_stop},
     {"quit", on_quit},
 
     /* Edit menu */
@@ -269,6 +317,7 @@ static const GActionEntry actions[] = {
     {"config.terminal", on_config_terminal},
 
     {"config.macros", on_config_macros},
+    {"periodic-macro", on_periodic_macro},
 
     {"config.profile.select", on_config_profile_select},
     {"config.profile.save", on_config_profile_save},
@@ -296,6 +345,18 @@ gt_main_window_dispose (GObject *object)
     g_clear_object (&self->logger);
     g_clear_object (&self->shortcuts);
 
+    if (self->replay != NULL) {
+        g_signal_handlers_disconnect_by_data (self->replay, self);
+        g_cancellable_cancel (self->replay_cancellable);
+    }
+
+    if (self->script_cancellable != NULL)
+        g_cancellable_cancel (self->script_cancellable);
+
+    if (self->paste_cancellable != NULL)
+        g_cancellable_cancel (self->paste_cancellable);
+    g_queue_clear_full (&self->paste_queue, (GDestroyNotify)g_bytes_unref);
+
     G_OBJECT_CLASS (gt_main_window_parent_class)->dispose (object);
 }
 
@@ -373,7 +434,16 @@ gt_main_window_init (GtMainWindow *self)
 
     self->buffer = gt_buffer_new ();
     self->serial_port = gt_serial_port_new ();
-    self->logger = gt_logging_new ();
+    g_queue_init (&self->paste_queue);
+    self->logger = gt_logging_new (self->buffer);
+    g_signal_connect_swapped (G_OBJECT (self->logger),
+                              "error",
+                              G_CALLBACK (on_logging_error),
+                              self);
+    g_signal_connect_swapped (G_OBJECT (self->logger),
+                              "notify::backpressure",
+                              G_CALLBACK (on_logging_backpressure),
+                              self);
 
     self->group = G_ACTION_GROUP (g_simple_action_group_new ());
     g_action_map_add_action_entries (
@@ -402,10 +472,6 @@ gt_main_window_init (GtMainWindow *self)
 
     g_signal_connect_after (
         G_OBJECT (self->display), "commit", G_CALLBACK (on_vte_commit), self);
-    g_signal_connect_swapped (G_OBJECT (self->display),
-                              "updated",
-                              G_CALLBACK (on_display_updated),
-                              self);
 
     gtk_scrolled_window_set_vadjustment (
         GTK_SCROLLED_WINDOW (self->scrolled_window),
@@ -464,12 +530,6 @@ gt_main_window_init (GtMainWindow *self)
     gtk_widget_add_controller (GTK_WIDGET (self->display),
                                GTK_EVENT_CONTROLLER (click));
 
-    self->popup_menu = gtk_popover_menu_new_from_model (self->popup_menu_model);
-    gtk_widget_set_parent (self->popup_menu, GTK_WIDGET (self));
-    gtk_popover_set_position (GTK_POPOVER (self->popup_menu), GTK_POS_BOTTOM);
-    gtk_popover_set_has_arrow (GTK_POPOVER (self->popup_menu), FALSE);
-    gtk_widget_set_halign (self->popup_menu, GTK_ALIGN_START);
-
     g_signal_connect (click, "pressed", G_CALLBACK (on_vte_button_press_callback), self);
 
     g_signal_connect (G_OBJECT (self->display),
@@ -511,6 +571,11 @@ gt_main_window_init (GtMainWindow *self)
     gtk_shortcut_controller_set_scope (
         GTK_SHORTCUT_CONTROLLER (self->shortcuts), GTK_SHORTCUT_SCOPE_GLOBAL);
 
+    g_simple_action_set_enabled (
+        G_SIMPLE_ACTION (
+            g_action_map_lookup_action (G_ACTION_MAP (self->group), "replay-stop")),
+        FALSE);
+
     gt_main_window_set_view (self, GT_MAIN_WINDOW_VIEW_TYPE_ASCII);
 }
 
@@ -579,6 +644,49 @@ gt_main_window_get_info_bar (GtMainWindow *self)
     return gtk_revealer_get_child (GTK_REVEALER (self->revealer));
 }
 
+typedef struct {
+    GtMainWindow *window;
+    GtkWidget *widget;
+} LingerData;
+
+static void
+linger_data_free (gpointer data)
+{
+    LingerData *linger = data;
+
+    g_object_unref (linger->window);
+    g_object_unref (linger->widget);
+    g_free (linger);
+}
+
+static gboolean
+on_info_bar_linger_timeout (gpointer user_data)
+{
+    LingerData *linger = user_data;
+
+    // Something else might have taken the place in the meantime
+    if (gt_main_window_get_info_bar (linger->window) == linger->widget)
+        gt_main_window_remove_info_bar (linger->window, linger->widget);
+
+    return G_SOURCE_REMOVE;
+}
+
+void
+gt_main_window_linger_info_bar (GtMainWindow *self,
+                                GtkWidget *widget,
+                                guint seconds)
+{
+    LingerData *linger = g_new0 (LingerData, 1);
+
+    linger->window = g_object_ref (self);
+    linger->widget = g_object_ref (widget);
+    g_timeout_add_seconds_full (G_PRIORITY_DEFAULT,
+                                seconds,
+                                on_info_bar_linger_timeout,
+                                linger,
+                                linger_data_free);
+}
+
 void
 gt_main_window_show_message (GtMainWindow *self,
                              const gchar *message,
@@ -588,6 +696,13 @@ gt_main_window_show_message (GtMainWindow *self,
     g_return_if_fail (type == GT_MESSAGE_TYPE_ERROR ||
                       type == GT_MESSAGE_TYPE_WARNING);
 
+    // Headless, there is nowhere to show a dialog
+    if (!gtk_is_initialized ()) {
+        g_printerr ("%s\n", message);
+
+        return;
+    }
+
     GtkWidget *dialog = gtk_message_dialog_new (GTK_WINDOW (self),
                                                 GTK_DIALOG_DESTROY_WITH_PARENT | GTK_DIALOG_MODAL,
                                                 (GtkMessageType)type,
@@ -615,12 +730,14 @@ gt_main_window_set_view (GtMainWindow *self, GtMainWindowViewType type)
         g_simple_action_set_enabled (G_SIMPLE_ACTION (hex_width), FALSE);
         gt_serial_view_set_display_mode (GT_SERIAL_VIEW (self->display),
                                          GT_SERIAL_VIEW_TEXT);
+        g_object_set (G_OBJECT (self->logger), "hex", FALSE, NULL);
         break;
     case GT_MAIN_WINDOW_VIEW_TYPE_HEX:
         g_simple_action_set_enabled (G_SIMPLE_ACTION (show_index), TRUE);
         g_simple_action_set_enabled (G_SIMPLE_ACTION (hex_width), TRUE);
         gt_serial_view_set_display_mode (GT_SERIAL_VIEW (self->display),
                                          GT_SERIAL_VIEW_HEX);
+        g_object_set (G_OBJECT (self->logger), "hex", TRUE, NULL);
         break;
     default:
         g_assert_not_reached ();
@@ -638,7 +755,8 @@ on_serial_port_data_available (GtMainWindow *self,
                                GBytes *bytes,
                                gpointer user_data)
 {
-    gt_buffer_put_bytes (self->buffer, bytes, config.crlfauto);
+    gt_buffer_put_bytes (
+        self->buffer, bytes, GT_BUFFER_DIRECTION_RX, config.crlfauto);
 }
 
 void
@@ -703,51 +821,88 @@ on_serial_port_signals_changed (GObject *object,
         gboolean active = (port_signals & signal_flags[i]) != 0;
         gtk_widget_set_sensitive (self->signals[i], active);
     }
+
+    guint32 lines = GUINT32_TO_LE (port_signals);
+    gt_logging_log_event (self->logger,
+                          GT_CAPTURE_EVENT_MODEM_LINES,
+                          GT_BUFFER_DIRECTION_RX,
+                          (const guint8 *)&lines,
+                          sizeof (lines));
 }
 
 static void
-on_send_hexadecimal (GtkWidget *widget, gpointer pointer)
+on_hexadecimal_sent (GObject *source_object,
+                     GAsyncResult *res,
+                     gpointer user_data)
 {
-    GtMainWindow *self = GT_MAIN_WINDOW (pointer);
+    GtMainWindow *self = GT_MAIN_WINDOW (user_data);
+    GError *error = NULL;
+    g_autofree char *message = NULL;
 
-    guint i;
-    gchar *message = NULL, **tokens = NULL, *buff = NULL;
-    guint scan_val;
+    gsize written = gt_serial_port_write_bytes_finish (
+        GT_SERIAL_PORT (source_object), res, &error);
 
-    const char *text = gtk_editable_get_text (GTK_EDITABLE (widget));
+    // The window was closed while the data was going out
+    if (self->serial_port == NULL) {
+        g_clear_error (&error);
+        g_object_unref (self);
 
-    if (strlen (text) == 0) {
-        message = g_strdup_printf (_ ("Nothing sent."));
-        gt_main_window_temp_message (self, message, 1500);
-        gtk_editable_set_text (GTK_EDITABLE (widget), "");
+        return;
+    }
 
-        goto exit;
+    gtk_widget_set_sensitive (self->hex_send_entry, TRUE);
+
+    if (error != NULL) {
+        message = g_strdup_printf (_ ("Failed to send hex data: %s"),
+                                   error->message);
+        gt_main_window_temp_message (self, message, 3000);
+        g_error_free (error);
+    } else {
+        message = g_strdup_printf (
+            ngettext ("%" G_GSIZE_FORMAT " byte sent.",
+                      "%" G_GSIZE_FORMAT " bytes sent.",
+                      written),
+            written);
+        gt_main_window_temp_message (self, message, 2000);
+        gtk_editable_set_text (GTK_EDITABLE (self->hex_send_entry), "");
     }
 
-    tokens = g_strsplit_set (text, " ;", -1);
-    buff = g_malloc0 (g_strv_length (tokens));
+    g_object_unref (self);
+}
+
+static void
+on_send_hexadecimal (GtkWidget *widget, gpointer pointer)
+{
+    GtMainWindow *self = GT_MAIN_WINDOW (pointer);
+    GError *error = NULL;
 
-    for (i = 0; tokens[i] != NULL; i++) {
-        if (sscanf (tokens[i], "%02X", &scan_val) != 1) {
-            gt_main_window_temp_message (
-                self, _ ("Improper formatted hex input, 0 bytes sent!"), 1500);
+    const char *text = gtk_editable_get_text (GTK_EDITABLE (widget));
+    g_autoptr (GBytes) bytes = gt_hex_parse (text, &error);
 
-            goto exit;
-        }
-        buff[i] = scan_val;
+    if (bytes == NULL) {
+        g_autofree char *message = g_strdup_printf (
+            _ ("Improper formatted hex input, 0 bytes sent: %s"),
+            error->message);
+        gt_main_window_temp_message (self, message, 3000);
+        g_error_free (error);
+
+        return;
     }
 
-    gt_serial_port_send_chars (self->serial_port, buff, i);
+    if (g_bytes_get_size (bytes) == 0) {
+        gt_main_window_temp_message (self, _ ("Nothing sent."), 1500);
+        gtk_editable_set_text (GTK_EDITABLE (widget), "");
 
-    message =
-        g_strdup_printf (ngettext ("%d byte sent.", "%d bytes sent.", i), i);
-    gt_main_window_temp_message (self, message, 2000);
-    gtk_editable_set_text (GTK_EDITABLE (widget), "");
+        return;
+    }
 
-exit:
-    g_clear_pointer (&message, g_free);
-    g_clear_pointer (&tokens, g_strfreev);
-    g_clear_pointer (&buff, g_free);
+    // The text stays until it is all out, so it can be sent again on failure
+    gtk_widget_set_sensitive (widget, FALSE);
+    gt_serial_port_write_bytes_async (self->serial_port,
+                                      bytes,
+                                      NULL,
+                                      on_hexadecimal_sent,
+                                      g_object_ref (self));
 }
 
 static void
@@ -755,12 +910,25 @@ on_vte_commit (VteTerminal *widget, gchar *text, guint length, gpointer ptr)
 {
     GtMainWindow *self = GT_MAIN_WINDOW (ptr);
 
+    // Pastes, and whatever is typed while one is going out, queue up behind
+    // each other
+    if (length > PASTE_DIRECT_MAX || self->paste != NULL) {
+        g_queue_push_tail (&self->paste_queue, g_bytes_new (text, length));
+        if (self->paste == NULL)
+            gt_main_window_start_paste (self);
+
+        return;
+    }
+
     int bytes_written =
         gt_serial_port_send_chars (self->serial_port, text, length);
 
     if (bytes_written > 0 && config.echo) {
-        gt_buffer_put_chars (
-            self->buffer, text, bytes_written, config.crlfauto);
+        gt_buffer_put_chars (self->buffer,
+                             text,
+                             bytes_written,
+                             GT_BUFFER_DIRECTION_TX,
+                             config.crlfauto);
     }
 }
 
@@ -789,6 +957,17 @@ on_vte_button_press_callback (GtkGesture *click,
     gtk_gesture_set_sequence_state (GTK_GESTURE (click), sequence,
                                     GTK_EVENT_SEQUENCE_CLAIMED);
 
+    // Built on first use, it is not needed to get the window up
+    if (self->popup_menu == NULL) {
+        self->popup_menu =
+            gtk_popover_menu_new_from_model (self->popup_menu_model);
+        gtk_widget_set_parent (self->popup_menu, GTK_WIDGET (self));
+        gtk_popover_set_position (GTK_POPOVER (self->popup_menu),
+                                  GTK_POS_BOTTOM);
+        gtk_popover_set_has_arrow (GTK_POPOVER (self->popup_menu), FALSE);
+        gtk_widget_set_halign (self->popup_menu, GTK_ALIGN_START);
+    }
+
     GdkRectangle rect = { x, y, 1, 1 };
     gtk_popover_set_pointing_to (GTK_POPOVER (self->popup_menu), &rect);
     gtk_popover_popup (GTK_POPOVER (self->popup_menu));
@@ -835,6 +1014,11 @@ on_signals_send_break (GSimpleAction *action,
     GtMainWindow *self = GT_MAIN_WINDOW (user_data);
 
     gt_serial_port_send_brk (self->serial_port);
+    gt_logging_log_event (self->logger,
+                          GT_CAPTURE_EVENT_BREAK,
+                          GT_BUFFER_DIRECTION_TX,
+                          NULL,
+                          0);
     gt_main_window_temp_message (self, _ ("Break signal sent!"), 800);
 }
 
@@ -870,6 +1054,163 @@ on_reconnect (GSimpleAction *action, GVariant *parameter, gpointer user_data)
     gt_serial_port_reconnect (GT_MAIN_WINDOW (user_data)->serial_port);
 }
 
+static void
+on_macro_script_ready (GObject *source_object,
+                       GAsyncResult *res,
+                       gpointer user_data)
+{
+    GtMainWindow *self = GT_MAIN_WINDOW (user_data);
+    GError *error = NULL;
+
+    gt_macro_script_run_finish (res, &error);
+
+    // The window was closed while the script was running
+    if (self->serial_port == NULL) {
+        g_clear_error (&error);
+    } else if (error != NULL) {
+        g_autofree char *msg = NULL;
+
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            msg = g_strdup (_ ("Macro stopped"));
+        else
+            msg = g_strdup_printf (_ ("Macro failed: %s"), error->message);
+        gt_main_window_temp_message (self, msg, 3000);
+        g_error_free (error);
+    } else {
+        gt_main_window_temp_message (self, _ ("Macro done"), 800);
+    }
+
+    g_clear_object (&self->script_cancellable);
+    g_object_unref (self);
+}
+
+// Only one script runs at a time; firing a script macro while one is running
+// stops it instead
+static void
+gt_main_window_run_macro_script (GtMainWindow *self, GtMacro *macro)
+{
+    if (self->script_cancellable != NULL) {
+        g_cancellable_cancel (self->script_cancellable);
+
+        return;
+    }
+
+    g_autofree char *str = g_strdup_printf (
+        _ ("Macro \"%s\" running…"), gt_macro_get_shortcut (macro));
+    gt_main_window_temp_message (self, str, 800);
+
+    self->script_cancellable = g_cancellable_new ();
+    gt_macro_script_run_async (gt_macro_get_script (macro),
+                               self->serial_port,
+                               self->script_cancellable,
+                               on_macro_script_ready,
+                               g_object_ref (self));
+}
+
+static void
+gt_main_window_send_macro_data (GtMainWindow *self,
+                                GtMacro *macro,
+                                GBytes *bytes)
+{
+    gsize size;
+    const guint8 *data = g_bytes_get_data (bytes, &size);
+
+    g_autofree char *str = g_strdup_printf (_ ("Macro \"%s\" sent !"),
+                                            gt_macro_get_shortcut (macro));
+    gt_main_window_temp_message (self, str, 800);
+
+    on_vte_commit (NULL, (char *)data, size, self);
+}
+
+static void
+on_macro_input_response (GtkDialog *dialog,
+                         gint response_id,
+                         gpointer user_data)
+{
+    GtMainWindow *self = GT_MAIN_WINDOW (user_data);
+    GtMacro *macro = g_object_get_data (G_OBJECT (dialog), "macro");
+    GPtrArray *entries = g_object_get_data (G_OBJECT (dialog), "entries");
+
+    if (response_id == GTK_RESPONSE_ACCEPT) {
+        g_autoptr (GPtrArray) inputs = g_ptr_array_new ();
+        guint i;
+
+        for (i = 0; i < entries->len; i++) {
+            GtkEditable *entry = g_ptr_array_index (entries, i);
+            g_ptr_array_add (inputs, (gpointer)gtk_editable_get_text (entry));
+        }
+        g_ptr_array_add (inputs, NULL);
+
+        g_autoptr (GBytes) bytes = gt_macro_template_render (
+            gt_macro_get_template (macro),
+            (const char *const *)inputs->pdata);
+        gt_main_window_send_macro_data (self, macro, bytes);
+    }
+
+    gtk_window_destroy (GTK_WINDOW (dialog));
+}
+
+static void
+gt_main_window_ask_macro_inputs (GtMainWindow *self, GtMacro *macro)
+{
+    GtMacroTemplate *template = gt_macro_get_template (macro);
+    GPtrArray *entries = g_ptr_array_new ();
+    guint i;
+
+    g_autofree char *title = g_strdup_printf (_ ("Send Macro \"%s\""),
+                                              gt_macro_get_shortcut (macro));
+    GtkWidget *dialog =
+        gtk_dialog_new_with_buttons (title,
+                                     GTK_WINDOW (self),
+                                     GTK_DIALOG_MODAL |
+                                         GTK_DIALOG_DESTROY_WITH_PARENT,
+                                     _ ("_Cancel"),
+                                     GTK_RESPONSE_CANCEL,
+                                     _ ("_Send"),
+                                     GTK_RESPONSE_ACCEPT,
+                                     NULL);
+    gtk_dialog_set_default_response (GTK_DIALOG (dialog), GTK_RESPONSE_ACCEPT);
+
+    GtkWidget *grid = gtk_grid_new ();
+    gtk_grid_set_row_spacing (GTK_GRID (grid), 6);
+    gtk_grid_set_column_spacing (GTK_GRID (grid), 12);
+    gtk_widget_set_margin_start (grid, 12);
+    gtk_widget_set_margin_end (grid, 12);
+    gtk_widget_set_margin_top (grid, 12);
+    gtk_widget_set_margin_bottom (grid, 12);
+
+    for (i = 0; i < gt_macro_template_get_n_inputs (template); i++) {
+        GtkWidget *entry = gtk_entry_new ();
+
+        gtk_entry_set_activates_default (GTK_ENTRY (entry), TRUE);
+        gtk_widget_set_hexpand (entry, TRUE);
+        gtk_grid_attach (GTK_GRID (grid),
+                         gtk_label_new (gt_macro_template_get_input_prompt (
+                             template, i)),
+                         0,
+                         i,
+                         1,
+                         1);
+        gtk_grid_attach (GTK_GRID (grid), entry, 1, i, 1, 1);
+        g_ptr_array_add (entries, entry);
+    }
+
+    gtk_box_append (
+        GTK_BOX (gtk_dialog_get_content_area (GTK_DIALOG (dialog))), grid);
+
+    g_object_set_data_full (
+        G_OBJECT (dialog), "macro", g_object_ref (macro), g_object_unref);
+    g_object_set_data_full (G_OBJECT (dialog),
+                            "entries",
+                            entries,
+                            (GDestroyNotify)g_ptr_array_unref);
+
+    g_signal_connect (
+        dialog, "response", G_CALLBACK (on_macro_input_response), self);
+
+    gtk_widget_show (dialog);
+}
+
 void
 on_macro (GSimpleAction *action, GVariant *parameter, gpointer user_data)
 {
@@ -878,16 +1219,35 @@ on_macro (GSimpleAction *action, GVariant *parameter, gpointer user_data)
     const char *id = g_variant_get_string (parameter, NULL);
     g_autoptr (GtMacro) macro =
         gt_macro_manager_get (gt_macro_manager_get_default (), id);
-    const char *shortcut = gt_macro_get_shortcut (macro);
-    GBytes *bytes = gt_macro_get_bytes (macro);
-    gsize size;
-    const guint8 *data = g_bytes_get_data (bytes, &size);
 
-    g_autofree char *str =
-        g_strdup_printf (_ ("Macro \"%s\" sent !"), shortcut);
-    gt_main_window_temp_message (self, str, 800);
+    // The macro may be gone if the profile changed under the shortcut
+    if (macro == NULL)
+        return;
 
-    on_vte_commit (NULL, (char *)data, size, self);
+    if (gt_macro_get_script (macro) != NULL) {
+        gt_main_window_run_macro_script (self, macro);
+
+        return;
+    }
+
+    GtMacroTemplate *template = gt_macro_get_template (macro);
+    if (template != NULL) {
+        if (gt_macro_template_get_n_inputs (template) > 0) {
+            gt_main_window_ask_macro_inputs (self, macro);
+
+            return;
+        }
+
+        g_autoptr (GBytes) bytes = gt_macro_template_render (template, NULL);
+        gt_main_window_send_macro_data (self, macro, bytes);
+
+        return;
+    }
+
+    if (gt_macro_get_bytes (macro) == NULL)
+        return;
+
+    gt_main_window_send_macro_data (self, macro, gt_macro_get_bytes (macro));
 }
 
 void
@@ -963,7 +1323,37 @@ on_logging_start_response (GtkDialog *self, gint response_id, gpointer data)
         g_autoptr (GFile) file =
             gtk_file_chooser_get_file (GTK_FILE_CHOOSER (self));
         g_autofree char *file_name = g_file_get_path (file);
-        gt_logging_start (w->logger, file_name, &error);
+        const char *choice =
+            gtk_file_chooser_get_choice (GTK_FILE_CHOOSER (self), "format");
+        GtLoggingFormat format = GT_LOGGING_FORMAT_RENDERED;
+
+        if (g_strcmp0 (choice, "raw") == 0)
+            format = GT_LOGGING_FORMAT_RAW;
+        else if (g_strcmp0 (choice, "capture") == 0)
+            format = GT_LOGGING_FORMAT_CAPTURE;
+
+        guint64 rotate_size = 0;
+        guint rotate_interval = 0;
+        choice =
+            gtk_file_chooser_get_choice (GTK_FILE_CHOOSER (self), "rotate");
+        if (g_strcmp0 (choice, "size") == 0)
+            rotate_size = LOG_ROTATE_SIZE;
+        else if (g_strcmp0 (choice, "hourly") == 0)
+            rotate_interval = 60 * 60;
+        else if (g_strcmp0 (choice, "daily") == 0)
+            rotate_interval = 24 * 60 * 60;
+
+        GtLogCompression compression = GT_LOG_COMPRESSION_NONE;
+        choice =
+            gtk_file_chooser_get_choice (GTK_FILE_CHOOSER (self), "compress");
+        if (g_strcmp0 (choice, "gzip") == 0)
+            compression = GT_LOG_COMPRESSION_GZIP;
+        else if (g_strcmp0 (choice, "zstd") == 0)
+            compression = GT_LOG_COMPRESSION_ZSTD;
+
+        gt_logging_set_rotation (
+            w->logger, rotate_size, rotate_interval, NULL, compression);
+        gt_logging_start (w->logger, file_name, format, &error);
         if (error != NULL) {
             gt_main_window_show_message (
                 w, error->message, GT_MESSAGE_TYPE_ERROR);
@@ -996,6 +1386,45 @@ on_logging_start (GSimpleAction *action,
         gtk_file_chooser_set_file (GTK_FILE_CHOOSER (file_select), file, NULL);
     }
 
+    const char *options[] = {"rendered", "raw", "capture", NULL};
+    const char *labels[] = {_ ("As displayed"),
+                            _ ("Raw received and sent bytes"),
+                            _ ("Timestamped binary capture"),
+                            NULL};
+    gtk_file_chooser_add_choice (
+        GTK_FILE_CHOOSER (file_select), "format", _ ("Log"), options, labels);
+    gtk_file_chooser_set_choice (
+        GTK_FILE_CHOOSER (file_select), "format", "rendered");
+
+    const char *rotate_options[] = {"none", "size", "hourly", "daily", NULL};
+    const char *rotate_labels[] = {_ ("Never"),
+                                   _ ("Every 100 MB"),
+                                   _ ("Every hour"),
+                                   _ ("Every day"),
+                                   NULL};
+    gtk_file_chooser_add_choice (GTK_FILE_CHOOSER (file_select),
+                                 "rotate",
+                                 _ ("Rotate"),
+                                 rotate_options,
+                                 rotate_labels);
+    gtk_file_chooser_set_choice (
+        GTK_FILE_CHOOSER (file_select), "rotate", "none");
+
+    const char *compress_options[] = {"none", "gzip", "zstd", NULL};
+    const char *compress_labels[] = {
+        _ ("Keep uncompressed"), _ ("gzip"), _ ("zstd"), NULL};
+    if (!gt_log_compression_is_supported (GT_LOG_COMPRESSION_ZSTD)) {
+        compress_options[2] = NULL;
+        compress_labels[2] = NULL;
+    }
+    gtk_file_chooser_add_choice (GTK_FILE_CHOOSER (file_select),
+                                 "compress",
+                                 _ ("Rotated files"),
+                                 compress_options,
+                                 compress_labels);
+    gtk_file_chooser_set_choice (
+        GTK_FILE_CHOOSER (file_select), "compress", "gzip");
+
     gtk_window_set_modal (GTK_WINDOW (file_select), TRUE);
     g_signal_connect (
         file_select, "response", G_CALLBACK (on_logging_start_response), self);
@@ -1125,13 +1554,79 @@ on_file_transfer_ready (GObject *source_object,
 {
     GtMainWindow *self = GT_MAIN_WINDOW (user_data);
     GError *error = NULL;
+    GtFileTransferStats stats;
 
     g_debug ("File transfer finished...");
-    gt_file_transfer_finish (GT_FILE_TRANSFER (source_object), res, &error);
+    gt_file_transfer_finish (
+        GT_FILE_TRANSFER (source_object), res, &stats, &error);
 
     GtkWidget *infobar = gt_main_window_get_info_bar (self);
-    gt_main_window_remove_info_bar (self, infobar);
-    // gtk_widget_destroy (infobar);
+
+    if (error == NULL && infobar != NULL) {
+        // Leave the summary up for a moment
+        g_autofree char *size = g_format_size (stats.bytes);
+        g_autofree char *average = g_format_size ((guint64)stats.average_rate);
+        g_autofree char *peak = g_format_size ((guint64)stats.peak_rate);
+        g_autofree char *msg = g_strdup_printf (
+            _ ("Sent %s in %.1f s, %s/s average, %s/s peak"),
+            size,
+            stats.elapsed / (gdouble)G_USEC_PER_SEC,
+            average,
+            peak);
+
+        if (stats.stalls > 0) {
+            g_autofree char *stalls = g_strdup_printf (
+                ngettext ("%s, waited %.1f s for %u reply",
+                          "%s, waited %.1f s for %u replies",
+                          stats.stalls),
+                msg,
+                stats.stall_time / (gdouble)G_USEC_PER_SEC,
+                stats.stalls);
+            g_free (msg);
+            msg = g_steal_pointer (&stalls);
+        }
+
+        if (stats.echo_compared > 0 || stats.echo_missing > 0) {
+            g_autofree char *echo = NULL;
+
+            if (stats.echo_errors == 0 && stats.echo_missing == 0 &&
+                stats.echo_resyncs == 0)
+                echo = g_strdup_printf (_ ("%s, echo verified"), msg);
+            else if (stats.echo_errors == 0)
+                echo = g_strdup_printf (
+                    _ ("%s, echo: %" G_GUINT64_FORMAT " bytes missing"),
+                    msg,
+                    stats.echo_missing);
+            else
+                echo = g_strdup_printf (
+                    _ ("%s, echo: %" G_GUINT64_FORMAT " bad bytes (%.3g%%), "
+                       "first at offset %" G_GINT64_FORMAT),
+                    msg,
+                    stats.echo_errors,
+                    100.0 * stats.echo_errors / MAX (stats.echo_compared, 1),
+                    stats.echo_first_error);
+            g_free (msg);
+            msg = g_steal_pointer (&echo);
+        }
+
+        // Lost or added bytes are not counted as bad, but say they happened
+        if (stats.echo_resyncs > 0) {
+            g_autofree char *resyncs = g_strdup_printf (
+                ngettext ("%s, echo out of step %" G_GUINT64_FORMAT " time",
+                          "%s, echo out of step %" G_GUINT64_FORMAT " times",
+                          stats.echo_resyncs),
+                msg,
+                stats.echo_resyncs);
+            g_free (msg);
+            msg = g_steal_pointer (&resyncs);
+        }
+
+        gt_infobar_set_label (GT_INFOBAR (infobar), msg);
+        gt_infobar_set_detail (GT_INFOBAR (infobar), NULL);
+        gt_main_window_linger_info_bar (self, infobar, 5);
+    } else {
+        gt_main_window_remove_info_bar (self, infobar);
+    }
 
     if (error != NULL) {
 
@@ -1154,49 +1649,365 @@ on_file_transfer_ready (GObject *source_object,
 }
 
 static void
-on_send_raw_file_response (GtkDialog *d, gint response_id, gpointer user_data)
+on_file_transfer_rate (GObject *object, GParamSpec *pspec, gpointer user_data)
+{
+    gdouble rate = 0.0;
+    gdouble eta = -1.0;
+
+    g_object_get (object, "bytes-per-second", &rate, "eta", &eta, NULL);
+
+    if (rate <= 0.0) {
+        gt_infobar_set_detail (GT_INFOBAR (user_data), NULL);
+
+        return;
+    }
+
+    g_autofree char *speed = g_format_size ((guint64)rate);
+    g_autofree char *detail = NULL;
+
+    if (eta >= 0.0) {
+        guint seconds = (guint)(eta + 0.5);
+        detail = g_strdup_printf (_ ("%s/s, %u:%02u left"),
+                                  speed,
+                                  seconds / 60,
+                                  seconds % 60);
+    } else {
+        detail = g_strdup_printf (_ ("%s/s"), speed);
+    }
+
+    gt_infobar_set_detail (GT_INFOBAR (user_data), detail);
+}
+
+static void
+on_paste_sent (GtFileTransfer *paste, GBytes *data, gpointer user_data)
 {
     GtMainWindow *self = GT_MAIN_WINDOW (user_data);
-    gtk_widget_hide (GTK_WIDGET (d));
+    gsize size;
+    const char *text = g_bytes_get_data (data, &size);
 
-    if (response_id == GTK_RESPONSE_ACCEPT) {
-        g_autoptr (GFile) file =
-            gtk_file_chooser_get_file (GTK_FILE_CHOOSER (d));
-        GtFileTransfer *transfer =
-            gt_serial_port_send_file (self->serial_port, file);
+    gt_buffer_put_chars (self->buffer,
+                         (char *)text,
+                         size,
+                         GT_BUFFER_DIRECTION_TX,
+                         config.crlfauto);
+}
+
+static void
+on_paste_done (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+    GtMainWindow *self = GT_MAIN_WINDOW (user_data);
+    GError *error = NULL;
+    GtkWidget *infobar = g_object_get_data (source_object, "infobar");
+
+    gt_file_transfer_finish (
+        GT_FILE_TRANSFER (source_object), res, NULL, &error);
+
+    g_clear_object (&self->paste);
+    g_clear_object (&self->paste_cancellable);
+
+    // The window was closed while the paste was going out
+    if (self->serial_port == NULL) {
+        g_clear_error (&error);
+        g_object_unref (self);
+
+        return;
+    }
+
+    if (infobar != NULL && gt_main_window_get_info_bar (self) == infobar)
+        gt_main_window_remove_info_bar (self, infobar);
+
+    if (error != NULL) {
+        g_autofree char *msg = NULL;
+
+        // Whatever was queued behind it goes too
+        g_queue_clear_full (&self->paste_queue, (GDestroyNotify)g_bytes_unref);
+
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            msg = g_strdup (_ ("Paste stopped"));
+        else
+            msg = g_strdup_printf (_ ("Paste failed: %s"), error->message);
+        gt_main_window_temp_message (self, msg, 3000);
+        g_error_free (error);
+    } else if (!g_queue_is_empty (&self->paste_queue)) {
+        gt_main_window_start_paste (self);
+    }
+
+    g_object_unref (self);
+}
+
+// Sends everything queued so far as one transfer, so pastes are written in
+// chunks without blocking and honour the pacing, delay and wait character
+// settings just like files
+static void
+gt_main_window_start_paste (GtMainWindow *self)
+{
+    GByteArray *data = g_byte_array_new ();
+    GBytes *chunk;
+
+    while ((chunk = g_queue_pop_head (&self->paste_queue)) != NULL) {
+        gsize size;
+        const guint8 *p = g_bytes_get_data (chunk, &size);
+
+        g_byte_array_append (data, p, size);
+        g_bytes_unref (chunk);
+    }
+
+    g_autoptr (GBytes) bytes = g_byte_array_free_to_bytes (data);
+    gsize size = g_bytes_get_size (bytes);
+
+    self->paste = gt_serial_port_send_bytes (self->serial_port, bytes);
+    self->paste_cancellable = g_cancellable_new ();
+
+    // Only the paste's own writes, not whatever else goes out meanwhile
+    if (config.echo)
+        g_signal_connect_object (G_OBJECT (self->paste),
+                                 "sent",
+                                 G_CALLBACK (on_paste_sent),
+                                 self,
+                                 0);
+
+    if (size >= PASTE_PROGRESS_MIN) {
         GtkWidget *infobar = gt_infobar_new ();
-        g_autofree char *path = g_file_get_path (file);
+        g_autofree char *size_str = g_format_size (size);
         g_autofree char *message =
-            g_strdup_printf (_ ("Sending file “%s”…"), path);
+            g_strdup_printf (_ ("Pasting %s…"), size_str);
+
         gt_infobar_set_label (GT_INFOBAR (infobar), message);
+        gt_infobar_set_action_label (GT_INFOBAR (infobar), _ ("_Stop"));
         gt_main_window_set_info_bar (self, infobar);
-        g_object_bind_property (G_OBJECT (transfer),
+        g_object_bind_property (G_OBJECT (self->paste),
                                 "progress",
                                 G_OBJECT (infobar),
                                 "progress",
                                 (GBindingFlags)0);
-
-        GCancellable *cancellable = g_cancellable_new ();
-        g_signal_connect (G_OBJECT (infobar),
-                          "close",
-                          G_CALLBACK (on_infobar_close),
-                          cancellable);
-        g_signal_connect (G_OBJECT (infobar),
-                          "response",
-                          G_CALLBACK (on_infobar_response),
-                          cancellable);
-
-        gt_file_transfer_start (
-            transfer, cancellable, on_file_transfer_ready, self);
+        g_signal_connect_object (G_OBJECT (self->paste),
+                                 "notify::eta",
+                                 G_CALLBACK (on_file_transfer_rate),
+                                 infobar,
+                                 0);
+        g_signal_connect_object (G_OBJECT (infobar),
+                                 "close",
+                                 G_CALLBACK (on_infobar_close),
+                                 self->paste_cancellable,
+                                 0);
+        g_signal_connect_object (G_OBJECT (infobar),
+                                 "response",
+                                 G_CALLBACK (on_infobar_response),
+                                 self->paste_cancellable,
+                                 0);
+        g_object_set_data_full (G_OBJECT (self->paste),
+                                "infobar",
+                                g_object_ref (infobar),
+                                g_object_unref);
     }
 
-    gtk_window_destroy (GTK_WINDOW (d));
+    gt_file_transfer_start (self->paste,
+                            self->paste_cancellable,
+                            on_paste_done,
+                            g_object_ref (self));
 }
 
-void
-on_send_raw_file (GSimpleAction *action,
-                  GVariant *parameter,
-                  gpointer user_data)
+static void
+on_transfer_queue_ready (GObject *source_object,
+                         GAsyncResult *res,
+                         gpointer user_data)
+{
+    GtMainWindow *self = GT_MAIN_WINDOW (user_data);
+    GError *error = NULL;
+    GtTransferQueueStats stats;
+
+    gt_transfer_queue_finish (
+        GT_TRANSFER_QUEUE (source_object), res, &stats, &error);
+
+    GtkWidget *infobar = gt_main_window_get_info_bar (self);
+
+    if (error == NULL && infobar != NULL) {
+        g_autofree char *size = g_format_size (stats.bytes);
+        g_autofree char *average = g_format_size ((guint64)stats.average_rate);
+        g_autofree char *msg = g_strdup_printf (
+            ngettext ("Sent %u file, %s in %.1f s, %s/s average",
+                      "Sent %u files, %s in %.1f s, %s/s average",
+                      stats.jobs),
+            stats.jobs,
+            size,
+            stats.elapsed / (gdouble)G_USEC_PER_SEC,
+            average);
+
+        if (stats.echo_compared > 0) {
+            g_autofree char *echo = g_strdup_printf (
+                _ ("%s, %" G_GUINT64_FORMAT " bad echo bytes (%.3g%%)"),
+                msg,
+                stats.echo_errors,
+                100.0 * stats.echo_errors / stats.echo_compared);
+            g_free (msg);
+            msg = g_steal_pointer (&echo);
+        }
+
+        if (stats.echo_missing > 0) {
+            g_autofree char *missing = g_strdup_printf (
+                _ ("%s, %" G_GUINT64_FORMAT " echo bytes missing"),
+                msg,
+                stats.echo_missing);
+            g_free (msg);
+            msg = g_steal_pointer (&missing);
+        }
+
+        if (stats.echo_resyncs > 0) {
+            g_autofree char *resyncs = g_strdup_printf (
+                ngettext ("%s, echo out of step %" G_GUINT64_FORMAT " time",
+                          "%s, echo out of step %" G_GUINT64_FORMAT " times",
+                          stats.echo_resyncs),
+                msg,
+                stats.echo_resyncs);
+            g_free (msg);
+            msg = g_steal_pointer (&resyncs);
+        }
+
+        gt_infobar_set_label (GT_INFOBAR (infobar), msg);
+        gt_infobar_set_detail (GT_INFOBAR (infobar), NULL);
+        gt_main_window_linger_info_bar (self, infobar, 5);
+    } else {
+        gt_main_window_remove_info_bar (self, infobar);
+    }
+
+    if (error != NULL) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            gt_main_window_show_message (
+                self, error->message, GT_MESSAGE_TYPE_ERROR);
+        g_error_free (error);
+    }
+
+    g_object_unref (source_object);
+    g_object_unref (self);
+}
+
+static void
+on_transfer_queue_job_started (GtTransferQueue *queue,
+                               guint index,
+                               GtFileTransfer *transfer,
+                               gpointer user_data)
+{
+    g_autofree char *name =
+        g_file_get_basename (gt_file_transfer_get_file (transfer));
+    g_autofree char *message =
+        g_strdup_printf (_ ("Sending file %u of %u, “%s”…"),
+                         index + 1,
+                         gt_transfer_queue_get_n_jobs (queue),
+                         name);
+
+    gt_infobar_set_label (GT_INFOBAR (user_data), message);
+    g_signal_connect_object (G_OBJECT (transfer),
+                             "notify::eta",
+                             G_CALLBACK (on_file_transfer_rate),
+                             user_data,
+                             0);
+}
+
+static void
+gt_main_window_send_files (GtMainWindow *self,
+                           GListModel *files,
+                           gboolean verify)
+{
+    GtTransferQueue *queue = gt_transfer_queue_new ();
+
+    for (guint i = 0; i < g_list_model_get_n_items (files); i++) {
+        g_autoptr (GFile) file = g_list_model_get_item (files, i);
+        g_autoptr (GtFileTransfer) transfer =
+            gt_serial_port_send_file (self->serial_port, file);
+
+        g_object_set (transfer, "verify", verify, NULL);
+        gt_transfer_queue_add (queue, transfer, 0);
+    }
+
+    GtkWidget *infobar = gt_infobar_new ();
+    gt_main_window_set_info_bar (self, infobar);
+    g_object_bind_property (G_OBJECT (queue),
+                            "progress",
+                            G_OBJECT (infobar),
+                            "progress",
+                            (GBindingFlags)0);
+    g_signal_connect_object (G_OBJECT (queue),
+                             "job-started",
+                             G_CALLBACK (on_transfer_queue_job_started),
+                             infobar,
+                             0);
+
+    GCancellable *cancellable = g_cancellable_new ();
+    g_signal_connect_object (G_OBJECT (infobar),
+                             "close",
+                             G_CALLBACK (on_infobar_close),
+                             cancellable,
+                             0);
+    g_signal_connect_object (G_OBJECT (infobar),
+                             "response",
+                             G_CALLBACK (on_infobar_response),
+                             cancellable,
+                             0);
+    g_object_set_data_full (
+        G_OBJECT (queue), "cancellable", cancellable, g_object_unref);
+
+    gt_transfer_queue_start (
+        queue, cancellable, on_transfer_queue_ready, g_object_ref (self));
+}
+
+static void
+on_send_raw_file_response (GtkDialog *d, gint response_id, gpointer user_data)
+{
+    GtMainWindow *self = GT_MAIN_WINDOW (user_data);
+    gtk_widget_hide (GTK_WIDGET (d));
+
+    g_autoptr (GListModel) files =
+        gtk_file_chooser_get_files (GTK_FILE_CHOOSER (d));
+    gboolean verify = g_strcmp0 (gtk_file_chooser_get_choice (
+                                     GTK_FILE_CHOOSER (d), "verify"),
+                                 "true") == 0;
+
+    if (response_id == GTK_RESPONSE_ACCEPT &&
+        g_list_model_get_n_items (files) > 1) {
+        gt_main_window_send_files (self, files, verify);
+    } else if (response_id == GTK_RESPONSE_ACCEPT) {
+        g_autoptr (GFile) file = g_list_model_get_item (files, 0);
+        GtFileTransfer *transfer =
+            gt_serial_port_send_file (self->serial_port, file);
+        g_object_set (transfer, "verify", verify, NULL);
+        GtkWidget *infobar = gt_infobar_new ();
+        g_autofree char *path = g_file_get_path (file);
+        g_autofree char *message =
+            g_strdup_printf (_ ("Sending file “%s”…"), path);
+        gt_infobar_set_label (GT_INFOBAR (infobar), message);
+        gt_main_window_set_info_bar (self, infobar);
+        g_object_bind_property (G_OBJECT (transfer),
+                                "progress",
+                                G_OBJECT (infobar),
+                                "progress",
+                                (GBindingFlags)0);
+        g_signal_connect_object (G_OBJECT (transfer),
+                                 "notify::eta",
+                                 G_CALLBACK (on_file_transfer_rate),
+                                 infobar,
+                                 0);
+
+        GCancellable *cancellable = g_cancellable_new ();
+        g_signal_connect (G_OBJECT (infobar),
+                          "close",
+                          G_CALLBACK (on_infobar_close),
+                          cancellable);
+        g_signal_connect (G_OBJECT (infobar),
+                          "response",
+                          G_CALLBACK (on_infobar_response),
+                          cancellable);
+
+        gt_file_transfer_start (
+            transfer, cancellable, on_file_transfer_ready, self);
+    }
+
+    gtk_window_destroy (GTK_WINDOW (d));
+}
+
+void
+on_send_raw_file (GSimpleAction *action,
+                  GVariant *parameter,
+                  gpointer user_data)
 {
     GtMainWindow *self = GT_MAIN_WINDOW (user_data);
 
@@ -1217,6 +2028,17 @@ on_send_raw_file (GSimpleAction *action,
             GTK_FILE_CHOOSER (file_selector), file, NULL);
     }
 
+    // Several files are sent back to back through a transfer queue
+    gtk_file_chooser_set_select_multiple (GTK_FILE_CHOOSER (file_selector),
+                                          TRUE);
+
+    // A boolean choice, for devices that echo everything they receive
+    gtk_file_chooser_add_choice (GTK_FILE_CHOOSER (file_selector),
+                                 "verify",
+                                 _ ("Verify echo"),
+                                 NULL,
+                                 NULL);
+
     gtk_dialog_set_default_response (GTK_DIALOG (file_selector),
                                      GTK_RESPONSE_ACCEPT);
     gtk_window_set_transient_for (GTK_WINDOW (file_selector),
@@ -1231,6 +2053,579 @@ on_send_raw_file (GSimpleAction *action,
     gtk_widget_show (file_selector);
 }
 
+static void
+on_file_receive_ready (GObject *source_object,
+                       GAsyncResult *res,
+                       gpointer user_data)
+{
+    GtMainWindow *self = GT_MAIN_WINDOW (user_data);
+    GError *error = NULL;
+    GtFileReceiveStats stats;
+
+    gt_file_receive_finish (
+        GT_FILE_RECEIVE (source_object), res, &stats, &error);
+
+    GtkWidget *infobar = gt_main_window_get_info_bar (self);
+
+    if (error == NULL && infobar != NULL) {
+        g_autofree char *size = g_format_size (stats.bytes);
+        g_autofree char *average = g_format_size ((guint64)stats.average_rate);
+        g_autofree char *msg = g_strdup_printf (
+            _ ("Received %s in %.1f s, %s/s average"),
+            size,
+            stats.elapsed / (gdouble)G_USEC_PER_SEC,
+            average);
+
+        if (stats.checksum[0] != '\0') {
+            g_autofree char *checksum =
+                g_strdup_printf (_ ("%s, checksum %s"), msg, stats.checksum);
+            g_free (msg);
+            msg = g_steal_pointer (&checksum);
+        }
+
+        gt_infobar_set_label (GT_INFOBAR (infobar), msg);
+        gt_infobar_set_detail (GT_INFOBAR (infobar), NULL);
+        gt_infobar_set_progress (GT_INFOBAR (infobar), 1.0);
+        gt_main_window_linger_info_bar (self, infobar, 10);
+    } else {
+        gt_main_window_remove_info_bar (self, infobar);
+    }
+
+    if (error != NULL) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_autofree char *msg = g_strdup_printf (
+                _ ("Failed to receive file: %s"), error->message);
+            gt_main_window_show_message (self, msg, GT_MESSAGE_TYPE_ERROR);
+        }
+        g_error_free (error);
+    }
+
+    g_object_unref (source_object);
+    g_object_unref (self);
+}
+
+static void
+on_file_receive_progress (GObject *object, GParamSpec *pspec, gpointer user_data)
+{
+    guint64 received = 0;
+    guint64 limit = 0;
+    gdouble rate = 0.0;
+
+    g_object_get (object,
+                  "bytes-received",
+                  &received,
+                  "max-bytes",
+                  &limit,
+                  "bytes-per-second",
+                  &rate,
+                  NULL);
+
+    g_autofree char *size = g_format_size (received);
+    g_autofree char *speed = g_format_size ((guint64)rate);
+    g_autofree char *detail = g_strdup_printf (_ ("%s, %s/s"), size, speed);
+
+    gt_infobar_set_detail (GT_INFOBAR (user_data), detail);
+    if (limit > 0)
+        gt_infobar_set_progress (GT_INFOBAR (user_data),
+                                 (gdouble)received / (gdouble)limit);
+}
+
+static void
+on_file_receive_stop (GtInfobar *infobar, gint response_id, gpointer user_data)
+{
+    gt_file_receive_stop (GT_FILE_RECEIVE (user_data));
+}
+
+static void
+on_receive_file_response (GtkDialog *d, gint response_id, gpointer user_data)
+{
+    GtMainWindow *self = GT_MAIN_WINDOW (user_data);
+    gtk_widget_hide (GTK_WIDGET (d));
+
+    if (response_id == GTK_RESPONSE_ACCEPT) {
+        GtkFileChooser *chooser = GTK_FILE_CHOOSER (d);
+        g_autoptr (GFile) file = gtk_file_chooser_get_file (chooser);
+        GtFileReceive *receive = gt_file_receive_new (self->serial_port, file);
+
+        const char *choice = gtk_file_chooser_get_choice (chooser, "stop");
+        guint idle_timeout = 0;
+        if (g_strcmp0 (choice, "idle-1") == 0)
+            idle_timeout = 1000;
+        else if (g_strcmp0 (choice, "idle-5") == 0)
+            idle_timeout = 5000;
+        else if (g_strcmp0 (choice, "idle-30") == 0)
+            idle_timeout = 30000;
+
+        g_autoptr (GBytes) terminator = NULL;
+        choice = gtk_file_chooser_get_choice (chooser, "terminator");
+        if (g_strcmp0 (choice, "eot") == 0)
+            terminator = g_bytes_new_static ("\x04", 1);
+        else if (g_strcmp0 (choice, "sub") == 0)
+            terminator = g_bytes_new_static ("\x1a", 1);
+
+        gint checksum_type = -1;
+        choice = gtk_file_chooser_get_choice (chooser, "checksum");
+        if (g_strcmp0 (choice, "md5") == 0)
+            checksum_type = G_CHECKSUM_MD5;
+        else if (g_strcmp0 (choice, "sha256") == 0)
+            checksum_type = G_CHECKSUM_SHA256;
+
+        g_object_set (receive,
+                      "idle-timeout",
+                      idle_timeout,
+                      "terminator",
+                      terminator,
+                      "checksum-type",
+                      checksum_type,
+                      NULL);
+
+        GtkWidget *infobar = gt_infobar_new ();
+        g_autofree char *path = g_file_get_path (file);
+        g_autofree char *message =
+            g_strdup_printf (_ ("Receiving into file “%s”…"), path);
+        gt_infobar_set_label (GT_INFOBAR (infobar), message);
+        gt_infobar_set_action_label (GT_INFOBAR (infobar), _ ("_Stop"));
+        gt_main_window_set_info_bar (self, infobar);
+
+        g_signal_connect_object (G_OBJECT (receive),
+                                 "notify::bytes-per-second",
+                                 G_CALLBACK (on_file_receive_progress),
+                                 infobar,
+                                 0);
+        g_signal_connect_object (G_OBJECT (infobar),
+                                 "response",
+                                 G_CALLBACK (on_file_receive_stop),
+                                 receive,
+                                 0);
+        g_signal_connect_object (G_OBJECT (infobar),
+                                 "close",
+                                 G_CALLBACK (gt_file_receive_stop),
+                                 receive,
+                                 G_CONNECT_SWAPPED);
+
+        gt_file_receive_start (
+            receive, NULL, on_file_receive_ready, g_object_ref (self));
+    }
+
+    gtk_window_destroy (GTK_WINDOW (d));
+}
+
+void
+on_receive_file (GSimpleAction *action,
+                 GVariant *parameter,
+                 gpointer user_data)
+{
+    GtMainWindow *self = GT_MAIN_WINDOW (user_data);
+
+    GtkWidget *file_selector =
+        gtk_file_chooser_dialog_new (_ ("Receive into file"),
+                                     GTK_WINDOW (self),
+                                     GTK_FILE_CHOOSER_ACTION_SAVE,
+                                     _ ("_Cancel"),
+                                     GTK_RESPONSE_CANCEL,
+                                     _ ("_Receive"),
+                                     GTK_RESPONSE_ACCEPT,
+                                     NULL);
+
+    const char *stop_options[] = {"none", "idle-1", "idle-5", "idle-30", NULL};
+    const char *stop_labels[] = {_ ("When stopped"),
+                                 _ ("After 1 s without data"),
+                                 _ ("After 5 s without data"),
+                                 _ ("After 30 s without data"),
+                                 NULL};
+    gtk_file_chooser_add_choice (GTK_FILE_CHOOSER (file_selector),
+                                 "stop",
+                                 _ ("Stop"),
+                                 stop_options,
+                                 stop_labels);
+    gtk_file_chooser_set_choice (
+        GTK_FILE_CHOOSER (file_selector), "stop", "none");
+
+    const char *terminator_options[] = {"none", "eot", "sub", NULL};
+    const char *terminator_labels[] = {
+        _ ("None"), _ ("EOT (Ctrl+D)"), _ ("SUB (Ctrl+Z)"), NULL};
+    gtk_file_chooser_add_choice (GTK_FILE_CHOOSER (file_selector),
+                                 "terminator",
+                                 _ ("End marker"),
+                                 terminator_options,
+                                 terminator_labels);
+    gtk_file_chooser_set_choice (
+        GTK_FILE_CHOOSER (file_selector), "terminator", "none");
+
+    const char *checksum_options[] = {"none", "md5", "sha256", NULL};
+    const char *checksum_labels[] = {_ ("None"), "MD5", "SHA-256", NULL};
+    gtk_file_chooser_add_choice (GTK_FILE_CHOOSER (file_selector),
+                                 "checksum",
+                                 _ ("Checksum"),
+                                 checksum_options,
+                                 checksum_labels);
+    gtk_file_chooser_set_choice (
+        GTK_FILE_CHOOSER (file_selector), "checksum", "none");
+
+    gtk_dialog_set_default_response (GTK_DIALOG (file_selector),
+                                     GTK_RESPONSE_ACCEPT);
+    gtk_window_set_modal (GTK_WINDOW (file_selector), TRUE);
+
+    g_signal_connect (file_selector,
+                      "response",
+                      G_CALLBACK (on_receive_file_response),
+                      self);
+
+    gtk_widget_show (file_selector);
+}
+
+static void
+on_modem_transfer_ready (GObject *source_object,
+                         GAsyncResult *res,
+                         gpointer user_data)
+{
+    GtMainWindow *self = GT_MAIN_WINDOW (user_data);
+    GtModemTransfer *transfer = GT_MODEM_TRANSFER (source_object);
+    GError *error = NULL;
+    GtModemStats stats;
+
+    gt_modem_transfer_finish (transfer, res, &error);
+    gt_modem_transfer_get_stats (transfer, &stats);
+
+    gt_main_window_remove_info_bar (self, gt_main_window_get_info_bar (self));
+
+    if (error != NULL) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_autofree char *msg = g_strdup_printf (
+                _ ("File transfer failed: %s"), error->message);
+            gt_main_window_show_message (self, msg, GT_MESSAGE_TYPE_ERROR);
+        }
+        g_error_free (error);
+    } else {
+        gdouble seconds = stats.elapsed / (gdouble)G_USEC_PER_SEC;
+        g_autofree char *size = g_format_size (stats.bytes);
+        g_autofree char *rate = g_format_size (
+            seconds > 0.0 ? (guint64)(stats.bytes / seconds) : stats.bytes);
+        g_autofree char *msg = g_strdup_printf (
+            ngettext ("Transferred %s in %.2f s (%s/s), %u retry",
+                      "Transferred %s in %.2f s (%s/s), %u retries",
+                      stats.retries),
+            size,
+            seconds,
+            rate,
+            stats.retries);
+
+        gt_main_window_temp_message (self, msg, 5000);
+    }
+
+    g_object_unref (transfer);
+    g_object_unref (self);
+}
+
+static void
+gt_main_window_run_modem_transfer (GtMainWindow *self,
+                                   GtModemTransfer *transfer,
+                                   const char *message)
+{
+    GtkWidget *infobar = gt_infobar_new ();
+    gt_infobar_set_label (GT_INFOBAR (infobar), message);
+    gt_main_window_set_info_bar (self, infobar);
+    g_object_bind_property (G_OBJECT (transfer),
+                            "progress",
+                            G_OBJECT (infobar),
+                            "progress",
+                            (GBindingFlags)0);
+
+    GCancellable *cancellable = g_cancellable_new ();
+    g_signal_connect_object (G_OBJECT (infobar),
+                             "close",
+                             G_CALLBACK (on_infobar_close),
+                             cancellable,
+                             0);
+    g_signal_connect_object (G_OBJECT (infobar),
+                             "response",
+                             G_CALLBACK (on_infobar_response),
+                             cancellable,
+                             0);
+    g_object_set_data_full (
+        G_OBJECT (transfer), "cancellable", cancellable, g_object_unref);
+
+    gt_modem_transfer_start (
+        transfer, cancellable, on_modem_transfer_ready, g_object_ref (self));
+}
+
+static GtModemProtocol
+gt_main_window_get_modem_protocol (GVariant *parameter)
+{
+    g_autoptr (GEnumClass) klass = g_type_class_ref (GT_TYPE_MODEM_PROTOCOL);
+    GEnumValue *value =
+        g_enum_get_value_by_nick (klass, g_variant_get_string (parameter, NULL));
+
+    return value != NULL ? (GtModemProtocol)value->value
+                         : GT_MODEM_PROTOCOL_XMODEM_1K;
+}
+
+static void
+on_send_modem_response (GtkDialog *dialog, gint response_id, gpointer user_data)
+{
+    GtMainWindow *self = GT_MAIN_WINDOW (user_data);
+    GtModemProtocol protocol = GPOINTER_TO_INT (
+        g_object_get_data (G_OBJECT (dialog), "modem-protocol"));
+
+    gtk_widget_hide (GTK_WIDGET (dialog));
+
+    if (response_id == GTK_RESPONSE_ACCEPT) {
+        g_autoptr (GListModel) model =
+            gtk_file_chooser_get_files (GTK_FILE_CHOOSER (dialog));
+        GList *files = NULL;
+        guint i;
+
+        for (i = 0; i < g_list_model_get_n_items (model); i++)
+            files = g_list_append (files, g_list_model_get_item (model, i));
+
+        if (files != NULL) {
+            GtModemTransfer *transfer =
+                gt_modem_transfer_new_send (self->serial_port, protocol, files);
+            g_autofree char *name = g_file_get_basename (G_FILE (files->data));
+            g_autofree char *message =
+                g_strdup_printf (_ ("Sending “%s” with %s…"),
+                                 name,
+                                 gt_modem_protocol_to_string (protocol));
+
+            gt_main_window_run_modem_transfer (self, transfer, message);
+        }
+
+        g_list_free_full (files, g_object_unref);
+    }
+
+    gtk_window_destroy (GTK_WINDOW (dialog));
+}
+
+void
+on_send_modem (GSimpleAction *action, GVariant *parameter, gpointer user_data)
+{
+    GtMainWindow *self = GT_MAIN_WINDOW (user_data);
+    GtModemProtocol protocol = gt_main_window_get_modem_protocol (parameter);
+    g_autofree char *title = g_strdup_printf (
+        _ ("Send File with %s"), gt_modem_protocol_to_string (protocol));
+
+    GtkWidget *file_selector =
+        gtk_file_chooser_dialog_new (title,
+                                     GTK_WINDOW (self),
+                                     GTK_FILE_CHOOSER_ACTION_OPEN,
+                                     _ ("_Cancel"),
+                                     GTK_RESPONSE_CANCEL,
+                                     _ ("_Send"),
+                                     GTK_RESPONSE_ACCEPT,
+                                     NULL);
+
+    // Only the batch protocols carry file names
+    gtk_file_chooser_set_select_multiple (
+        GTK_FILE_CHOOSER (file_selector),
+        protocol == GT_MODEM_PROTOCOL_YMODEM ||
+            protocol == GT_MODEM_PROTOCOL_ZMODEM);
+    g_object_set_data (G_OBJECT (file_selector),
+                       "modem-protocol",
+                       GINT_TO_POINTER (protocol));
+
+    gtk_dialog_set_default_response (GTK_DIALOG (file_selector),
+                                     GTK_RESPONSE_ACCEPT);
+    gtk_window_set_transient_for (GTK_WINDOW (file_selector),
+                                  GTK_WINDOW (self));
+    gtk_window_set_modal (GTK_WINDOW (file_selector), TRUE);
+
+    g_signal_connect (file_selector,
+                      "response",
+                      G_CALLBACK (on_send_modem_response),
+                      self);
+
+    gtk_widget_show (file_selector);
+}
+
+static void
+on_receive_modem_response (GtkDialog *dialog,
+                           gint response_id,
+                           gpointer user_data)
+{
+    GtMainWindow *self = GT_MAIN_WINDOW (user_data);
+    GtModemProtocol protocol = GPOINTER_TO_INT (
+        g_object_get_data (G_OBJECT (dialog), "modem-protocol"));
+
+    gtk_widget_hide (GTK_WIDGET (dialog));
+
+    if (response_id == GTK_RESPONSE_ACCEPT) {
+        g_autoptr (GFile) destination =
+            gtk_file_chooser_get_file (GTK_FILE_CHOOSER (dialog));
+        GtModemTransfer *transfer = gt_modem_transfer_new_receive (
+            self->serial_port, protocol, destination);
+        g_autofree char *message =
+            g_strdup_printf (_ ("Receiving with %s…"),
+                             gt_modem_protocol_to_string (protocol));
+
+        gt_main_window_run_modem_transfer (self, transfer, message);
+    }
+
+    gtk_window_destroy (GTK_WINDOW (dialog));
+}
+
+void
+on_receive_modem (GSimpleAction *action,
+                  GVariant *parameter,
+                  gpointer user_data)
+{
+    GtMainWindow *self = GT_MAIN_WINDOW (user_data);
+    GtModemProtocol protocol = gt_main_window_get_modem_protocol (parameter);
+    gboolean batch = protocol == GT_MODEM_PROTOCOL_YMODEM ||
+                     protocol == GT_MODEM_PROTOCOL_ZMODEM;
+    g_autofree char *title = g_strdup_printf (
+        _ ("Receive with %s"), gt_modem_protocol_to_string (protocol));
+
+    // The batch protocols send the file names, so only ask for a folder
+    GtkWidget *file_selector = gtk_file_chooser_dialog_new (
+        title,
+        GTK_WINDOW (self),
+        batch ? GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER
+              : GTK_FILE_CHOOSER_ACTION_SAVE,
+        _ ("_Cancel"),
+        GTK_RESPONSE_CANCEL,
+        _ ("_Receive"),
+        GTK_RESPONSE_ACCEPT,
+        NULL);
+    g_object_set_data (G_OBJECT (file_selector),
+                       "modem-protocol",
+                       GINT_TO_POINTER (protocol));
+
+    gtk_dialog_set_default_response (GTK_DIALOG (file_selector),
+                                     GTK_RESPONSE_ACCEPT);
+    gtk_window_set_transient_for (GTK_WINDOW (file_selector),
+                                  GTK_WINDOW (self));
+    gtk_window_set_modal (GTK_WINDOW (file_selector), TRUE);
+
+    g_signal_connect (file_selector,
+                      "response",
+                      G_CALLBACK (on_receive_modem_response),
+                      self);
+
+    gtk_widget_show (file_selector);
+}
+
+static void
+on_bert_ready (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+    GtMainWindow *self = GT_MAIN_WINDOW (user_data);
+    GError *error = NULL;
+    GtBertStats stats;
+
+    gt_bert_finish (GT_BERT (source_object), res, &stats, &error);
+
+    GtkWidget *infobar = gt_main_window_get_info_bar (self);
+
+    if (error == NULL && infobar != NULL) {
+        g_autofree char *msg = g_strdup_printf (
+            _ ("%" G_GUINT64_FORMAT " bit errors in %" G_GUINT64_FORMAT
+               " bits (BER %.2e), %" G_GUINT64_FORMAT " bad bytes, %u slips "
+               "in %.1f s"),
+            stats.bit_errors,
+            stats.bits_compared,
+            stats.bits_compared > 0
+                ? (gdouble)stats.bit_errors / (gdouble)stats.bits_compared
+                : 0.0,
+            stats.byte_errors,
+            stats.slips,
+            stats.elapsed / (gdouble)G_USEC_PER_SEC);
+
+        gt_infobar_set_label (GT_INFOBAR (infobar), msg);
+        gt_infobar_set_detail (GT_INFOBAR (infobar), NULL);
+        gt_main_window_linger_info_bar (self, infobar, 30);
+    } else {
+        gt_main_window_remove_info_bar (self, infobar);
+    }
+
+    if (error != NULL) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_autofree char *msg = g_strdup_printf (
+                _ ("Bit error rate test failed: %s"), error->message);
+            gt_main_window_show_message (self, msg, GT_MESSAGE_TYPE_ERROR);
+        }
+        g_error_free (error);
+    }
+
+    g_object_unref (source_object);
+    g_object_unref (self);
+}
+
+static void
+on_bert_progress (GObject *object, GParamSpec *pspec, gpointer user_data)
+{
+    GtBertStats stats;
+    gt_bert_get_stats (GT_BERT (object), &stats);
+
+    g_autofree char *tx = g_format_size ((guint64)stats.tx_rate);
+    g_autofree char *rx = g_format_size ((guint64)stats.rx_rate);
+    g_autofree char *detail = NULL;
+
+    if (stats.locked)
+        detail = g_strdup_printf (
+            _ ("Locked, %" G_GUINT64_FORMAT " bit errors (BER %.2e), "
+               "%u slips, sending %s/s, receiving %s/s"),
+            stats.bit_errors,
+            stats.bits_compared > 0
+                ? (gdouble)stats.bit_errors / (gdouble)stats.bits_compared
+                : 0.0,
+            stats.slips,
+            tx,
+            rx);
+    else
+        detail = g_strdup_printf (
+            _ ("Searching for the pattern, %u slips, sending %s/s, "
+               "receiving %s/s"),
+            stats.slips,
+            tx,
+            rx);
+
+    gt_infobar_set_detail (GT_INFOBAR (user_data), detail);
+}
+
+static void
+on_bert_stop (GtInfobar *infobar, gint response_id, gpointer user_data)
+{
+    gt_bert_stop (GT_BERT (user_data));
+}
+
+void
+on_bert (GSimpleAction *action, GVariant *parameter, gpointer user_data)
+{
+    GtMainWindow *self = GT_MAIN_WINDOW (user_data);
+    g_autoptr (GEnumClass) klass = g_type_class_ref (GT_TYPE_PRBS_PATTERN);
+    GEnumValue *value =
+        g_enum_get_value_by_nick (klass, g_variant_get_string (parameter, NULL));
+    GtPrbsPattern pattern = value != NULL ? (GtPrbsPattern)value->value
+                                          : GT_PRBS_PATTERN_PRBS15;
+
+    GtBert *bert = gt_bert_new (self->serial_port, pattern);
+
+    GtkWidget *infobar = gt_infobar_new ();
+    g_autofree char *message =
+        g_strdup_printf (_ ("Running bit error rate test with %s…"),
+                         gt_prbs_pattern_to_string (pattern));
+    gt_infobar_set_label (GT_INFOBAR (infobar), message);
+    gt_infobar_set_action_label (GT_INFOBAR (infobar), _ ("_Stop"));
+    gt_main_window_set_info_bar (self, infobar);
+
+    g_signal_connect_object (G_OBJECT (bert),
+                             "notify::bytes-per-second",
+                             G_CALLBACK (on_bert_progress),
+                             infobar,
+                             0);
+    g_signal_connect_object (G_OBJECT (infobar),
+                             "response",
+                             G_CALLBACK (on_bert_stop),
+                             bert,
+                             0);
+    g_signal_connect_object (G_OBJECT (infobar),
+                             "close",
+                             G_CALLBACK (gt_bert_stop),
+                             bert,
+                             G_CONNECT_SWAPPED);
+
+    gt_bert_start (bert, NULL, on_bert_ready, g_object_ref (self));
+}
+
 static void
 on_save_raw_file_response (GtkDialog *file_select, gint result, gpointer data)
 {
@@ -1246,9 +2641,17 @@ on_save_raw_file_response (GtkDialog *file_select, gint result, gpointer data)
             gt_main_window_show_message (self, msg, GT_MESSAGE_TYPE_ERROR);
         } else {
             g_autofree char *fileName = g_file_get_path (file);
+            const char *choice = gtk_file_chooser_get_choice (
+                GTK_FILE_CHOOSER (file_select), "direction");
+            GtBufferExportMode mode = GT_BUFFER_EXPORT_MODE_ALL;
+
+            if (g_strcmp0 (choice, "rx") == 0)
+                mode = GT_BUFFER_EXPORT_MODE_RX;
+            else if (g_strcmp0 (choice, "tagged") == 0)
+                mode = GT_BUFFER_EXPORT_MODE_TAGGED;
 
             GError *error = NULL;
-            gt_buffer_write_to_file (self->buffer, fileName, &error);
+            gt_buffer_write_to_file (self->buffer, fileName, mode, &error);
 
             if (error != NULL) {
                 g_autofree char *msg = g_strdup_printf (
@@ -1279,6 +2682,19 @@ on_save_raw_file (GSimpleAction *action,
                                      _ ("_OK"),
                                      GTK_RESPONSE_ACCEPT,
                                      NULL);
+    const char *options[] = {"all", "rx", "tagged", NULL};
+    const char *labels[] = {_ ("Sent and received data"),
+                            _ ("Received data only"),
+                            _ ("Sent and received data, tagged"),
+                            NULL};
+    gtk_file_chooser_add_choice (GTK_FILE_CHOOSER (file_select),
+                                 "direction",
+                                 _ ("Save"),
+                                 options,
+                                 labels);
+    gtk_file_chooser_set_choice (
+        GTK_FILE_CHOOSER (file_select), "direction", "all");
+
     gtk_window_set_modal (GTK_WINDOW (file_select), TRUE);
     g_signal_connect (
         file_select, "response", G_CALLBACK (on_save_raw_file_response), self);
@@ -1324,6 +2740,217 @@ on_config_terminal (GSimpleAction *action,
         d, "response", G_CALLBACK (on_config_terminal_response), self);
 }
 
+static void
+on_periodic_sender_ready (GObject *source_object,
+                          GAsyncResult *res,
+                          gpointer user_data)
+{
+    GtMainWindow *self = GT_MAIN_WINDOW (user_data);
+    GError *error = NULL;
+    GtPeriodicSenderStats stats;
+
+    gt_periodic_sender_finish (
+        GT_PERIODIC_SENDER (source_object), res, &stats, &error);
+
+    GtkWidget *infobar = gt_main_window_get_info_bar (self);
+
+    if (error == NULL && infobar != NULL) {
+        g_autofree char *msg = g_strdup_printf (
+            _ ("Sent %" G_GUINT64_FORMAT " times in %.1f s: period %.3f ms, "
+               "jitter %.1f µs RMS, %.1f µs max, %" G_GUINT64_FORMAT
+               " missed deadlines, %" G_GUINT64_FORMAT " skipped frames"),
+            stats.sent,
+            stats.elapsed / (gdouble)G_USEC_PER_SEC,
+            stats.period / 1000.0,
+            stats.jitter_rms,
+            stats.jitter_max,
+            stats.missed,
+            stats.skipped);
+
+        gt_infobar_set_label (GT_INFOBAR (infobar), msg);
+        gt_infobar_set_detail (GT_INFOBAR (infobar), NULL);
+        gt_main_window_linger_info_bar (self, infobar, 30);
+    } else {
+        gt_main_window_remove_info_bar (self, infobar);
+    }
+
+    if (error != NULL) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_autofree char *msg = g_strdup_printf (
+                _ ("Periodic sending failed: %s"), error->message);
+            gt_main_window_show_message (self, msg, GT_MESSAGE_TYPE_ERROR);
+        }
+        g_error_free (error);
+    }
+
+    g_object_unref (source_object);
+    g_object_unref (self);
+}
+
+static void
+on_periodic_sender_progress (GObject *object,
+                             GParamSpec *pspec,
+                             gpointer user_data)
+{
+    GtPeriodicSenderStats stats;
+    gt_periodic_sender_get_stats (GT_PERIODIC_SENDER (object), &stats);
+
+    g_autofree char *detail = g_strdup_printf (
+        _ ("%" G_GUINT64_FORMAT " sent, period %.3f ms, jitter %.1f µs RMS, "
+           "%" G_GUINT64_FORMAT " missed, %" G_GUINT64_FORMAT " skipped"),
+        stats.sent,
+        stats.period / 1000.0,
+        stats.jitter_rms,
+        stats.missed,
+        stats.skipped);
+
+    gt_infobar_set_detail (GT_INFOBAR (user_data), detail);
+}
+
+static void
+on_periodic_sender_stop (GtInfobar *infobar,
+                         gint response_id,
+                         gpointer user_data)
+{
+    gt_periodic_sender_stop (GT_PERIODIC_SENDER (user_data));
+}
+
+static void
+on_periodic_macro_response (GtkDialog *dialog,
+                            gint response_id,
+                            gpointer user_data)
+{
+    GtMainWindow *self = GT_MAIN_WINDOW (user_data);
+    GPtrArray *macros = g_object_get_data (G_OBJECT (dialog), "macros");
+    GtkDropDown *chooser = g_object_get_data (G_OBJECT (dialog), "chooser");
+    GtkSpinButton *period = g_object_get_data (G_OBJECT (dialog), "period");
+    guint selected = gtk_drop_down_get_selected (chooser);
+
+    if (response_id == GTK_RESPONSE_ACCEPT && selected < macros->len) {
+        GtMacro *macro = g_ptr_array_index (macros, selected);
+        gdouble ms = gtk_spin_button_get_value (period);
+        GtPeriodicSender *sender =
+            gt_periodic_sender_new (self->serial_port,
+                                    gt_macro_get_bytes (macro),
+                                    (gint64)(ms * 1000.0));
+
+        GtkWidget *infobar = gt_infobar_new ();
+        g_autofree char *message =
+            g_strdup_printf (_ ("Sending macro \"%s\" every %g ms…"),
+                             gt_macro_get_shortcut (macro),
+                             ms);
+        gt_infobar_set_label (GT_INFOBAR (infobar), message);
+        gt_infobar_set_action_label (GT_INFOBAR (infobar), _ ("_Stop"));
+        gt_main_window_set_info_bar (self, infobar);
+
+        g_signal_connect_object (G_OBJECT (sender),
+                                 "notify::sent",
+                                 G_CALLBACK (on_periodic_sender_progress),
+                                 infobar,
+                                 0);
+        g_signal_connect_object (G_OBJECT (infobar),
+                                 "response",
+                                 G_CALLBACK (on_periodic_sender_stop),
+                                 sender,
+                                 0);
+        g_signal_connect_object (G_OBJECT (infobar),
+                                 "close",
+                                 G_CALLBACK (gt_periodic_sender_stop),
+                                 sender,
+                                 G_CONNECT_SWAPPED);
+
+        gt_periodic_sender_start (
+            sender, NULL, on_periodic_sender_ready, g_object_ref (self));
+    }
+
+    gtk_window_destroy (GTK_WINDOW (dialog));
+}
+
+// Only plain macros can be repeated; scripts do their own timing
+void
+on_periodic_macro (GSimpleAction *action,
+                   GVariant *parameter,
+                   gpointer user_data)
+{
+    GtMainWindow *self = GT_MAIN_WINDOW (user_data);
+    GListModel *model =
+        gt_macro_manager_get_model (gt_macro_manager_get_default ());
+    GPtrArray *macros = g_ptr_array_new_with_free_func (g_object_unref);
+    GtkStringList *names = gtk_string_list_new (NULL);
+    guint i;
+
+    for (i = 0; i < g_list_model_get_n_items (model); i++) {
+        GtMacro *macro = g_list_model_get_item (model, i);
+
+        if (gt_macro_get_bytes (macro) == NULL) {
+            g_object_unref (macro);
+            continue;
+        }
+
+        g_autofree char *name = g_strdup_printf (
+            "%s  %s", gt_macro_get_shortcut (macro), gt_macro_get_action (macro));
+        gtk_string_list_append (names, name);
+        g_ptr_array_add (macros, macro);
+    }
+
+    if (macros->len == 0) {
+        gt_main_window_show_message (self,
+                                     _ ("There are no macros to send"),
+                                     GT_MESSAGE_TYPE_WARNING);
+        g_ptr_array_unref (macros);
+        g_object_unref (names);
+
+        return;
+    }
+
+    GtkWidget *dialog =
+        gtk_dialog_new_with_buttons (_ ("Send Macro Periodically"),
+                                     GTK_WINDOW (self),
+                                     GTK_DIALOG_MODAL |
+                                         GTK_DIALOG_DESTROY_WITH_PARENT,
+                                     _ ("_Cancel"),
+                                     GTK_RESPONSE_CANCEL,
+                                     _ ("_Start"),
+                                     GTK_RESPONSE_ACCEPT,
+                                     NULL);
+    gtk_dialog_set_default_response (GTK_DIALOG (dialog), GTK_RESPONSE_ACCEPT);
+
+    GtkWidget *grid = gtk_grid_new ();
+    gtk_grid_set_row_spacing (GTK_GRID (grid), 6);
+    gtk_grid_set_column_spacing (GTK_GRID (grid), 12);
+    gtk_widget_set_margin_start (grid, 12);
+    gtk_widget_set_margin_end (grid, 12);
+    gtk_widget_set_margin_top (grid, 12);
+    gtk_widget_set_margin_bottom (grid, 12);
+
+    GtkWidget *chooser = gtk_drop_down_new (G_LIST_MODEL (names), NULL);
+    gtk_widget_set_hexpand (chooser, TRUE);
+    gtk_grid_attach (GTK_GRID (grid), gtk_label_new (_ ("Macro")), 0, 0, 1, 1);
+    gtk_grid_attach (GTK_GRID (grid), chooser, 1, 0, 1, 1);
+
+    GtkWidget *period = gtk_spin_button_new_with_range (0.1, 60000.0, 0.1);
+    gtk_spin_button_set_digits (GTK_SPIN_BUTTON (period), 1);
+    gtk_spin_button_set_value (GTK_SPIN_BUTTON (period), 10.0);
+    gtk_grid_attach (
+        GTK_GRID (grid), gtk_label_new (_ ("Period (ms)")), 0, 1, 1, 1);
+    gtk_grid_attach (GTK_GRID (grid), period, 1, 1, 1, 1);
+
+    gtk_box_append (
+        GTK_BOX (gtk_dialog_get_content_area (GTK_DIALOG (dialog))), grid);
+
+    g_object_set_data_full (
+        G_OBJECT (dialog), "macros", macros, (GDestroyNotify)g_ptr_array_unref);
+    g_object_set_data (G_OBJECT (dialog), "chooser", chooser);
+    g_object_set_data (G_OBJECT (dialog), "period", period);
+
+    g_signal_connect (dialog,
+                      "response",
+                      G_CALLBACK (on_periodic_macro_response),
+                      self);
+
+    gtk_widget_show (dialog);
+}
+
 void
 on_config_macros (GSimpleAction *action,
                   GVariant *parameter,
@@ -1362,17 +2989,203 @@ on_config_profile_delete (GSimpleAction *action,
 }
 
 static void
-on_display_updated (GtMainWindow *self,
-                    gchar *text,
-                    guint length,
-                    gpointer user_data)
+on_logging_error (GtMainWindow *self, GError *error, gpointer user_data)
 {
+    gt_main_window_show_message (self, error->message, GT_MESSAGE_TYPE_ERROR);
+}
+
+static void
+on_logging_backpressure (GtMainWindow *self,
+                         GParamSpec *pspec,
+                         gpointer user_data)
+{
+    gboolean backpressure = FALSE;
+
+    g_object_get (G_OBJECT (self->logger), "backpressure", &backpressure, NULL);
+
+    if (backpressure)
+        gt_main_window_push_status (
+            self, _ ("Log file cannot keep up with the incoming data"));
+    else
+        gt_main_window_pop_status (self);
+}
+
+static void
+gt_main_window_set_replay_running (GtMainWindow *self, gboolean running)
+{
+    GAction *action = NULL;
+
+    action = g_action_map_lookup_action (G_ACTION_MAP (self->group), "replay");
+    g_simple_action_set_enabled (G_SIMPLE_ACTION (action), !running);
+    action =
+        g_action_map_lookup_action (G_ACTION_MAP (self->group), "replay-stop");
+    g_simple_action_set_enabled (G_SIMPLE_ACTION (action), running);
+}
+
+static void
+on_replay_ready (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+    GtMainWindow *self = GT_MAIN_WINDOW (user_data);
+    GtReplaySource *replay = GT_REPLAY_SOURCE (source_object);
     GError *error = NULL;
 
-    gt_logging_log (self->logger, text, length, &error);
+    gt_replay_source_finish (replay, res, &error);
+
+    // The window was closed while replaying
+    if (self->buffer == NULL) {
+        g_clear_error (&error);
+        g_clear_object (&self->replay_cancellable);
+        g_clear_object (&self->replay);
+        g_object_unref (self);
+
+        return;
+    }
+
+    gt_main_window_remove_info_bar (self, gt_main_window_get_info_bar (self));
+
     if (error != NULL) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_autofree char *msg = g_strdup_printf (
+                _ ("Failed to replay capture: %s"), error->message);
+            gt_main_window_show_message (self, msg, GT_MESSAGE_TYPE_ERROR);
+        }
+        g_error_free (error);
+    } else {
+        guint64 bytes = gt_replay_source_get_bytes (replay);
+        gdouble seconds =
+            gt_replay_source_get_elapsed (replay) / (gdouble)G_USEC_PER_SEC;
+        g_autofree char *size = g_format_size (bytes);
+        g_autofree char *rate = g_format_size (
+            seconds > 0.0 ? (guint64)(bytes / seconds) : bytes);
+        g_autofree char *msg = g_strdup_printf (
+            _ ("Replayed %s in %.2f s (%s/s)"), size, seconds, rate);
+
+        // Printed as well, so scripted replays can be used as a benchmark
+        g_message ("%s", msg);
+        gt_main_window_temp_message (self, msg, 5000);
+    }
+
+    g_clear_object (&self->replay_cancellable);
+    g_clear_object (&self->replay);
+    gt_main_window_set_replay_running (self, FALSE);
+    g_object_unref (self);
+}
+
+/* Replay a binary capture or a plain log as if it was received from the
+ * port. speed is relative to the recording, 0 replays as fast as possible */
+void
+gt_main_window_start_replay (GtMainWindow *self,
+                             const char *file_name,
+                             gdouble speed)
+{
+    GError *error = NULL;
+
+    if (self->replay != NULL)
+        return;
+
+    self->replay = gt_replay_source_new (file_name, &error);
+    if (self->replay == NULL) {
         gt_main_window_show_message (
             self, error->message, GT_MESSAGE_TYPE_ERROR);
         g_error_free (error);
+
+        return;
     }
+
+    // Plain logs have no timestamps, replay them at the line rate
+    g_object_set (G_OBJECT (self->replay),
+                  "speed",
+                  speed,
+                  "byte-rate",
+                  (guint)(config.vitesse / 10),
+                  NULL);
+
+    g_signal_connect_swapped (G_OBJECT (self->replay),
+                              "data-available",
+                              G_CALLBACK (on_serial_port_data_available),
+                              self);
+
+    GtkWidget *infobar = gt_infobar_new ();
+    g_autofree char *message =
+        g_strdup_printf (_ ("Replaying “%s”…"), file_name);
+    gt_infobar_set_label (GT_INFOBAR (infobar), message);
+    gt_main_window_set_info_bar (self, infobar);
+    g_object_bind_property (G_OBJECT (self->replay),
+                            "progress",
+                            G_OBJECT (infobar),
+                            "progress",
+                            (GBindingFlags)0);
+
+    self->replay_cancellable = g_cancellable_new ();
+    gt_main_window_set_replay_running (self, TRUE);
+    gt_replay_source_start (self->replay,
+                            self->replay_cancellable,
+                            on_replay_ready,
+                            g_object_ref (self));
+}
+
+static void
+on_replay_response (GtkDialog *dialog, gint response_id, gpointer user_data)
+{
+    GtMainWindow *self = GT_MAIN_WINDOW (user_data);
+
+    gtk_widget_hide (GTK_WIDGET (dialog));
+
+    if (response_id == GTK_RESPONSE_ACCEPT) {
+        g_autoptr (GFile) file =
+            gtk_file_chooser_get_file (GTK_FILE_CHOOSER (dialog));
+        g_autofree char *path = g_file_get_path (file);
+        const char *choice =
+            gtk_file_chooser_get_choice (GTK_FILE_CHOOSER (dialog), "speed");
+        gdouble speed = 1.0;
+
+        if (g_strcmp0 (choice, "10") == 0)
+            speed = 10.0;
+        else if (g_strcmp0 (choice, "max") == 0)
+            speed = 0.0;
+
+        gt_main_window_start_replay (self, path, speed);
+    }
+
+    gtk_window_destroy (GTK_WINDOW (dialog));
+}
+
+void
+on_replay (GSimpleAction *action, GVariant *parameter, gpointer user_data)
+{
+    GtMainWindow *self = GT_MAIN_WINDOW (user_data);
+
+    GtkWidget *file_select =
+        gtk_file_chooser_dialog_new (_ ("Replay Capture"),
+                                     GTK_WINDOW (self),
+                                     GTK_FILE_CHOOSER_ACTION_OPEN,
+                                     _ ("_Cancel"),
+                                     GTK_RESPONSE_CANCEL,
+                                     _ ("_OK"),
+                                     GTK_RESPONSE_ACCEPT,
+                                     NULL);
+    const char *options[] = {"1", "10", "max", NULL};
+    const char *labels[] = {_ ("Original timing"),
+                            _ ("Ten times faster"),
+                            _ ("As fast as possible"),
+                            NULL};
+    gtk_file_chooser_add_choice (
+        GTK_FILE_CHOOSER (file_select), "speed", _ ("Speed"), options, labels);
+    gtk_file_chooser_set_choice (GTK_FILE_CHOOSER (file_select), "speed", "1");
+
+    gtk_window_set_modal (GTK_WINDOW (file_select), TRUE);
+    g_signal_connect (
+        file_select, "response", G_CALLBACK (on_replay_response), self);
+    gtk_widget_show (file_select);
+}
+
+void
+on_replay_stop (GSimpleAction *action,
+                GVariant *parameter,
+                gpointer user_data)
+{
+    GtMainWindow *self = GT_MAIN_WINDOW (user_data);
+
+    if (self->replay_cancellable != NULL)
+        g_cancellable_cancel (self->replay_cancellable);
 }
@@ -21,6 +21,7 @@
 #include "serial-port.h"
 #include "logging.h"
 #include "buffer.h"
+#include "replay-source.h"
 
 #include <glib-object.h>
 #include <gtk/gtk.h>
@@ -50,6 +51,12 @@ struct _GtMainWindow
     GActionGroup *group;
     GtkEventController *shortcuts;
     char *default_raw_file;
+    GtReplaySource *replay;
+    GCancellable *replay_cancellable;
+    GCancellable *script_cancellable;
+    GtFileTransfer *paste;
+    GCancellable *paste_cancellable;
+    GQueue paste_queue;
 };
 
 enum _GtMessageType {
@@ -77,9 +84,13 @@ void gt_main_window_remove_info_bar (GtMainWindow *self, GtkWidget *widget);
 void
 gt_main_window_set_info_bar (GtMainWindow *self, GtkWidget *widget);
 GtkWidget *gt_main_window_get_info_bar (GtMainWindow *self);
+void gt_main_window_linger_info_bar (GtMainWindow *self,
+                                     GtkWidget *widget,
+                                     guint seconds);
 void gt_main_window_show_message (GtMainWindow *self, const char *message, GtMessageType type);
 void gt_main_window_add_shortcut (GtMainWindow *self, guint key, GdkModifierType mod, GClosure *closure);
 void gt_main_window_remove_shortcut (GtMainWindow *self, GClosure *closure);
+void gt_main_window_start_replay (GtMainWindow *self, const char *file_name, gdouble speed);
 
 G_END_DECLS
 
@@ -0,0 +1,110 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Interface between GtModemTransfer and the protocol engines. The transfer
+ * owns the port, the output queue, the timeout and the task; an engine is a
+ * state machine fed with received bytes, timeouts and "output drained"
+ * notifications */
+
+#pragma once
+
+#include "modem-transfer.h"
+
+G_BEGIN_DECLS
+
+#define GT_MODEM_SOH 0x01
+#define GT_MODEM_STX 0x02
+#define GT_MODEM_EOT 0x04
+#define GT_MODEM_ACK 0x06
+#define GT_MODEM_BS 0x08
+#define GT_MODEM_NAK 0x15
+#define GT_MODEM_CAN 0x18
+#define GT_MODEM_SUB 0x1a
+
+#define GT_MODEM_MAX_RETRIES 10
+
+typedef struct {
+    gpointer (*create) (GtModemTransfer *transfer);
+    void (*free) (gpointer engine);
+    void (*start) (gpointer engine);
+    void (*receive) (gpointer engine, const guint8 *data, gsize length);
+    void (*timeout) (gpointer engine);
+    void (*output_drained) (gpointer engine);
+} GtModemEngineFuncs;
+
+extern const GtModemEngineFuncs gt_xmodem_engine_funcs;
+extern const GtModemEngineFuncs gt_zmodem_engine_funcs;
+
+GtModemProtocol
+gt_modem_transfer_get_protocol (GtModemTransfer *self);
+
+GtModemDirection
+gt_modem_transfer_get_direction (GtModemTransfer *self);
+
+gboolean
+gt_modem_transfer_is_running (GtModemTransfer *self);
+
+GFile *
+gt_modem_transfer_next_file (GtModemTransfer *self);
+
+guint
+gt_modem_transfer_get_files_left (GtModemTransfer *self);
+
+GBytes *
+gt_modem_transfer_map_file (GtModemTransfer *self, GFile *file, GError **error);
+
+GOutputStream *
+gt_modem_transfer_create_file (GtModemTransfer *self,
+                               const char *name,
+                               GError **error);
+
+void
+gt_modem_transfer_write (GtModemTransfer *self,
+                         GBytes *bytes,
+                         gsize offset,
+                         gsize length);
+
+void
+gt_modem_transfer_write_data (GtModemTransfer *self,
+                              const void *data,
+                              gsize length);
+
+gsize
+gt_modem_transfer_get_pending (GtModemTransfer *self);
+
+void
+gt_modem_transfer_discard_output (GtModemTransfer *self);
+
+void
+gt_modem_transfer_set_timeout (GtModemTransfer *self, guint msec);
+
+void
+gt_modem_transfer_clear_timeout (GtModemTransfer *self);
+
+GtModemStats *
+gt_modem_transfer_stats (GtModemTransfer *self);
+
+void
+gt_modem_transfer_update_progress (GtModemTransfer *self);
+
+void
+gt_modem_transfer_abort (GtModemTransfer *self, GError *error);
+
+void
+gt_modem_transfer_complete (GtModemTransfer *self, GError *error);
+
+G_END_DECLS
@@ -0,0 +1,638 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* XMODEM, YMODEM and ZMODEM transfers on top of GtSerialPort. The protocol
+ * logic lives in xmodem.c and zmodem.c; this object connects them to the
+ * port and keeps the statistics */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "modem-engine.h"
+#include "modem-transfer.h"
+
+#include <string.h>
+
+#include <glib/gi18n.h>
+
+typedef struct {
+    GBytes *bytes;
+    gsize offset;
+    gsize length;
+} ModemWrite;
+
+struct _GtModemTransfer {
+    GObject parent_instance;
+
+    GtSerialPort *port;
+    GtModemProtocol protocol;
+    GtModemDirection direction;
+    GList *files;
+    GFile *destination;
+
+    const GtModemEngineFuncs *funcs;
+    gpointer engine;
+
+    GTask *task;
+    gulong data_handler;
+    GSource *cancel_source;
+    guint timeout_id;
+    gint64 start_time;
+
+    GQueue output;
+    gsize pending;
+    gboolean writing;
+
+    GtModemStats stats;
+};
+
+G_DEFINE_TYPE (GtModemTransfer, gt_modem_transfer, G_TYPE_OBJECT)
+
+enum { PROP_0, PROP_PROGRESS, PROP_BYTES_PER_SECOND, PROP_RETRIES, N_PROPS };
+
+static GParamSpec *properties[N_PROPS];
+
+static void
+modem_write_free (ModemWrite *item)
+{
+    g_bytes_unref (item->bytes);
+    g_free (item);
+}
+
+static gdouble
+gt_modem_transfer_get_bytes_per_second (GtModemTransfer *self)
+{
+    gint64 elapsed = self->stats.elapsed;
+
+    if (self->task != NULL)
+        elapsed = g_get_monotonic_time () - self->start_time;
+
+    if (elapsed <= 0)
+        return 0.0;
+
+    return (gdouble)self->stats.bytes * G_USEC_PER_SEC / elapsed;
+}
+
+static void
+gt_modem_transfer_finalize (GObject *object)
+{
+    GtModemTransfer *self = GT_MODEM_TRANSFER (object);
+
+    if (self->engine != NULL)
+        self->funcs->free (self->engine);
+
+    g_queue_clear_full (&self->output, (GDestroyNotify)modem_write_free);
+    g_list_free_full (self->files, g_object_unref);
+    g_clear_object (&self->destination);
+    g_clear_object (&self->port);
+
+    G_OBJECT_CLASS (gt_modem_transfer_parent_class)->finalize (object);
+}
+
+static void
+gt_modem_transfer_get_property (GObject *object,
+                                guint prop_id,
+                                GValue *value,
+                                GParamSpec *pspec)
+{
+    GtModemTransfer *self = GT_MODEM_TRANSFER (object);
+
+    switch (prop_id) {
+    case PROP_PROGRESS:
+        if (self->stats.total != 0)
+            g_value_set_double (value,
+                                MIN (1.0,
+                                     (gdouble)self->stats.bytes /
+                                         (gdouble)self->stats.total));
+        else
+            g_value_set_double (value, 0.0);
+        break;
+    case PROP_BYTES_PER_SECOND:
+        g_value_set_double (value,
+                            gt_modem_transfer_get_bytes_per_second (self));
+        break;
+    case PROP_RETRIES:
+        g_value_set_uint (value, self->stats.retries);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gt_modem_transfer_class_init (GtModemTransferClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    object_class->finalize = gt_modem_transfer_finalize;
+    object_class->get_property = gt_modem_transfer_get_property;
+
+    properties[PROP_PROGRESS] =
+        g_param_spec_double ("progress",
+                             "progress",
+                             "progress",
+                             0.0,
+                             1.0,
+                             0.0,
+                             G_PARAM_STATIC_STRINGS | G_PARAM_READABLE);
+    properties[PROP_BYTES_PER_SECOND] =
+        g_param_spec_double ("bytes-per-second",
+                             "bytes-per-second",
+                             "Average payload throughput",
+                             0.0,
+                             G_MAXDOUBLE,
+                             0.0,
+                             G_PARAM_STATIC_STRINGS | G_PARAM_READABLE);
+    properties[PROP_RETRIES] =
+        g_param_spec_uint ("retries",
+                           "retries",
+                           "Number of repeated blocks or frames",
+                           0,
+                           G_MAXUINT,
+                           0,
+                           G_PARAM_STATIC_STRINGS | G_PARAM_READABLE);
+
+    g_object_class_install_properties (object_class, N_PROPS, properties);
+}
+
+static void
+gt_modem_transfer_init (GtModemTransfer *self)
+{
+    g_queue_init (&self->output);
+}
+
+static GtModemTransfer *
+gt_modem_transfer_new (GtSerialPort *port,
+                       GtModemProtocol protocol,
+                       GtModemDirection direction)
+{
+    GtModemTransfer *self = g_object_new (GT_TYPE_MODEM_TRANSFER, NULL);
+
+    self->port = g_object_ref (port);
+    self->protocol = protocol;
+    self->direction = direction;
+    self->funcs = protocol == GT_MODEM_PROTOCOL_ZMODEM
+                      ? &gt_zmodem_engine_funcs
+                      : &gt_xmodem_engine_funcs;
+
+    return self;
+}
+
+GtModemTransfer *
+gt_modem_transfer_new_send (GtSerialPort *port,
+                            GtModemProtocol protocol,
+                            GList *files)
+{
+    GtModemTransfer *self =
+        gt_modem_transfer_new (port, protocol, GT_MODEM_DIRECTION_SEND);
+
+    self->files = g_list_copy_deep (files, (GCopyFunc)g_object_ref, NULL);
+
+    // XMODEM has no notion of file names, so only the first file is sent
+    if (protocol == GT_MODEM_PROTOCOL_XMODEM ||
+        protocol == GT_MODEM_PROTOCOL_XMODEM_1K) {
+        GList *rest = g_list_next (self->files);
+        if (rest != NULL) {
+            rest->prev->next = NULL;
+            rest->prev = NULL;
+            g_list_free_full (rest, g_object_unref);
+        }
+    }
+
+    return self;
+}
+
+GtModemTransfer *
+gt_modem_transfer_new_receive (GtSerialPort *port,
+                               GtModemProtocol protocol,
+                               GFile *destination)
+{
+    GtModemTransfer *self =
+        gt_modem_transfer_new (port, protocol, GT_MODEM_DIRECTION_RECEIVE);
+
+    self->destination = g_object_ref (destination);
+
+    return self;
+}
+
+static void
+on_modem_data_available (GtSerialPort *port, GBytes *data, gpointer user_data)
+{
+    GtModemTransfer *self = GT_MODEM_TRANSFER (user_data);
+    gsize size = 0;
+    const guint8 *bytes = g_bytes_get_data (data, &size);
+
+    if (self->task == NULL || size == 0)
+        return;
+
+    self->funcs->receive (self->engine, bytes, size);
+}
+
+static gboolean
+on_modem_cancelled (GCancellable *cancellable, gpointer user_data)
+{
+    GtModemTransfer *self = GT_MODEM_TRANSFER (user_data);
+    GError *error = NULL;
+
+    g_cancellable_set_error_if_cancelled (cancellable, &error);
+    gt_modem_transfer_abort (self, error);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+gt_modem_transfer_query_total (GtModemTransfer *self)
+{
+    GList *iter;
+
+    for (iter = self->files; iter != NULL; iter = iter->next) {
+        g_autoptr (GFileInfo) info =
+            g_file_query_info (G_FILE (iter->data),
+                               G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                               G_FILE_QUERY_INFO_NONE,
+                               NULL,
+                               NULL);
+        if (info != NULL)
+            self->stats.total += g_file_info_get_size (info);
+    }
+}
+
+void
+gt_modem_transfer_start (GtModemTransfer *self,
+                         GCancellable *cancellable,
+                         GAsyncReadyCallback callback,
+                         gpointer user_data)
+{
+    g_return_if_fail (self->task == NULL && self->engine == NULL);
+
+    self->task = g_task_new (self, cancellable, callback, user_data);
+    g_task_set_name (self->task, "Modem transfer");
+    self->start_time = g_get_monotonic_time ();
+    gt_modem_transfer_query_total (self);
+
+    self->data_handler =
+        g_signal_connect (G_OBJECT (self->port),
+                          "data-available",
+                          G_CALLBACK (on_modem_data_available),
+                          self);
+
+    if (cancellable != NULL) {
+        self->cancel_source = g_cancellable_source_new (cancellable);
+        g_source_set_callback (self->cancel_source,
+                               G_SOURCE_FUNC (on_modem_cancelled),
+                               self,
+                               NULL);
+        g_source_attach (self->cancel_source, NULL);
+    }
+
+    self->engine = self->funcs->create (self);
+    self->funcs->start (self->engine);
+}
+
+gboolean
+gt_modem_transfer_finish (GtModemTransfer *self,
+                          GAsyncResult *res,
+                          GError **error)
+{
+    g_return_val_if_fail (g_task_is_valid (G_TASK (res), self), FALSE);
+
+    return g_task_propagate_boolean (G_TASK (res), error);
+}
+
+void
+gt_modem_transfer_get_stats (GtModemTransfer *self, GtModemStats *stats)
+{
+    *stats = self->stats;
+    if (self->task != NULL)
+        stats->elapsed = g_get_monotonic_time () - self->start_time;
+}
+
+const char *
+gt_modem_protocol_to_string (GtModemProtocol protocol)
+{
+    switch (protocol) {
+    case GT_MODEM_PROTOCOL_XMODEM:
+        return "XMODEM";
+    case GT_MODEM_PROTOCOL_XMODEM_1K:
+        return "XMODEM-1K";
+    case GT_MODEM_PROTOCOL_YMODEM:
+        return "YMODEM";
+    case GT_MODEM_PROTOCOL_ZMODEM:
+        return "ZMODEM";
+    default:
+        g_assert_not_reached ();
+    }
+}
+
+// Engine services
+
+GtModemProtocol
+gt_modem_transfer_get_protocol (GtModemTransfer *self)
+{
+    return self->protocol;
+}
+
+GtModemDirection
+gt_modem_transfer_get_direction (GtModemTransfer *self)
+{
+    return self->direction;
+}
+
+gboolean
+gt_modem_transfer_is_running (GtModemTransfer *self)
+{
+    return self->task != NULL;
+}
+
+GFile *
+gt_modem_transfer_next_file (GtModemTransfer *self)
+{
+    GFile *file = NULL;
+
+    if (self->files == NULL)
+        return NULL;
+
+    file = G_FILE (self->files->data);
+    self->files = g_list_delete_link (self->files, self->files);
+
+    return file;
+}
+
+guint
+gt_modem_transfer_get_files_left (GtModemTransfer *self)
+{
+    return g_list_length (self->files);
+}
+
+GBytes *
+gt_modem_transfer_map_file (GtModemTransfer *self, GFile *file, GError **error)
+{
+    g_autofree char *path = g_file_get_path (file);
+
+    if (path == NULL) {
+        g_autofree char *uri = g_file_get_uri (file);
+        g_set_error (error,
+                     G_IO_ERROR,
+                     G_IO_ERROR_NOT_SUPPORTED,
+                     _ ("Only local files can be sent: %s"),
+                     uri);
+
+        return NULL;
+    }
+
+    GMappedFile *mapped = g_mapped_file_new (path, FALSE, error);
+    if (mapped == NULL)
+        return NULL;
+
+    GBytes *bytes = g_mapped_file_get_bytes (mapped);
+    g_mapped_file_unref (mapped);
+
+    return bytes;
+}
+
+GOutputStream *
+gt_modem_transfer_create_file (GtModemTransfer *self,
+                               const char *name,
+                               GError **error)
+{
+    g_autoptr (GFile) file = NULL;
+
+    if (name == NULL) {
+        file = g_object_ref (self->destination);
+    } else {
+        // Never let the remote side choose a directory
+        g_autofree char *base = g_path_get_basename (name);
+        if (g_str_equal (base, ".") || g_str_equal (base, "..") ||
+            g_str_equal (base, G_DIR_SEPARATOR_S))
+            file = g_file_get_child (self->destination, "received");
+        else
+            file = g_file_get_child (self->destination, base);
+    }
+
+    return G_OUTPUT_STREAM (
+        g_file_replace (file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, error));
+}
+
+static void
+gt_modem_transfer_kick (GtModemTransfer *self);
+
+static void
+on_modem_write_ready (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+    GtModemTransfer *self = GT_MODEM_TRANSFER (user_data);
+    GError *error = NULL;
+
+    gt_serial_port_write_bytes_finish (GT_SERIAL_PORT (source), res, &error);
+
+    self->writing = FALSE;
+    ModemWrite *item = g_queue_pop_head (&self->output);
+    if (item != NULL) {
+        self->pending -= item->length;
+        modem_write_free (item);
+    }
+
+    if (error != NULL) {
+        gt_modem_transfer_complete (self, error);
+    } else if (self->task != NULL) {
+        if (g_queue_is_empty (&self->output))
+            self->funcs->output_drained (self->engine);
+        else
+            gt_modem_transfer_kick (self);
+    }
+
+    g_object_unref (self);
+}
+
+static void
+gt_modem_transfer_kick (GtModemTransfer *self)
+{
+    if (self->writing || self->task == NULL)
+        return;
+
+    ModemWrite *item = g_queue_peek_head (&self->output);
+    if (item == NULL)
+        return;
+
+    self->writing = TRUE;
+    gt_serial_port_write_range_async (self->port,
+                                      item->bytes,
+                                      item->offset,
+                                      item->length,
+                                      NULL,
+                                      NULL,
+                                      on_modem_write_ready,
+                                      g_object_ref (self));
+}
+
+void
+gt_modem_transfer_write (GtModemTransfer *self,
+                         GBytes *bytes,
+                         gsize offset,
+                         gsize length)
+{
+    if (length == 0)
+        return;
+
+    ModemWrite *item = g_new0 (ModemWrite, 1);
+    item->bytes = g_bytes_ref (bytes);
+    item->offset = offset;
+    item->length = length;
+    g_queue_push_tail (&self->output, item);
+    self->pending += length;
+
+    gt_modem_transfer_kick (self);
+}
+
+void
+gt_modem_transfer_write_data (GtModemTransfer *self,
+                              const void *data,
+                              gsize length)
+{
+    g_autoptr (GBytes) bytes = g_bytes_new (data, length);
+
+    gt_modem_transfer_write (self, bytes, 0, length);
+}
+
+gsize
+gt_modem_transfer_get_pending (GtModemTransfer *self)
+{
+    return self->pending;
+}
+
+// Drop everything that has not been handed to the port yet
+void
+gt_modem_transfer_discard_output (GtModemTransfer *self)
+{
+    ModemWrite *in_flight = NULL;
+
+    if (self->writing)
+        in_flight = g_queue_pop_head (&self->output);
+
+    g_queue_clear_full (&self->output, (GDestroyNotify)modem_write_free);
+    self->pending = 0;
+
+    if (in_flight != NULL) {
+        g_queue_push_head (&self->output, in_flight);
+        self->pending = in_flight->length;
+    }
+}
+
+static gboolean
+on_modem_timeout (gpointer user_data)
+{
+    GtModemTransfer *self = GT_MODEM_TRANSFER (user_data);
+
+    self->timeout_id = 0;
+    self->stats.timeouts++;
+    self->funcs->timeout (self->engine);
+
+    return G_SOURCE_REMOVE;
+}
+
+void
+gt_modem_transfer_set_timeout (GtModemTransfer *self, guint msec)
+{
+    gt_modem_transfer_clear_timeout (self);
+    self->timeout_id = g_timeout_add (msec, on_modem_timeout, self);
+}
+
+void
+gt_modem_transfer_clear_timeout (GtModemTransfer *self)
+{
+    if (self->timeout_id != 0) {
+        g_source_remove (self->timeout_id);
+        self->timeout_id = 0;
+    }
+}
+
+GtModemStats *
+gt_modem_transfer_stats (GtModemTransfer *self)
+{
+    return &self->stats;
+}
+
+void
+gt_modem_transfer_update_progress (GtModemTransfer *self)
+{
+    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_PROGRESS]);
+    g_object_notify_by_pspec (G_OBJECT (self),
+                              properties[PROP_BYTES_PER_SECOND]);
+}
+
+// Tell the other side to stop, then fail the transfer
+void
+gt_modem_transfer_abort (GtModemTransfer *self, GError *error)
+{
+    static const guint8 abort_sequence[] = {
+        GT_MODEM_CAN, GT_MODEM_CAN, GT_MODEM_CAN, GT_MODEM_CAN,
+        GT_MODEM_CAN, GT_MODEM_CAN, GT_MODEM_CAN, GT_MODEM_CAN,
+        GT_MODEM_BS,  GT_MODEM_BS,  GT_MODEM_BS,  GT_MODEM_BS,
+        GT_MODEM_BS,  GT_MODEM_BS,  GT_MODEM_BS,  GT_MODEM_BS};
+
+    if (self->task == NULL) {
+        g_clear_error (&error);
+
+        return;
+    }
+
+    // Bypass the queue, the transfer is over once this returns
+    g_autoptr (GBytes) bytes =
+        g_bytes_new_static (abort_sequence, sizeof (abort_sequence));
+    gt_serial_port_write_bytes_async (self->port, bytes, NULL, NULL, NULL);
+
+    gt_modem_transfer_complete (self, error);
+}
+
+void
+gt_modem_transfer_complete (GtModemTransfer *self, GError *error)
+{
+    GTask *task = g_steal_pointer (&self->task);
+
+    if (task == NULL) {
+        g_clear_error (&error);
+
+        return;
+    }
+
+    self->stats.elapsed = g_get_monotonic_time () - self->start_time;
+
+    gt_modem_transfer_clear_timeout (self);
+    g_clear_signal_handler (&self->data_handler, self->port);
+    if (self->cancel_source != NULL) {
+        g_source_destroy (self->cancel_source);
+        g_clear_pointer (&self->cancel_source, g_source_unref);
+    }
+
+    g_debug ("%s transfer done: %" G_GUINT64_FORMAT " bytes, %u blocks, "
+             "%u retries, %u timeouts",
+             gt_modem_protocol_to_string (self->protocol),
+             self->stats.bytes,
+             self->stats.blocks,
+             self->stats.retries,
+             self->stats.timeouts);
+
+    gt_modem_transfer_update_progress (self);
+    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_RETRIES]);
+
+    if (error != NULL)
+        g_task_return_error (task, error);
+    else
+        g_task_return_boolean (task, TRUE);
+
+    g_object_unref (task);
+}
@@ -0,0 +1,81 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "serial-port.h"
+
+#include <gio/gio.h>
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+    GT_MODEM_PROTOCOL_XMODEM,
+    GT_MODEM_PROTOCOL_XMODEM_1K,
+    GT_MODEM_PROTOCOL_YMODEM,
+    GT_MODEM_PROTOCOL_ZMODEM
+} GtModemProtocol;
+
+typedef enum {
+    GT_MODEM_DIRECTION_SEND,
+    GT_MODEM_DIRECTION_RECEIVE
+} GtModemDirection;
+
+typedef struct {
+    guint64 bytes;
+    guint64 total;
+    guint blocks;
+    guint retries;
+    guint timeouts;
+    guint files;
+    gint64 elapsed;
+} GtModemStats;
+
+#define GT_TYPE_MODEM_TRANSFER (gt_modem_transfer_get_type ())
+
+G_DECLARE_FINAL_TYPE (
+    GtModemTransfer, gt_modem_transfer, GT, MODEM_TRANSFER, GObject)
+
+GtModemTransfer *
+gt_modem_transfer_new_send (GtSerialPort *port,
+                            GtModemProtocol protocol,
+                            GList *files);
+
+GtModemTransfer *
+gt_modem_transfer_new_receive (GtSerialPort *port,
+                               GtModemProtocol protocol,
+                               GFile *destination);
+
+void
+gt_modem_transfer_start (GtModemTransfer *self,
+                         GCancellable *cancellable,
+                         GAsyncReadyCallback callback,
+                         gpointer user_data);
+
+gboolean
+gt_modem_transfer_finish (GtModemTransfer *self,
+                          GAsyncResult *res,
+                          GError **error);
+
+void
+gt_modem_transfer_get_stats (GtModemTransfer *self, GtModemStats *stats);
+
+const char *
+gt_modem_protocol_to_string (GtModemProtocol protocol);
+
+G_END_DECLS
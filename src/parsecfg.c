@@ -103,6 +103,8 @@ static int
 dump_simple (FILE *fp, cfgStruct cfg[], cfgFileType type);
 static int
 dump_ini (FILE *fp, cfgStruct cfg[], cfgFileType type, int max);
+static int
+dump_ini_section (FILE *fp, cfgStruct cfg[], int j);
 static void
 single_or_double_quote (const char *str, char *ret);
 
@@ -133,6 +135,8 @@ fetch_value (const char *file,
 
 static char **parsecfg_section_name = NULL;
 static int parsecfg_maximum_section;
+/* sections the cfg arrays hold, even if a parse stopped half-way */
+static int parsecfg_allocated_sections;
 
 /*************************************************************/
 /*                      PUBLIC FUCNCTIONS                    */
@@ -196,6 +200,7 @@ cfgParse (const char *file, cfgStruct cfg[], cfgFileType type)
                 CFG_NO_ERROR) {
                 fclose (fp);
                 cfgFatal (error_code, file, line, line_buf);
+                free (line_buf);
                 return (-1);
             }
             break;
@@ -204,11 +209,13 @@ cfgParse (const char *file, cfgStruct cfg[], cfgFileType type)
                      file, fp, ptr, cfg, &line, &max_cfg)) != CFG_NO_ERROR) {
                 fclose (fp);
                 cfgFatal (error_code, file, line, line_buf);
+                free (line_buf);
                 return (-1);
             }
             break;
         default:
             fclose (fp);
+            free (line_buf);
             cfgFatal (CFG_INTERNAL_ERROR, file, 0, NULL);
             return (-1);
         }
@@ -260,6 +267,26 @@ cfgDump (const char *file, cfgStruct cfg[], cfgFileType type, int max_section)
     return (retcode);
 }
 
+/* --------------------------------------------------
+   NAME       cfgDumpSection
+   FUNCTION   write a single section of an INI-like configuration
+              to an open stream, in the same format as cfgDump
+   INPUT      fp ... stream to write to
+              cfg .... array of possible variables
+              section ... the section number
+   OUTPUT     0 on success and -1 on error
+   -------------------------------------------------- */
+int
+cfgDumpSection (FILE *fp, cfgStruct cfg[], int section)
+{
+    if (section < 0 || section >= parsecfg_maximum_section) {
+        cfgFatal (CFG_INTERNAL_ERROR, "?", 0, NULL);
+        return (-1);
+    }
+
+    return (dump_ini_section (fp, cfg, section));
+}
+
 /* --------------------------------------------------
    NAME       fetchVarFromCfgFile
    FUNCTION   fetch specified variable from configuration file
@@ -412,6 +439,66 @@ cfgStoreValue (cfgStruct cfg[],
     return (0);
 }
 
+/* --------------------------------------------------
+   NAME       cfgFree
+   FUNCTION   free everything a CFG_INI parse allocated: the
+              per-section arrays, the strings and string lists
+              in them and the section names, so the file can be
+              parsed again without leaking
+   INPUT      cfg ... array of possible variables
+   OUTPUT     none
+   -------------------------------------------------- */
+void
+cfgFree (cfgStruct cfg[])
+{
+    int num;
+    int section;
+    char **strings;
+    cfgList **lists;
+    cfgList *listptr;
+    cfgList *next;
+
+    for (num = 0; cfg[num].type != CFG_END; num++) {
+        switch (cfg[num].type) {
+        case CFG_STRING:
+            strings = *(char ***)(cfg[num].value);
+            for (section = 0;
+                 strings != NULL && section < parsecfg_allocated_sections;
+                 section++) {
+                free (strings[section]);
+            }
+            break;
+        case CFG_STRING_LIST:
+            lists = *(cfgList ***)(cfg[num].value);
+            for (section = 0;
+                 lists != NULL && section < parsecfg_allocated_sections;
+                 section++) {
+                for (listptr = lists[section]; listptr != NULL;
+                     listptr = next) {
+                    next = listptr->next;
+                    free (listptr->str);
+                    free (listptr);
+                }
+            }
+            break;
+        default:
+            break;
+        }
+        free (*(void **)(cfg[num].value));
+        *(void **)(cfg[num].value) = NULL;
+    }
+
+    if (parsecfg_section_name != NULL) {
+        for (section = 0; section < parsecfg_allocated_sections; section++) {
+            free (parsecfg_section_name[section]);
+        }
+        free (parsecfg_section_name);
+        parsecfg_section_name = NULL;
+    }
+    parsecfg_allocated_sections = 0;
+    parsecfg_maximum_section = 0;
+}
+
 /*************************************************************/
 /*                     PRIVATE FUCNCTIONS                    */
 /*************************************************************/
@@ -629,6 +716,7 @@ parse_word (char *ptr, char **word, cfgKeywordValue word_type)
     case CFG_PARAMETER:
         if (*ptr != '=') {
             free (*word);
+            *word = NULL;
             return (NULL);
         }
         ptr++;
@@ -637,17 +725,20 @@ parse_word (char *ptr, char **word, cfgKeywordValue word_type)
     case CFG_VALUE:
         if (*ptr != '\0' && *ptr != '#') {
             free (*word);
+            *word = NULL;
             return (NULL);
         }
         break;
     case CFG_SECTION:
         if (*ptr != ']') {
             free (*word);
+            *word = NULL;
             return (NULL);
         }
         break;
     default:
         free (*word);
+        *word = NULL;
         return (NULL);
     }
     return (ptr);
@@ -948,6 +1039,7 @@ parse_ini (const char *file,
 
         parsecfg_section_name =
             realloc (parsecfg_section_name, sizeof (char *) * (*section + 1));
+        parsecfg_section_name[*section] = NULL;
 
         if ((ptr = parse_word (
                  ptr, &parsecfg_section_name[*section], CFG_SECTION)) == NULL) {
@@ -1106,6 +1198,7 @@ alloc_for_new_section (cfgStruct cfg[], int *section)
             return (CFG_INTERNAL_ERROR);
         }
     }
+    parsecfg_allocated_sections = *section + 1;
     return (CFG_NO_ERROR);
 }
 
@@ -1285,91 +1378,110 @@ dump_simple (FILE *fp, cfgStruct cfg[], cfgFileType type)
 static int
 dump_ini (FILE *fp, cfgStruct cfg[], cfgFileType type, int max)
 {
-    int i, j;
+    int j;
+
+    for (j = 0; j < max; j++) {
+        if (dump_ini_section (fp, cfg, j) == -1) {
+            return (-1);
+        }
+    }
+    return (0);
+}
+
+/* --------------------------------------------------
+   NAME       dump_ini_section
+   FUNCTION   write one section, header included
+   INPUT      fp ... stream to write to
+              cfg ... array of possible variables
+              j ... section number
+   OUTPUT     0 on success, -1 on error
+   -------------------------------------------------- */
+static int
+dump_ini_section (FILE *fp, cfgStruct cfg[], int j)
+{
+    int i;
     char c[2];
     cfgList *l;
 
-    for (j = 0; j < max; j++) {
-        single_or_double_quote (cfgSectionNumberToName (j), c);
-        fprintf (fp, "[%s%s%s]\n", c, cfgSectionNumberToName (j), c);
+    single_or_double_quote (cfgSectionNumberToName (j), c);
+    fprintf (fp, "[%s%s%s]\n", c, cfgSectionNumberToName (j), c);
 
-        for (i = 0; cfg[i].type != CFG_END; i++) {
-            switch (cfg[i].type) {
-            case CFG_BOOL:
-                fprintf (fp,
-                         "%s\t= %s\n",
-                         cfg[i].parameterName,
-                         (*(int **)(cfg[i].value))[j] ? "True" : "False");
-                break;
-            case CFG_INT:
-                fprintf (fp,
-                         "%s\t= %d\n",
-                         cfg[i].parameterName,
-                         (*(int **)(cfg[i].value))[j]);
-                break;
-            case CFG_UINT:
-                fprintf (fp,
-                         "%s\t= %u\n",
-                         cfg[i].parameterName,
-                         (*(unsigned int **)(cfg[i].value))[j]);
-                break;
-            case CFG_LONG:
-                fprintf (fp,
-                         "%s\t= %ld\n",
-                         cfg[i].parameterName,
-                         (*(long **)(cfg[i].value))[j]);
-                break;
-            case CFG_ULONG:
-                fprintf (fp,
-                         "%s\t= %lu\n",
-                         cfg[i].parameterName,
-                         (*(unsigned long **)(cfg[i].value))[j]);
+    for (i = 0; cfg[i].type != CFG_END; i++) {
+        switch (cfg[i].type) {
+        case CFG_BOOL:
+            fprintf (fp,
+                     "%s\t= %s\n",
+                     cfg[i].parameterName,
+                     (*(int **)(cfg[i].value))[j] ? "True" : "False");
+            break;
+        case CFG_INT:
+            fprintf (fp,
+                     "%s\t= %d\n",
+                     cfg[i].parameterName,
+                     (*(int **)(cfg[i].value))[j]);
+            break;
+        case CFG_UINT:
+            fprintf (fp,
+                     "%s\t= %u\n",
+                     cfg[i].parameterName,
+                     (*(unsigned int **)(cfg[i].value))[j]);
+            break;
+        case CFG_LONG:
+            fprintf (fp,
+                     "%s\t= %ld\n",
+                     cfg[i].parameterName,
+                     (*(long **)(cfg[i].value))[j]);
+            break;
+        case CFG_ULONG:
+            fprintf (fp,
+                     "%s\t= %lu\n",
+                     cfg[i].parameterName,
+                     (*(unsigned long **)(cfg[i].value))[j]);
+            break;
+        case CFG_STRING:
+            if ((*(char ***)(cfg[i].value))[j] == NULL) {
                 break;
-            case CFG_STRING:
-                if ((*(char ***)(cfg[i].value))[j] == NULL) {
-                    break;
-                }
-                single_or_double_quote ((*(char ***)(cfg[i].value))[j], c);
+            }
+            single_or_double_quote ((*(char ***)(cfg[i].value))[j], c);
+            fprintf (fp,
+                     "%s\t= %s%s%s\n",
+                     cfg[i].parameterName,
+                     c,
+                     (*(char ***)(cfg[i].value))[j],
+                     c);
+            break;
+        case CFG_STRING_LIST:
+            for (l = (*(cfgList ***)(cfg[i].value))[j]; l != NULL;
+                 l = l->next) {
+                single_or_double_quote (l->str, c);
                 fprintf (fp,
                          "%s\t= %s%s%s\n",
                          cfg[i].parameterName,
                          c,
-                         (*(char ***)(cfg[i].value))[j],
+                         l->str,
                          c);
-                break;
-            case CFG_STRING_LIST:
-                for (l = (*(cfgList ***)(cfg[i].value))[j]; l != NULL;
-                     l = l->next) {
-                    single_or_double_quote (l->str, c);
-                    fprintf (fp,
-                             "%s\t= %s%s%s\n",
-                             cfg[i].parameterName,
-                             c,
-                             l->str,
-                             c);
-                }
-                break;
-            case CFG_FLOAT:
-                fprintf (fp,
-                         "%s\t= %f\n",
-                         cfg[i].parameterName,
-                         (*(float **)(cfg[i].value))[j]);
-                break;
-            case CFG_DOUBLE:
-                fprintf (fp,
-                         "%s\t= %f\n",
-                         cfg[i].parameterName,
-                         (*(double **)(cfg[i].value))[j]);
-                break;
-            case CFG_END:
-                g_assert_not_reached ();
-            default:
-                cfgFatal (CFG_INTERNAL_ERROR, "?", 0, NULL);
-                return (-1);
             }
+            break;
+        case CFG_FLOAT:
+            fprintf (fp,
+                     "%s\t= %f\n",
+                     cfg[i].parameterName,
+                     (*(float **)(cfg[i].value))[j]);
+            break;
+        case CFG_DOUBLE:
+            fprintf (fp,
+                     "%s\t= %f\n",
+                     cfg[i].parameterName,
+                     (*(double **)(cfg[i].value))[j]);
+            break;
+        case CFG_END:
+            g_assert_not_reached ();
+        default:
+            cfgFatal (CFG_INTERNAL_ERROR, "?", 0, NULL);
+            return (-1);
         }
-        fprintf (fp, "\n");
     }
+    fprintf (fp, "\n");
     return (0);
 }
 
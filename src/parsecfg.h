@@ -42,6 +42,8 @@
 #ifndef PARSECFG_H_INCLUDED
 #define PARSECFG_H_INCLUDED
 
+#include <stdio.h>
+
 #undef PARSECFG_VERSION
 #define PARSECFG_VERSION "3.6.7"
 
@@ -112,6 +114,8 @@ cfgParse (const char *file, cfgStruct cfg[], cfgFileType type);
 int
 cfgDump (const char *file, cfgStruct cfg[], cfgFileType type, int max_section);
 int
+cfgDumpSection (FILE *fp, cfgStruct cfg[], int section);
+int
 fetchVarFromCfgFile (const char *file,
                      char *parameter_name,
                      void *result_value,
@@ -131,6 +135,8 @@ cfgStoreValue (cfgStruct cfg[],
                const char *value,
                cfgFileType type,
                int section);
+void
+cfgFree (cfgStruct cfg[]);
 
 #ifdef __cplusplus
 }
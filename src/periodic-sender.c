@@ -0,0 +1,635 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Sends the same data at a fixed rate for load testing. A worker thread
+ * sleeps on absolute deadlines, with a timerfd where available, so neither
+ * main loop latency nor accumulated rounding makes the period drift. At each
+ * deadline the thread hands the frame to the main thread, which sends it with
+ * gt_serial_port_write_bytes_async() like any other data. The frame therefore
+ * goes through the pacer and the RS485 handling, shows up in "data-sent" and
+ * never interleaves with other writes. At most one frame is in flight; a
+ * frame that cannot start before the next deadline is skipped whole. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "periodic-sender.h"
+
+#include <glib/gi18n.h>
+
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+
+#ifdef HAVE_TIMERFD
+#include <sys/timerfd.h>
+#endif
+
+#define PERIODIC_SENDER_NOTIFY_INTERVAL 250
+#define PERIODIC_SENDER_MIN_PERIOD 100
+
+struct _GtPeriodicSender {
+    GObject parent_instance;
+    GtSerialPort *port;
+    GBytes *data;
+    gint64 period;
+
+    GTask *task;
+    GCancellable *stop;
+    GSource *cancel_source;
+    GMainContext *context;
+    gulong status_handler;
+    guint notify_id;
+
+    // Set by the worker when it hands over a frame, cleared by the main thread
+    // once the frame is written or dropped
+    gint in_flight;
+    gboolean worker_done;
+    GError *error;
+    gint64 frame_start;
+    gint64 frame_slot;
+
+    // Written by both threads, read by the main thread
+    GMutex lock;
+    GtPeriodicSenderStats stats;
+    gint64 start_time;
+    gint64 first_send;
+    gint64 last_send;
+    gint64 last_slot;
+    gdouble deviation_sq;
+};
+
+typedef struct {
+    GtPeriodicSender *self;
+    // The deadline the frame belongs to and the one after it
+    gint64 slot;
+    gint64 deadline;
+} GtPeriodicFrame;
+
+G_DEFINE_TYPE (GtPeriodicSender, gt_periodic_sender, G_TYPE_OBJECT)
+
+enum { PROP_0, PROP_SERIAL_PORT, PROP_DATA, PROP_PERIOD, PROP_SENT, N_PROPS };
+
+static GParamSpec *properties[N_PROPS];
+
+static void
+gt_periodic_sender_dispose (GObject *object)
+{
+    GtPeriodicSender *self = (GtPeriodicSender *)object;
+
+    g_clear_signal_handler (&self->status_handler, self->port);
+    g_clear_handle_id (&self->notify_id, g_source_remove);
+
+    if (self->cancel_source != NULL) {
+        g_source_destroy (self->cancel_source);
+        g_clear_pointer (&self->cancel_source, g_source_unref);
+    }
+
+    G_OBJECT_CLASS (gt_periodic_sender_parent_class)->dispose (object);
+}
+
+static void
+gt_periodic_sender_finalize (GObject *object)
+{
+    GtPeriodicSender *self = (GtPeriodicSender *)object;
+
+    g_clear_error (&self->error);
+    g_clear_pointer (&self->context, g_main_context_unref);
+    g_mutex_clear (&self->lock);
+    g_clear_pointer (&self->data, g_bytes_unref);
+    g_clear_object (&self->stop);
+    g_clear_object (&self->port);
+
+    G_OBJECT_CLASS (gt_periodic_sender_parent_class)->finalize (object);
+}
+
+static void
+gt_periodic_sender_get_property (GObject *object,
+                                 guint prop_id,
+                                 GValue *value,
+                                 GParamSpec *pspec)
+{
+    GtPeriodicSender *self = GT_PERIODIC_SENDER (object);
+
+    switch (prop_id) {
+    case PROP_DATA:
+        g_value_set_boxed (value, self->data);
+        break;
+    case PROP_PERIOD:
+        g_value_set_int64 (value, self->period);
+        break;
+    case PROP_SENT:
+        g_mutex_lock (&self->lock);
+        g_value_set_uint64 (value, self->stats.sent);
+        g_mutex_unlock (&self->lock);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gt_periodic_sender_set_property (GObject *object,
+                                 guint prop_id,
+                                 const GValue *value,
+                                 GParamSpec *pspec)
+{
+    GtPeriodicSender *self = GT_PERIODIC_SENDER (object);
+
+    switch (prop_id) {
+    case PROP_SERIAL_PORT:
+        self->port = GT_SERIAL_PORT (g_value_dup_object (value));
+        break;
+    case PROP_DATA:
+        self->data = g_value_dup_boxed (value);
+        break;
+    case PROP_PERIOD:
+        self->period = g_value_get_int64 (value);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gt_periodic_sender_class_init (GtPeriodicSenderClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    object_class->dispose = gt_periodic_sender_dispose;
+    object_class->finalize = gt_periodic_sender_finalize;
+    object_class->get_property = gt_periodic_sender_get_property;
+    object_class->set_property = gt_periodic_sender_set_property;
+
+    properties[PROP_SERIAL_PORT] = g_param_spec_object (
+        "serial-port",
+        "serial-port",
+        "serial-port",
+        GT_TYPE_SERIAL_PORT,
+        G_PARAM_STATIC_STRINGS | G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY);
+
+    properties[PROP_DATA] = g_param_spec_boxed (
+        "data",
+        "data",
+        "Bytes to send every period",
+        G_TYPE_BYTES,
+        G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+
+    properties[PROP_PERIOD] = g_param_spec_int64 (
+        "period",
+        "period",
+        "Time between the starts of two sends, in microseconds",
+        PERIODIC_SENDER_MIN_PERIOD,
+        G_MAXINT64,
+        G_USEC_PER_SEC,
+        G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+
+    properties[PROP_SENT] =
+        g_param_spec_uint64 ("sent",
+                             "sent",
+                             "Number of completed sends",
+                             0,
+                             G_MAXUINT64,
+                             0,
+                             G_PARAM_STATIC_STRINGS | G_PARAM_READABLE);
+
+    g_object_class_install_properties (object_class, N_PROPS, properties);
+}
+
+static void
+gt_periodic_sender_init (GtPeriodicSender *self)
+{
+    g_mutex_init (&self->lock);
+}
+
+/**
+ * gt_periodic_sender_new:
+ * @port: the port to send on
+ * @data: what to send
+ * @period: time between sends in microseconds, at least 100
+ */
+GtPeriodicSender *
+gt_periodic_sender_new (GtSerialPort *port, GBytes *data, gint64 period)
+{
+    return g_object_new (GT_TYPE_PERIODIC_SENDER,
+                         "serial-port",
+                         port,
+                         "data",
+                         data,
+                         "period",
+                         MAX (period, PERIODIC_SENDER_MIN_PERIOD),
+                         NULL);
+}
+
+// worker thread
+
+static void
+gt_periodic_sender_count (GtPeriodicSender *self,
+                          guint64 missed,
+                          guint64 skipped)
+{
+    g_mutex_lock (&self->lock);
+    self->stats.missed += missed;
+    self->stats.skipped += skipped;
+    g_mutex_unlock (&self->lock);
+}
+
+static gboolean gt_periodic_sender_send_frame (gpointer user_data);
+
+static void
+gt_periodic_sender_frame_free (gpointer user_data)
+{
+    GtPeriodicFrame *frame = user_data;
+
+    g_object_unref (frame->self);
+    g_free (frame);
+}
+
+static void
+gt_periodic_sender_worker (GTask *task,
+                           gpointer source_object,
+                           gpointer task_data,
+                           GCancellable *cancellable)
+{
+    GtPeriodicSender *self = GT_PERIODIC_SENDER (source_object);
+    gint64 period = self->period;
+    gint64 deadline = g_get_monotonic_time () + period;
+    GPollFD fds[2] = {{0}};
+    GError *error = NULL;
+
+    g_cancellable_make_pollfd (cancellable, &fds[1]);
+
+#ifdef HAVE_TIMERFD
+    // g_get_monotonic_time() is CLOCK_MONOTONIC, so the deadlines line up
+    int timer = timerfd_create (CLOCK_MONOTONIC, TFD_CLOEXEC);
+    struct itimerspec spec = {
+        {period / G_USEC_PER_SEC, (period % G_USEC_PER_SEC) * 1000},
+        {deadline / G_USEC_PER_SEC, (deadline % G_USEC_PER_SEC) * 1000}};
+
+    if (timer == -1 ||
+        timerfd_settime (timer, TFD_TIMER_ABSTIME, &spec, NULL) == -1) {
+        int errsv = errno;
+        g_set_error (&error,
+                     G_IO_ERROR,
+                     g_io_error_from_errno (errsv),
+                     _ ("Failed to set up the send timer: %s"),
+                     g_strerror (errsv));
+    }
+
+    fds[0].fd = timer;
+    fds[0].events = G_IO_IN;
+#endif
+
+    while (error == NULL && !g_cancellable_is_cancelled (cancellable)) {
+        guint64 expirations = 1;
+
+#ifdef HAVE_TIMERFD
+        if (g_poll (fds, 2, -1) <= 0 || fds[1].revents != 0)
+            continue;
+
+        if (read (timer, &expirations, sizeof (expirations)) !=
+            sizeof (expirations))
+            continue;
+#else
+        // Without a timerfd the wait is only as exact as poll's milliseconds
+        gint64 wait = deadline - g_get_monotonic_time ();
+        if (wait > 0) {
+            g_poll (&fds[1], 1, (gint)((wait + 999) / 1000));
+            continue;
+        }
+
+        expirations = 1 + (-wait) / period;
+#endif
+        gint64 slot = deadline + (expirations - 1) * period;
+        deadline += expirations * period;
+
+        // The previous frame is still going out, so this one has no room
+        if (!g_atomic_int_compare_and_exchange (
+                &self->in_flight, FALSE, TRUE)) {
+            gt_periodic_sender_count (self, expirations - 1, 1);
+            continue;
+        }
+
+        gt_periodic_sender_count (self, expirations - 1, 0);
+
+        GtPeriodicFrame *frame = g_new0 (GtPeriodicFrame, 1);
+        frame->self = g_object_ref (self);
+        frame->slot = slot;
+        frame->deadline = deadline;
+        g_main_context_invoke_full (self->context,
+                                    G_PRIORITY_HIGH,
+                                    gt_periodic_sender_send_frame,
+                                    frame,
+                                    gt_periodic_sender_frame_free);
+    }
+
+#ifdef HAVE_TIMERFD
+    if (timer != -1)
+        close (timer);
+#endif
+    g_cancellable_release_fd (cancellable);
+
+    if (error != NULL)
+        g_task_return_error (task, error);
+    else
+        g_task_return_boolean (task, TRUE);
+}
+
+// main thread
+
+static void
+gt_periodic_sender_fill_stats (GtPeriodicSender *self,
+                               GtPeriodicSenderStats *stats)
+{
+    g_mutex_lock (&self->lock);
+
+    *stats = self->stats;
+    stats->elapsed = g_get_monotonic_time () - self->start_time;
+    if (stats->sent > 1) {
+        stats->period = (gdouble)(self->last_send - self->first_send) /
+                        (gdouble)(stats->sent - 1);
+        stats->jitter_rms = sqrt (self->deviation_sq / (stats->sent - 1));
+    }
+
+    g_mutex_unlock (&self->lock);
+}
+
+static gboolean
+on_notify_timeout (gpointer user_data)
+{
+    g_object_notify_by_pspec (G_OBJECT (user_data), properties[PROP_SENT]);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+gt_periodic_sender_record (GtPeriodicSender *self)
+{
+    g_mutex_lock (&self->lock);
+
+    GtPeriodicSenderStats *stats = &self->stats;
+
+    // Measured against the schedule, so skipped frames are not jitter
+    if (stats->sent == 0) {
+        self->first_send = self->frame_start;
+    } else {
+        gdouble deviation = (gdouble)(self->frame_start - self->last_send) -
+                            (gdouble)(self->frame_slot - self->last_slot);
+
+        self->deviation_sq += deviation * deviation;
+        stats->jitter_max = MAX (stats->jitter_max, ABS (deviation));
+    }
+
+    self->last_send = self->frame_start;
+    self->last_slot = self->frame_slot;
+    stats->sent++;
+
+    g_mutex_unlock (&self->lock);
+}
+
+static void
+gt_periodic_sender_complete (GtPeriodicSender *self)
+{
+    g_clear_signal_handler (&self->status_handler, self->port);
+    g_clear_handle_id (&self->notify_id, g_source_remove);
+    if (self->cancel_source != NULL) {
+        g_source_destroy (self->cancel_source);
+        g_clear_pointer (&self->cancel_source, g_source_unref);
+    }
+
+    GTask *task = g_steal_pointer (&self->task);
+    GtPeriodicSenderStats *stats = g_new0 (GtPeriodicSenderStats, 1);
+    gt_periodic_sender_fill_stats (self, stats);
+    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_SENT]);
+
+    if (g_task_return_error_if_cancelled (task)) {
+        g_clear_error (&self->error);
+        g_free (stats);
+    } else if (self->error != NULL) {
+        g_task_return_error (task, g_steal_pointer (&self->error));
+        g_free (stats);
+    } else {
+        g_task_return_pointer (task, stats, g_free);
+    }
+
+    g_object_unref (task);
+}
+
+static void
+gt_periodic_sender_frame_done (GtPeriodicSender *self)
+{
+    g_atomic_int_set (&self->in_flight, FALSE);
+
+    // Once the worker is gone, this was the last frame
+    if (self->worker_done && self->task != NULL)
+        gt_periodic_sender_complete (self);
+}
+
+static void
+on_frame_written (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+    GtPeriodicSender *self = GT_PERIODIC_SENDER (user_data);
+    GError *error = NULL;
+
+    gt_serial_port_write_bytes_finish (GT_SERIAL_PORT (source), res, &error);
+
+    if (error == NULL) {
+        gt_periodic_sender_record (self);
+    } else if (self->error == NULL &&
+               !g_cancellable_is_cancelled (self->stop)) {
+        // Losing the port after a stop is how on_port_status() ends things
+        self->error = g_steal_pointer (&error);
+        gt_periodic_sender_stop (self);
+    }
+
+    g_clear_error (&error);
+    gt_periodic_sender_frame_done (self);
+    g_object_unref (self);
+}
+
+static gboolean
+gt_periodic_sender_send_frame (gpointer user_data)
+{
+    GtPeriodicFrame *frame = user_data;
+    GtPeriodicSender *self = frame->self;
+    gint64 now = g_get_monotonic_time ();
+
+    if (g_cancellable_is_cancelled (self->stop)) {
+        gt_periodic_sender_frame_done (self);
+
+        return G_SOURCE_REMOVE;
+    }
+
+    // The main loop was too busy to start the frame within its period
+    if (now >= frame->deadline) {
+        gt_periodic_sender_count (self, 0, 1);
+        gt_periodic_sender_frame_done (self);
+
+        return G_SOURCE_REMOVE;
+    }
+
+    // Not cancellable, so even a stop never cuts a frame short
+    self->frame_start = now;
+    self->frame_slot = frame->slot;
+    gt_serial_port_write_bytes_async (
+        self->port, self->data, NULL, on_frame_written, g_object_ref (self));
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+on_worker_done (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+    GtPeriodicSender *self = GT_PERIODIC_SENDER (source);
+    GError *error = NULL;
+
+    g_task_propagate_boolean (G_TASK (res), &error);
+    if (self->error == NULL)
+        self->error = g_steal_pointer (&error);
+    g_clear_error (&error);
+
+    self->worker_done = TRUE;
+
+    // Otherwise the frame still going out completes the task
+    if (!g_atomic_int_get (&self->in_flight))
+        gt_periodic_sender_complete (self);
+}
+
+static gboolean
+on_cancelled (GCancellable *cancellable, gpointer user_data)
+{
+    gt_periodic_sender_stop (GT_PERIODIC_SENDER (user_data));
+
+    return G_SOURCE_REMOVE;
+}
+
+// Frames would only fail one after the other once the port is gone
+static void
+on_port_status (GObject *object, GParamSpec *pspec, gpointer user_data)
+{
+    if (gt_serial_port_get_status (GT_SERIAL_PORT (object)) !=
+        GT_SERIAL_PORT_STATE_ONLINE)
+        gt_periodic_sender_stop (GT_PERIODIC_SENDER (user_data));
+}
+
+/**
+ * gt_periodic_sender_start:
+ * @self: a #GtPeriodicSender
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: called once sending has stopped
+ * @user_data: data for @callback
+ *
+ * Sends the data every period until gt_periodic_sender_stop() is called or
+ * the port goes offline. Each frame is sent with
+ * gt_serial_port_write_bytes_async(). A frame that cannot start before the
+ * next deadline, because the previous one is still being sent, is skipped
+ * whole and counted. A frame in flight is always finished, even on a stop.
+ */
+void
+gt_periodic_sender_start (GtPeriodicSender *self,
+                          GCancellable *cancellable,
+                          GAsyncReadyCallback callback,
+                          gpointer user_data)
+{
+    g_return_if_fail (self->task == NULL && self->stop == NULL);
+
+    self->task = g_task_new (self, cancellable, callback, user_data);
+    g_task_set_source_tag (self->task, gt_periodic_sender_start);
+    self->stop = g_cancellable_new ();
+    self->start_time = g_get_monotonic_time ();
+
+    if (gt_serial_port_get_status (self->port) !=
+        GT_SERIAL_PORT_STATE_ONLINE) {
+        GTask *task = g_steal_pointer (&self->task);
+        g_task_return_new_error (task,
+                                 G_IO_ERROR,
+                                 G_IO_ERROR_NOT_CONNECTED,
+                                 _ ("The serial port is not open"));
+        g_object_unref (task);
+
+        return;
+    }
+
+    self->context = g_main_context_ref_thread_default ();
+
+    self->status_handler = g_signal_connect (
+        self->port, "notify::status", G_CALLBACK (on_port_status), self);
+    self->notify_id = g_timeout_add (
+        PERIODIC_SENDER_NOTIFY_INTERVAL, on_notify_timeout, self);
+
+    if (cancellable != NULL) {
+        self->cancel_source = g_cancellable_source_new (cancellable);
+        g_source_set_callback (
+            self->cancel_source, G_SOURCE_FUNC (on_cancelled), self, NULL);
+        g_source_attach (self->cancel_source, NULL);
+    }
+
+    GTask *worker = g_task_new (self, self->stop, on_worker_done, NULL);
+    // Stopping is the normal way to end, not an error
+    g_task_set_check_cancellable (worker, FALSE);
+    g_task_run_in_thread (worker, gt_periodic_sender_worker);
+    g_object_unref (worker);
+}
+
+gboolean
+gt_periodic_sender_finish (GtPeriodicSender *self,
+                           GAsyncResult *res,
+                           GtPeriodicSenderStats *stats,
+                           GError **error)
+{
+    g_return_val_if_fail (g_task_is_valid (res, self), FALSE);
+
+    GtPeriodicSenderStats *result =
+        g_task_propagate_pointer (G_TASK (res), error);
+    if (result == NULL)
+        return FALSE;
+
+    if (stats != NULL)
+        *stats = *result;
+    g_free (result);
+
+    return TRUE;
+}
+
+/**
+ * gt_periodic_sender_stop:
+ * @self: a #GtPeriodicSender
+ *
+ * Stops sending. The task completes with the final statistics once the
+ * worker thread is done and the frame in flight, if any, is written.
+ */
+void
+gt_periodic_sender_stop (GtPeriodicSender *self)
+{
+    if (self->stop != NULL)
+        g_cancellable_cancel (self->stop);
+}
+
+/**
+ * gt_periodic_sender_get_stats:
+ * @self: a #GtPeriodicSender
+ * @stats: (out): the statistics so far
+ *
+ * Can be called at any time, for example on notify::sent.
+ */
+void
+gt_periodic_sender_get_stats (GtPeriodicSender *self,
+                              GtPeriodicSenderStats *stats)
+{
+    gt_periodic_sender_fill_stats (self, stats);
+}
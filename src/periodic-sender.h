@@ -0,0 +1,68 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "serial-port.h"
+
+#include <gio/gio.h>
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define GT_TYPE_PERIODIC_SENDER (gt_periodic_sender_get_type ())
+
+G_DECLARE_FINAL_TYPE (
+    GtPeriodicSender, gt_periodic_sender, GT, PERIODIC_SENDER, GObject)
+
+typedef struct {
+    guint64 sent;
+    /* Deadlines that passed without a send, because the thread woke late */
+    guint64 missed;
+    /* Frames dropped whole because the previous one was still being sent, or
+     * the main loop could not start them before the next deadline */
+    guint64 skipped;
+    gint64 elapsed;
+    /* Achieved period and its deviation from the requested one, in
+     * microseconds */
+    gdouble period;
+    gdouble jitter_rms;
+    gdouble jitter_max;
+} GtPeriodicSenderStats;
+
+GtPeriodicSender *
+gt_periodic_sender_new (GtSerialPort *port, GBytes *data, gint64 period);
+
+void
+gt_periodic_sender_start (GtPeriodicSender *self,
+                          GCancellable *cancellable,
+                          GAsyncReadyCallback callback,
+                          gpointer user_data);
+gboolean
+gt_periodic_sender_finish (GtPeriodicSender *self,
+                           GAsyncResult *res,
+                           GtPeriodicSenderStats *stats,
+                           GError **error);
+
+void
+gt_periodic_sender_stop (GtPeriodicSender *self);
+
+void
+gt_periodic_sender_get_stats (GtPeriodicSender *self,
+                              GtPeriodicSenderStats *stats);
+
+G_END_DECLS
@@ -0,0 +1,139 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "prbs.h"
+
+static const struct {
+    guint order;
+    guint tap;
+    const char *name;
+} patterns[] = {
+    [GT_PRBS_PATTERN_PRBS7] = {7, 6, "PRBS7"},
+    [GT_PRBS_PATTERN_PRBS15] = {15, 14, "PRBS15"},
+    [GT_PRBS_PATTERN_PRBS23] = {23, 18, "PRBS23"},
+    [GT_PRBS_PATTERN_PRBS31] = {31, 28, "PRBS31"},
+};
+
+void
+gt_prbs_init (GtPrbs *self, GtPrbsPattern pattern)
+{
+    g_return_if_fail (pattern < G_N_ELEMENTS (patterns));
+
+    self->order = patterns[pattern].order;
+    self->tap = patterns[pattern].tap;
+    self->state = (1u << self->order) - 1;
+    self->spare = 0;
+    self->n_spare = 0;
+}
+
+// With s[k] = s[k - order] ^ s[k - tap], the next @tap bits only depend on
+// bits already in the state, so they are computed in one go instead of one
+// bit per step
+static inline guint32
+gt_prbs_step (GtPrbs *self)
+{
+    guint order = self->order;
+    guint tap = self->tap;
+    guint32 bits =
+        (self->state ^ (self->state >> (order - tap))) & ((1u << tap) - 1);
+
+    self->state = (self->state >> tap) | (bits << (order - tap));
+
+    return bits;
+}
+
+/**
+ * gt_prbs_fill:
+ * @self: a #GtPrbs
+ * @buffer: where to put the sequence
+ * @length: number of bytes to generate
+ *
+ * Continues the sequence, least significant bit of each byte first.
+ */
+void
+gt_prbs_fill (GtPrbs *self, guint8 *buffer, gsize length)
+{
+    guint64 spare = self->spare;
+    guint n_spare = self->n_spare;
+    gsize i = 0;
+
+    while (i < length) {
+        // Top up to at least a full 32 bits, then hand out whole bytes
+        while (n_spare < 32) {
+            spare |= (guint64)gt_prbs_step (self) << n_spare;
+            n_spare += self->tap;
+        }
+
+        while (n_spare >= 8 && i < length) {
+            buffer[i++] = (guint8)spare;
+            spare >>= 8;
+            n_spare -= 8;
+        }
+    }
+
+    self->spare = spare;
+    self->n_spare = n_spare;
+}
+
+/**
+ * gt_prbs_get_seed_length:
+ * @self: a #GtPrbs
+ *
+ * Returns: the number of received bytes gt_prbs_seed() needs
+ */
+gsize
+gt_prbs_get_seed_length (const GtPrbs *self)
+{
+    return (self->order + 7) / 8;
+}
+
+/**
+ * gt_prbs_seed:
+ * @self: a #GtPrbs
+ * @data: gt_prbs_get_seed_length() bytes of a received sequence
+ *
+ * Synchronises the generator to received data, so that gt_prbs_fill()
+ * continues with the bytes that should follow @data.
+ *
+ * Returns: %FALSE if @data cannot be part of the sequence
+ */
+gboolean
+gt_prbs_seed (GtPrbs *self, const guint8 *data)
+{
+    gsize length = gt_prbs_get_seed_length (self);
+    guint64 bits = 0;
+    gsize i;
+
+    for (i = 0; i < length; i++)
+        bits |= (guint64)data[i] << (8 * i);
+
+    // The last @order bits received are exactly the generator state
+    self->state = (guint32)(bits >> (8 * length - self->order));
+    self->spare = 0;
+    self->n_spare = 0;
+
+    // All zeroes is the one state the generator never leaves
+    return self->state != 0;
+}
+
+const char *
+gt_prbs_pattern_to_string (GtPrbsPattern pattern)
+{
+    g_return_val_if_fail (pattern < G_N_ELEMENTS (patterns), NULL);
+
+    return patterns[pattern].name;
+}
@@ -0,0 +1,60 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* The ITU-T O.150 pseudo-random bit sequences, without inversion */
+typedef enum {
+    GT_PRBS_PATTERN_PRBS7,
+    GT_PRBS_PATTERN_PRBS15,
+    GT_PRBS_PATTERN_PRBS23,
+    GT_PRBS_PATTERN_PRBS31
+} GtPrbsPattern;
+
+/* Fibonacci LFSR for x^order + x^tap + 1. The state holds the last @order
+ * bits of the sequence, oldest in bit 0, which is also the order they go out
+ * on a serial line. */
+typedef struct {
+    guint order;
+    guint tap;
+    guint32 state;
+
+    // Generated bits not yet handed out, oldest in bit 0
+    guint64 spare;
+    guint n_spare;
+} GtPrbs;
+
+void
+gt_prbs_init (GtPrbs *self, GtPrbsPattern pattern);
+
+void
+gt_prbs_fill (GtPrbs *self, guint8 *buffer, gsize length);
+
+gsize
+gt_prbs_get_seed_length (const GtPrbs *self);
+
+gboolean
+gt_prbs_seed (GtPrbs *self, const guint8 *data);
+
+const char *
+gt_prbs_pattern_to_string (GtPrbsPattern pattern);
+
+G_END_DECLS
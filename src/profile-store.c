@@ -0,0 +1,514 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Cache of the profiles in the configuration file.
+ *
+ * The file is parsed once into the parsecfg arrays and the sections are
+ * indexed by name, so switching profiles is a hash lookup. A file monitor
+ * drops the cache when someone else changes the file; our own writes are
+ * told apart by the modification time and size they leave behind. Saving
+ * a profile only serializes its own section and splices it into the text
+ * of the file. */
+
+#include "profile-store.h"
+
+#include <gio/gio.h>
+#include <glib/gi18n.h>
+#include <glib/gstdio.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <unistd.h>
+
+struct _GtProfileStore {
+    char *path;
+    cfgStruct *cfg;
+    GFileMonitor *monitor;
+
+    // Section name -> index into the parsecfg arrays, NULL when stale
+    GHashTable *index;
+    int n_sections;
+
+    // The file as we last read or wrote it
+    gint64 mtime;
+    gint64 size;
+};
+
+static void
+gt_profile_store_get_stamp (GtProfileStore *self, gint64 *mtime, gint64 *size)
+{
+    GStatBuf buf;
+
+    if (g_stat (self->path, &buf) != 0) {
+        *mtime = -1;
+        *size = -1;
+
+        return;
+    }
+
+    *mtime = (gint64)buf.st_mtime * G_USEC_PER_SEC;
+#ifdef __linux__
+    *mtime += buf.st_mtim.tv_nsec / 1000;
+#endif
+    *size = (gint64)buf.st_size;
+}
+
+static void
+gt_profile_store_invalidate (GtProfileStore *self)
+{
+    g_clear_pointer (&self->index, g_hash_table_unref);
+}
+
+static void
+on_profile_file_changed (GFileMonitor *monitor,
+                         GFile *file,
+                         GFile *other_file,
+                         GFileMonitorEvent event,
+                         gpointer user_data)
+{
+    GtProfileStore *self = user_data;
+    gint64 mtime, size;
+
+    if (event == G_FILE_MONITOR_EVENT_CHANGED ||
+        event == G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED)
+        return;
+
+    gt_profile_store_get_stamp (self, &mtime, &size);
+    if (mtime == self->mtime && size == self->size)
+        return;
+
+    g_debug ("Configuration file %s changed, dropping profile cache",
+             self->path);
+    gt_profile_store_invalidate (self);
+}
+
+GtProfileStore *
+gt_profile_store_new (const char *path, cfgStruct *cfg)
+{
+    GtProfileStore *self = g_new0 (GtProfileStore, 1);
+    g_autoptr (GFile) file = g_file_new_for_path (path);
+    g_autoptr (GError) error = NULL;
+
+    self->path = g_strdup (path);
+    self->cfg = cfg;
+    self->mtime = -1;
+    self->size = -1;
+
+    self->monitor =
+        g_file_monitor_file (file, G_FILE_MONITOR_WATCH_MOVES, NULL, &error);
+    if (self->monitor != NULL)
+        g_signal_connect (self->monitor,
+                          "changed",
+                          G_CALLBACK (on_profile_file_changed),
+                          self);
+    else
+        g_warning ("Cannot watch configuration file %s: %s",
+                   path,
+                   error->message);
+
+    return self;
+}
+
+void
+gt_profile_store_free (GtProfileStore *self)
+{
+    if (self->monitor != NULL) {
+        g_signal_handlers_disconnect_by_data (self->monitor, self);
+        g_file_monitor_cancel (self->monitor);
+        g_object_unref (self->monitor);
+    }
+    g_clear_pointer (&self->index, g_hash_table_unref);
+    cfgFree (self->cfg);
+    g_free (self->path);
+    g_free (self);
+}
+
+// Parses the file if the cache is stale. A missing file is an empty store.
+static gboolean
+gt_profile_store_ensure (GtProfileStore *self)
+{
+    if (self->index != NULL)
+        return TRUE;
+
+    // The previous parse, if any, is replaced wholesale
+    cfgFree (self->cfg);
+
+    int max = 0;
+    if (g_file_test (self->path, G_FILE_TEST_EXISTS)) {
+        max = cfgParse (self->path, self->cfg, CFG_INI);
+        if (max == -1)
+            return FALSE;
+    }
+
+    self->index = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    self->n_sections = max;
+    for (int i = 0; i < max; i++)
+        g_hash_table_insert (self->index,
+                             g_strdup (cfgSectionNumberToName (i)),
+                             GINT_TO_POINTER (i));
+
+    gt_profile_store_get_stamp (self, &self->mtime, &self->size);
+
+    return TRUE;
+}
+
+int
+gt_profile_store_get_n_profiles (GtProfileStore *self)
+{
+    if (!gt_profile_store_ensure (self))
+        return -1;
+
+    return self->n_sections;
+}
+
+const char *
+gt_profile_store_get_name (GtProfileStore *self, int index)
+{
+    return cfgSectionNumberToName (index);
+}
+
+int
+gt_profile_store_lookup (GtProfileStore *self, const char *name)
+{
+    gpointer index;
+
+    if (!gt_profile_store_ensure (self))
+        return -1;
+
+    if (!g_hash_table_lookup_extended (self->index, name, NULL, &index))
+        return -1;
+
+    return GPOINTER_TO_INT (index);
+}
+
+// Resets a section to what a freshly allocated one holds
+static void
+gt_profile_store_clear_section (GtProfileStore *self, int section)
+{
+    for (cfgStruct *entry = self->cfg; entry->type != CFG_END; entry++) {
+        switch (entry->type) {
+        case CFG_BOOL:
+            (*(int **)entry->value)[section] = -1;
+            break;
+        case CFG_INT:
+        case CFG_UINT:
+            (*(int **)entry->value)[section] = 0;
+            break;
+        case CFG_LONG:
+        case CFG_ULONG:
+            (*(long **)entry->value)[section] = 0;
+            break;
+        case CFG_FLOAT:
+            (*(float **)entry->value)[section] = 0;
+            break;
+        case CFG_DOUBLE:
+            (*(double **)entry->value)[section] = 0;
+            break;
+        case CFG_STRING:
+            g_clear_pointer (&(*(char ***)entry->value)[section], free);
+            break;
+        case CFG_STRING_LIST: {
+            cfgList *list = (*(cfgList ***)entry->value)[section];
+
+            while (list != NULL) {
+                cfgList *next = list->next;
+
+                free (list->str);
+                free (list);
+                list = next;
+            }
+            (*(cfgList ***)entry->value)[section] = NULL;
+        } break;
+        default:
+            g_assert_not_reached ();
+        }
+    }
+}
+
+/* Returns the section to fill in for the profile @name: an existing one,
+ * emptied, or a new one. Nothing is written until gt_profile_store_save(). */
+int
+gt_profile_store_add (GtProfileStore *self, const char *name)
+{
+    int index = gt_profile_store_lookup (self, name);
+
+    if (index != -1) {
+        gt_profile_store_clear_section (self, index);
+
+        return index;
+    }
+
+    if (self->index == NULL)
+        return -1;
+
+    int max = cfgAllocForNewSection (self->cfg, name);
+    if (max == -1)
+        return -1;
+
+    self->n_sections = max;
+    g_hash_table_insert (
+        self->index, g_strdup (name), GINT_TO_POINTER (max - 1));
+
+    return max - 1;
+}
+
+/* Returns the name of the section a line starts, if it is a section header
+ * the way parsecfg reads them: "[name]", "[ 'name' ]" or "["name"]" */
+static char *
+section_header_name (const char *line, const char *end)
+{
+    const char *p = line;
+
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    if (p == end || *p != '[')
+        return NULL;
+
+    for (p++; p < end && (*p == ' ' || *p == '\t'); p++)
+        ;
+
+    const char *start = p;
+    if (p < end && (*p == '"' || *p == '\'')) {
+        char quote = *p;
+
+        start = ++p;
+        while (p < end && *p != quote)
+            p++;
+    } else {
+        while (p < end && *p != ']' && *p != ' ' && *p != '\t' && *p != '#')
+            p++;
+    }
+
+    return g_strndup (start, p - start);
+}
+
+/* Tells whether a line holds anything for parsecfg, rather than being blank
+ * or a comment */
+static gboolean
+is_content_line (const char *line, const char *end)
+{
+    const char *p = line;
+
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+
+    return p < end && *p != '\n' && *p != '\r' && *p != '#';
+}
+
+/* Finds where the section @name starts and where it ends. The section ends
+ * after its last setting, so the blank lines and comments that lead into the
+ * next header stay with the next profile. */
+static gboolean
+find_section (const char *contents,
+              gsize length,
+              const char *name,
+              gsize *start,
+              gsize *end)
+{
+    const char *p = contents;
+    const char *limit = contents + length;
+    gboolean found = FALSE;
+
+    *end = length;
+
+    while (p < limit) {
+        const char *eol = memchr (p, '\n', limit - p);
+        const char *next = eol != NULL ? eol + 1 : limit;
+        g_autofree char *header = section_header_name (p, next);
+
+        if (header != NULL) {
+            if (found)
+                return TRUE;
+
+            if (g_str_equal (header, name)) {
+                *start = p - contents;
+                found = TRUE;
+            }
+        }
+
+        if (found && is_content_line (p, next))
+            *end = next - contents;
+
+        p = next;
+    }
+
+    if (!found)
+        *end = length;
+
+    return found;
+}
+
+/* Writes the file as @contents with the bytes from @start to @end replaced
+ * by @section, or just cut out if @section is -1. The result goes to a
+ * temporary file that is renamed over the configuration once it is synced,
+ * so a crash leaves either the old or the new file behind. */
+static gboolean
+gt_profile_store_write_spliced (GtProfileStore *self,
+                                const char *contents,
+                                gsize length,
+                                gsize start,
+                                gsize end,
+                                int section,
+                                GError **error)
+{
+    g_autofree char *tmp = g_strconcat (self->path, ".XXXXXX", NULL);
+    GStatBuf buf;
+    FILE *fp = NULL;
+    int fd, errsv;
+
+    fd = g_mkstemp (tmp);
+    if (fd == -1) {
+        errsv = errno;
+        g_set_error (error,
+                     G_FILE_ERROR,
+                     g_file_error_from_errno (errsv),
+                     _ ("Cannot create temporary file for %s: %s"),
+                     self->path,
+                     g_strerror (errsv));
+
+        return FALSE;
+    }
+
+    // Keep the permissions of the file we replace
+    if (g_stat (self->path, &buf) == 0)
+        fchmod (fd, buf.st_mode & 0777);
+
+    fp = fdopen (fd, "w");
+    if (fp == NULL)
+        goto fail;
+    fd = -1;
+
+    fwrite (contents, 1, start, fp);
+    if (section != -1) {
+        // Files edited by hand may lack the final line break
+        if (start > 0 && contents[start - 1] != '\n')
+            fputc ('\n', fp);
+
+        if (cfgDumpSection (fp, self->cfg, section) != 0) {
+            errno = EINVAL;
+            goto fail;
+        }
+    }
+    fwrite (contents + end, 1, length - end, fp);
+
+    if (fflush (fp) != 0 || ferror (fp) || fsync (fileno (fp)) != 0)
+        goto fail;
+
+    errsv = fclose (fp);
+    fp = NULL;
+    if (errsv != 0 || g_rename (tmp, self->path) != 0)
+        goto fail;
+
+    gt_profile_store_get_stamp (self, &self->mtime, &self->size);
+
+    return TRUE;
+
+fail:
+    errsv = errno;
+    if (fp != NULL)
+        fclose (fp);
+    else if (fd != -1)
+        close (fd);
+    g_unlink (tmp);
+    g_set_error (error,
+                 G_FILE_ERROR,
+                 g_file_error_from_errno (errsv),
+                 _ ("Cannot write %s: %s"),
+                 self->path,
+                 g_strerror (errsv));
+
+    return FALSE;
+}
+
+/* Reads the configuration file. A missing file reads as empty. */
+static gboolean
+gt_profile_store_read (GtProfileStore *self,
+                       char **contents,
+                       gsize *length,
+                       GError **error)
+{
+    g_autoptr (GError) read_error = NULL;
+
+    if (g_file_get_contents (self->path, contents, length, &read_error))
+        return TRUE;
+
+    if (!g_error_matches (read_error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+        g_propagate_error (error, g_steal_pointer (&read_error));
+
+        return FALSE;
+    }
+
+    *contents = g_strdup ("");
+    *length = 0;
+
+    return TRUE;
+}
+
+/* Writes the profile @name back to the file. Only that section is
+ * serialized; the text of the other profiles is copied over as it is. */
+gboolean
+gt_profile_store_save (GtProfileStore *self, const char *name, GError **error)
+{
+    g_autofree char *contents = NULL;
+    gsize length, start, end;
+    int section = gt_profile_store_lookup (self, name);
+
+    g_return_val_if_fail (section != -1, FALSE);
+
+    if (!gt_profile_store_read (self, &contents, &length, error))
+        return FALSE;
+
+    // A new profile goes at the end of the file
+    if (!find_section (contents, length, name, &start, &end))
+        start = end = length;
+
+    return gt_profile_store_write_spliced (
+        self, contents, length, start, end, section, error);
+}
+
+gboolean
+gt_profile_store_remove (GtProfileStore *self,
+                         const char *name,
+                         GError **error)
+{
+    g_autofree char *contents = NULL;
+    gsize length, start, end;
+
+    if (!gt_profile_store_read (self, &contents, &length, error))
+        return FALSE;
+
+    if (!find_section (contents, length, name, &start, &end)) {
+        g_set_error (error,
+                     G_FILE_ERROR,
+                     G_FILE_ERROR_NOENT,
+                     _ ("Cannot find section %s"),
+                     name);
+
+        return FALSE;
+    }
+
+    if (!gt_profile_store_write_spliced (
+            self, contents, length, start, end, -1, error))
+        return FALSE;
+
+    // The parsecfg arrays cannot drop a section, so read the file again
+    gt_profile_store_invalidate (self);
+
+    return TRUE;
+}
@@ -0,0 +1,56 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "parsecfg.h"
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GtProfileStore GtProfileStore;
+
+GtProfileStore *
+gt_profile_store_new (const char *path, cfgStruct *cfg);
+
+void
+gt_profile_store_free (GtProfileStore *self);
+
+int
+gt_profile_store_get_n_profiles (GtProfileStore *self);
+
+const char *
+gt_profile_store_get_name (GtProfileStore *self, int index);
+
+int
+gt_profile_store_lookup (GtProfileStore *self, const char *name);
+
+int
+gt_profile_store_add (GtProfileStore *self, const char *name);
+
+gboolean
+gt_profile_store_save (GtProfileStore *self, const char *name, GError **error);
+
+gboolean
+gt_profile_store_remove (GtProfileStore *self,
+                         const char *name,
+                         GError **error);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GtProfileStore, gt_profile_store_free)
+
+G_END_DECLS
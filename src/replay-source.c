@@ -0,0 +1,452 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Feed a recorded session back in as if it was received from the port. The
+ * source emits "data-available" exactly like GtSerialPort does, so it can be
+ * connected to the same handlers */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "replay-source.h"
+#include "capture.h"
+
+#include <string.h>
+
+#include <glib/gi18n.h>
+
+/* Same chunk size the serial port uses for reading */
+#define REPLAY_CHUNK_SIZE 8192
+
+struct _GtReplaySource {
+    GObject parent_instance;
+
+    /* Either a capture or a plain log file */
+    GtCaptureReader *reader;
+    GMappedFile *file;
+    gsize pos;
+
+    gdouble speed;
+    guint byte_rate;
+    gdouble progress;
+
+    GTask *task;
+    GSource *source;
+    gint64 start_time;
+    gint64 first_timestamp;
+    gboolean have_first;
+    GtCaptureRecord pending;
+    gboolean have_pending;
+
+    guint64 bytes;
+    gint64 elapsed;
+};
+
+G_DEFINE_TYPE (GtReplaySource, gt_replay_source, G_TYPE_OBJECT)
+
+enum { PROP_0, PROP_SPEED, PROP_BYTE_RATE, PROP_PROGRESS, N_PROPS };
+
+static GParamSpec *properties[N_PROPS];
+
+enum { SIGNAL_DATA_AVAILABLE, SIGNAL_COUNT };
+
+static guint SIGNALS[SIGNAL_COUNT];
+
+static gboolean
+gt_replay_source_dispatch (GSource *source,
+                           GSourceFunc callback,
+                           gpointer user_data)
+{
+    return callback (user_data);
+}
+
+static GSourceFuncs replay_source_funcs = {
+    NULL,
+    NULL,
+    gt_replay_source_dispatch,
+    NULL,
+};
+
+static void
+gt_replay_source_stop (GtReplaySource *self)
+{
+    if (self->source != NULL) {
+        g_source_destroy (self->source);
+        g_clear_pointer (&self->source, g_source_unref);
+    }
+}
+
+static void
+gt_replay_source_finalize (GObject *object)
+{
+    GtReplaySource *self = GT_REPLAY_SOURCE (object);
+
+    gt_replay_source_stop (self);
+    g_clear_pointer (&self->reader, gt_capture_reader_free);
+    g_clear_pointer (&self->file, g_mapped_file_unref);
+
+    G_OBJECT_CLASS (gt_replay_source_parent_class)->finalize (object);
+}
+
+static void
+gt_replay_source_get_property (GObject *object,
+                               guint prop_id,
+                               GValue *value,
+                               GParamSpec *pspec)
+{
+    GtReplaySource *self = GT_REPLAY_SOURCE (object);
+
+    switch (prop_id) {
+    case PROP_SPEED:
+        g_value_set_double (value, self->speed);
+        break;
+    case PROP_BYTE_RATE:
+        g_value_set_uint (value, self->byte_rate);
+        break;
+    case PROP_PROGRESS:
+        g_value_set_double (value, self->progress);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gt_replay_source_set_property (GObject *object,
+                               guint prop_id,
+                               const GValue *value,
+                               GParamSpec *pspec)
+{
+    GtReplaySource *self = GT_REPLAY_SOURCE (object);
+
+    switch (prop_id) {
+    case PROP_SPEED:
+        self->speed = g_value_get_double (value);
+        break;
+    case PROP_BYTE_RATE:
+        self->byte_rate = g_value_get_uint (value);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gt_replay_source_class_init (GtReplaySourceClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    object_class->finalize = gt_replay_source_finalize;
+    object_class->get_property = gt_replay_source_get_property;
+    object_class->set_property = gt_replay_source_set_property;
+
+    /* Replay speed relative to the recording, 0 replays as fast as
+     * possible */
+    properties[PROP_SPEED] =
+        g_param_spec_double ("speed",
+                             "speed",
+                             "speed",
+                             0.0,
+                             G_MAXDOUBLE,
+                             1.0,
+                             G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE |
+                                 G_PARAM_CONSTRUCT);
+
+    /* Plain logs carry no timing, they are replayed at this many bytes per
+     * second (times speed). 0 replays them as fast as possible */
+    properties[PROP_BYTE_RATE] =
+        g_param_spec_uint ("byte-rate",
+                           "byte-rate",
+                           "byte-rate",
+                           0,
+                           G_MAXUINT,
+                           0,
+                           G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE);
+
+    properties[PROP_PROGRESS] = g_param_spec_double ("progress",
+                                                     "progress",
+                                                     "progress",
+                                                     0.0,
+                                                     1.0,
+                                                     0.0,
+                                                     G_PARAM_STATIC_STRINGS |
+                                                         G_PARAM_READABLE);
+
+    g_object_class_install_properties (object_class, N_PROPS, properties);
+
+    /* Same contract as GtSerialPort::data-available */
+    SIGNALS[SIGNAL_DATA_AVAILABLE] = g_signal_new ("data-available",
+                                                   GT_TYPE_REPLAY_SOURCE,
+                                                   G_SIGNAL_RUN_FIRST,
+                                                   0,
+                                                   NULL,
+                                                   NULL,
+                                                   NULL,
+                                                   G_TYPE_NONE,
+                                                   1,
+                                                   G_TYPE_BYTES,
+                                                   0);
+}
+
+static void
+gt_replay_source_init (GtReplaySource *self)
+{
+}
+
+GtReplaySource *
+gt_replay_source_new (const char *file_name, GError **error)
+{
+    GtCaptureReader *reader = gt_capture_reader_new (file_name, error);
+
+    if (reader == NULL)
+        return NULL;
+
+    GtReplaySource *self = g_object_new (GT_TYPE_REPLAY_SOURCE, NULL);
+
+    if (gt_capture_reader_is_capture (reader)) {
+        self->reader = reader;
+    } else {
+        gt_capture_reader_free (reader);
+        self->file = g_mapped_file_new (file_name, FALSE, error);
+        if (self->file == NULL)
+            g_clear_object (&self);
+    }
+
+    return self;
+}
+
+static void
+gt_replay_source_set_progress (GtReplaySource *self, gdouble progress)
+{
+    // Do not flood the infobar, whole percents are enough
+    if ((int)(progress * 100) == (int)(self->progress * 100) && progress < 1.0)
+        return;
+
+    self->progress = progress;
+    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_PROGRESS]);
+}
+
+static void
+gt_replay_source_emit (GtReplaySource *self, GBytes *bytes)
+{
+    self->bytes += g_bytes_get_size (bytes);
+
+    // Like the serial port, the data-available handler takes over the
+    // reference
+    g_signal_emit (self, SIGNALS[SIGNAL_DATA_AVAILABLE], 0, bytes);
+}
+
+/* Monotonic time at which data recorded at timestamp is due */
+static gint64
+gt_replay_source_due_time (GtReplaySource *self, gint64 timestamp)
+{
+    if (self->speed <= 0.0)
+        return 0;
+
+    return self->start_time +
+           (gint64)((timestamp - self->first_timestamp) / self->speed);
+}
+
+/* Only received data is replayed, sent data was produced by us */
+static gboolean
+gt_replay_source_next_record (GtReplaySource *self, GError **error)
+{
+    if (self->have_pending)
+        return TRUE;
+
+    while (gt_capture_reader_next (self->reader, &self->pending, error)) {
+        if (self->pending.event != GT_CAPTURE_EVENT_DATA ||
+            self->pending.direction != GT_BUFFER_DIRECTION_RX ||
+            self->pending.length == 0)
+            continue;
+
+        if (!self->have_first) {
+            self->first_timestamp = self->pending.timestamp;
+            self->have_first = TRUE;
+        }
+
+        self->have_pending = TRUE;
+
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* Returns the time the next chunk is due, -1 at the end of the capture */
+static gint64
+gt_replay_source_step_capture (GtReplaySource *self, GError **error)
+{
+    g_autoptr (GByteArray) chunk = NULL;
+    gint64 now = g_get_monotonic_time ();
+
+    while (gt_replay_source_next_record (self, error)) {
+        gint64 due = gt_replay_source_due_time (self, self->pending.timestamp);
+
+        if (due > now)
+            break;
+
+        // Records that are due are merged, up to the usual read size
+        if (chunk != NULL &&
+            chunk->len + self->pending.length > REPLAY_CHUNK_SIZE)
+            break;
+
+        if (chunk == NULL)
+            chunk = g_byte_array_sized_new (REPLAY_CHUNK_SIZE);
+
+        g_byte_array_append (chunk, self->pending.payload, self->pending.length);
+        self->have_pending = FALSE;
+    }
+
+    if (chunk != NULL)
+        gt_replay_source_emit (
+            self, g_byte_array_free_to_bytes (g_steal_pointer (&chunk)));
+
+    gt_replay_source_set_progress (
+        self, gt_capture_reader_get_fraction (self->reader));
+
+    if (!self->have_pending)
+        return -1;
+
+    return gt_replay_source_due_time (self, self->pending.timestamp);
+}
+
+static gint64
+gt_replay_source_step_file (GtReplaySource *self)
+{
+    gsize size = g_mapped_file_get_length (self->file);
+    const char *data = g_mapped_file_get_contents (self->file);
+    gsize length = MIN (size - self->pos, REPLAY_CHUNK_SIZE);
+
+    if (length > 0) {
+        gt_replay_source_emit (self, g_bytes_new (data + self->pos, length));
+        self->pos += length;
+    }
+
+    gt_replay_source_set_progress (
+        self, size == 0 ? 1.0 : (gdouble)self->pos / size);
+
+    if (self->pos >= size)
+        return -1;
+
+    if (self->byte_rate == 0 || self->speed <= 0.0)
+        return 0;
+
+    return self->start_time + (gint64)(self->pos * G_USEC_PER_SEC /
+                                       (self->byte_rate * self->speed));
+}
+
+static gboolean
+on_replay_source_ready (gpointer user_data)
+{
+    GtReplaySource *self = GT_REPLAY_SOURCE (user_data);
+    GTask *task = self->task;
+    GError *error = NULL;
+    gint64 next = 0;
+
+    if (!g_cancellable_is_cancelled (g_task_get_cancellable (task))) {
+        if (self->reader != NULL)
+            next = gt_replay_source_step_capture (self, &error);
+        else
+            next = gt_replay_source_step_file (self);
+
+        if (error == NULL && next >= 0) {
+            // 0 means right away, after the main loop had a chance to run
+            g_source_set_ready_time (self->source, next);
+
+            return G_SOURCE_CONTINUE;
+        }
+    }
+
+    // Done, the statistics need to be final before the callback runs
+    self->elapsed = g_get_monotonic_time () - self->start_time;
+    g_clear_pointer (&self->source, g_source_unref);
+    self->task = NULL;
+
+    if (g_task_return_error_if_cancelled (task))
+        g_clear_error (&error);
+    else if (error != NULL)
+        g_task_return_error (task, error);
+    else
+        g_task_return_boolean (task, TRUE);
+
+    g_object_unref (task);
+
+    return G_SOURCE_REMOVE;
+}
+
+void
+gt_replay_source_start (GtReplaySource *self,
+                        GCancellable *cancellable,
+                        GAsyncReadyCallback callback,
+                        gpointer user_data)
+{
+    g_return_if_fail (GT_IS_REPLAY_SOURCE (self));
+    g_return_if_fail (self->task == NULL);
+
+    self->task = g_task_new (self, cancellable, callback, user_data);
+    g_task_set_source_tag (self->task, gt_replay_source_start);
+
+    self->start_time = g_get_monotonic_time ();
+    self->bytes = 0;
+    self->pos = 0;
+    self->have_first = FALSE;
+    self->have_pending = FALSE;
+    if (self->reader != NULL)
+        gt_capture_reader_rewind (self->reader);
+
+    self->source = g_source_new (&replay_source_funcs, sizeof (GSource));
+    g_source_set_name (self->source, "GtReplaySource");
+    g_source_set_callback (self->source, on_replay_source_ready, self, NULL);
+
+    // Wakes up the source to notice the cancellation while it is waiting
+    // for the next record
+    if (cancellable != NULL) {
+        GSource *cancel_source = g_cancellable_source_new (cancellable);
+        g_source_set_dummy_callback (cancel_source);
+        g_source_add_child_source (self->source, cancel_source);
+        g_source_unref (cancel_source);
+    }
+
+    g_source_set_ready_time (self->source, 0);
+    g_source_attach (self->source, g_task_get_context (self->task));
+}
+
+gboolean
+gt_replay_source_finish (GtReplaySource *self,
+                         GAsyncResult *res,
+                         GError **error)
+{
+    g_return_val_if_fail (g_task_is_valid (res, self), FALSE);
+
+    return g_task_propagate_boolean (G_TASK (res), error);
+}
+
+/* Number of bytes replayed so far */
+guint64
+gt_replay_source_get_bytes (GtReplaySource *self)
+{
+    return self->bytes;
+}
+
+/* Wall time the last replay took, in microseconds */
+gint64
+gt_replay_source_get_elapsed (GtReplaySource *self)
+{
+    return self->elapsed;
+}
@@ -0,0 +1,49 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define GT_TYPE_REPLAY_SOURCE (gt_replay_source_get_type ())
+
+G_DECLARE_FINAL_TYPE (
+    GtReplaySource, gt_replay_source, GT, REPLAY_SOURCE, GObject)
+
+GtReplaySource *
+gt_replay_source_new (const char *file_name, GError **error);
+
+void
+gt_replay_source_start (GtReplaySource *self,
+                        GCancellable *cancellable,
+                        GAsyncReadyCallback callback,
+                        gpointer user_data);
+gboolean
+gt_replay_source_finish (GtReplaySource *self,
+                         GAsyncResult *res,
+                         GError **error);
+
+guint64
+gt_replay_source_get_bytes (GtReplaySource *self);
+
+gint64
+gt_replay_source_get_elapsed (GtReplaySource *self);
+
+G_END_DECLS
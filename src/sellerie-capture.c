@@ -0,0 +1,287 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Convert binary captures written by Sellerie to text or CSV */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "capture.h"
+
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+#include <glib.h>
+#include <glib/gi18n.h>
+
+static char *output_format = NULL;
+static char *start_time = NULL;
+static char **files = NULL;
+
+static GOptionEntry entries[] = {
+    {"format",
+     'f',
+     0,
+     G_OPTION_ARG_STRING,
+     &output_format,
+     N_ ("Output format, text (default) or csv"),
+     "FORMAT"},
+    {"from",
+     0,
+     0,
+     G_OPTION_ARG_STRING,
+     &start_time,
+     N_ ("Start at the given ISO 8601 time"),
+     "TIME"},
+    {G_OPTION_REMAINING,
+     0,
+     0,
+     G_OPTION_ARG_FILENAME_ARRAY,
+     &files,
+     NULL,
+     N_ ("FILE")},
+    {NULL}};
+
+static const struct {
+    guint flag;
+    const char *name;
+} modem_lines[] = {{TIOCM_RI, "RI"},
+                   {TIOCM_DSR, "DSR"},
+                   {TIOCM_CD, "CD"},
+                   {TIOCM_CTS, "CTS"},
+                   {TIOCM_RTS, "RTS"},
+                   {TIOCM_DTR, "DTR"}};
+
+static void
+print_escaped (const guint8 *data, gsize length)
+{
+    gsize i;
+
+    for (i = 0; i < length; i++) {
+        switch (data[i]) {
+        case '\n':
+            fputs ("\\n", stdout);
+            break;
+        case '\r':
+            fputs ("\\r", stdout);
+            break;
+        case '\t':
+            fputs ("\\t", stdout);
+            break;
+        case '\\':
+            fputs ("\\\\", stdout);
+            break;
+        default:
+            if (data[i] < 0x20 || data[i] >= 0x7F)
+                printf ("\\x%02x", data[i]);
+            else
+                putchar (data[i]);
+        }
+    }
+}
+
+static void
+print_hex (const guint8 *data, gsize length)
+{
+    gsize i;
+
+    for (i = 0; i < length; i++)
+        printf ("%02x", data[i]);
+}
+
+static void
+print_time (const GtCaptureRecord *record)
+{
+    g_autoptr (GDateTime) time = NULL;
+    g_autofree char *formatted = NULL;
+
+    if (record->wall_time == 0) {
+        printf ("%" G_GINT64_FORMAT ".%06" G_GINT64_FORMAT,
+                record->timestamp / G_USEC_PER_SEC,
+                record->timestamp % G_USEC_PER_SEC);
+
+        return;
+    }
+
+    time = g_date_time_new_from_unix_local (record->wall_time /
+                                             G_USEC_PER_SEC);
+    formatted = g_date_time_format (time, "%F %T");
+    printf ("%s.%06" G_GINT64_FORMAT,
+            formatted,
+            record->wall_time % G_USEC_PER_SEC);
+}
+
+static void
+print_lines (const GtCaptureRecord *record)
+{
+    guint32 lines = 0;
+    gsize i;
+
+    if (record->length < sizeof (lines))
+        return;
+
+    memcpy (&lines, record->payload, sizeof (lines));
+    lines = GUINT32_FROM_LE (lines);
+
+    for (i = 0; i < G_N_ELEMENTS (modem_lines); i++) {
+        if (lines & modem_lines[i].flag)
+            printf (" %s", modem_lines[i].name);
+    }
+}
+
+static void
+print_record_text (const GtCaptureRecord *record)
+{
+    print_time (record);
+    printf (" %s %-7s",
+            record->direction == GT_BUFFER_DIRECTION_TX ? "TX" : "RX",
+            gt_capture_event_to_string (record->event));
+
+    switch (record->event) {
+    case GT_CAPTURE_EVENT_MODEM_LINES:
+        print_lines (record);
+        break;
+    case GT_CAPTURE_EVENT_BREAK:
+        break;
+    default:
+        printf (" %" G_GSIZE_FORMAT " \"", record->length);
+        print_escaped (record->payload, record->length);
+        putchar ('"');
+        break;
+    }
+
+    putchar ('\n');
+}
+
+static void
+print_record_csv (const GtCaptureRecord *record)
+{
+    printf ("%" G_GINT64_FORMAT ",%" G_GINT64_FORMAT ",%s,%s,%" G_GSIZE_FORMAT
+            ",",
+            record->timestamp,
+            record->wall_time,
+            record->direction == GT_BUFFER_DIRECTION_TX ? "TX" : "RX",
+            gt_capture_event_to_string (record->event),
+            record->length);
+    print_hex (record->payload, record->length);
+    putchar ('\n');
+}
+
+static gboolean
+convert (const char *file_name, gboolean csv, gint64 from, GError **error)
+{
+    g_autoptr (GtCaptureReader) reader = NULL;
+    GtCaptureRecord record;
+
+    reader = gt_capture_reader_new (file_name, error);
+    if (reader == NULL)
+        return FALSE;
+
+    if (from != 0)
+        gt_capture_reader_seek (reader, from);
+
+    while (gt_capture_reader_next (reader, &record, error)) {
+        // Sync records are an implementation detail of the format
+        if (record.event == GT_CAPTURE_EVENT_SYNC)
+            continue;
+
+        if (from != 0 && record.wall_time != 0 && record.wall_time < from)
+            continue;
+
+        if (csv)
+            print_record_csv (&record);
+        else
+            print_record_text (&record);
+    }
+
+    return error == NULL || *error == NULL;
+}
+
+int
+main (int argc, char *argv[])
+{
+    g_autoptr (GOptionContext) context = NULL;
+    g_autoptr (GError) error = NULL;
+    gboolean csv = FALSE;
+    gint64 from = 0;
+    int result = EXIT_SUCCESS;
+    char **file = NULL;
+
+    setlocale (LC_ALL, "");
+    bindtextdomain (PACKAGE, LOCALEDIR);
+    bind_textdomain_codeset (PACKAGE, "UTF-8");
+    textdomain (PACKAGE);
+
+    context = g_option_context_new (NULL);
+    g_option_context_set_summary (
+        context, _ ("Convert Sellerie capture files to text or CSV"));
+    g_option_context_add_main_entries (context, entries, GETTEXT_PACKAGE);
+
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        g_printerr ("%s\n", error->message);
+
+        return EXIT_FAILURE;
+    }
+
+    if (files == NULL) {
+        g_printerr (_ ("No capture file given\n"));
+
+        return EXIT_FAILURE;
+    }
+
+    if (output_format != NULL) {
+        if (g_str_equal (output_format, "csv")) {
+            csv = TRUE;
+        } else if (!g_str_equal (output_format, "text")) {
+            g_printerr (_ ("Unknown output format %s\n"), output_format);
+
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (start_time != NULL) {
+        g_autoptr (GTimeZone) local = g_time_zone_new_local ();
+        g_autoptr (GDateTime) time =
+            g_date_time_new_from_iso8601 (start_time, local);
+
+        if (time == NULL) {
+            g_printerr (_ ("Invalid start time %s\n"), start_time);
+
+            return EXIT_FAILURE;
+        }
+
+        from = g_date_time_to_unix (time) * G_USEC_PER_SEC +
+               g_date_time_get_microsecond (time);
+    }
+
+    if (csv)
+        printf ("timestamp_us,wall_time_us,direction,event,length,data\n");
+
+    for (file = files; *file != NULL; file++) {
+        if (!convert (*file, csv, from, &error)) {
+            g_printerr ("%s: %s\n", *file, error->message);
+            g_clear_error (&error);
+            result = EXIT_FAILURE;
+        }
+    }
+
+    return result;
+}
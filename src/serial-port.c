@@ -24,6 +24,7 @@
 #include "buffer.h"
 #include "sellerie-enums.h"
 #include "term_config.h"
+#include "tx-pacer.h"
 #include "util.h"
 
 #include <errno.h>
@@ -73,8 +74,19 @@ typedef struct {
     guint status_timeout;
     GtBuffer *buffer;
     GCancellable *cancellable;
+    GtTxPacer *pacer;
+    // Tag of the asynchronous write that is going out right now
+    gconstpointer sending_tag;
 } GtSerialPortPrivate;
 
+typedef struct {
+    GBytes *bytes;
+    gsize offset;
+    gsize remaining;
+    gsize written;
+    gconstpointer tag;
+} SerialWriteData;
+
 struct _GtSerialPort {
     GObject parent_instance;
 };
@@ -100,6 +112,7 @@ static GParamSpec *gt_serial_port_properties[N_PROPERTIES] = {
 
 enum GtSerialPortSignals {
     SIGNAL_DATA_AVAILABLE,
+    SIGNAL_DATA_SENT,
     SIGNAL_COUNT,
 };
 
@@ -250,27 +263,23 @@ gt_serial_port_termios_from_config (GtSerialPort *self,
     return TRUE;
 }
 
-gsize
-gt_serial_port_write (GtSerialPort *self,
-                      const char *data,
-                      gsize length,
-                      GError **error)
-{
-    return gt_serial_port_send_chars (self, (char *)data, (int)length);
-}
-
-int
-gt_serial_port_send_chars (GtSerialPort *self, char *string, int length)
+static gssize
+gt_serial_port_write_now (GtSerialPort *self,
+                          const char *data,
+                          gsize length,
+                          GError **error)
 {
     GtSerialPortPrivate *priv = gt_serial_port_get_instance_private (self);
-    int bytes_written = 0;
+    gssize bytes_written = 0;
 
-    if (priv->serial_port_fd == -1)
-        return 0;
+    if (priv->serial_port_fd == -1) {
+        g_set_error_literal (error,
+                             G_IO_ERROR,
+                             G_IO_ERROR_CLOSED,
+                             _ ("Serial port is not open"));
 
-    /* Normally it never happens, but it is better not to segfault ;) */
-    if (length == 0)
-        return 0;
+        return -1;
+    }
 
     /* RS485 half-duplex mode ? */
     if (priv->config.flow == GT_SERIAL_PORT_FLOW_CONTROL_RS485) {
@@ -280,21 +289,30 @@ gt_serial_port_send_chars (GtSerialPort *self, char *string, int length)
             usleep (priv->config.rs485_rts_time_before_transmit * 1000);
     }
 
-    GError *error = NULL;
+    GError *write_error = NULL;
     bytes_written = g_output_stream_write (
-        priv->output_stream, string, length, priv->cancellable, &error);
+        priv->output_stream, data, length, priv->cancellable, &write_error);
 
-    if (error != NULL) {
-        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+    if (write_error != NULL) {
+        if (!g_error_matches (
+                write_error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
             gt_serial_port_close (self);
-            gt_serial_port_set_status (self, GT_SERIAL_PORT_STATE_ERROR, error);
-        } else {
-            g_clear_error (&error);
+            gt_serial_port_set_status (
+                self, GT_SERIAL_PORT_STATE_ERROR, g_error_copy (write_error));
         }
+        g_propagate_error (error, write_error);
 
         return -1;
     }
 
+    if (bytes_written > 0 &&
+        g_signal_has_handler_pending (
+            self, SIGNALS[SIGNAL_DATA_SENT], 0, FALSE)) {
+        GBytes *sent = g_bytes_new (data, bytes_written);
+        g_signal_emit (self, SIGNALS[SIGNAL_DATA_SENT], 0, sent);
+        g_bytes_unref (sent);
+    }
+
     /* RS485 half-duplex mode ? */
     if (priv->config.flow == GT_SERIAL_PORT_FLOW_CONTROL_RS485) {
         /* wait all chars are send */
@@ -308,6 +326,64 @@ gt_serial_port_send_chars (GtSerialPort *self, char *string, int length)
     return bytes_written;
 }
 
+static gssize
+gt_serial_port_paced_write (const guint8 *data,
+                            gsize length,
+                            GTask *task,
+                            gpointer user_data,
+                            GError **error)
+{
+    GtSerialPort *self = GT_SERIAL_PORT (user_data);
+    GtSerialPortPrivate *priv = gt_serial_port_get_instance_private (self);
+    SerialWriteData *write = task != NULL ? g_task_get_task_data (task) : NULL;
+
+    priv->sending_tag = write != NULL ? write->tag : NULL;
+    gssize written =
+        gt_serial_port_write_now (self, (const char *)data, length, error);
+    priv->sending_tag = NULL;
+
+    return written;
+}
+
+/* Write right away if nothing is paced or queued. Otherwise the data is
+ * queued behind whatever is still waiting to go out and counts as written,
+ * so it can neither overtake paced data nor defeat the pacing itself */
+gsize
+gt_serial_port_write (GtSerialPort *self,
+                      const char *data,
+                      gsize length,
+                      GError **error)
+{
+    GtSerialPortPrivate *priv = gt_serial_port_get_instance_private (self);
+
+    if (gt_tx_pacer_is_active (priv->pacer)) {
+        GBytes *bytes = g_bytes_new (data, length);
+        gt_tx_pacer_push (priv->pacer, bytes, 0, length, NULL);
+        g_bytes_unref (bytes);
+
+        return length;
+    }
+
+    gssize bytes_written = gt_serial_port_write_now (self, data, length, error);
+
+    return bytes_written < 0 ? 0 : (gsize)bytes_written;
+}
+
+int
+gt_serial_port_send_chars (GtSerialPort *self, char *string, int length)
+{
+    GtSerialPortPrivate *priv = gt_serial_port_get_instance_private (self);
+
+    if (priv->serial_port_fd == -1)
+        return 0;
+
+    /* Normally it never happens, but it is better not to segfault ;) */
+    if (length == 0)
+        return 0;
+
+    return (int)gt_serial_port_write (self, string, length, NULL);
+}
+
 gboolean
 gt_serial_port_config (GtSerialPort *self, struct configuration_port *config)
 {
@@ -370,6 +446,16 @@ gt_serial_port_connect (GtSerialPort *self)
     tcflush (priv->serial_port_fd, TCOFLUSH);
     tcflush (priv->serial_port_fd, TCIFLUSH);
 
+    gt_tx_pacer_set_interval (
+        priv->pacer,
+        gt_tx_pacer_interval_for (
+            priv->config.tx_rate,
+            priv->config.tx_gap,
+            priv->config.vitesse,
+            1 + priv->config.bits +
+                (priv->config.parity != GT_SERIAL_PORT_PARITY_NONE) +
+                priv->config.stops));
+
     priv->input_stream = g_unix_input_stream_new (priv->serial_port_fd, FALSE);
     priv->output_stream =
         g_unix_output_stream_new (priv->serial_port_fd, FALSE);
@@ -434,6 +520,11 @@ gt_serial_port_close (GtSerialPort *self)
 {
     GtSerialPortPrivate *priv = gt_serial_port_get_instance_private (self);
     if (priv->serial_port_fd != -1) {
+        GError *error = g_error_new_literal (
+            G_IO_ERROR, G_IO_ERROR_CLOSED, _ ("Serial port was closed"));
+        gt_tx_pacer_flush (priv->pacer, error);
+        g_error_free (error);
+
         tcsetattr (priv->serial_port_fd, TCSANOW, &(priv->termios_save));
         tcflush (priv->serial_port_fd, TCOFLUSH);
         tcflush (priv->serial_port_fd, TCIFLUSH);
@@ -830,6 +921,18 @@ gt_serial_port_class_init (GtSerialPortClass *klass)
                                                    1,
                                                    G_TYPE_BYTES,
                                                    0);
+
+    // Emitted with what actually went to the device, after pacing
+    SIGNALS[SIGNAL_DATA_SENT] = g_signal_new ("data-sent",
+                                              GT_TYPE_SERIAL_PORT,
+                                              G_SIGNAL_RUN_FIRST,
+                                              0,
+                                              NULL,
+                                              NULL,
+                                              NULL,
+                                              G_TYPE_NONE,
+                                              1,
+                                              G_TYPE_BYTES);
 }
 
 static void
@@ -839,6 +942,7 @@ gt_serial_port_init (GtSerialPort *self)
 
     priv->serial_port_fd = -1;
     priv->state = GT_SERIAL_PORT_STATE_OFFLINE;
+    priv->pacer = gt_tx_pacer_new (gt_serial_port_paced_write, self);
 }
 
 static void
@@ -900,6 +1004,7 @@ gt_serial_port_finalize (GObject *object)
     GObjectClass *object_class = NULL;
 
     g_clear_error (&priv->last_error);
+    gt_tx_pacer_free (priv->pacer);
 
     object_class = G_OBJECT_CLASS (gt_serial_port_parent_class);
     object_class->finalize (object);
@@ -963,6 +1068,30 @@ gt_serial_port_get_status (GtSerialPort *self)
     return priv->state;
 }
 
+static void
+serial_write_data_free (SerialWriteData *data)
+{
+    g_bytes_unref (data->bytes);
+    g_free (data);
+}
+
+static void
+on_serial_paced_rest_written (GObject *source,
+                              GAsyncResult *res,
+                              gpointer user_data)
+{
+    GTask *task = G_TASK (user_data);
+    SerialWriteData *data = g_task_get_task_data (task);
+    GError *error = NULL;
+    gssize written = g_task_propagate_int (G_TASK (res), &error);
+
+    if (error != NULL)
+        g_task_return_error (task, error);
+    else
+        g_task_return_int (task, data->written + written);
+    g_object_unref (task);
+}
+
 static gboolean
 on_serial_io_async_write (GObject *source, gpointer user_data)
 {
@@ -975,13 +1104,33 @@ on_serial_io_async_write (GObject *source, gpointer user_data)
     }
 
     GtSerialPort *self = GT_SERIAL_PORT (g_task_get_source_object (task));
-    GBytes *data = g_task_get_task_data (task);
-    gsize length = 0;
-    gconstpointer buffer = g_bytes_get_data (data, &length);
+    GtSerialPortPrivate *priv = gt_serial_port_get_instance_private (self);
+    SerialWriteData *data = g_task_get_task_data (task);
+    const guint8 *buffer =
+        (const guint8 *)g_bytes_get_data (data->bytes, NULL) + data->offset;
+
+    // Pacing was switched on or something got queued while we waited. The
+    // rest goes behind it, still tagged, and the task completes once it
+    // is really out.
+    if (gt_tx_pacer_is_active (priv->pacer)) {
+        GTask *rest = g_task_new (self,
+                                  g_task_get_cancellable (task),
+                                  on_serial_paced_rest_written,
+                                  task);
+
+        g_task_set_task_data (rest, data, NULL);
+        gt_tx_pacer_push (
+            priv->pacer, data->bytes, data->offset, data->remaining, rest);
+        g_object_unref (rest);
+
+        return FALSE;
+    }
 
     GError *write_error = NULL;
-    gsize bytes_written =
-        gt_serial_port_write (self, (const char *)buffer, length, &write_error);
+    priv->sending_tag = data->tag;
+    gsize bytes_written = gt_serial_port_write (
+        self, (const char *)buffer, data->remaining, &write_error);
+    priv->sending_tag = NULL;
     if (write_error != NULL) {
         g_task_return_error (task, write_error);
         g_object_unref (task);
@@ -989,7 +1138,7 @@ on_serial_io_async_write (GObject *source, gpointer user_data)
         return FALSE;
     }
 
-    if (bytes_written == 0 && length > 0) {
+    if (bytes_written == 0 && data->remaining > 0) {
         g_task_return_new_error (task,
                                  G_IO_ERROR,
                                  G_IO_ERROR_FAILED,
@@ -999,17 +1148,19 @@ on_serial_io_async_write (GObject *source, gpointer user_data)
         return FALSE;
     }
 
-    // Partial write; continue
-    if (bytes_written < length) {
-        g_debug ("=> underwrite... setting up new slice");
-        GBytes *new_data = g_bytes_new_from_bytes (
-            data, bytes_written, length - bytes_written);
-        g_task_set_task_data (task, new_data, (GDestroyNotify)g_bytes_unref);
+    data->offset += bytes_written;
+    data->remaining -= bytes_written;
+    data->written += bytes_written;
+
+    // Partial write; continue with the rest of the range
+    if (data->remaining > 0) {
+        g_debug ("=> underwrite... %" G_GSIZE_FORMAT " bytes left",
+                 data->remaining);
 
         return TRUE;
     }
 
-    g_task_return_int (task, bytes_written);
+    g_task_return_int (task, data->written);
     g_object_unref (task);
 
     return FALSE;
@@ -1021,20 +1172,77 @@ gt_serial_port_write_bytes_async (GtSerialPort *self,
                                   GCancellable *cancellable,
                                   GAsyncReadyCallback callback,
                                   gpointer user_data)
+{
+    gt_serial_port_write_range_async (self,
+                                      bytes,
+                                      0,
+                                      g_bytes_get_size (bytes),
+                                      NULL,
+                                      cancellable,
+                                      callback,
+                                      user_data);
+}
+
+/**
+ * gt_serial_port_write_range_async:
+ * @self: a #GtSerialPort
+ * @bytes: the data
+ * @offset: start of the range to write
+ * @length: length of the range
+ * @tag: (nullable): marks the write for gt_serial_port_get_sending_tag()
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: called once the whole range is written
+ * @user_data: data for @callback
+ */
+void
+gt_serial_port_write_range_async (GtSerialPort *self,
+                                  GBytes *bytes,
+                                  gsize offset,
+                                  gsize length,
+                                  gconstpointer tag,
+                                  GCancellable *cancellable,
+                                  GAsyncReadyCallback callback,
+                                  gpointer user_data)
 {
     GtSerialPortPrivate *priv = gt_serial_port_get_instance_private (self);
+
+    g_return_if_fail (offset + length <= g_bytes_get_size (bytes));
+
     GTask *task = g_task_new (self, cancellable, callback, user_data);
     if (priv->last_error != NULL) {
         g_task_return_error (task, g_error_copy (priv->last_error));
+        g_object_unref (task);
         return;
     }
 
-    g_task_set_task_data (
-        task, g_bytes_ref (bytes), (GDestroyNotify)g_bytes_unref);
+    if (priv->serial_port_fd == -1) {
+        g_task_return_new_error (task,
+                                 G_IO_ERROR,
+                                 G_IO_ERROR_NOT_CONNECTED,
+                                 _ ("The serial port is not open"));
+        g_object_unref (task);
+        return;
+    }
+
+    SerialWriteData *data = g_new0 (SerialWriteData, 1);
+    data->bytes = g_bytes_ref (bytes);
+    data->offset = offset;
+    data->remaining = length;
+    data->tag = tag;
+    g_task_set_task_data (task, data, (GDestroyNotify)serial_write_data_free);
+
+    // The pacer only needs the tag from the task data
+    if (gt_tx_pacer_is_active (priv->pacer)) {
+        gt_tx_pacer_push (priv->pacer, bytes, offset, length, task);
+        g_object_unref (task);
+
+        return;
+    }
 
     GSource *source = g_pollable_output_stream_create_source (
         G_POLLABLE_OUTPUT_STREAM (priv->output_stream), cancellable);
     g_task_attach_source (task, source, (GSourceFunc)on_serial_io_async_write);
+    g_source_unref (source);
 }
 
 gsize
@@ -1047,6 +1255,24 @@ gt_serial_port_write_bytes_finish (GtSerialPort *self,
     return (gsize)g_task_propagate_int (G_TASK (result), error);
 }
 
+/**
+ * gt_serial_port_get_sending_tag:
+ * @self: a #GtSerialPort
+ *
+ * Tells a "data-sent" handler which write the data came from, so it can
+ * pick out its own among everything else the port sends.
+ *
+ * Returns: the tag given to gt_serial_port_write_range_async() for the data
+ * being sent, or %NULL outside of such a write
+ */
+gconstpointer
+gt_serial_port_get_sending_tag (GtSerialPort *self)
+{
+    GtSerialPortPrivate *priv = gt_serial_port_get_instance_private (self);
+
+    return priv->sending_tag;
+}
+
 #ifdef HAVE_GUDEV
 static gboolean
 probe_port (const char *name)
@@ -1145,6 +1371,44 @@ gt_serial_port_detect_devices (void)
     return result;
 }
 
+static void
+device_list_free (gpointer data)
+{
+    g_list_free_full (data, g_free);
+}
+
+static void
+detect_devices_worker (GTask *task,
+                       gpointer source_object,
+                       gpointer task_data,
+                       GCancellable *cancellable)
+{
+    g_task_return_pointer (
+        task, gt_serial_port_detect_devices (), device_list_free);
+}
+
+/* The udev query and probing the 8250 ports can take a while, so do it
+ * in a thread */
+void
+gt_serial_port_detect_devices_async (GCancellable *cancellable,
+                                     GAsyncReadyCallback callback,
+                                     gpointer user_data)
+{
+    GTask *task = g_task_new (NULL, cancellable, callback, user_data);
+
+    g_task_set_source_tag (task, gt_serial_port_detect_devices_async);
+    g_task_run_in_thread (task, detect_devices_worker);
+    g_object_unref (task);
+}
+
+GList *
+gt_serial_port_detect_devices_finish (GAsyncResult *result, GError **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+
+    return g_task_propagate_pointer (G_TASK (result), error);
+}
+
 int
 gt_get_value_by_nick (GType type, const char *value, int fallback)
 {
@@ -1219,6 +1483,23 @@ gt_serial_port_send_file (GtSerialPort *self, GFile *file)
                          NULL);
 }
 
+GtFileTransfer *
+gt_serial_port_send_bytes (GtSerialPort *self, GBytes *bytes)
+{
+    GtSerialPortPrivate *priv = gt_serial_port_get_instance_private (self);
+
+    return g_object_new (GT_TYPE_FILE_TRANSFER,
+                         "bytes",
+                         bytes,
+                         "serial-port",
+                         self,
+                         "wait-character",
+                         priv->config.car,
+                         "delay",
+                         priv->config.delai,
+                         NULL);
+}
+
 static void
 gt_serial_port_on_data_ready (GObject *source,
                               GAsyncResult *res,
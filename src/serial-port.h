@@ -62,6 +62,12 @@ GtSerialPortState gt_serial_port_get_status (GtSerialPort *self);
 gboolean gt_serial_port_reconnect (GtSerialPort *);
 gboolean gt_serial_port_connect (GtSerialPort *self);
 GList *gt_serial_port_detect_devices (void);
+void
+gt_serial_port_detect_devices_async (GCancellable *cancellable,
+                                     GAsyncReadyCallback callback,
+                                     gpointer user_data);
+GList *
+gt_serial_port_detect_devices_finish (GAsyncResult *result, GError **error);
 
 void
 gt_serial_port_write_bytes_async (GtSerialPort *self,
@@ -69,10 +75,21 @@ gt_serial_port_write_bytes_async (GtSerialPort *self,
                                   GCancellable *cancellable,
                                   GAsyncReadyCallback callback,
                                   gpointer user_data);
+void
+gt_serial_port_write_range_async (GtSerialPort *self,
+                                  GBytes *bytes,
+                                  gsize offset,
+                                  gsize length,
+                                  gconstpointer tag,
+                                  GCancellable *cancellable,
+                                  GAsyncReadyCallback callback,
+                                  gpointer user_data);
 gsize
 gt_serial_port_write_bytes_finish (GtSerialPort *self,
                                    GAsyncResult *result,
                                    GError **error);
+gconstpointer
+gt_serial_port_get_sending_tag (GtSerialPort *self);
 
 GtSerialPortParity
 gt_serial_port_parity_from_string (const char *name);
@@ -83,6 +100,9 @@ gt_serial_port_flow_control_from_string (const char *name);
 GtFileTransfer *
 gt_serial_port_send_file (GtSerialPort *self, GFile *file);
 
+GtFileTransfer *
+gt_serial_port_send_bytes (GtSerialPort *self, GBytes *bytes);
+
 #define LINE_FEED 0x0A
 
 G_END_DECLS
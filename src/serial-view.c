@@ -17,16 +17,17 @@
  */
 
 #include "serial-view.h"
+#include "sellerie-enums.h"
 
 #include <glib-object.h>
 
+static const GdkRGBA GT_SERIAL_VIEW_DEFAULT_TX_TEXT = {0.96, 0.76, 0.07, 1.0};
+
 struct _GtHexDisplay {
     guint bytes_per_line;
     guint total_bytes;
     gboolean show_index;
 
-    gchar data[128];
-    gchar data_byte[6];
     guint column;
 };
 typedef struct _GtHexDisplay GtHexDisplay;
@@ -37,6 +38,8 @@ typedef struct {
     GtHexDisplay hex_display;
     GdkRGBA *text;
     GdkRGBA *background;
+    GdkRGBA *tx_text;
+    GtBufferDirection direction;
 } GtSerialViewPrivate;
 
 struct _GtSerialView {
@@ -49,29 +52,43 @@ struct _GtSerialViewClass {
 
 G_DEFINE_TYPE_WITH_PRIVATE (GtSerialView, gt_serial_view, VTE_TYPE_TERMINAL)
 
-enum { PROP_0, PROP_BUFFER, PROP_TEXT, PROP_BACKGROUND, N_PROPS };
+enum {
+    PROP_0,
+    PROP_BUFFER,
+    PROP_TEXT,
+    PROP_BACKGROUND,
+    PROP_TX_TEXT,
+    N_PROPS
+};
 static GParamSpec *properties[N_PROPS] = {NULL};
 
 enum { SIGNAL_NEW_DATA, SIGNAL_COUNT };
 static guint SIGNALS[SIGNAL_COUNT] = {0};
 
 void
-on_write_hex (GtSerialView *self, gchar *string, guint size);
+on_write_hex (GtSerialView *self,
+              const gchar *string,
+              guint size,
+              GtBufferDirection direction);
 
 void
-on_write_ascii (GtSerialView *self, gchar *string, guint size);
+on_write_ascii (GtSerialView *self,
+                const gchar *string,
+                guint size,
+                GtBufferDirection direction);
 
 static void
 on_buffer_updated (GtSerialView *self,
                    gpointer data,
                    guint size,
+                   GtBufferDirection direction,
                    gpointer user_data)
 {
     GtSerialViewPrivate *priv = gt_serial_view_get_instance_private (self);
     if (priv->mode == GT_SERIAL_VIEW_HEX)
-        on_write_hex (self, (gchar *)data, size);
+        on_write_hex (self, (const gchar *)data, size, direction);
     else
-        on_write_ascii (self, (gchar *)data, size);
+        on_write_ascii (self, (const gchar *)data, size, direction);
 }
 
 GtkWidget *
@@ -100,6 +117,7 @@ gt_serial_view_finalize (GObject *object)
     g_clear_object (&priv->buffer);
     g_clear_pointer (&priv->text, gdk_rgba_free);
     g_clear_pointer (&priv->background, gdk_rgba_free);
+    g_clear_pointer (&priv->tx_text, gdk_rgba_free);
 
     G_OBJECT_CLASS (gt_serial_view_parent_class)->finalize (object);
 }
@@ -123,6 +141,9 @@ gt_serial_view_get_property (GObject *object,
     case PROP_BACKGROUND:
         g_value_set_boxed (value, priv->background);
         break;
+    case PROP_TX_TEXT:
+        g_value_set_boxed (value, priv->tx_text);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -147,6 +168,9 @@ gt_serial_view_set_property (GObject *object,
     case PROP_BACKGROUND:
         gt_serial_view_set_background_color (self, g_value_get_boxed (value));
         break;
+    case PROP_TX_TEXT:
+        gt_serial_view_set_tx_text_color (self, g_value_get_boxed (value));
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -183,9 +207,10 @@ gt_serial_view_class_init (GtSerialViewClass *klass)
                                              NULL,
                                              NULL,
                                              G_TYPE_NONE,
-                                             2,
-                                             G_TYPE_STRING,
-                                             G_TYPE_UINT64);
+                                             3,
+                                             G_TYPE_POINTER,
+                                             G_TYPE_UINT,
+                                             GT_TYPE_BUFFER_DIRECTION);
 
     properties[PROP_BUFFER] = g_param_spec_object (
         "buffer",
@@ -210,6 +235,13 @@ gt_serial_view_class_init (GtSerialViewClass *klass)
         G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS |
             G_PARAM_EXPLICIT_NOTIFY);
 
+    properties[PROP_TX_TEXT] = g_param_spec_boxed (
+        "tx-text",
+        "tx-text",
+        "tx-text",
+        GDK_TYPE_RGBA,
+        G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
     g_object_class_install_properties (object_class, N_PROPS, properties);
 }
 
@@ -224,6 +256,8 @@ gt_serial_view_init (GtSerialView *self)
     priv->hex_display.total_bytes = 0;
     priv->hex_display.bytes_per_line = 16;
     priv->hex_display.show_index = FALSE;
+    priv->tx_text = gdk_rgba_copy (&GT_SERIAL_VIEW_DEFAULT_TX_TEXT);
+    priv->direction = GT_BUFFER_DIRECTION_RX;
 }
 
 void
@@ -233,6 +267,7 @@ gt_serial_view_clear (GtSerialView *self)
 
     priv->hex_display.total_bytes = 0;
     priv->hex_display.column = 0;
+    priv->direction = GT_BUFFER_DIRECTION_RX;
     vte_terminal_reset (VTE_TERMINAL (self), TRUE, TRUE);
 }
 
@@ -309,91 +344,117 @@ gt_serial_view_set_background_color (GtSerialView *self,
 }
 
 void
-on_write_hex (GtSerialView *self, gchar *string, guint size)
+gt_serial_view_set_tx_text_color (GtSerialView *self, const GdkRGBA *tx_text)
+{
+    GtSerialViewPrivate *priv = gt_serial_view_get_instance_private (self);
+
+    g_clear_pointer (&priv->tx_text, gdk_rgba_free);
+    priv->tx_text = (tx_text == NULL ? NULL : gdk_rgba_copy (tx_text));
+
+    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_TX_TEXT]);
+}
+
+/* Switch the foreground color if the direction of the data changes. This
+ * is one SGR sequence per direction change, not per byte */
+static void
+gt_serial_view_append_direction (GtSerialView *self,
+                                 GString *out,
+                                 GtBufferDirection direction)
 {
     GtSerialViewPrivate *priv = gt_serial_view_get_instance_private (self);
-    VteTerminal *term = VTE_TERMINAL (self);
-    GtHexDisplay *display = &(priv->hex_display);
 
+    if (direction == priv->direction)
+        return;
+
+    priv->direction = direction;
+
+    if (direction == GT_BUFFER_DIRECTION_TX && priv->tx_text != NULL) {
+        g_string_append_printf (out,
+                                "\033[38;2;%d;%d;%dm",
+                                (int)(priv->tx_text->red * 255),
+                                (int)(priv->tx_text->green * 255),
+                                (int)(priv->tx_text->blue * 255));
+    } else {
+        g_string_append (out, "\033[39m");
+    }
+}
+
+void
+on_write_hex (GtSerialView *self,
+              const gchar *string,
+              guint size,
+              GtBufferDirection direction)
+{
+    static const char hex_digits[] = "0123456789ABCDEF";
+    GtSerialViewPrivate *priv = gt_serial_view_get_instance_private (self);
+    GtHexDisplay *display = &(priv->hex_display);
+    guint bytes_per_line = display->bytes_per_line;
     guint i = 0;
 
     if (size == 0) {
         return;
     }
 
-    // We are spinning the mainloop below. If the user closes the window it
-    // might mean that we accidentally access a disposed VTE. So we add a weak
-    // pointer here that we can check after the loop iteration.
-    // FIXME: Need to do this without the nested main loop (which is ugly)
-    g_object_add_weak_pointer (G_OBJECT (self), (gpointer *)&term);
+    // Render the whole chunk and feed it to the terminal in one go
+    g_autoptr (GString) out = g_string_sized_new (size * 16);
+    g_autoptr (GString) hex = g_string_sized_new (size * 3);
 
-    while (i < size) {
-        while (g_main_context_pending (NULL))
-            g_main_context_iteration (NULL, TRUE);
+    gt_serial_view_append_direction (self, out, direction);
 
-        // User closed window, stop right here
-        if (term == NULL)
-            return;
+    for (i = 0; i < size; i++) {
+        guchar byte = (guchar)string[i];
+        gint avance = 0;
+
+        if ((display->show_index) && (display->column == 0)) {
+            /* First byte on line */
+            g_string_append_printf (out, "%6d: ", display->total_bytes);
+        }
 
         /* Print hexadecimal characters */
-        display->data[0] = 0;
-
-        guint bytes_per_line = display->bytes_per_line;
-        while (display->column < bytes_per_line && i < size) {
-            gint avance = 0;
-            gchar ascii[1];
-
-            if ((display->show_index) && (display->column == 0)) {
-                /* First byte on line */
-                sprintf (display->data, "%6d: ", display->total_bytes);
-                vte_terminal_feed (term, display->data, strlen (display->data));
-                display->column = 0;
-            }
-
-            sprintf (display->data_byte, "%02X ", (guchar)string[i]);
-            g_signal_emit (
-                self, SIGNALS[SIGNAL_NEW_DATA], 0, display->data_byte, 3);
-
-            vte_terminal_feed (term, display->data_byte, 3);
-
-            avance =
-                (bytes_per_line - display->column) * 3 + display->column + 2;
-
-            /* Move forward */
-            sprintf (display->data_byte, "%c[%dC", 27, avance);
-            vte_terminal_feed (
-                term, display->data_byte, strlen (display->data_byte));
-
-            /* Print ascii characters */
-            ascii[0] = (string[i] > 0x1F) ? string[i] : '.';
-            vte_terminal_feed (term, ascii, 1);
-
-            /* Move backward */
-            sprintf (display->data_byte, "%c[%dD", 27, avance + 1);
-            vte_terminal_feed (
-                term, display->data_byte, strlen (display->data_byte));
-
-            if (display->column == bytes_per_line / 2 - 1)
-                vte_terminal_feed (term, "- ", strlen ("- "));
-
-            display->column++;
-            i++;
-
-            /* End of line ? */
-            if (display->column == bytes_per_line) {
-                vte_terminal_feed (term, "\r\n", 2);
-                display->total_bytes += display->column;
-                display->column = 0;
-            }
+        g_string_append_c (hex, hex_digits[byte >> 4]);
+        g_string_append_c (hex, hex_digits[byte & 0x0F]);
+        g_string_append_c (hex, ' ');
+        g_string_append_len (out, hex->str + hex->len - 3, 3);
+
+        avance = (bytes_per_line - display->column) * 3 + display->column + 2;
+
+        /* Move forward, print ascii character, move backward */
+        g_string_append_printf (out,
+                                "\033[%dC%c\033[%dD",
+                                avance,
+                                (string[i] > 0x1F) ? string[i] : '.',
+                                avance + 1);
+
+        if (display->column == bytes_per_line / 2 - 1)
+            g_string_append (out, "- ");
+
+        display->column++;
+
+        /* End of line ? */
+        if (display->column == bytes_per_line) {
+            g_string_append (out, "\r\n");
+            display->total_bytes += display->column;
+            display->column = 0;
         }
     }
 
-    g_object_remove_weak_pointer (G_OBJECT (self), (gpointer *)&term);
+    vte_terminal_feed (VTE_TERMINAL (self), out->str, out->len);
+    g_signal_emit (
+        self, SIGNALS[SIGNAL_NEW_DATA], 0, hex->str, (guint)hex->len, direction);
 }
 
 void
-on_write_ascii (GtSerialView *self, gchar *string, guint size)
+on_write_ascii (GtSerialView *self,
+                const gchar *string,
+                guint size,
+                GtBufferDirection direction)
 {
+    g_autoptr (GString) out = g_string_new (NULL);
+
+    gt_serial_view_append_direction (self, out, direction);
+    if (out->len > 0)
+        vte_terminal_feed (VTE_TERMINAL (self), out->str, out->len);
+
     vte_terminal_feed (VTE_TERMINAL (self), string, size);
-    g_signal_emit (self, SIGNALS[SIGNAL_NEW_DATA], 0, string, size);
+    g_signal_emit (self, SIGNALS[SIGNAL_NEW_DATA], 0, string, size, direction);
 }
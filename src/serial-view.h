@@ -68,6 +68,9 @@ void
 gt_serial_view_set_background_color (GtSerialView *self,
                                      const GdkRGBA *background);
 
+void
+gt_serial_view_set_tx_text_color (GtSerialView *self, const GdkRGBA *tx_text);
+
 G_END_DECLS
 
 #endif /* SERIAL_VIEW_H */
@@ -0,0 +1,109 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Timing of the startup phases, printed with --profile-startup.
+ *
+ * Marks are recorded from the top of main(), before the command line is
+ * parsed, so they are kept until we know whether to print them. Once
+ * enabled, every mark is printed as it happens; the last one is the first
+ * byte received from the port, or whatever gt_startup_profile_finish()
+ * is called with. */
+
+#include "startup-profile.h"
+
+#include <stdio.h>
+
+typedef struct {
+    const char *phase;
+    gint64 time;
+} GtStartupMark;
+
+static gint64 startup_start = -1;
+static gint64 startup_last;
+static gboolean startup_enabled = FALSE;
+static gboolean startup_finished = FALSE;
+static GArray *startup_pending = NULL;
+
+static void
+gt_startup_profile_print (const GtStartupMark *mark)
+{
+    fprintf (stderr,
+             "startup: %9.3f ms %+9.3f ms  %s\n",
+             (mark->time - startup_start) / 1000.0,
+             (mark->time - startup_last) / 1000.0,
+             mark->phase);
+    startup_last = mark->time;
+}
+
+/* Records the end of @phase, which must be a static string */
+void
+gt_startup_profile_mark (const char *phase)
+{
+    GtStartupMark mark = {phase, g_get_monotonic_time ()};
+
+    if (startup_finished)
+        return;
+
+    if (startup_start == -1) {
+        startup_start = mark.time;
+        startup_last = mark.time;
+    }
+
+    if (startup_enabled) {
+        gt_startup_profile_print (&mark);
+
+        return;
+    }
+
+    if (startup_pending == NULL)
+        startup_pending = g_array_new (FALSE, FALSE, sizeof (GtStartupMark));
+    g_array_append_val (startup_pending, mark);
+}
+
+/* Called once the command line is parsed. Without the option, nothing is
+ * recorded from then on. */
+void
+gt_startup_profile_set_enabled (gboolean enabled)
+{
+    if (!enabled) {
+        startup_finished = TRUE;
+        g_clear_pointer (&startup_pending, g_array_unref);
+
+        return;
+    }
+
+    if (startup_enabled || startup_finished)
+        return;
+
+    startup_enabled = TRUE;
+    if (startup_pending == NULL)
+        return;
+
+    for (guint i = 0; i < startup_pending->len; i++)
+        gt_startup_profile_print (
+            &g_array_index (startup_pending, GtStartupMark, i));
+    g_clear_pointer (&startup_pending, g_array_unref);
+}
+
+/* Records the last phase; marks after this one are ignored */
+void
+gt_startup_profile_finish (const char *phase)
+{
+    gt_startup_profile_mark (phase);
+    startup_finished = TRUE;
+    g_clear_pointer (&startup_pending, g_array_unref);
+}
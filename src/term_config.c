@@ -22,6 +22,7 @@
 #include "i18n.h"
 #include "main-window.h"
 #include "parsecfg.h"
+#include "profile-store.h"
 #include "sellerie-enums.h"
 #include "serial-port.h"
 #include "serial-view.h"
@@ -58,6 +59,7 @@
 #define DEFAULT_DELAY 0
 #define DEFAULT_CHAR -1
 #define DEFAULT_DELAY_RS485 30
+#define MAX_TX_GAP 1000000
 #define DEFAULT_ECHO FALSE
 
 extern GtSerialPort *serial_port;
@@ -74,6 +76,8 @@ static gint *wait_delay;
 static gint *wait_char;
 static gint *rts_time_before_tx;
 static gint *rts_time_after_tx;
+static gint *tx_rate;
+static gint *tx_gap;
 static gint *echo;
 static gint *crlfauto;
 static cfgList **macro_list = NULL;
@@ -102,6 +106,8 @@ static cfgStruct cfg[] = {
     {"wait_char", CFG_INT, &wait_char},
     {"rs485_rts_time_before_tx", CFG_INT, &rts_time_before_tx},
     {"rs485_rts_time_after_tx", CFG_INT, &rts_time_after_tx},
+    {"tx_rate", CFG_INT, &tx_rate},
+    {"tx_gap", CFG_INT, &tx_gap},
     {"echo", CFG_BOOL, &echo},
     {"crlfauto", CFG_BOOL, &crlfauto},
     {"font", CFG_STRING, &font},
@@ -120,6 +126,7 @@ static cfgStruct cfg[] = {
     {NULL, CFG_END, NULL}};
 
 static gchar *config_file = NULL;
+static GtProfileStore *profile_store = NULL;
 
 struct configuration_port config;
 
@@ -155,8 +162,8 @@ static void
 save_config (GtkDialog *, gint, GtkWidget *);
 static void
 really_save_config (GtkDialog *, gint, gpointer);
-static gint
-remove_section (gchar *, gchar *);
+static GtProfileStore *
+get_profile_store (void);
 static void
 Selec_couleur (GdkRGBA *, gfloat, gfloat, gfloat);
 
@@ -174,22 +181,25 @@ on_config_dialog_response (GtkDialog *self, gint response_id, gpointer data)
     gtk_window_destroy (GTK_WINDOW (self));
 }
 
-void
-Config_Port_Fenetre (GtkWindow *parent)
+static void
+on_devices_detected (GObject *source, GAsyncResult *result, gpointer user_data)
 {
-    GtkBuilder *builder;
-    GtkDialog *dialog;
-    GtkWidget *combo;
-    GtkWidget *entry;
+    g_autoptr (GtkWidget) combo = user_data;
     GList *device_list = NULL;
     GList *it = NULL;
-    char *rate = NULL;
 
-    device_list = gt_serial_port_detect_devices ();
+    device_list = gt_serial_port_detect_devices_finish (result, NULL);
+
+    // The dialog was closed while we were looking
+    if (gtk_widget_get_root (combo) == NULL) {
+        g_list_free_full (device_list, g_free);
+
+        return;
+    }
 
     if (device_list == NULL) {
         gt_main_window_show_message (
-            GT_MAIN_WINDOW (parent),
+            GT_MAIN_WINDOW (Fenetre),
             _ ("No serial devices found!\n\n"
                "Searched the following paths:\n"
                "\t/dev/ttyS*\n\t/dev/tts/*\n\t/dev/ttyUSB*\n\t/dev/"
@@ -198,6 +208,26 @@ Config_Port_Fenetre (GtkWindow *parent)
             GT_MESSAGE_TYPE_WARNING);
     }
 
+    for (it = device_list; it != NULL; it = it->next) {
+        gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (combo),
+                                        (const gchar *)it->data);
+    }
+
+    g_list_free_full (device_list, g_free);
+
+    if (config.port[0] == '\0')
+        gtk_combo_box_set_active (GTK_COMBO_BOX (combo), 0);
+}
+
+void
+Config_Port_Fenetre (GtkWindow *parent)
+{
+    GtkBuilder *builder;
+    GtkDialog *dialog;
+    GtkWidget *combo;
+    GtkWidget *entry;
+    char *rate = NULL;
+
     builder =
         gtk_builder_new_from_resource ("/org/jensge/Sellerie/settings-port.ui");
     dialog =
@@ -206,20 +236,16 @@ Config_Port_Fenetre (GtkWindow *parent)
     gtk_window_set_modal (GTK_WINDOW (dialog), TRUE);
     combo = GTK_WIDGET (gtk_builder_get_object (builder, "combo-device"));
 
-    for (it = device_list; it != NULL; it = it->next) {
-        gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (combo),
-                                        (const gchar *)it->data);
-    }
-
-    g_list_free_full (device_list, g_free);
+    /* The device list is filled in once the scan is done, so the dialog
+       does not wait for it */
+    gt_serial_port_detect_devices_async (
+        NULL, on_devices_detected, g_object_ref (combo));
 
     /* Set values on first page */
     if (config.port[0] != '\0') {
         entry = gtk_combo_box_get_child (GTK_COMBO_BOX (combo));
 
         gtk_editable_set_text (GTK_EDITABLE (entry), config.port);
-    } else {
-        gtk_combo_box_set_active (GTK_COMBO_BOX (combo), 0);
     }
 
     combo = GTK_WIDGET (gtk_builder_get_object (builder, "combo-baud-rate"));
@@ -289,6 +315,17 @@ Config_Port_Fenetre (GtkWindow *parent)
             GTK_SPIN_BUTTON (combo),
             (gfloat)config.rs485_rts_time_after_transmit);
     }
+
+    /* Set values on fourth page */
+    {
+        combo = GTK_WIDGET (gtk_builder_get_object (builder, "spin-tx-rate"));
+        gtk_spin_button_set_value (GTK_SPIN_BUTTON (combo),
+                                   (gdouble)config.tx_rate);
+
+        combo = GTK_WIDGET (gtk_builder_get_object (builder, "spin-tx-gap"));
+        gtk_spin_button_set_value (GTK_SPIN_BUTTON (combo),
+                                   (gdouble)config.tx_gap);
+    }
     g_signal_connect (
         dialog, "response", G_CALLBACK (on_config_dialog_response), builder);
     gtk_widget_show (GTK_WIDGET (dialog));
@@ -323,6 +360,12 @@ Lis_Config (GtkBuilder *builder)
     config.rs485_rts_time_after_transmit =
         gtk_spin_button_get_value_as_int (GTK_SPIN_BUTTON (widget));
 
+    widget = gtk_builder_get_object (builder, "spin-tx-rate");
+    config.tx_rate = gtk_spin_button_get_value_as_int (GTK_SPIN_BUTTON (widget));
+
+    widget = gtk_builder_get_object (builder, "spin-tx-gap");
+    config.tx_gap = gtk_spin_button_get_value_as_int (GTK_SPIN_BUTTON (widget));
+
     widget = gtk_builder_get_object (builder, "combo-parity");
     message = (char *)gtk_combo_box_get_active_id (GTK_COMBO_BOX (widget));
     config.parity = gt_serial_port_parity_from_string (message);
@@ -396,9 +439,7 @@ Select_config (gchar *title, void *callback)
 
     enum { N_texte, N_COLONNES };
 
-    /* Parse the config file */
-
-    max = cfgParse (config_file, cfg, CFG_INI);
+    max = gt_profile_store_get_n_profiles (get_profile_store ());
 
     if (max == -1) {
         gt_main_window_show_message (GT_MAIN_WINDOW (Fenetre),
@@ -466,7 +507,7 @@ Select_config (gchar *title, void *callback)
             gtk_list_store_set (Modele_Liste,
                                 &iter_Liste,
                                 N_texte,
-                                cfgSectionNumberToName (i),
+                                gt_profile_store_get_name (profile_store, i),
                                 -1);
         }
 
@@ -535,46 +576,29 @@ Save_config_file (void)
 void
 really_save_config (GtkDialog *dialog, gint response_id, gpointer data)
 {
-    int max, cfg_num, i;
+    int cfg_num;
     gchar *string = NULL;
 
-    cfg_num = -1;
-
     if (response_id == GTK_RESPONSE_ACCEPT) {
-        max = cfgParse (config_file, cfg, CFG_INI);
-
-        if (max == -1)
-            return;
-
-        for (i = 0; i < max; i++) {
-            if (!strcmp ((char *)data, cfgSectionNumberToName (i)))
-                cfg_num = i;
-        }
+        GtProfileStore *store = get_profile_store ();
+        g_autoptr (GError) error = NULL;
 
-        /* not overwriting */
+        /* Overwriting reuses the existing section in place */
+        cfg_num = gt_profile_store_add (store, (char *)data);
         if (cfg_num == -1) {
-            max = cfgAllocForNewSection (cfg, (char *)data);
-            cfg_num = max - 1;
-        } else {
-            if (remove_section (config_file, (char *)data) == -1) {
-                gt_main_window_show_message (GT_MAIN_WINDOW (Fenetre),
-                                             _ ("Cannot overwrite section!"),
-                                             GT_MESSAGE_TYPE_ERROR);
-                return;
-            }
-            if (max == cfgParse (config_file, cfg, CFG_INI)) {
-                gt_main_window_show_message (
-                    GT_MAIN_WINDOW (Fenetre),
-                    _ ("Cannot read configuration file!"),
-                    GT_MESSAGE_TYPE_ERROR);
-                return;
-            }
-            max = cfgAllocForNewSection (cfg, (char *)data);
-            cfg_num = max - 1;
+            gt_main_window_show_message (GT_MAIN_WINDOW (Fenetre),
+                                         _ ("Cannot read configuration file!"),
+                                         GT_MESSAGE_TYPE_ERROR);
+            return;
         }
 
         Copy_configuration (cfg_num);
-        cfgDump (config_file, cfg, CFG_INI, max);
+        if (!gt_profile_store_save (store, (char *)data, &error)) {
+            gt_main_window_show_message (GT_MAIN_WINDOW (Fenetre),
+                                         error->message,
+                                         GT_MESSAGE_TYPE_ERROR);
+            return;
+        }
 
         string =
             g_strdup_printf (_ ("Configuration [%s] saved\n"), (char *)data);
@@ -597,48 +621,41 @@ on_save_config_response (GtkDialog *self, gint response_id, gpointer user_data)
 void
 save_config (GtkDialog *dialog, gint response_id, GtkWidget *edit)
 {
-    int max, i;
     const gchar *config_name;
+    GtProfileStore *store = get_profile_store ();
 
     if (response_id == GTK_RESPONSE_ACCEPT) {
-        max = cfgParse (config_file, cfg, CFG_INI);
-
-        if (max == -1)
+        if (gt_profile_store_get_n_profiles (store) == -1)
             return;
 
         config_name = gtk_editable_get_text (GTK_EDITABLE (edit));
 
-        for (i = 0; i < max; i++) {
-            if (!strcmp (config_name, cfgSectionNumberToName (i))) {
-                GtkWidget *message_dialog;
-                message_dialog = gtk_message_dialog_new_with_markup (
-                    GTK_WINDOW (dialog),
-                    GTK_DIALOG_DESTROY_WITH_PARENT | GTK_DIALOG_MODAL,
-                    GTK_MESSAGE_QUESTION,
-                    GTK_BUTTONS_NONE,
-                    _ ("<b>Section [%s] already exists.</b>\n\nDo you want to "
-                       "overwrite it ?"),
-                    config_name);
-
-                gtk_dialog_add_buttons (GTK_DIALOG (message_dialog),
-                                        _ ("_Cancel"),
-                                        GTK_RESPONSE_NONE,
-                                        _ ("_OK"),
-                                        GTK_RESPONSE_ACCEPT,
-                                        NULL);
-
-                gtk_window_set_modal (GTK_WINDOW (message_dialog), TRUE);
-
-                g_signal_connect (message_dialog,
-                                  "response",
-                                  G_CALLBACK (on_save_config_response),
-                                  (gpointer)config_name);
-                gtk_widget_show (GTK_WIDGET (message_dialog));
-
-                i = max + 1;
-            }
-        }
-        if (i == max) /* Section does not exist */
+        if (gt_profile_store_lookup (store, config_name) != -1) {
+            GtkWidget *message_dialog;
+            message_dialog = gtk_message_dialog_new_with_markup (
+                GTK_WINDOW (dialog),
+                GTK_DIALOG_DESTROY_WITH_PARENT | GTK_DIALOG_MODAL,
+                GTK_MESSAGE_QUESTION,
+                GTK_BUTTONS_NONE,
+                _ ("<b>Section [%s] already exists.</b>\n\nDo you want to "
+                   "overwrite it ?"),
+                config_name);
+
+            gtk_dialog_add_buttons (GTK_DIALOG (message_dialog),
+                                    _ ("_Cancel"),
+                                    GTK_RESPONSE_NONE,
+                                    _ ("_OK"),
+                                    GTK_RESPONSE_ACCEPT,
+                                    NULL);
+
+            gtk_window_set_modal (GTK_WINDOW (message_dialog), TRUE);
+
+            g_signal_connect (message_dialog,
+                              "response",
+                              G_CALLBACK (on_save_config_response),
+                              (gpointer)config_name);
+            gtk_widget_show (GTK_WIDGET (message_dialog));
+        } else /* Section does not exist */
             really_save_config (
                 NULL, GTK_RESPONSE_ACCEPT, (gpointer)config_name);
     }
@@ -677,10 +694,14 @@ delete_config (GtkDialog *dialog,
         if (gtk_tree_selection_get_selected (Selection_Liste, &Modele, &iter)) {
             gtk_tree_model_get (
                 GTK_TREE_MODEL (Modele), &iter, 0, (gint *)&txt, -1);
-            if (remove_section (config_file, txt) == -1)
-                gt_main_window_show_message (GT_MAIN_WINDOW (Fenetre),
-                                             _ ("Cannot delete section!"),
-                                             GT_MESSAGE_TYPE_ERROR);
+            g_autoptr (GError) error = NULL;
+
+            if (!gt_profile_store_remove (get_profile_store (), txt, &error)) {
+                g_autofree char *string = g_strdup_printf (
+                    _ ("Cannot delete section: %s"), error->message);
+                gt_main_window_show_message (
+                    GT_MAIN_WINDOW (Fenetre), string, GT_MESSAGE_TYPE_ERROR);
+            }
         }
     }
 }
@@ -708,124 +729,115 @@ update_vte_config (void)
 gint
 Load_configuration_from_file (const gchar *config_name)
 {
-    int max, i;
+    GtProfileStore *store = get_profile_store ();
+    int i;
     gchar *string = NULL;
     cfgList *t;
 
-    max = cfgParse (config_file, cfg, CFG_INI);
+    if (gt_profile_store_get_n_profiles (store) == -1)
+        return -1;
 
-    if (max == -1)
+    i = gt_profile_store_lookup (store, config_name);
+    if (i == -1) {
+        string = g_strdup_printf (
+            _ ("No section \"%s\" in configuration file\n"), config_name);
+        gt_main_window_show_message (
+            GT_MAIN_WINDOW (Fenetre), string, GT_MESSAGE_TYPE_ERROR);
+        g_free (string);
         return -1;
+    }
 
-    else {
-        for (i = 0; i < max; i++) {
-            if (!strcmp (config_name, cfgSectionNumberToName (i))) {
-                Hard_default_configuration ();
-
-                if (port[i] != NULL)
-                    strncpy (config.port, port[i], sizeof (config.port) - 1);
-                if (speed[i] != 0)
-                    config.vitesse = speed[i];
-                if (bits[i] != 0)
-                    config.bits = bits[i];
-                if (stopbits[i] != 0)
-                    config.stops = stopbits[i];
-                if (parity[i] != NULL) {
-                    config.parity =
-                        gt_serial_port_parity_from_string (parity[i]);
-                }
-                if (flow[i] != NULL) {
-                    config.flow =
-                        gt_serial_port_flow_control_from_string (flow[i]);
-                }
-
-                config.delai = wait_delay[i];
-
-                if (wait_char[i] != 0)
-                    config.car = (signed char)wait_char[i];
-                else
-                    config.car = -1;
-
-                config.rs485_rts_time_before_transmit = rts_time_before_tx[i];
-                config.rs485_rts_time_after_transmit = rts_time_after_tx[i];
-
-                if (echo[i] != -1)
-                    config.echo = (gboolean)echo[i];
-                else
-                    config.echo = FALSE;
-
-                if (crlfauto[i] != -1)
-                    config.crlfauto = (gboolean)crlfauto[i];
-                else
-                    config.crlfauto = FALSE;
-
-                g_clear_pointer (&term_conf.font, pango_font_description_free);
-                term_conf.font = pango_font_description_from_string (font[i]);
-
-                GtMacroManager *manager = gt_macro_manager_get_default ();
-
-                gt_macro_manager_clear (manager);
-                for (t = macro_list[i]; t != NULL; t = t->next) {
-                    gt_macro_manager_add_from_string (manager, t->str);
-                }
-
-                if (rows[i] != 0)
-                    term_conf.rows = rows[i];
-
-                if (columns[i] != 0)
-                    term_conf.columns = columns[i];
-
-                if (scrollback[i] != 0)
-                    term_conf.scrollback = scrollback[i];
-
-                if (visual_bell[i] != -1)
-                    term_conf.visual_bell = (gboolean)visual_bell[i];
-                else
-                    term_conf.visual_bell = FALSE;
-
-                term_conf.foreground_color.red =
-                    (double)foreground_red[i] / G_MAXUINT16;
-                term_conf.foreground_color.green =
-                    (double)foreground_green[i] / G_MAXUINT16;
-                term_conf.foreground_color.blue =
-                    (double)foreground_blue[i] / G_MAXUINT16;
-
-                term_conf.background_color.red =
-                    (double)background_red[i] / G_MAXUINT16;
-                term_conf.background_color.green =
-                    (double)background_green[i] / G_MAXUINT16;
-                term_conf.background_color.blue =
-                    (double)background_blue[i] / G_MAXUINT16;
-
-                /* rows and columns are empty when the conf is autogenerate in
-                   the
-                   first save; so set term to default */
-                if (rows[i] == 0 || columns[i] == 0) {
-                    term_conf.rows = 80;
-                    term_conf.columns = 25;
-                    term_conf.scrollback = DEFAULT_SCROLLBACK;
-                    term_conf.visual_bell = FALSE;
-
-                    term_conf.foreground_color.red = 0.66;
-                    term_conf.foreground_color.green = 0.66;
-                    term_conf.foreground_color.blue = 0.66;
-
-                    term_conf.background_color.red = 0;
-                    term_conf.background_color.green = 0;
-                    term_conf.background_color.blue = 0;
-                }
-
-                i = max + 1;
-            }
-        }
-        if (i == max) {
-            string = g_strdup_printf (
-                _ ("No section \"%s\" in configuration file\n"), config_name);
-            gt_main_window_show_message (
-                GT_MAIN_WINDOW (Fenetre), string, GT_MESSAGE_TYPE_ERROR);
-            g_free (string);
-            return -1;
-        }
+    Hard_default_configuration ();
+
+    if (port[i] != NULL)
+        strncpy (config.port, port[i], sizeof (config.port) - 1);
+    if (speed[i] != 0)
+        config.vitesse = speed[i];
+    if (bits[i] != 0)
+        config.bits = bits[i];
+    if (stopbits[i] != 0)
+        config.stops = stopbits[i];
+    if (parity[i] != NULL) {
+        config.parity = gt_serial_port_parity_from_string (parity[i]);
+    }
+    if (flow[i] != NULL) {
+        config.flow = gt_serial_port_flow_control_from_string (flow[i]);
+    }
+
+    config.delai = wait_delay[i];
+
+    if (wait_char[i] != 0)
+        config.car = (signed char)wait_char[i];
+    else
+        config.car = -1;
+
+    config.rs485_rts_time_before_transmit = rts_time_before_tx[i];
+    config.rs485_rts_time_after_transmit = rts_time_after_tx[i];
+    config.tx_rate = tx_rate[i];
+    config.tx_gap = tx_gap[i];
+
+    if (echo[i] != -1)
+        config.echo = (gboolean)echo[i];
+    else
+        config.echo = FALSE;
+
+    if (crlfauto[i] != -1)
+        config.crlfauto = (gboolean)crlfauto[i];
+    else
+        config.crlfauto = FALSE;
+
+    g_clear_pointer (&term_conf.font, pango_font_description_free);
+    term_conf.font = pango_font_description_from_string (font[i]);
+
+    g_autoptr (GPtrArray) macros = g_ptr_array_new ();
+    for (t = macro_list[i]; t != NULL; t = t->next) {
+        g_ptr_array_add (macros, t->str);
+    }
+    g_ptr_array_add (macros, NULL);
+
+    gt_macro_manager_set_from_strings (
+        gt_macro_manager_get_default (),
+        (const char *const *)macros->pdata);
+
+    if (rows[i] != 0)
+        term_conf.rows = rows[i];
+
+    if (columns[i] != 0)
+        term_conf.columns = columns[i];
+
+    if (scrollback[i] != 0)
+        term_conf.scrollback = scrollback[i];
+
+    if (visual_bell[i] != -1)
+        term_conf.visual_bell = (gboolean)visual_bell[i];
+    else
+        term_conf.visual_bell = FALSE;
+
+    term_conf.foreground_color.red = (double)foreground_red[i] / G_MAXUINT16;
+    term_conf.foreground_color.green =
+        (double)foreground_green[i] / G_MAXUINT16;
+    term_conf.foreground_color.blue = (double)foreground_blue[i] / G_MAXUINT16;
+
+    term_conf.background_color.red = (double)background_red[i] / G_MAXUINT16;
+    term_conf.background_color.green =
+        (double)background_green[i] / G_MAXUINT16;
+    term_conf.background_color.blue = (double)background_blue[i] / G_MAXUINT16;
+
+    /* rows and columns are empty when the conf is autogenerate in the
+       first save; so set term to default */
+    if (rows[i] == 0 || columns[i] == 0) {
+        term_conf.rows = 80;
+        term_conf.columns = 25;
+        term_conf.scrollback = DEFAULT_SCROLLBACK;
+        term_conf.visual_bell = FALSE;
+
+        term_conf.foreground_color.red = 0.66;
+        term_conf.foreground_color.green = 0.66;
+        term_conf.foreground_color.blue = 0.66;
+
+        term_conf.background_color.red = 0;
+        term_conf.background_color.green = 0;
+        term_conf.background_color.blue = 0;
     }
 
     update_vte_config ();
@@ -894,6 +906,26 @@ Verify_configuration (void)
         g_free (string);
     }
 
+    if (config.tx_rate < 0) {
+        string = g_strdup_printf (_ ("Invalid transmit rate: %d characters/s\n"
+                                     "Transmit pacing is disabled\n"),
+                                  config.tx_rate);
+        gt_main_window_show_message (
+            GT_MAIN_WINDOW (Fenetre), string, GT_MESSAGE_TYPE_ERROR);
+        config.tx_rate = 0;
+        g_free (string);
+    }
+
+    if (config.tx_gap < 0 || config.tx_gap > MAX_TX_GAP) {
+        string = g_strdup_printf (_ ("Invalid character gap: %d microseconds\n"
+                                     "Falling back to no gap\n"),
+                                  config.tx_gap);
+        gt_main_window_show_message (
+            GT_MAIN_WINDOW (Fenetre), string, GT_MESSAGE_TYPE_ERROR);
+        config.tx_gap = 0;
+        g_free (string);
+    }
+
     if (term_conf.font == NULL) {
         term_conf.font = pango_font_description_from_string (DEFAULT_FONT);
     }
@@ -916,15 +948,31 @@ Check_configuration_file (void)
 
     /* if not, create it, with the [default] section */
     else {
+        GtProfileStore *store = get_profile_store ();
+        g_autoptr (GError) error = NULL;
+
+        Hard_default_configuration ();
+
+        /* Keep running on the hard defaults without a section to put them in */
+        int cfg_num = gt_profile_store_add (store, "default");
+        if (cfg_num == -1) {
+            gt_main_window_show_message (
+                GT_MAIN_WINDOW (Fenetre),
+                _ ("Cannot create the configuration file, using the "
+                   "built-in defaults"),
+                GT_MESSAGE_TYPE_ERROR);
+            return -1;
+        }
+
         string = g_strdup_printf (_ ("Configuration file (%s) with\n[default] "
                                      "configuration has been created.\n"),
                                   config_file);
         gt_main_window_show_message (
             GT_MAIN_WINDOW (Fenetre), string, GT_MESSAGE_TYPE_WARNING);
-        cfgAllocForNewSection (cfg, "default");
-        Hard_default_configuration ();
-        Copy_configuration (0);
-        cfgDump (config_file, cfg, CFG_INI, 1);
+
+        Copy_configuration (cfg_num);
+        if (!gt_profile_store_save (store, "default", &error))
+            g_warning ("Failed to create %s: %s", config_file, error->message);
         g_free (string);
     }
     return 0;
@@ -942,6 +990,8 @@ Hard_default_configuration (void)
     config.delai = DEFAULT_DELAY;
     config.rs485_rts_time_before_transmit = DEFAULT_DELAY_RS485;
     config.rs485_rts_time_after_transmit = DEFAULT_DELAY_RS485;
+    config.tx_rate = 0;
+    config.tx_gap = 0;
     config.car = DEFAULT_CHAR;
     config.echo = DEFAULT_ECHO;
     config.crlfauto = FALSE;
@@ -1012,6 +1062,13 @@ Copy_configuration (int pos)
     cfgStoreValue (cfg, "rs485_rts_time_after_tx", string, CFG_INI, pos);
     g_free (string);
 
+    string = g_strdup_printf ("%d", config.tx_rate);
+    cfgStoreValue (cfg, "tx_rate", string, CFG_INI, pos);
+    g_free (string);
+    string = g_strdup_printf ("%d", config.tx_gap);
+    cfgStoreValue (cfg, "tx_gap", string, CFG_INI, pos);
+    g_free (string);
+
     if (config.echo == FALSE)
         string = g_strdup_printf ("False");
     else
@@ -1038,7 +1095,7 @@ Copy_configuration (int pos)
     for (guint i = 0; i < g_list_model_get_n_items (model); i++) {
         g_autoptr (GtMacro) macro = g_list_model_get_item (model, i);
         g_autofree char *string = gt_macro_to_string (macro);
-        cfgStoreValue (cfg, "macros", string, CFG_INI, i);
+        cfgStoreValue (cfg, "macros", string, CFG_INI, pos);
     }
 
     string = g_strdup_printf ("%d", term_conf.rows);
@@ -1087,94 +1144,6 @@ Copy_configuration (int pos)
     g_free (string);
 }
 
-gint
-remove_section (gchar *cfg_file, gchar *section)
-{
-    FILE *f = NULL;
-    char *buffer = NULL;
-    char *buf;
-    size_t size;
-    gchar *to_search;
-    size_t i, j, length, sect;
-
-    f = fopen (cfg_file, "r");
-    if (f == NULL) {
-        perror (cfg_file);
-        return -1;
-    }
-
-    if (fseek (f, 0L, SEEK_END) < 0) {
-        fclose (f);
-        perror ("Seek");
-        return -1;
-    }
-
-    long tell = ftell (f);
-    if (tell == -1) {
-        fclose (f);
-        perror ("ftell");
-        return -1;
-    }
-
-    size = (size_t)tell;
-    rewind (f);
-
-    buffer = g_malloc (size);
-    if (buffer == NULL) {
-        fclose (f);
-        perror ("malloc");
-        return -1;
-    }
-
-    if (fread (buffer, 1, size, f) != size) {
-        perror (cfg_file);
-        fclose (f);
-        return -1;
-    }
-
-    to_search = g_strdup_printf ("[%s]", section);
-    length = strlen (to_search);
-
-    /* Search section */
-    for (i = 0; i < size - length; i++) {
-        for (j = 0; j < length; j++) {
-            if (to_search[j] != buffer[i + j])
-                break;
-        }
-        if (j == length)
-            break;
-    }
-
-    if (i == size - length) {
-        i18n_printf (_ ("Cannot find section %s\n"), to_search);
-        return -1;
-    }
-
-    sect = i;
-
-    /* Search for next section */
-    for (i = sect + length; i < size; i++) {
-        if (buffer[i] == '[')
-            break;
-    }
-
-    f = fopen (cfg_file, "w");
-    if (f == NULL) {
-        perror (cfg_file);
-        return -1;
-    }
-
-    fwrite (buffer, 1, sect, f);
-    buf = buffer + i;
-    fwrite (buf, 1, size - i, f);
-    fclose (f);
-
-    g_free (to_search);
-    g_free (buffer);
-
-    return 0;
-}
-
 void
 Selec_couleur (GdkRGBA *color, gfloat R, gfloat G, gfloat B)
 {
@@ -1232,6 +1201,16 @@ gt_config_set_file_path (const char *path)
 {
     g_free (config_file);
     config_file = g_strdup (path);
+    g_clear_pointer (&profile_store, gt_profile_store_free);
+}
+
+static GtProfileStore *
+get_profile_store (void)
+{
+    if (profile_store == NULL)
+        profile_store = gt_profile_store_new (config_file, cfg);
+
+    return profile_store;
 }
 
 void
@@ -64,6 +64,8 @@ struct configuration_port {
   gint delai;                  // end of char delay: in ms
   gint rs485_rts_time_before_transmit;
   gint rs485_rts_time_after_transmit;
+  gint tx_rate;                // transmit pacing: characters per second
+  gint tx_gap;                 // transmit pacing: gap between chars in us
   gchar car;             // caractere à attendre
   gboolean echo;               // echo local
   gboolean crlfauto;         // line feed auto
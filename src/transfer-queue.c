@@ -0,0 +1,474 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "transfer-queue.h"
+
+#include <glib/gi18n.h>
+
+// Jobs run strictly one after the other. The sizes of all files are looked
+// up before the first byte is sent, so a missing file fails the batch up
+// front instead of half way through flashing a device, and the overall
+// progress can be weighted by size.
+typedef struct {
+    GtFileTransfer *transfer;
+    guint pause;
+    guint64 size;
+} TransferJob;
+
+struct _GtTransferQueue {
+    GObject parent_instance;
+
+    GPtrArray *jobs;
+    guint current;
+    guint sized;
+
+    GTask *task;
+    GSource *pause;
+    gulong progress_handler;
+
+    guint64 total;
+    guint64 done;
+    gdouble job_progress;
+
+    gint64 start_time;
+    GtTransferQueueStats stats;
+};
+
+G_DEFINE_TYPE (GtTransferQueue, gt_transfer_queue, G_TYPE_OBJECT)
+
+enum { PROP_0, PROP_PROGRESS, PROP_CURRENT, PROP_N_JOBS, N_PROPS };
+
+enum { SIGNAL_JOB_STARTED, N_SIGNALS };
+
+static GParamSpec *properties[N_PROPS];
+static guint signals[N_SIGNALS] = {0};
+
+static void
+gt_transfer_queue_run_next (GtTransferQueue *self);
+
+static void
+transfer_job_free (TransferJob *job)
+{
+    g_object_unref (job->transfer);
+    g_free (job);
+}
+
+static void
+gt_transfer_queue_dispose (GObject *object)
+{
+    GtTransferQueue *self = (GtTransferQueue *)object;
+
+    if (self->pause != NULL) {
+        g_source_destroy (self->pause);
+        g_clear_pointer (&self->pause, g_source_unref);
+    }
+
+    G_OBJECT_CLASS (gt_transfer_queue_parent_class)->dispose (object);
+}
+
+static void
+gt_transfer_queue_finalize (GObject *object)
+{
+    GtTransferQueue *self = (GtTransferQueue *)object;
+
+    g_ptr_array_unref (self->jobs);
+
+    G_OBJECT_CLASS (gt_transfer_queue_parent_class)->finalize (object);
+}
+
+static gdouble
+gt_transfer_queue_get_progress (GtTransferQueue *self)
+{
+    if (self->total > 0) {
+        TransferJob *job = NULL;
+        gdouble current = 0.0;
+
+        if (self->current < self->jobs->len) {
+            job = g_ptr_array_index (self->jobs, self->current);
+            current = self->job_progress * job->size;
+        }
+
+        return MIN (((gdouble)self->done + current) / self->total, 1.0);
+    }
+
+    // Nothing but empty files; count jobs instead
+    if (self->jobs->len == 0)
+        return 0.0;
+
+    return (gdouble)self->current / self->jobs->len;
+}
+
+static void
+gt_transfer_queue_get_property (GObject *object,
+                                guint prop_id,
+                                GValue *value,
+                                GParamSpec *pspec)
+{
+    GtTransferQueue *self = GT_TRANSFER_QUEUE (object);
+
+    switch (prop_id) {
+    case PROP_PROGRESS:
+        g_value_set_double (value, gt_transfer_queue_get_progress (self));
+        break;
+    case PROP_CURRENT:
+        g_value_set_uint (value, self->current);
+        break;
+    case PROP_N_JOBS:
+        g_value_set_uint (value, self->jobs->len);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gt_transfer_queue_class_init (GtTransferQueueClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    object_class->dispose = gt_transfer_queue_dispose;
+    object_class->finalize = gt_transfer_queue_finalize;
+    object_class->get_property = gt_transfer_queue_get_property;
+
+    properties[PROP_PROGRESS] =
+        g_param_spec_double ("progress",
+                             "progress",
+                             "Overall progress, weighted by file size",
+                             0.0,
+                             1.0,
+                             0.0,
+                             G_PARAM_STATIC_STRINGS | G_PARAM_READABLE);
+
+    properties[PROP_CURRENT] =
+        g_param_spec_uint ("current",
+                           "current",
+                           "Index of the job being sent",
+                           0,
+                           G_MAXUINT,
+                           0,
+                           G_PARAM_STATIC_STRINGS | G_PARAM_READABLE);
+
+    properties[PROP_N_JOBS] =
+        g_param_spec_uint ("n-jobs",
+                           "n-jobs",
+                           "Number of queued jobs",
+                           0,
+                           G_MAXUINT,
+                           0,
+                           G_PARAM_STATIC_STRINGS | G_PARAM_READABLE);
+
+    g_object_class_install_properties (object_class, N_PROPS, properties);
+
+    signals[SIGNAL_JOB_STARTED] = g_signal_new ("job-started",
+                                                G_TYPE_FROM_CLASS (klass),
+                                                G_SIGNAL_RUN_LAST,
+                                                0,
+                                                NULL,
+                                                NULL,
+                                                NULL,
+                                                G_TYPE_NONE,
+                                                2,
+                                                G_TYPE_UINT,
+                                                GT_TYPE_FILE_TRANSFER);
+}
+
+static void
+gt_transfer_queue_init (GtTransferQueue *self)
+{
+    self->jobs = g_ptr_array_new_with_free_func (
+        (GDestroyNotify)transfer_job_free);
+}
+
+GtTransferQueue *
+gt_transfer_queue_new (void)
+{
+    return g_object_new (GT_TYPE_TRANSFER_QUEUE, NULL);
+}
+
+/**
+ * gt_transfer_queue_add:
+ * @self: a #GtTransferQueue
+ * @transfer: a transfer that was not started yet, with its own pacing set up
+ * @pause: time in milliseconds to wait after this job before the next one
+ */
+void
+gt_transfer_queue_add (GtTransferQueue *self,
+                       GtFileTransfer *transfer,
+                       guint pause)
+{
+    g_return_if_fail (self->task == NULL);
+
+    TransferJob *job = g_new0 (TransferJob, 1);
+    job->transfer = g_object_ref (transfer);
+    job->pause = pause;
+    g_ptr_array_add (self->jobs, job);
+
+    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_N_JOBS]);
+}
+
+guint
+gt_transfer_queue_get_n_jobs (GtTransferQueue *self)
+{
+    return self->jobs->len;
+}
+
+GtFileTransfer *
+gt_transfer_queue_get_job (GtTransferQueue *self, guint index)
+{
+    g_return_val_if_fail (index < self->jobs->len, NULL);
+
+    return ((TransferJob *)g_ptr_array_index (self->jobs, index))->transfer;
+}
+
+// internal functions
+
+static void
+gt_transfer_queue_complete (GtTransferQueue *self, GError *error)
+{
+    GTask *task = g_steal_pointer (&self->task);
+
+    if (task == NULL) {
+        g_clear_error (&error);
+        return;
+    }
+
+    if (self->pause != NULL) {
+        g_source_destroy (self->pause);
+        g_clear_pointer (&self->pause, g_source_unref);
+    }
+
+    self->stats.elapsed = g_get_monotonic_time () - self->start_time;
+    if (self->stats.elapsed > 0)
+        self->stats.average_rate =
+            (gdouble)self->stats.bytes * G_USEC_PER_SEC / self->stats.elapsed;
+
+    if (error != NULL) {
+        g_task_return_error (task, error);
+    } else {
+        GtTransferQueueStats *result = g_new (GtTransferQueueStats, 1);
+        *result = self->stats;
+        g_task_return_pointer (task, result, g_free);
+    }
+
+    g_object_unref (task);
+}
+
+static void
+on_job_progress (GObject *object, GParamSpec *pspec, gpointer user_data)
+{
+    GtTransferQueue *self = GT_TRANSFER_QUEUE (user_data);
+
+    g_object_get (object, "progress", &self->job_progress, NULL);
+    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_PROGRESS]);
+}
+
+static gboolean
+on_pause_done (GCancellable *cancellable, gpointer user_data)
+{
+    GTask *task = G_TASK (user_data);
+    GtTransferQueue *self = GT_TRANSFER_QUEUE (g_task_get_source_object (task));
+    GError *error = NULL;
+
+    g_clear_pointer (&self->pause, g_source_unref);
+
+    if (g_cancellable_set_error_if_cancelled (cancellable, &error))
+        gt_transfer_queue_complete (self, error);
+    else
+        gt_transfer_queue_run_next (self);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+on_job_done (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+    GTask *task = G_TASK (user_data);
+    GtTransferQueue *self = GT_TRANSFER_QUEUE (g_task_get_source_object (task));
+    TransferJob *job = g_ptr_array_index (self->jobs, self->current);
+    GtFileTransferStats stats;
+    GError *error = NULL;
+
+    g_clear_signal_handler (&self->progress_handler, job->transfer);
+
+    if (!gt_file_transfer_finish (
+            GT_FILE_TRANSFER (source), res, &stats, &error)) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_autofree char *name = g_file_get_parse_name (
+                gt_file_transfer_get_file (job->transfer));
+            g_prefix_error (&error, _ ("Sending “%s” failed: "), name);
+        }
+        gt_transfer_queue_complete (self, error);
+        g_object_unref (task);
+
+        return;
+    }
+
+    self->stats.jobs++;
+    self->stats.bytes += stats.bytes;
+    self->stats.peak_rate = MAX (self->stats.peak_rate, stats.peak_rate);
+    self->stats.echo_compared += stats.echo_compared;
+    self->stats.echo_errors += stats.echo_errors;
+    self->stats.echo_missing += stats.echo_missing;
+    self->stats.echo_resyncs += stats.echo_resyncs;
+
+    self->done += job->size;
+    self->job_progress = 0.0;
+    self->current++;
+    g_object_freeze_notify (G_OBJECT (self));
+    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_CURRENT]);
+    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_PROGRESS]);
+    g_object_thaw_notify (G_OBJECT (self));
+
+    if (job->pause > 0 && self->current < self->jobs->len) {
+        // A cancellable source with a ready time doubles as a cancellable
+        // sleep, so cancelling does not have to wait for the pause to end
+        self->pause = g_cancellable_source_new (g_task_get_cancellable (task));
+        g_source_set_ready_time (self->pause,
+                                 g_get_monotonic_time () +
+                                     (gint64)job->pause * 1000);
+        g_source_set_callback (self->pause,
+                               G_SOURCE_FUNC (on_pause_done),
+                               task,
+                               g_object_unref);
+        g_source_attach (self->pause, NULL);
+
+        return;
+    }
+
+    gt_transfer_queue_run_next (self);
+    g_object_unref (task);
+}
+
+static void
+gt_transfer_queue_run_next (GtTransferQueue *self)
+{
+    if (self->current == self->jobs->len) {
+        gt_transfer_queue_complete (self, NULL);
+
+        return;
+    }
+
+    TransferJob *job = g_ptr_array_index (self->jobs, self->current);
+
+    self->progress_handler = g_signal_connect (job->transfer,
+                                               "notify::progress",
+                                               G_CALLBACK (on_job_progress),
+                                               self);
+    g_signal_emit (self,
+                   signals[SIGNAL_JOB_STARTED],
+                   0,
+                   self->current,
+                   job->transfer);
+
+    gt_file_transfer_start (job->transfer,
+                            g_task_get_cancellable (self->task),
+                            on_job_done,
+                            g_object_ref (self->task));
+}
+
+static void
+gt_transfer_queue_query_size (GtTransferQueue *self);
+
+static void
+on_size_ready (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+    GTask *task = G_TASK (user_data);
+    GtTransferQueue *self = GT_TRANSFER_QUEUE (g_task_get_source_object (task));
+    GError *error = NULL;
+
+    g_autoptr (GFileInfo) info =
+        g_file_query_info_finish (G_FILE (source), res, &error);
+
+    if (info == NULL) {
+        gt_transfer_queue_complete (self, error);
+    } else {
+        TransferJob *job = g_ptr_array_index (self->jobs, self->sized);
+
+        job->size = (guint64)g_file_info_get_size (info);
+        self->total += job->size;
+        self->sized++;
+
+        if (self->task == task)
+            gt_transfer_queue_query_size (self);
+    }
+
+    g_object_unref (task);
+}
+
+static void
+gt_transfer_queue_query_size (GtTransferQueue *self)
+{
+    if (self->sized == self->jobs->len) {
+        self->start_time = g_get_monotonic_time ();
+        gt_transfer_queue_run_next (self);
+
+        return;
+    }
+
+    TransferJob *job = g_ptr_array_index (self->jobs, self->sized);
+
+    g_file_query_info_async (gt_file_transfer_get_file (job->transfer),
+                             G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                             G_FILE_QUERY_INFO_NONE,
+                             G_PRIORITY_DEFAULT,
+                             g_task_get_cancellable (self->task),
+                             on_size_ready,
+                             g_object_ref (self->task));
+}
+
+/**
+ * gt_transfer_queue_start:
+ * @self: a #GtTransferQueue
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: called once all jobs are sent or one of them failed
+ * @user_data: data for @callback
+ *
+ * Sends all queued transfers back to back. The queue can only be run once.
+ */
+void
+gt_transfer_queue_start (GtTransferQueue *self,
+                         GCancellable *cancellable,
+                         GAsyncReadyCallback callback,
+                         gpointer user_data)
+{
+    g_return_if_fail (self->task == NULL && self->current == 0);
+
+    self->task = g_task_new (self, cancellable, callback, user_data);
+    g_task_set_source_tag (self->task, gt_transfer_queue_start);
+
+    gt_transfer_queue_query_size (self);
+}
+
+gboolean
+gt_transfer_queue_finish (GtTransferQueue *self,
+                          GAsyncResult *res,
+                          GtTransferQueueStats *stats,
+                          GError **error)
+{
+    g_return_val_if_fail (g_task_is_valid (res, self), FALSE);
+
+    GtTransferQueueStats *result =
+        g_task_propagate_pointer (G_TASK (res), error);
+    if (result == NULL)
+        return FALSE;
+
+    if (stats != NULL)
+        *stats = *result;
+    g_free (result);
+
+    return TRUE;
+}
@@ -0,0 +1,69 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "file-transfer.h"
+
+#include <gio/gio.h>
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define GT_TYPE_TRANSFER_QUEUE (gt_transfer_queue_get_type ())
+
+G_DECLARE_FINAL_TYPE (
+    GtTransferQueue, gt_transfer_queue, GT, TRANSFER_QUEUE, GObject)
+
+typedef struct {
+    guint jobs;
+    guint64 bytes;
+    gint64 elapsed;
+    gdouble average_rate;
+    gdouble peak_rate;
+    guint64 echo_compared;
+    guint64 echo_errors;
+    guint64 echo_missing;
+    guint64 echo_resyncs;
+} GtTransferQueueStats;
+
+GtTransferQueue *
+gt_transfer_queue_new (void);
+
+void
+gt_transfer_queue_add (GtTransferQueue *self,
+                       GtFileTransfer *transfer,
+                       guint pause);
+
+guint
+gt_transfer_queue_get_n_jobs (GtTransferQueue *self);
+
+GtFileTransfer *
+gt_transfer_queue_get_job (GtTransferQueue *self, guint index);
+
+void
+gt_transfer_queue_start (GtTransferQueue *self,
+                         GCancellable *cancellable,
+                         GAsyncReadyCallback callback,
+                         gpointer user_data);
+gboolean
+gt_transfer_queue_finish (GtTransferQueue *self,
+                          GAsyncResult *res,
+                          GtTransferQueueStats *stats,
+                          GError **error);
+
+G_END_DECLS
@@ -0,0 +1,115 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "transfer-rate.h"
+
+/* The peak is only taken from windows at least this long, so the first
+ * chunks of a transfer do not produce absurd rates */
+#define TRANSFER_RATE_MIN_SPAN (G_USEC_PER_SEC / 4)
+
+void
+gt_transfer_rate_init (GtTransferRate *self, gint64 now, gint64 window)
+{
+    self->start = now;
+    self->window = window;
+    self->first = 0;
+    self->count = 1;
+    self->times[0] = now;
+    self->bytes[0] = 0;
+    self->peak = 0.0;
+}
+
+static guint
+gt_transfer_rate_last (const GtTransferRate *self)
+{
+    return (self->first + self->count - 1) % GT_TRANSFER_RATE_SAMPLES;
+}
+
+void
+gt_transfer_rate_add (GtTransferRate *self, gint64 now, guint64 bytes)
+{
+    guint last = gt_transfer_rate_last (self);
+
+    // Several writes in the same tick are merged into one sample
+    if (self->times[last] == now) {
+        self->bytes[last] = bytes;
+    } else {
+        if (self->count == GT_TRANSFER_RATE_SAMPLES) {
+            self->first = (self->first + 1) % GT_TRANSFER_RATE_SAMPLES;
+            self->count--;
+        }
+
+        last = (self->first + self->count) % GT_TRANSFER_RATE_SAMPLES;
+        self->times[last] = now;
+        self->bytes[last] = bytes;
+        self->count++;
+    }
+
+    // Keep one sample older than the window as the reference point
+    while (self->count > 2) {
+        guint next = (self->first + 1) % GT_TRANSFER_RATE_SAMPLES;
+        if (now - self->times[next] < self->window)
+            break;
+        self->first = next;
+        self->count--;
+    }
+
+    if (now - self->times[self->first] >= TRANSFER_RATE_MIN_SPAN)
+        self->peak = MAX (self->peak, gt_transfer_rate_get_current (self));
+}
+
+gdouble
+gt_transfer_rate_get_current (const GtTransferRate *self)
+{
+    guint last = gt_transfer_rate_last (self);
+    gint64 span = self->times[last] - self->times[self->first];
+
+    if (span <= 0)
+        return 0.0;
+
+    return (gdouble)(self->bytes[last] - self->bytes[self->first]) *
+           G_USEC_PER_SEC / span;
+}
+
+gdouble
+gt_transfer_rate_get_average (const GtTransferRate *self, gint64 now)
+{
+    guint last = gt_transfer_rate_last (self);
+
+    if (now <= self->start)
+        return 0.0;
+
+    return (gdouble)self->bytes[last] * G_USEC_PER_SEC / (now - self->start);
+}
+
+gdouble
+gt_transfer_rate_get_peak (const GtTransferRate *self)
+{
+    return self->peak;
+}
+
+/* Remaining time in microseconds, or -1 while there is no estimate */
+gint64
+gt_transfer_rate_get_eta (const GtTransferRate *self, guint64 remaining)
+{
+    gdouble rate = gt_transfer_rate_get_current (self);
+
+    if (rate <= 0.0)
+        return -1;
+
+    return (gint64)(remaining / rate * G_USEC_PER_SEC);
+}
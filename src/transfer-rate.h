@@ -0,0 +1,55 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define GT_TRANSFER_RATE_SAMPLES 32
+
+/* Throughput estimate over a sliding window of recent progress samples */
+typedef struct {
+    gint64 start;
+    gint64 window;
+    gint64 times[GT_TRANSFER_RATE_SAMPLES];
+    guint64 bytes[GT_TRANSFER_RATE_SAMPLES];
+    guint first;
+    guint count;
+    gdouble peak;
+} GtTransferRate;
+
+void
+gt_transfer_rate_init (GtTransferRate *self, gint64 now, gint64 window);
+
+void
+gt_transfer_rate_add (GtTransferRate *self, gint64 now, guint64 bytes);
+
+gdouble
+gt_transfer_rate_get_current (const GtTransferRate *self);
+
+gdouble
+gt_transfer_rate_get_average (const GtTransferRate *self, gint64 now);
+
+gdouble
+gt_transfer_rate_get_peak (const GtTransferRate *self);
+
+gint64
+gt_transfer_rate_get_eta (const GtTransferRate *self, guint64 remaining);
+
+G_END_DECLS
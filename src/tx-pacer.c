@@ -0,0 +1,452 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "tx-pacer.h"
+
+#include <glib/gi18n.h>
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_TIMERFD
+#include <sys/timerfd.h>
+#endif
+
+#define NSEC_PER_SEC G_GINT64_CONSTANT (1000000000)
+#define NSEC_PER_USEC G_GINT64_CONSTANT (1000)
+
+/* Shortest timer period. Faster rates release several characters per
+ * tick instead of waking up more often */
+#define TX_PACER_MIN_TICK (100 * NSEC_PER_USEC)
+
+/* Chunk size used to drain what is still queued after pacing was
+ * switched off */
+#define TX_PACER_UNPACED_BURST 4096
+
+typedef struct {
+    GBytes *bytes;
+    gsize offset;
+    gsize remaining;
+    gsize written;
+    GTask *task;
+} PacerItem;
+
+typedef struct {
+    GSource source;
+    GtTxPacer *pacer;
+} PacerSource;
+
+struct _GtTxPacer {
+    GtTxPacerWriteFunc write_func;
+    gpointer user_data;
+
+    GSource *source;
+    int timer_fd;
+    gboolean armed;
+
+    gint64 interval;
+    gint64 tick;
+    gsize burst;
+    gsize credit;
+    gint64 next_tick;
+    gint64 last_tick;
+
+    GQueue items;
+    /* Head item while the write function runs */
+    PacerItem *writing;
+};
+
+static void
+gt_tx_pacer_tick (GtTxPacer *self, guint64 ticks);
+
+static gint64
+gt_tx_pacer_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void
+pacer_item_free (PacerItem *item)
+{
+    g_bytes_unref (item->bytes);
+    g_clear_object (&item->task);
+    g_free (item);
+}
+
+static gboolean
+pacer_source_dispatch (GSource *source, GSourceFunc callback, gpointer data)
+{
+    GtTxPacer *self = ((PacerSource *)source)->pacer;
+    guint64 ticks = 0;
+
+#ifdef HAVE_TIMERFD
+    if (self->timer_fd >= 0) {
+        if (read (self->timer_fd, &ticks, sizeof (ticks)) != sizeof (ticks))
+            return G_SOURCE_CONTINUE;
+
+        gt_tx_pacer_tick (self, ticks);
+
+        return G_SOURCE_CONTINUE;
+    }
+#endif
+
+    gint64 now = gt_tx_pacer_now ();
+
+    if (now < self->next_tick)
+        return G_SOURCE_CONTINUE;
+
+    ticks = (now - self->next_tick) / self->tick + 1;
+    self->next_tick += ticks * self->tick;
+    g_source_set_ready_time (source, self->next_tick / NSEC_PER_USEC);
+
+    gt_tx_pacer_tick (self, ticks);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs pacer_source_funcs = {
+    NULL,
+    NULL,
+    pacer_source_dispatch,
+    NULL,
+};
+
+GtTxPacer *
+gt_tx_pacer_new (GtTxPacerWriteFunc write_func, gpointer user_data)
+{
+    GtTxPacer *self = g_new0 (GtTxPacer, 1);
+
+    self->write_func = write_func;
+    self->user_data = user_data;
+    self->timer_fd = -1;
+    g_queue_init (&self->items);
+
+    self->source = g_source_new (&pacer_source_funcs, sizeof (PacerSource));
+    ((PacerSource *)self->source)->pacer = self;
+    g_source_set_priority (self->source, G_PRIORITY_HIGH);
+    g_source_set_name (self->source, "[sellerie] transmit pacer");
+
+#ifdef HAVE_TIMERFD
+    // The ready time of the source is coarser, but good enough to go on
+    self->timer_fd =
+        timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (self->timer_fd >= 0)
+        g_source_add_unix_fd (self->source, self->timer_fd, G_IO_IN);
+    else
+        g_warning ("Failed to create transmit timer, pacing will be less "
+                   "precise: %s",
+                   g_strerror (errno));
+#endif
+
+    g_source_attach (self->source, NULL);
+    gt_tx_pacer_set_interval (self, 0);
+
+    return self;
+}
+
+void
+gt_tx_pacer_free (GtTxPacer *self)
+{
+    GError *error = g_error_new_literal (
+        G_IO_ERROR, G_IO_ERROR_CLOSED, _ ("Serial port was closed"));
+
+    gt_tx_pacer_flush (self, error);
+    g_error_free (error);
+
+    g_source_destroy (self->source);
+    g_source_unref (self->source);
+
+    if (self->timer_fd >= 0)
+        close (self->timer_fd);
+
+    g_free (self);
+}
+
+static void
+gt_tx_pacer_disarm (GtTxPacer *self)
+{
+    if (!self->armed)
+        return;
+
+    self->armed = FALSE;
+
+#ifdef HAVE_TIMERFD
+    if (self->timer_fd >= 0) {
+        struct itimerspec spec = {{0, 0}, {0, 0}};
+
+        timerfd_settime (self->timer_fd, 0, &spec, NULL);
+
+        return;
+    }
+#endif
+
+    g_source_set_ready_time (self->source, -1);
+}
+
+static void
+gt_tx_pacer_arm (GtTxPacer *self)
+{
+    if (self->armed)
+        return;
+
+    self->armed = TRUE;
+
+    // Keep the spacing to whatever went out last, even after an idle period
+    self->next_tick = MAX (gt_tx_pacer_now (), self->last_tick + self->tick);
+
+#ifdef HAVE_TIMERFD
+    if (self->timer_fd >= 0) {
+        struct itimerspec spec;
+
+        spec.it_value.tv_sec = self->next_tick / NSEC_PER_SEC;
+        spec.it_value.tv_nsec = self->next_tick % NSEC_PER_SEC;
+        spec.it_interval.tv_sec = self->tick / NSEC_PER_SEC;
+        spec.it_interval.tv_nsec = self->tick % NSEC_PER_SEC;
+
+        timerfd_settime (self->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+
+        return;
+    }
+#endif
+
+    g_source_set_ready_time (self->source, self->next_tick / NSEC_PER_USEC);
+}
+
+/**
+ * gt_tx_pacer_set_interval:
+ * @self: a #GtTxPacer
+ * @interval: time between two characters in nanoseconds, 0 to disable
+ */
+void
+gt_tx_pacer_set_interval (GtTxPacer *self, gint64 interval)
+{
+    self->interval = MAX (interval, 0);
+
+    if (self->interval == 0) {
+        self->tick = TX_PACER_MIN_TICK;
+        self->burst = TX_PACER_UNPACED_BURST;
+    } else if (self->interval >= TX_PACER_MIN_TICK) {
+        self->tick = self->interval;
+        self->burst = 1;
+    } else {
+        // Release whole groups of characters so the average stays exact
+        self->burst = (TX_PACER_MIN_TICK + self->interval - 1) / self->interval;
+        self->tick = self->interval * self->burst;
+    }
+
+    self->credit = 0;
+
+    if (self->armed) {
+        gt_tx_pacer_disarm (self);
+        gt_tx_pacer_arm (self);
+    }
+}
+
+/**
+ * gt_tx_pacer_is_active:
+ * @self: a #GtTxPacer
+ *
+ * Returns: %TRUE if writes have to go through the pacer, either because
+ * pacing is enabled or because earlier data is still queued
+ */
+gboolean
+gt_tx_pacer_is_active (GtTxPacer *self)
+{
+    return self->interval > 0 || !g_queue_is_empty (&self->items);
+}
+
+/**
+ * gt_tx_pacer_push:
+ * @self: a #GtTxPacer
+ * @bytes: data to send
+ * @offset: start of the range in @bytes
+ * @length: length of the range
+ * @task: (nullable): task to return the number of bytes written on
+ *
+ * Queues a range for paced transmission. The pacer takes its own
+ * reference on @task and completes it once the range is written.
+ */
+void
+gt_tx_pacer_push (GtTxPacer *self,
+                  GBytes *bytes,
+                  gsize offset,
+                  gsize length,
+                  GTask *task)
+{
+    g_return_if_fail (offset + length <= g_bytes_get_size (bytes));
+
+    PacerItem *item = g_new0 (PacerItem, 1);
+    item->bytes = g_bytes_ref (bytes);
+    item->offset = offset;
+    item->remaining = length;
+    item->task = task != NULL ? g_object_ref (task) : NULL;
+
+    g_queue_push_tail (&self->items, item);
+
+    gt_tx_pacer_arm (self);
+}
+
+/**
+ * gt_tx_pacer_flush:
+ * @self: a #GtTxPacer
+ * @error: error to fail the queued writes with
+ *
+ * Drops everything that is still queued, for example because the port
+ * was closed.
+ */
+void
+gt_tx_pacer_flush (GtTxPacer *self, const GError *error)
+{
+    PacerItem *writing = NULL;
+    PacerItem *item;
+
+    while ((item = g_queue_pop_head (&self->items)) != NULL) {
+        // A failing write closes the port and so flushes us; the tick fails
+        // the item it was writing with the real error afterwards
+        if (item == self->writing) {
+            writing = item;
+            continue;
+        }
+
+        if (item->task != NULL)
+            g_task_return_error (item->task, g_error_copy (error));
+        pacer_item_free (item);
+    }
+
+    if (writing != NULL)
+        g_queue_push_head (&self->items, writing);
+
+    gt_tx_pacer_disarm (self);
+}
+
+static void
+gt_tx_pacer_drop_cancelled (GtTxPacer *self)
+{
+    GList *iter = self->items.head;
+
+    while (iter != NULL) {
+        GList *next = iter->next;
+        PacerItem *item = iter->data;
+
+        if (item->task != NULL &&
+            g_cancellable_is_cancelled (g_task_get_cancellable (item->task))) {
+            g_queue_delete_link (&self->items, iter);
+            g_task_return_error_if_cancelled (item->task);
+            pacer_item_free (item);
+        }
+
+        iter = next;
+    }
+}
+
+static void
+gt_tx_pacer_tick (GtTxPacer *self, guint64 ticks)
+{
+    self->last_tick = gt_tx_pacer_now ();
+
+    // Ticks missed while the main loop was busy are not made up for by a
+    // burst; that would defeat the point for receivers with tiny FIFOs
+    self->credit = MIN (self->credit + ticks * self->burst, self->burst);
+
+    gt_tx_pacer_drop_cancelled (self);
+
+    while (self->credit > 0 && !g_queue_is_empty (&self->items)) {
+        PacerItem *item = g_queue_peek_head (&self->items);
+        const guint8 *data = g_bytes_get_data (item->bytes, NULL);
+        GError *error = NULL;
+
+        self->writing = item;
+        gssize written = self->write_func (data + item->offset,
+                                           MIN (self->credit, item->remaining),
+                                           item->task,
+                                           self->user_data,
+                                           &error);
+        self->writing = NULL;
+        if (written < 0) {
+            g_queue_remove (&self->items, item);
+            if (item->task != NULL)
+                g_task_return_error (item->task, g_error_copy (error));
+            pacer_item_free (item);
+
+            // Anything the close of the port left behind goes too
+            gt_tx_pacer_flush (self, error);
+            g_error_free (error);
+
+            return;
+        }
+
+        if (written == 0)
+            break;
+
+        item->offset += written;
+        item->remaining -= written;
+        item->written += written;
+        self->credit -= written;
+
+        if (item->remaining == 0) {
+            g_queue_pop_head (&self->items);
+            if (item->task != NULL)
+                g_task_return_int (item->task, item->written);
+            pacer_item_free (item);
+        }
+    }
+
+    if (g_queue_is_empty (&self->items))
+        gt_tx_pacer_disarm (self);
+}
+
+/**
+ * gt_tx_pacer_interval_for:
+ * @rate: maximum number of characters per second, 0 for unlimited
+ * @gap: idle time between two characters in microseconds, 0 for none
+ * @baud: line speed
+ * @bits_per_character: start, data, parity and stop bits of one character
+ *
+ * Returns: the time in nanoseconds from the start of one character to the
+ * start of the next one, 0 if no pacing is needed
+ */
+gint64
+gt_tx_pacer_interval_for (gint rate,
+                          gint gap,
+                          gint baud,
+                          gint bits_per_character)
+{
+    gint64 interval = 0;
+
+    if (rate > 0)
+        interval = NSEC_PER_SEC / rate;
+
+    if (gap > 0) {
+        gint64 character = 0;
+
+        if (baud > 0)
+            character = bits_per_character * NSEC_PER_SEC / baud;
+
+        interval = MAX (interval, character + gap * NSEC_PER_USEC);
+    }
+
+    return interval;
+}
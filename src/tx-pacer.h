@@ -0,0 +1,64 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Hands one paced chunk to the device, along with the task its range was
+ * pushed with. Returns the number of bytes taken, 0 if the device would block
+ * or -1 with @error set. */
+typedef gssize (*GtTxPacerWriteFunc) (const guint8 *data,
+                                      gsize length,
+                                      GTask *task,
+                                      gpointer user_data,
+                                      GError **error);
+
+typedef struct _GtTxPacer GtTxPacer;
+
+GtTxPacer *
+gt_tx_pacer_new (GtTxPacerWriteFunc write_func, gpointer user_data);
+
+void
+gt_tx_pacer_free (GtTxPacer *self);
+
+void
+gt_tx_pacer_set_interval (GtTxPacer *self, gint64 interval);
+
+gboolean
+gt_tx_pacer_is_active (GtTxPacer *self);
+
+void
+gt_tx_pacer_push (GtTxPacer *self,
+                  GBytes *bytes,
+                  gsize offset,
+                  gsize length,
+                  GTask *task);
+
+void
+gt_tx_pacer_flush (GtTxPacer *self, const GError *error);
+
+gint64
+gt_tx_pacer_interval_for (gint rate,
+                          gint gap,
+                          gint baud,
+                          gint bits_per_character);
+
+G_END_DECLS
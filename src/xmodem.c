@@ -0,0 +1,748 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* XMODEM (128 byte blocks, checksum or CRC-16), XMODEM-1K and YMODEM batch
+ * engines. Full data blocks are written straight out of the mapped file; only
+ * the three byte header and the CRC are framed around them */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "crc.h"
+#include "modem-engine.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <glib/gi18n.h>
+
+#define XMODEM_CRC_START 'C'
+
+#define XMODEM_SHORT_BLOCK 128
+#define XMODEM_LONG_BLOCK 1024
+
+#define XMODEM_START_TIMEOUT 3000
+#define XMODEM_BLOCK_TIMEOUT 10000
+
+typedef enum {
+    XMODEM_SEND_WAIT_START,
+    XMODEM_SEND_WAIT_BLOCK_ACK,
+    XMODEM_SEND_WAIT_EOT_ACK,
+    XMODEM_SEND_WAIT_END_ACK,
+    XMODEM_RECEIVE_START,
+    XMODEM_RECEIVE_BLOCKS
+} XmodemState;
+
+typedef struct {
+    GtModemTransfer *transfer;
+    GtModemProtocol protocol;
+    XmodemState state;
+    gboolean crc;
+    guint retries;
+    guint cancels;
+
+    // Sending
+    GFile *file;
+    GBytes *data;
+    gsize offset;
+    gsize block_length;
+    guint8 block;
+    gboolean header_sent;
+
+    // Receiving
+    guint8 rx[3 + XMODEM_LONG_BLOCK + 2];
+    gsize rx_length;
+    gsize rx_needed;
+    guint8 expected;
+    GOutputStream *output;
+    guint64 file_size;
+    guint64 file_received;
+    gboolean in_file;
+    gboolean eot_seen;
+} Xmodem;
+
+static gpointer
+xmodem_create (GtModemTransfer *transfer)
+{
+    Xmodem *self = g_new0 (Xmodem, 1);
+
+    self->transfer = transfer;
+    self->protocol = gt_modem_transfer_get_protocol (transfer);
+    self->crc = TRUE;
+
+    return self;
+}
+
+static void
+xmodem_free (gpointer engine)
+{
+    Xmodem *self = engine;
+
+    if (self->output != NULL)
+        g_output_stream_close (self->output, NULL, NULL);
+
+    g_clear_object (&self->output);
+    g_clear_object (&self->file);
+    g_clear_pointer (&self->data, g_bytes_unref);
+    g_free (self);
+}
+
+static void
+xmodem_fail (Xmodem *self, const char *message)
+{
+    gt_modem_transfer_abort (
+        self->transfer,
+        g_error_new_literal (G_IO_ERROR, G_IO_ERROR_FAILED, message));
+}
+
+static void
+xmodem_write_byte (Xmodem *self, guint8 c)
+{
+    gt_modem_transfer_write_data (self->transfer, &c, 1);
+}
+
+// Returns FALSE if the transfer was aborted
+static gboolean
+xmodem_count_retry (Xmodem *self)
+{
+    gt_modem_transfer_stats (self->transfer)->retries++;
+
+    if (++self->retries > GT_MODEM_MAX_RETRIES) {
+        xmodem_fail (self, _ ("Too many retries"));
+
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// Returns TRUE once the remote side sent two CANs in a row
+static gboolean
+xmodem_check_cancel (Xmodem *self, guint8 c)
+{
+    if (c != GT_MODEM_CAN) {
+        self->cancels = 0;
+
+        return FALSE;
+    }
+
+    if (++self->cancels < 2)
+        return FALSE;
+
+    gt_modem_transfer_complete (
+        self->transfer,
+        g_error_new_literal (G_IO_ERROR,
+                             G_IO_ERROR_CONNECTION_CLOSED,
+                             _ ("Transfer cancelled by the remote side")));
+
+    return TRUE;
+}
+
+static void
+xmodem_write_frame (Xmodem *self,
+                    guint8 block,
+                    GBytes *payload,
+                    gsize offset,
+                    gsize size)
+{
+    const guint8 *data = (const guint8 *)g_bytes_get_data (payload, NULL);
+    guint8 header[3] = {size == XMODEM_LONG_BLOCK ? GT_MODEM_STX
+                                                  : GT_MODEM_SOH,
+                        block,
+                        (guint8)~block};
+    guint8 trailer[2];
+    gsize trailer_length;
+
+    if (self->crc) {
+        guint16 crc = gt_crc16_update (0, data + offset, size);
+        trailer[0] = crc >> 8;
+        trailer[1] = crc & 0xff;
+        trailer_length = 2;
+    } else {
+        guint8 sum = 0;
+        gsize i;
+        for (i = 0; i < size; i++)
+            sum += data[offset + i];
+        trailer[0] = sum;
+        trailer_length = 1;
+    }
+
+    gt_modem_transfer_write_data (self->transfer, header, sizeof (header));
+    gt_modem_transfer_write (self->transfer, payload, offset, size);
+    gt_modem_transfer_write_data (self->transfer, trailer, trailer_length);
+}
+
+// YMODEM block 0: "name\0size", or all zeros to end the batch
+static void
+xmodem_send_header (Xmodem *self)
+{
+    gsize size = XMODEM_SHORT_BLOCK;
+    guint8 *buffer;
+
+    if (self->file != NULL) {
+        g_autofree char *name = g_file_get_basename (self->file);
+        g_autofree char *length = g_strdup_printf (
+            "%" G_GSIZE_FORMAT, g_bytes_get_size (self->data));
+        gsize needed = strlen (name) + 1 + strlen (length) + 1;
+
+        if (needed > XMODEM_LONG_BLOCK) {
+            xmodem_fail (self, _ ("File name is too long for YMODEM"));
+
+            return;
+        }
+
+        if (needed > XMODEM_SHORT_BLOCK)
+            size = XMODEM_LONG_BLOCK;
+
+        buffer = g_malloc0 (size);
+        memcpy (buffer, name, strlen (name));
+        memcpy (buffer + strlen (name) + 1, length, strlen (length));
+    } else {
+        buffer = g_malloc0 (size);
+    }
+
+    g_autoptr (GBytes) payload = g_bytes_new_take (buffer, size);
+    xmodem_write_frame (self, 0, payload, 0, size);
+    gt_modem_transfer_set_timeout (self->transfer, XMODEM_BLOCK_TIMEOUT);
+}
+
+static void
+xmodem_send_block (Xmodem *self)
+{
+    gsize remaining = g_bytes_get_size (self->data) - self->offset;
+    gsize size = XMODEM_SHORT_BLOCK;
+
+    if (self->protocol != GT_MODEM_PROTOCOL_XMODEM &&
+        remaining > XMODEM_SHORT_BLOCK)
+        size = XMODEM_LONG_BLOCK;
+
+    self->block_length = MIN (size, remaining);
+
+    if (self->block_length == size) {
+        xmodem_write_frame (self, self->block, self->data, self->offset, size);
+    } else {
+        // Only the last block is copied, to pad it
+        guint8 *buffer = g_malloc (size);
+        const guint8 *data =
+            (const guint8 *)g_bytes_get_data (self->data, NULL) + self->offset;
+
+        memcpy (buffer, data, self->block_length);
+        memset (buffer + self->block_length,
+                GT_MODEM_SUB,
+                size - self->block_length);
+
+        g_autoptr (GBytes) payload = g_bytes_new_take (buffer, size);
+        xmodem_write_frame (self, self->block, payload, 0, size);
+    }
+
+    gt_modem_transfer_set_timeout (self->transfer, XMODEM_BLOCK_TIMEOUT);
+}
+
+static void
+xmodem_send_eot (Xmodem *self)
+{
+    xmodem_write_byte (self, GT_MODEM_EOT);
+    gt_modem_transfer_set_timeout (self->transfer, XMODEM_BLOCK_TIMEOUT);
+}
+
+// Returns FALSE if there was nothing left to send
+static gboolean
+xmodem_next_file (Xmodem *self)
+{
+    GError *error = NULL;
+
+    g_clear_object (&self->file);
+    g_clear_pointer (&self->data, g_bytes_unref);
+
+    self->file = gt_modem_transfer_next_file (self->transfer);
+    if (self->file == NULL)
+        return FALSE;
+
+    self->data = gt_modem_transfer_map_file (self->transfer, self->file, &error);
+    if (self->data == NULL) {
+        gt_modem_transfer_abort (self->transfer, error);
+
+        return FALSE;
+    }
+
+    self->offset = 0;
+    self->block = self->protocol == GT_MODEM_PROTOCOL_YMODEM ? 0 : 1;
+    self->header_sent = FALSE;
+
+    return TRUE;
+}
+
+// Send whatever the current state is waiting to be acknowledged
+static void
+xmodem_send_current (Xmodem *self)
+{
+    switch (self->state) {
+    case XMODEM_SEND_WAIT_BLOCK_ACK:
+        if (self->block == 0)
+            xmodem_send_header (self);
+        else
+            xmodem_send_block (self);
+        break;
+    case XMODEM_SEND_WAIT_EOT_ACK:
+        xmodem_send_eot (self);
+        break;
+    case XMODEM_SEND_WAIT_END_ACK:
+        xmodem_send_header (self);
+        break;
+    default:
+        break;
+    }
+}
+
+static void
+xmodem_send_start (Xmodem *self)
+{
+    if (self->file == NULL) {
+        // YMODEM batch is done, close it with an empty header
+        self->state = XMODEM_SEND_WAIT_END_ACK;
+    } else if (self->block == 0) {
+        self->state = XMODEM_SEND_WAIT_BLOCK_ACK;
+    } else if (self->offset < g_bytes_get_size (self->data)) {
+        self->state = XMODEM_SEND_WAIT_BLOCK_ACK;
+    } else {
+        self->state = XMODEM_SEND_WAIT_EOT_ACK;
+    }
+
+    xmodem_send_current (self);
+}
+
+static void
+xmodem_send_receive (Xmodem *self, guint8 c)
+{
+    GtModemStats *stats = gt_modem_transfer_stats (self->transfer);
+
+    switch (self->state) {
+    case XMODEM_SEND_WAIT_START:
+        if (c == XMODEM_CRC_START) {
+            self->crc = TRUE;
+        } else if (c == GT_MODEM_NAK &&
+                   self->protocol != GT_MODEM_PROTOCOL_YMODEM) {
+            self->crc = FALSE;
+        } else {
+            return;
+        }
+        self->retries = 0;
+        xmodem_send_start (self);
+        break;
+
+    case XMODEM_SEND_WAIT_BLOCK_ACK:
+        if (c == GT_MODEM_ACK) {
+            self->retries = 0;
+
+            // YMODEM: the receiver asks for the data with another 'C'
+            if (self->block == 0) {
+                self->header_sent = TRUE;
+                self->block = 1;
+                self->state = XMODEM_SEND_WAIT_START;
+                gt_modem_transfer_set_timeout (self->transfer,
+                                               XMODEM_BLOCK_TIMEOUT);
+
+                return;
+            }
+
+            self->offset += self->block_length;
+            self->block++;
+            stats->bytes += self->block_length;
+            stats->blocks++;
+            gt_modem_transfer_update_progress (self->transfer);
+
+            xmodem_send_start (self);
+        } else if (c == GT_MODEM_NAK ||
+                   (c == XMODEM_CRC_START && self->offset == 0)) {
+            if (xmodem_count_retry (self))
+                xmodem_send_current (self);
+        }
+        break;
+
+    case XMODEM_SEND_WAIT_EOT_ACK:
+        if (c == GT_MODEM_ACK) {
+            self->retries = 0;
+            stats->files++;
+
+            if (self->protocol != GT_MODEM_PROTOCOL_YMODEM) {
+                gt_modem_transfer_complete (self->transfer, NULL);
+
+                return;
+            }
+
+            // Wait for the 'C' asking for the next header
+            xmodem_next_file (self);
+            if (!gt_modem_transfer_is_running (self->transfer))
+                return;
+
+            self->state = XMODEM_SEND_WAIT_START;
+            gt_modem_transfer_set_timeout (self->transfer,
+                                           XMODEM_BLOCK_TIMEOUT);
+        } else if (c == GT_MODEM_NAK) {
+            // YMODEM receivers NAK the first EOT on purpose
+            if (self->protocol == GT_MODEM_PROTOCOL_YMODEM ||
+                xmodem_count_retry (self))
+                xmodem_send_eot (self);
+        }
+        break;
+
+    case XMODEM_SEND_WAIT_END_ACK:
+        if (c == GT_MODEM_ACK) {
+            gt_modem_transfer_complete (self->transfer, NULL);
+        } else if (c == GT_MODEM_NAK) {
+            if (xmodem_count_retry (self))
+                xmodem_send_header (self);
+        }
+        break;
+
+    default:
+        g_assert_not_reached ();
+    }
+}
+
+static void
+xmodem_request (Xmodem *self)
+{
+    xmodem_write_byte (self, self->crc ? XMODEM_CRC_START : GT_MODEM_NAK);
+    gt_modem_transfer_set_timeout (self->transfer, XMODEM_START_TIMEOUT);
+}
+
+static gboolean
+xmodem_close_file (Xmodem *self)
+{
+    GError *error = NULL;
+
+    if (self->output == NULL)
+        return TRUE;
+
+    if (!g_output_stream_close (self->output, NULL, &error)) {
+        gt_modem_transfer_abort (self->transfer, error);
+        g_clear_object (&self->output);
+
+        return FALSE;
+    }
+
+    g_clear_object (&self->output);
+    gt_modem_transfer_stats (self->transfer)->files++;
+
+    return TRUE;
+}
+
+static void
+xmodem_receive_header (Xmodem *self, const guint8 *payload, gsize size)
+{
+    GError *error = NULL;
+    GtModemStats *stats = gt_modem_transfer_stats (self->transfer);
+    const guint8 *end = memchr (payload, '\0', size);
+
+    // An empty name ends the batch
+    if (payload[0] == '\0') {
+        xmodem_write_byte (self, GT_MODEM_ACK);
+        gt_modem_transfer_complete (self->transfer, NULL);
+
+        return;
+    }
+
+    if (end == NULL) {
+        xmodem_fail (self, _ ("Invalid YMODEM header"));
+
+        return;
+    }
+
+    g_autofree char *name = g_strndup ((const char *)payload, end - payload);
+    g_autofree char *info =
+        g_strndup ((const char *)end + 1, size - (end - payload) - 1);
+
+    self->output = gt_modem_transfer_create_file (self->transfer, name, &error);
+    if (self->output == NULL) {
+        gt_modem_transfer_abort (self->transfer, error);
+
+        return;
+    }
+
+    self->file_size = g_ascii_strtoull (info, NULL, 10);
+    self->file_received = 0;
+    self->in_file = TRUE;
+    self->expected = 1;
+    stats->total += self->file_size;
+
+    xmodem_write_byte (self, GT_MODEM_ACK);
+    xmodem_request (self);
+}
+
+static void
+xmodem_receive_block (Xmodem *self)
+{
+    GError *error = NULL;
+    GtModemStats *stats = gt_modem_transfer_stats (self->transfer);
+    gsize size = self->rx_needed - 3 - (self->crc ? 2 : 1);
+    const guint8 *payload = self->rx + 3;
+    gboolean valid = self->rx[1] == (guint8)~self->rx[2];
+
+    self->rx_length = 0;
+    self->state = XMODEM_RECEIVE_BLOCKS;
+
+    if (valid && self->crc) {
+        valid = gt_crc16_update (0, payload, size + 2) == 0;
+    } else if (valid) {
+        guint8 sum = 0;
+        gsize i;
+        for (i = 0; i < size; i++)
+            sum += payload[i];
+        valid = sum == payload[size];
+    }
+
+    if (!valid) {
+        if (xmodem_count_retry (self)) {
+            xmodem_write_byte (self, GT_MODEM_NAK);
+            gt_modem_transfer_set_timeout (self->transfer,
+                                           XMODEM_BLOCK_TIMEOUT);
+        }
+
+        return;
+    }
+
+    self->retries = 0;
+
+    if (self->rx[1] == (guint8)(self->expected - 1) &&
+        (self->in_file || self->expected != 0)) {
+        // The ACK got lost, the sender repeated the block
+        xmodem_write_byte (self, GT_MODEM_ACK);
+        if (self->rx[1] == 0)
+            xmodem_request (self);
+        else
+            gt_modem_transfer_set_timeout (self->transfer,
+                                           XMODEM_BLOCK_TIMEOUT);
+
+        return;
+    }
+
+    if (self->rx[1] != self->expected) {
+        xmodem_fail (self, _ ("Block sequence error"));
+
+        return;
+    }
+
+    if (!self->in_file) {
+        xmodem_receive_header (self, payload, size);
+
+        return;
+    }
+
+    // YMODEM knows the real size and drops the padding of the last block
+    gsize length = size;
+    if (self->file_size != 0)
+        length = MIN (size, self->file_size - self->file_received);
+
+    if (!g_output_stream_write_all (
+            self->output, payload, length, NULL, NULL, &error)) {
+        gt_modem_transfer_abort (self->transfer, error);
+
+        return;
+    }
+
+    self->file_received += length;
+    self->expected++;
+    stats->bytes += length;
+    stats->blocks++;
+    gt_modem_transfer_update_progress (self->transfer);
+
+    xmodem_write_byte (self, GT_MODEM_ACK);
+    gt_modem_transfer_set_timeout (self->transfer, XMODEM_BLOCK_TIMEOUT);
+}
+
+static void
+xmodem_receive_eot (Xmodem *self)
+{
+    if (!self->in_file)
+        return;
+
+    // YMODEM makes sure the EOT was not line noise by asking twice
+    if (self->protocol == GT_MODEM_PROTOCOL_YMODEM && !self->eot_seen) {
+        self->eot_seen = TRUE;
+        xmodem_write_byte (self, GT_MODEM_NAK);
+        gt_modem_transfer_set_timeout (self->transfer, XMODEM_BLOCK_TIMEOUT);
+
+        return;
+    }
+
+    self->eot_seen = FALSE;
+    xmodem_write_byte (self, GT_MODEM_ACK);
+
+    if (!xmodem_close_file (self))
+        return;
+
+    if (self->protocol != GT_MODEM_PROTOCOL_YMODEM) {
+        gt_modem_transfer_complete (self->transfer, NULL);
+
+        return;
+    }
+
+    self->in_file = FALSE;
+    self->expected = 0;
+    self->crc = TRUE;
+    xmodem_request (self);
+}
+
+static void
+xmodem_receive_byte (Xmodem *self, guint8 c)
+{
+    if (self->rx_length == 0) {
+        switch (c) {
+        case GT_MODEM_SOH:
+            self->rx_needed = 3 + XMODEM_SHORT_BLOCK + (self->crc ? 2 : 1);
+            break;
+        case GT_MODEM_STX:
+            self->rx_needed = 3 + XMODEM_LONG_BLOCK + (self->crc ? 2 : 1);
+            break;
+        case GT_MODEM_EOT:
+            xmodem_receive_eot (self);
+            return;
+        default:
+            // Line noise between blocks
+            return;
+        }
+    }
+
+    self->rx[self->rx_length++] = c;
+    if (self->rx_length == self->rx_needed)
+        xmodem_receive_block (self);
+}
+
+static void
+xmodem_start (gpointer engine)
+{
+    Xmodem *self = engine;
+    GError *error = NULL;
+
+    if (gt_modem_transfer_get_direction (self->transfer) ==
+        GT_MODEM_DIRECTION_SEND) {
+        if (!xmodem_next_file (self)) {
+            // Either nothing to send or the file could not be mapped
+            if (self->file == NULL)
+                gt_modem_transfer_complete (self->transfer, NULL);
+
+            return;
+        }
+
+        // The receiver has a minute to start the transfer
+        self->state = XMODEM_SEND_WAIT_START;
+        gt_modem_transfer_set_timeout (self->transfer, XMODEM_BLOCK_TIMEOUT);
+
+        return;
+    }
+
+    if (self->protocol != GT_MODEM_PROTOCOL_YMODEM) {
+        self->output =
+            gt_modem_transfer_create_file (self->transfer, NULL, &error);
+        if (self->output == NULL) {
+            gt_modem_transfer_complete (self->transfer, error);
+
+            return;
+        }
+        self->in_file = TRUE;
+        self->expected = 1;
+    }
+
+    self->state = XMODEM_RECEIVE_START;
+    xmodem_request (self);
+}
+
+static void
+xmodem_receive (gpointer engine, const guint8 *data, gsize length)
+{
+    Xmodem *self = engine;
+    gsize i;
+
+    for (i = 0; i < length; i++) {
+        // Only look for CAN between blocks, it is a valid data byte
+        if (self->rx_length == 0 && xmodem_check_cancel (self, data[i]))
+            return;
+
+        if (self->state >= XMODEM_RECEIVE_START)
+            xmodem_receive_byte (self, data[i]);
+        else
+            xmodem_send_receive (self, data[i]);
+
+        if (!gt_modem_transfer_is_running (self->transfer))
+            return;
+    }
+}
+
+static void
+xmodem_timeout (gpointer engine)
+{
+    Xmodem *self = engine;
+
+    switch (self->state) {
+    case XMODEM_SEND_WAIT_START:
+        if (++self->retries > 6)
+            xmodem_fail (self, _ ("The receiver did not start the transfer"));
+        else
+            gt_modem_transfer_set_timeout (self->transfer,
+                                           XMODEM_BLOCK_TIMEOUT);
+        break;
+
+    case XMODEM_SEND_WAIT_BLOCK_ACK:
+    case XMODEM_SEND_WAIT_EOT_ACK:
+    case XMODEM_SEND_WAIT_END_ACK:
+        if (xmodem_count_retry (self))
+            xmodem_send_current (self);
+        break;
+
+    case XMODEM_RECEIVE_START:
+        if (++self->retries > GT_MODEM_MAX_RETRIES) {
+            xmodem_fail (self, _ ("The sender did not start the transfer"));
+
+            return;
+        }
+
+        // Fall back to the checksum variant for plain XMODEM senders
+        if (self->retries == 3 &&
+            self->protocol == GT_MODEM_PROTOCOL_XMODEM)
+            self->crc = FALSE;
+
+        xmodem_request (self);
+        break;
+
+    case XMODEM_RECEIVE_BLOCKS:
+        self->rx_length = 0;
+        if (xmodem_count_retry (self)) {
+            xmodem_write_byte (self, self->in_file ? GT_MODEM_NAK
+                                                   : XMODEM_CRC_START);
+            gt_modem_transfer_set_timeout (self->transfer,
+                                           XMODEM_BLOCK_TIMEOUT);
+        }
+        break;
+
+    default:
+        g_assert_not_reached ();
+    }
+}
+
+static void
+xmodem_output_drained (gpointer engine)
+{
+}
+
+const GtModemEngineFuncs gt_xmodem_engine_funcs = {xmodem_create,
+                                                   xmodem_free,
+                                                   xmodem_start,
+                                                   xmodem_receive,
+                                                   xmodem_timeout,
+                                                   xmodem_output_drained};
@@ -0,0 +1,1206 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* ZMODEM send and receive engine. The sender streams ZCRCG subpackets as long
+ * as the receiver allows full streaming and falls back to ZCRCW windows of
+ * the advertised buffer size otherwise; errors are recovered by the receiver
+ * asking for a new position with ZRPOS. Positions in headers are 32 bits, so
+ * files are limited to 4 GiB */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "crc.h"
+#include "modem-engine.h"
+
+#include <string.h>
+
+#include <glib/gi18n.h>
+
+#define ZPAD '*'
+#define ZDLE 0x18
+#define ZBIN 'A'
+#define ZHEX 'B'
+#define ZBIN32 'C'
+
+#define ZRQINIT 0
+#define ZRINIT 1
+#define ZSINIT 2
+#define ZACK 3
+#define ZFILE 4
+#define ZSKIP 5
+#define ZNAK 6
+#define ZABORT 7
+#define ZFIN 8
+#define ZRPOS 9
+#define ZDATA 10
+#define ZEOF 11
+#define ZFERR 12
+#define ZCAN 16
+
+#define ZCRCE 'h'
+#define ZCRCG 'i'
+#define ZCRCQ 'j'
+#define ZCRCW 'k'
+#define ZRUB0 'l'
+#define ZRUB1 'm'
+
+// ZRINIT capabilities in ZF0
+#define CANFDX 0x01
+#define CANOVIO 0x02
+#define CANFC32 0x20
+
+// ZFILE conversion option in ZF0
+#define ZCBIN 1
+
+#define XON 0x11
+#define XOFF 0x13
+
+// Byte positions in the four header bytes
+#define ZP0 0
+#define ZP1 1
+#define ZF0 3
+
+#define ZMODEM_SUBPACKET 1024
+#define ZMODEM_MAX_SUBPACKET 8192
+#define ZMODEM_HIGH_WATER (16 * 1024)
+#define ZMODEM_HALF_DUPLEX_WINDOW 4096
+#define ZMODEM_TIMEOUT 10000
+
+typedef enum {
+    ZMODEM_SEND_WAIT_RINIT,
+    ZMODEM_SEND_WAIT_RPOS,
+    ZMODEM_SEND_STREAMING,
+    ZMODEM_SEND_WAIT_ACK,
+    ZMODEM_SEND_WAIT_EOF_RINIT,
+    ZMODEM_SEND_WAIT_FIN,
+    ZMODEM_RECEIVE_WAIT_FILE,
+    ZMODEM_RECEIVE_WAIT_SINIT_DATA,
+    ZMODEM_RECEIVE_WAIT_FILE_INFO,
+    ZMODEM_RECEIVE_WAIT_DATA,
+    ZMODEM_RECEIVE_DATA
+} ZmodemState;
+
+typedef enum {
+    PARSE_HUNT,
+    PARSE_PAD,
+    PARSE_FORMAT,
+    PARSE_BIN_HEADER,
+    PARSE_HEX_HEADER,
+    PARSE_DATA,
+    PARSE_DATA_CRC
+} ZmodemParseState;
+
+typedef enum {
+    ZDL_NONE,
+    ZDL_BYTE,
+    ZDL_FRAME_END,
+    ZDL_ERROR
+} ZdlResult;
+
+typedef struct {
+    GtModemTransfer *transfer;
+    ZmodemState state;
+    guint retries;
+
+    // Input parser
+    ZmodemParseState parse;
+    gboolean escape;
+    guint cancels;
+    guint8 header[9];
+    gsize header_length;
+    gsize header_needed;
+    gboolean header_crc32;
+    char hex[14];
+    gsize hex_length;
+    gboolean data_crc32;
+    GByteArray *data;
+    guint8 frame_end;
+    guint8 crc[4];
+    gsize crc_length;
+
+    // Sending
+    GFile *file;
+    GBytes *source;
+    gsize offset;
+    gsize acked;
+    // Position of the last ZRPOS, retries only count while stuck there
+    gsize rpos;
+    gsize since_ack;
+    guint64 done_bytes;
+    guint8 rx_flags;
+    gsize rx_buffer;
+    gboolean use_crc32;
+    guint8 last_sent;
+
+    // Receiving
+    GOutputStream *output;
+    guint64 received;
+} Zmodem;
+
+static void
+zmodem_on_header (Zmodem *self, guint8 type, const guint8 *p);
+
+static void
+zmodem_on_data (Zmodem *self,
+                const guint8 *data,
+                gsize length,
+                guint8 frame_end);
+
+static void
+zmodem_on_bad_data (Zmodem *self);
+
+static gpointer
+zmodem_create (GtModemTransfer *transfer)
+{
+    Zmodem *self = g_new0 (Zmodem, 1);
+
+    self->transfer = transfer;
+    self->data = g_byte_array_sized_new (ZMODEM_SUBPACKET);
+
+    return self;
+}
+
+static void
+zmodem_free (gpointer engine)
+{
+    Zmodem *self = engine;
+
+    if (self->output != NULL)
+        g_output_stream_close (self->output, NULL, NULL);
+
+    g_clear_object (&self->output);
+    g_clear_object (&self->file);
+    g_clear_pointer (&self->source, g_bytes_unref);
+    g_byte_array_unref (self->data);
+    g_free (self);
+}
+
+static void
+zmodem_fail (Zmodem *self, const char *message)
+{
+    gt_modem_transfer_abort (
+        self->transfer,
+        g_error_new_literal (G_IO_ERROR, G_IO_ERROR_FAILED, message));
+}
+
+static gboolean
+zmodem_count_retry (Zmodem *self)
+{
+    gt_modem_transfer_stats (self->transfer)->retries++;
+
+    if (++self->retries > GT_MODEM_MAX_RETRIES) {
+        zmodem_fail (self, _ ("Too many retries"));
+
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+zmodem_fail_too_large (Zmodem *self)
+{
+    zmodem_fail (self, _ ("ZMODEM cannot transfer files of 4 GiB or more"));
+}
+
+static void
+zmodem_pos_to_header (guint32 pos, guint8 *p)
+{
+    p[0] = pos & 0xff;
+    p[1] = (pos >> 8) & 0xff;
+    p[2] = (pos >> 16) & 0xff;
+    p[3] = (pos >> 24) & 0xff;
+}
+
+static guint32
+zmodem_header_to_pos (const guint8 *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((guint32)p[3] << 24);
+}
+
+// Output encoding
+
+static void
+zmodem_escape (Zmodem *self, GByteArray *out, const guint8 *data, gsize length)
+{
+    gsize i;
+
+    for (i = 0; i < length; i++) {
+        guint8 c = data[i];
+        gboolean escape = FALSE;
+
+        switch (c & 0x7f) {
+        case ZDLE:
+        case 0x10:
+        case XON:
+        case XOFF:
+            escape = TRUE;
+            break;
+        case '\r':
+            // Protect "@\r", which would start a Telenet command
+            escape = (self->last_sent & 0x7f) == '@';
+            break;
+        default:
+            break;
+        }
+
+        if (escape) {
+            guint8 escaped[2] = {ZDLE, c ^ 0x40};
+            g_byte_array_append (out, escaped, 2);
+        } else {
+            g_byte_array_append (out, &c, 1);
+        }
+        self->last_sent = c;
+    }
+}
+
+static void
+zmodem_queue (Zmodem *self, GByteArray *out)
+{
+    gsize length = out->len;
+    GBytes *bytes = g_byte_array_free_to_bytes (out);
+
+    gt_modem_transfer_write (self->transfer, bytes, 0, length);
+    g_bytes_unref (bytes);
+}
+
+static void
+zmodem_send_hex_header (Zmodem *self, guint8 type, const guint8 *p)
+{
+    guint8 raw[5] = {type, p[0], p[1], p[2], p[3]};
+    guint16 crc = gt_crc16_update (0, raw, sizeof (raw));
+    GString *frame = g_string_new (NULL);
+    gsize i;
+
+    g_string_append_c (frame, ZPAD);
+    g_string_append_c (frame, ZPAD);
+    g_string_append_c (frame, ZDLE);
+    g_string_append_c (frame, ZHEX);
+    for (i = 0; i < sizeof (raw); i++)
+        g_string_append_printf (frame, "%02x", raw[i]);
+    g_string_append_printf (frame, "%02x%02x", crc >> 8, crc & 0xff);
+    g_string_append_c (frame, '\r');
+    g_string_append_c (frame, (char)0x8a);
+    if (type != ZFIN && type != ZACK)
+        g_string_append_c (frame, XON);
+
+    gsize length = frame->len;
+    GBytes *bytes = g_string_free_to_bytes (frame);
+    gt_modem_transfer_write (self->transfer, bytes, 0, length);
+    g_bytes_unref (bytes);
+    self->last_sent = 0;
+}
+
+static void
+zmodem_append_bin_header (Zmodem *self,
+                          GByteArray *out,
+                          guint8 type,
+                          const guint8 *p)
+{
+    guint8 raw[9] = {type, p[0], p[1], p[2], p[3]};
+    guint8 start[3] = {ZPAD, ZDLE, self->use_crc32 ? ZBIN32 : ZBIN};
+
+    g_byte_array_append (out, start, sizeof (start));
+
+    if (self->use_crc32) {
+        guint32 crc = ~gt_crc32_update (GT_CRC32_INIT, raw, 5);
+        zmodem_pos_to_header (crc, raw + 5);
+        zmodem_escape (self, out, raw, 9);
+    } else {
+        guint16 crc = gt_crc16_update (0, raw, 5);
+        raw[5] = crc >> 8;
+        raw[6] = crc & 0xff;
+        zmodem_escape (self, out, raw, 7);
+    }
+}
+
+static void
+zmodem_append_subpacket (Zmodem *self,
+                         GByteArray *out,
+                         const guint8 *data,
+                         gsize length,
+                         guint8 frame_end)
+{
+    guint8 end[2] = {ZDLE, frame_end};
+    guint8 crc_bytes[4];
+    gsize crc_length;
+
+    zmodem_escape (self, out, data, length);
+    g_byte_array_append (out, end, sizeof (end));
+
+    if (self->use_crc32) {
+        guint32 crc = gt_crc32_update (GT_CRC32_INIT, data, length);
+        crc = ~gt_crc32_update (crc, &frame_end, 1);
+        zmodem_pos_to_header (crc, crc_bytes);
+        crc_length = 4;
+    } else {
+        guint16 crc = gt_crc16_update (0, data, length);
+        crc = gt_crc16_update (crc, &frame_end, 1);
+        crc_bytes[0] = crc >> 8;
+        crc_bytes[1] = crc & 0xff;
+        crc_length = 2;
+    }
+
+    zmodem_escape (self, out, crc_bytes, crc_length);
+
+    if (frame_end == ZCRCW) {
+        guint8 xon = XON;
+        g_byte_array_append (out, &xon, 1);
+    }
+}
+
+static void
+zmodem_send_pos_header (Zmodem *self, guint8 type, guint32 pos)
+{
+    guint8 p[4];
+
+    zmodem_pos_to_header (pos, p);
+    zmodem_send_hex_header (self, type, p);
+}
+
+// Input decoding
+
+static ZdlResult
+zmodem_decode (Zmodem *self, guint8 c, guint8 *out)
+{
+    if (self->escape) {
+        self->escape = FALSE;
+
+        switch (c) {
+        case ZCRCE:
+        case ZCRCG:
+        case ZCRCQ:
+        case ZCRCW:
+            *out = c;
+            return ZDL_FRAME_END;
+        case ZRUB0:
+            *out = 0x7f;
+            return ZDL_BYTE;
+        case ZRUB1:
+            *out = 0xff;
+            return ZDL_BYTE;
+        default:
+            break;
+        }
+
+        if ((c & 0x60) == 0x40) {
+            *out = c ^ 0x40;
+            return ZDL_BYTE;
+        }
+
+        return ZDL_ERROR;
+    }
+
+    if (c == ZDLE) {
+        self->escape = TRUE;
+        return ZDL_NONE;
+    }
+
+    // Flow control characters are never part of the data
+    if ((c & 0x7f) == XON || (c & 0x7f) == XOFF)
+        return ZDL_NONE;
+
+    *out = c;
+
+    return ZDL_BYTE;
+}
+
+static void
+zmodem_header_done (Zmodem *self, const guint8 *header, gboolean crc32)
+{
+    gboolean valid;
+
+    if (crc32) {
+        guint32 crc = ~gt_crc32_update (GT_CRC32_INIT, header, 5);
+        valid = crc == zmodem_header_to_pos (header + 5);
+    } else {
+        valid = gt_crc16_update (0, header, 7) == 0;
+    }
+
+    if (!valid) {
+        g_debug ("ZMODEM: header with bad CRC");
+        gt_modem_transfer_stats (self->transfer)->retries++;
+
+        return;
+    }
+
+    self->data_crc32 = crc32;
+    zmodem_on_header (self, header[0], header + 1);
+}
+
+static void
+zmodem_data_done (Zmodem *self)
+{
+    gboolean valid;
+
+    if (self->data_crc32) {
+        guint32 crc =
+            gt_crc32_update (GT_CRC32_INIT, self->data->data, self->data->len);
+        crc = ~gt_crc32_update (crc, &self->frame_end, 1);
+        valid = crc == zmodem_header_to_pos (self->crc);
+    } else {
+        guint16 crc = gt_crc16_update (0, self->data->data, self->data->len);
+        crc = gt_crc16_update (crc, &self->frame_end, 1);
+        valid = gt_crc16_update (crc, self->crc, 2) == 0;
+    }
+
+    if (!valid) {
+        self->parse = PARSE_HUNT;
+        g_byte_array_set_size (self->data, 0);
+        zmodem_on_bad_data (self);
+
+        return;
+    }
+
+    // More subpackets follow the ZCRCG and ZCRCQ ones without a new header
+    if (self->frame_end == ZCRCG || self->frame_end == ZCRCQ)
+        self->parse = PARSE_DATA;
+    else
+        self->parse = PARSE_HUNT;
+
+    zmodem_on_data (self, self->data->data, self->data->len, self->frame_end);
+    g_byte_array_set_size (self->data, 0);
+}
+
+static void
+zmodem_parse (Zmodem *self, guint8 c)
+{
+    ZdlResult result;
+    guint8 out = 0;
+
+    switch (self->parse) {
+    case PARSE_HUNT:
+        if (c == ZPAD)
+            self->parse = PARSE_PAD;
+        break;
+
+    case PARSE_PAD:
+        if (c == ZDLE)
+            self->parse = PARSE_FORMAT;
+        else if (c != ZPAD)
+            self->parse = PARSE_HUNT;
+        break;
+
+    case PARSE_FORMAT:
+        self->escape = FALSE;
+        self->header_length = 0;
+        self->hex_length = 0;
+        if (c == ZBIN || c == ZBIN32) {
+            self->header_crc32 = c == ZBIN32;
+            self->header_needed = c == ZBIN32 ? 9 : 7;
+            self->parse = PARSE_BIN_HEADER;
+        } else if (c == ZHEX) {
+            self->parse = PARSE_HEX_HEADER;
+        } else {
+            self->parse = PARSE_HUNT;
+        }
+        break;
+
+    case PARSE_BIN_HEADER:
+        result = zmodem_decode (self, c, &out);
+        if (result == ZDL_NONE)
+            break;
+
+        if (result != ZDL_BYTE) {
+            self->parse = PARSE_HUNT;
+            break;
+        }
+
+        self->header[self->header_length++] = out;
+        if (self->header_length == self->header_needed) {
+            self->parse = PARSE_HUNT;
+            zmodem_header_done (self, self->header, self->header_crc32);
+        }
+        break;
+
+    case PARSE_HEX_HEADER:
+        if (!g_ascii_isxdigit (c)) {
+            self->parse = PARSE_HUNT;
+            break;
+        }
+
+        self->hex[self->hex_length++] = c;
+        if (self->hex_length == sizeof (self->hex)) {
+            gsize i;
+            for (i = 0; i < 7; i++)
+                self->header[i] =
+                    (g_ascii_xdigit_value (self->hex[2 * i]) << 4) |
+                    g_ascii_xdigit_value (self->hex[2 * i + 1]);
+
+            self->parse = PARSE_HUNT;
+            zmodem_header_done (self, self->header, FALSE);
+        }
+        break;
+
+    case PARSE_DATA:
+        result = zmodem_decode (self, c, &out);
+        if (result == ZDL_NONE)
+            break;
+
+        if (result == ZDL_ERROR ||
+            (result == ZDL_BYTE && self->data->len >= ZMODEM_MAX_SUBPACKET)) {
+            self->parse = PARSE_HUNT;
+            g_byte_array_set_size (self->data, 0);
+            zmodem_on_bad_data (self);
+            break;
+        }
+
+        if (result == ZDL_FRAME_END) {
+            self->frame_end = out;
+            self->crc_length = 0;
+            self->parse = PARSE_DATA_CRC;
+        } else {
+            g_byte_array_append (self->data, &out, 1);
+        }
+        break;
+
+    case PARSE_DATA_CRC:
+        result = zmodem_decode (self, c, &out);
+        if (result == ZDL_NONE)
+            break;
+
+        if (result != ZDL_BYTE) {
+            self->parse = PARSE_HUNT;
+            g_byte_array_set_size (self->data, 0);
+            zmodem_on_bad_data (self);
+            break;
+        }
+
+        self->crc[self->crc_length++] = out;
+        if (self->crc_length == (self->data_crc32 ? 4u : 2u))
+            zmodem_data_done (self);
+        break;
+
+    default:
+        g_assert_not_reached ();
+    }
+}
+
+static void
+zmodem_expect_data (Zmodem *self)
+{
+    self->parse = PARSE_DATA;
+    self->escape = FALSE;
+    g_byte_array_set_size (self->data, 0);
+}
+
+// Sender
+
+static void
+zmodem_send_rqinit (Zmodem *self)
+{
+    static const guint8 zero[4] = {0, 0, 0, 0};
+
+    zmodem_send_hex_header (self, ZRQINIT, zero);
+    gt_modem_transfer_set_timeout (self->transfer, ZMODEM_TIMEOUT);
+}
+
+static void
+zmodem_send_fin (Zmodem *self)
+{
+    static const guint8 zero[4] = {0, 0, 0, 0};
+
+    self->state = ZMODEM_SEND_WAIT_FIN;
+    zmodem_send_hex_header (self, ZFIN, zero);
+    gt_modem_transfer_set_timeout (self->transfer, ZMODEM_TIMEOUT);
+}
+
+static void
+zmodem_send_file (Zmodem *self)
+{
+    guint8 p[4] = {0, 0, 0, ZCBIN};
+    g_autofree char *name = g_file_get_basename (self->file);
+    g_autofree char *info =
+        g_strdup_printf ("%" G_GSIZE_FORMAT " 0 100644 0 %u",
+                         g_bytes_get_size (self->source),
+                         gt_modem_transfer_get_files_left (self->transfer) + 1);
+    GByteArray *out = g_byte_array_new ();
+    GByteArray *payload = g_byte_array_new ();
+
+    g_byte_array_append (payload, (const guint8 *)name, strlen (name) + 1);
+    g_byte_array_append (payload, (const guint8 *)info, strlen (info) + 1);
+
+    zmodem_append_bin_header (self, out, ZFILE, p);
+    zmodem_append_subpacket (self, out, payload->data, payload->len, ZCRCW);
+    g_byte_array_unref (payload);
+    zmodem_queue (self, out);
+
+    self->state = ZMODEM_SEND_WAIT_RPOS;
+    gt_modem_transfer_set_timeout (self->transfer, ZMODEM_TIMEOUT);
+}
+
+static void
+zmodem_send_eof (Zmodem *self)
+{
+    guint8 p[4];
+    GByteArray *out = g_byte_array_new ();
+
+    zmodem_pos_to_header (g_bytes_get_size (self->source), p);
+    zmodem_append_bin_header (self, out, ZEOF, p);
+    zmodem_queue (self, out);
+
+    self->state = ZMODEM_SEND_WAIT_EOF_RINIT;
+    gt_modem_transfer_set_timeout (self->transfer, ZMODEM_TIMEOUT);
+}
+
+// Move on to the next file, or end the session
+static void
+zmodem_next_file (Zmodem *self)
+{
+    GError *error = NULL;
+
+    if (self->source != NULL)
+        self->done_bytes += g_bytes_get_size (self->source);
+
+    g_clear_object (&self->file);
+    g_clear_pointer (&self->source, g_bytes_unref);
+
+    self->file = gt_modem_transfer_next_file (self->transfer);
+    if (self->file == NULL) {
+        zmodem_send_fin (self);
+
+        return;
+    }
+
+    self->source =
+        gt_modem_transfer_map_file (self->transfer, self->file, &error);
+    if (self->source == NULL) {
+        gt_modem_transfer_abort (self->transfer, error);
+
+        return;
+    }
+
+    if (g_bytes_get_size (self->source) > G_MAXUINT32) {
+        zmodem_fail_too_large (self);
+
+        return;
+    }
+
+    zmodem_send_file (self);
+}
+
+static void
+zmodem_send_more (Zmodem *self)
+{
+    GtModemStats *stats = gt_modem_transfer_stats (self->transfer);
+    const guint8 *data = g_bytes_get_data (self->source, NULL);
+    gsize size = g_bytes_get_size (self->source);
+    gsize window = self->rx_buffer;
+
+    if (window == 0 && !(self->rx_flags & CANFDX))
+        window = ZMODEM_HALF_DUPLEX_WINDOW;
+
+    while (self->state == ZMODEM_SEND_STREAMING &&
+           gt_modem_transfer_get_pending (self->transfer) < ZMODEM_HIGH_WATER) {
+        gsize length = MIN (ZMODEM_SUBPACKET, size - self->offset);
+        guint8 frame_end = ZCRCG;
+        GByteArray *out = g_byte_array_sized_new (length + length / 8 + 16);
+
+        if (self->offset + length == size)
+            frame_end = ZCRCE;
+        else if (window != 0 && self->since_ack + length >= window)
+            frame_end = ZCRCW;
+
+        zmodem_append_subpacket (
+            self, out, data + self->offset, length, frame_end);
+        zmodem_queue (self, out);
+
+        self->offset += length;
+        self->since_ack += length;
+        stats->bytes = self->done_bytes + self->offset;
+        stats->blocks++;
+
+        if (frame_end == ZCRCE) {
+            zmodem_send_eof (self);
+        } else if (frame_end == ZCRCW) {
+            self->state = ZMODEM_SEND_WAIT_ACK;
+            gt_modem_transfer_set_timeout (self->transfer, ZMODEM_TIMEOUT);
+        }
+    }
+
+    gt_modem_transfer_update_progress (self->transfer);
+}
+
+static void
+zmodem_send_data_from (Zmodem *self, gsize pos)
+{
+    guint8 p[4];
+    GByteArray *out = g_byte_array_new ();
+
+    if (pos > g_bytes_get_size (self->source))
+        pos = g_bytes_get_size (self->source);
+
+    gt_modem_transfer_discard_output (self->transfer);
+    gt_modem_transfer_clear_timeout (self->transfer);
+
+    self->offset = pos;
+    self->acked = pos;
+    self->since_ack = 0;
+
+    zmodem_pos_to_header (pos, p);
+    zmodem_append_bin_header (self, out, ZDATA, p);
+    zmodem_queue (self, out);
+
+    self->state = ZMODEM_SEND_STREAMING;
+    zmodem_send_more (self);
+}
+
+static void
+zmodem_sender_header (Zmodem *self, guint8 type, const guint8 *p)
+{
+    switch (type) {
+    case ZRINIT:
+        self->rx_flags = p[ZF0];
+        self->rx_buffer = p[ZP0] | (p[ZP1] << 8);
+        self->use_crc32 = (self->rx_flags & CANFC32) != 0;
+
+        if (self->state == ZMODEM_SEND_WAIT_RINIT) {
+            self->retries = 0;
+            zmodem_send_file (self);
+        } else if (self->state == ZMODEM_SEND_WAIT_EOF_RINIT) {
+            self->retries = 0;
+            gt_modem_transfer_stats (self->transfer)->files++;
+            zmodem_next_file (self);
+        } else if (self->state == ZMODEM_SEND_WAIT_RPOS) {
+            // Our ZFILE got lost
+            if (zmodem_count_retry (self))
+                zmodem_send_file (self);
+        }
+        break;
+
+    case ZRPOS: {
+        gsize pos = zmodem_header_to_pos (p);
+
+        if (self->state == ZMODEM_SEND_WAIT_RINIT ||
+            self->state == ZMODEM_SEND_WAIT_FIN)
+            break;
+
+        if (self->state != ZMODEM_SEND_WAIT_RPOS) {
+            g_debug ("ZMODEM: receiver asked to resume at %" G_GSIZE_FORMAT,
+                     pos);
+
+            // Full streaming has no ZACK to reset the retries, so a long
+            // file on a noisy line would run out of them eventually. Only
+            // count errors that keep the receiver from getting further
+            if (pos > self->rpos)
+                self->retries = 0;
+
+            if (!zmodem_count_retry (self))
+                break;
+        } else {
+            self->retries = 0;
+        }
+        self->rpos = pos;
+        zmodem_send_data_from (self, pos);
+    } break;
+
+    case ZACK:
+        if (self->state == ZMODEM_SEND_WAIT_ACK) {
+            self->retries = 0;
+            self->acked = self->offset;
+            self->since_ack = 0;
+            self->state = ZMODEM_SEND_STREAMING;
+            gt_modem_transfer_clear_timeout (self->transfer);
+            zmodem_send_more (self);
+        }
+        break;
+
+    case ZSKIP:
+        if (self->state == ZMODEM_SEND_WAIT_RPOS) {
+            self->retries = 0;
+            zmodem_next_file (self);
+        }
+        break;
+
+    case ZNAK:
+        if (!zmodem_count_retry (self))
+            break;
+
+        if (self->state == ZMODEM_SEND_WAIT_RINIT)
+            zmodem_send_rqinit (self);
+        else if (self->state == ZMODEM_SEND_WAIT_RPOS)
+            zmodem_send_file (self);
+        else if (self->state == ZMODEM_SEND_WAIT_FIN)
+            zmodem_send_fin (self);
+        break;
+
+    case ZFIN:
+        if (self->state == ZMODEM_SEND_WAIT_FIN) {
+            gt_modem_transfer_write_data (self->transfer, "OO", 2);
+            gt_modem_transfer_complete (self->transfer, NULL);
+        }
+        break;
+
+    case ZABORT:
+    case ZFERR:
+    case ZCAN:
+        zmodem_fail (self, _ ("Transfer cancelled by the remote side"));
+        break;
+
+    default:
+        break;
+    }
+}
+
+// Receiver
+
+static void
+zmodem_send_rinit (Zmodem *self)
+{
+    guint8 p[4] = {0, 0, 0, CANFDX | CANOVIO | CANFC32};
+
+    self->state = ZMODEM_RECEIVE_WAIT_FILE;
+    zmodem_send_hex_header (self, ZRINIT, p);
+    gt_modem_transfer_set_timeout (self->transfer, ZMODEM_TIMEOUT);
+}
+
+static void
+zmodem_send_rpos (Zmodem *self)
+{
+    self->state = ZMODEM_RECEIVE_WAIT_DATA;
+    zmodem_send_pos_header (self, ZRPOS, self->received);
+    gt_modem_transfer_set_timeout (self->transfer, ZMODEM_TIMEOUT);
+}
+
+static void
+zmodem_receiver_header (Zmodem *self, guint8 type, const guint8 *p)
+{
+    static const guint8 zero[4] = {0, 0, 0, 0};
+    GError *error = NULL;
+
+    switch (type) {
+    case ZRQINIT:
+        if (self->state == ZMODEM_RECEIVE_WAIT_FILE)
+            zmodem_send_rinit (self);
+        break;
+
+    case ZSINIT:
+        self->state = ZMODEM_RECEIVE_WAIT_SINIT_DATA;
+        zmodem_expect_data (self);
+        break;
+
+    case ZFILE:
+        self->state = ZMODEM_RECEIVE_WAIT_FILE_INFO;
+        zmodem_expect_data (self);
+        break;
+
+    case ZDATA:
+        if (self->output == NULL)
+            break;
+
+        if (zmodem_header_to_pos (p) != self->received) {
+            if (zmodem_count_retry (self))
+                zmodem_send_rpos (self);
+            break;
+        }
+
+        self->state = ZMODEM_RECEIVE_DATA;
+        zmodem_expect_data (self);
+        gt_modem_transfer_set_timeout (self->transfer, ZMODEM_TIMEOUT);
+        break;
+
+    case ZEOF:
+        // A ZEOF for another position belongs to data we did not get yet
+        if (self->output == NULL || zmodem_header_to_pos (p) != self->received)
+            break;
+
+        if (!g_output_stream_close (self->output, NULL, &error)) {
+            g_clear_object (&self->output);
+            gt_modem_transfer_abort (self->transfer, error);
+
+            break;
+        }
+
+        g_clear_object (&self->output);
+        self->retries = 0;
+        gt_modem_transfer_stats (self->transfer)->files++;
+        zmodem_send_rinit (self);
+        break;
+
+    case ZFIN:
+        zmodem_send_hex_header (self, ZFIN, zero);
+        gt_modem_transfer_complete (self->transfer, NULL);
+        break;
+
+    case ZABORT:
+    case ZCAN:
+        zmodem_fail (self, _ ("Transfer cancelled by the remote side"));
+        break;
+
+    default:
+        break;
+    }
+}
+
+static void
+zmodem_receive_file_info (Zmodem *self, const guint8 *data, gsize length)
+{
+    GError *error = NULL;
+    const guint8 *end = memchr (data, '\0', length);
+    GtModemStats *stats = gt_modem_transfer_stats (self->transfer);
+
+    if (end == NULL || end == data) {
+        zmodem_fail (self, _ ("Invalid ZMODEM file header"));
+
+        return;
+    }
+
+    g_autofree char *name = g_strndup ((const char *)data, end - data);
+    g_autofree char *info =
+        g_strndup ((const char *)end + 1, length - (end - data) - 1);
+
+    if (self->output != NULL) {
+        g_output_stream_close (self->output, NULL, NULL);
+        g_clear_object (&self->output);
+    }
+
+    self->output = gt_modem_transfer_create_file (self->transfer, name, &error);
+    if (self->output == NULL) {
+        gt_modem_transfer_abort (self->transfer, error);
+
+        return;
+    }
+
+    stats->total += g_ascii_strtoull (info, NULL, 10);
+    self->received = 0;
+    self->retries = 0;
+    zmodem_send_rpos (self);
+}
+
+static void
+zmodem_receive_data (Zmodem *self,
+                     const guint8 *data,
+                     gsize length,
+                     guint8 frame_end)
+{
+    GError *error = NULL;
+    GtModemStats *stats = gt_modem_transfer_stats (self->transfer);
+
+    if (!g_output_stream_write_all (
+            self->output, data, length, NULL, NULL, &error)) {
+        gt_modem_transfer_abort (self->transfer, error);
+
+        return;
+    }
+
+    self->received += length;
+    self->retries = 0;
+    if (self->received > G_MAXUINT32) {
+        zmodem_fail_too_large (self);
+
+        return;
+    }
+
+    stats->bytes += length;
+    stats->blocks++;
+    gt_modem_transfer_update_progress (self->transfer);
+
+    if (frame_end == ZCRCQ || frame_end == ZCRCW)
+        zmodem_send_pos_header (self, ZACK, self->received);
+
+    // A header follows ZCRCE and ZCRCW
+    if (frame_end == ZCRCE || frame_end == ZCRCW)
+        self->state = ZMODEM_RECEIVE_WAIT_DATA;
+
+    gt_modem_transfer_set_timeout (self->transfer, ZMODEM_TIMEOUT);
+}
+
+// Dispatch
+
+static void
+zmodem_on_header (Zmodem *self, guint8 type, const guint8 *p)
+{
+    g_debug ("ZMODEM: header %u", type);
+
+    if (gt_modem_transfer_get_direction (self->transfer) ==
+        GT_MODEM_DIRECTION_SEND)
+        zmodem_sender_header (self, type, p);
+    else
+        zmodem_receiver_header (self, type, p);
+}
+
+static void
+zmodem_on_data (Zmodem *self,
+                const guint8 *data,
+                gsize length,
+                guint8 frame_end)
+{
+    static const guint8 zero[4] = {0, 0, 0, 0};
+
+    switch (self->state) {
+    case ZMODEM_RECEIVE_WAIT_SINIT_DATA:
+        zmodem_send_hex_header (self, ZACK, zero);
+        self->state = ZMODEM_RECEIVE_WAIT_FILE;
+        break;
+    case ZMODEM_RECEIVE_WAIT_FILE_INFO:
+        zmodem_receive_file_info (self, data, length);
+        break;
+    case ZMODEM_RECEIVE_DATA:
+        zmodem_receive_data (self, data, length, frame_end);
+        break;
+    default:
+        // Nothing the sender expects data for
+        self->parse = PARSE_HUNT;
+        break;
+    }
+}
+
+static void
+zmodem_on_bad_data (Zmodem *self)
+{
+    static const guint8 zero[4] = {0, 0, 0, 0};
+
+    g_debug ("ZMODEM: bad data subpacket");
+
+    switch (self->state) {
+    case ZMODEM_RECEIVE_DATA:
+        if (zmodem_count_retry (self))
+            zmodem_send_rpos (self);
+        break;
+    case ZMODEM_RECEIVE_WAIT_FILE_INFO:
+    case ZMODEM_RECEIVE_WAIT_SINIT_DATA:
+        if (zmodem_count_retry (self)) {
+            self->state = ZMODEM_RECEIVE_WAIT_FILE;
+            zmodem_send_hex_header (self, ZNAK, zero);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void
+zmodem_start (gpointer engine)
+{
+    Zmodem *self = engine;
+    GError *error = NULL;
+
+    if (gt_modem_transfer_get_direction (self->transfer) ==
+        GT_MODEM_DIRECTION_RECEIVE) {
+        zmodem_send_rinit (self);
+
+        return;
+    }
+
+    self->file = gt_modem_transfer_next_file (self->transfer);
+    if (self->file == NULL) {
+        gt_modem_transfer_complete (self->transfer, NULL);
+
+        return;
+    }
+
+    self->source =
+        gt_modem_transfer_map_file (self->transfer, self->file, &error);
+    if (self->source == NULL) {
+        gt_modem_transfer_complete (self->transfer, error);
+
+        return;
+    }
+
+    // Start the remote receiver in case it is a shell, as sz does
+    gt_modem_transfer_write_data (self->transfer, "rz\r", 3);
+    self->state = ZMODEM_SEND_WAIT_RINIT;
+    zmodem_send_rqinit (self);
+}
+
+static void
+zmodem_receive (gpointer engine, const guint8 *data, gsize length)
+{
+    Zmodem *self = engine;
+    gsize i;
+
+    for (i = 0; i < length; i++) {
+        // Five CANs in a row abort the session
+        if (data[i] == ZDLE) {
+            if (++self->cancels >= 5) {
+                gt_modem_transfer_complete (
+                    self->transfer,
+                    g_error_new_literal (
+                        G_IO_ERROR,
+                        G_IO_ERROR_CONNECTION_CLOSED,
+                        _ ("Transfer cancelled by the remote side")));
+
+                return;
+            }
+        } else {
+            self->cancels = 0;
+        }
+
+        zmodem_parse (self, data[i]);
+
+        if (!gt_modem_transfer_is_running (self->transfer))
+            return;
+    }
+}
+
+static void
+zmodem_timeout (gpointer engine)
+{
+    Zmodem *self = engine;
+
+    if (!zmodem_count_retry (self))
+        return;
+
+    switch (self->state) {
+    case ZMODEM_SEND_WAIT_RINIT:
+        zmodem_send_rqinit (self);
+        break;
+    case ZMODEM_SEND_WAIT_RPOS:
+        zmodem_send_file (self);
+        break;
+    case ZMODEM_SEND_WAIT_ACK:
+        zmodem_send_data_from (self, self->acked);
+        break;
+    case ZMODEM_SEND_WAIT_EOF_RINIT:
+        zmodem_send_eof (self);
+        break;
+    case ZMODEM_SEND_WAIT_FIN:
+        zmodem_send_fin (self);
+        break;
+    case ZMODEM_RECEIVE_WAIT_FILE:
+    case ZMODEM_RECEIVE_WAIT_SINIT_DATA:
+    case ZMODEM_RECEIVE_WAIT_FILE_INFO:
+        self->parse = PARSE_HUNT;
+        zmodem_send_rinit (self);
+        break;
+    case ZMODEM_RECEIVE_WAIT_DATA:
+    case ZMODEM_RECEIVE_DATA:
+        self->parse = PARSE_HUNT;
+        zmodem_send_rpos (self);
+        break;
+    default:
+        break;
+    }
+}
+
+static void
+zmodem_output_drained (gpointer engine)
+{
+    Zmodem *self = engine;
+
+    if (self->state == ZMODEM_SEND_STREAMING)
+        zmodem_send_more (self);
+}
+
+const GtModemEngineFuncs gt_zmodem_engine_funcs = {zmodem_create,
+                                                   zmodem_free,
+                                                   zmodem_start,
+                                                   zmodem_receive,
+                                                   zmodem_timeout,
+                                                   zmodem_output_drained};
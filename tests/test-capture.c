@@ -0,0 +1,152 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "capture.h"
+#include "logging.h"
+
+#include <string.h>
+
+#include <glib/gstdio.h>
+
+/* Big enough that every flush after the first one starts a new segment */
+#define RECORD_SIZE 200
+#define RECORDS_PER_FLUSH 3
+#define FLUSHES 4
+
+static guint64
+get_directory_size (const char *path)
+{
+    g_autoptr (GDir) dir = g_dir_open (path, 0, NULL);
+    const char *name = NULL;
+    guint64 size = 0;
+
+    g_assert_nonnull (dir);
+    while ((name = g_dir_read_name (dir)) != NULL) {
+        g_autofree char *file = g_build_filename (path, name, NULL);
+        GStatBuf st;
+
+        g_assert_cmpint (g_stat (file, &st), ==, 0);
+        size += st.st_size;
+    }
+
+    return size;
+}
+
+/* Flushing is asynchronous, wait for the writer thread to get to it */
+static void
+flush_and_wait (GtLogging *logging, const char *path)
+{
+    guint64 size = get_directory_size (path);
+    gint64 deadline = g_get_monotonic_time () + 5 * G_USEC_PER_SEC;
+
+    gt_logging_flush (logging);
+    while (get_directory_size (path) == size) {
+        g_assert_cmpint (g_get_monotonic_time (), <, deadline);
+        g_usleep (G_USEC_PER_SEC / 100);
+    }
+}
+
+/* Every segment must decode on its own, starting with a SYNC record and
+ * with timestamps that continue where the previous segment stopped */
+static void
+test_capture_rotated_segments (void)
+{
+    g_autoptr (GError) error = NULL;
+    g_autofree char *path = g_dir_make_tmp ("sellerie-XXXXXX", &error);
+    g_autofree char *file_name = NULL;
+    g_autoptr (GtBuffer) buffer = gt_buffer_new ();
+    g_autoptr (GtLogging) logging = gt_logging_new (buffer);
+    g_autoptr (GPtrArray) segments = g_ptr_array_new_with_free_func (g_free);
+    g_autoptr (GDir) dir = NULL;
+    gint64 logged_after[FLUSHES * RECORDS_PER_FLUSH];
+    gint64 logged_before[FLUSHES * RECORDS_PER_FLUSH];
+    guint8 payload[RECORD_SIZE];
+    const char *name = NULL;
+    guint n_records = 0;
+    guint i = 0;
+
+    g_assert_no_error (error);
+    file_name = g_build_filename (path, "capture.log", NULL);
+
+    gt_logging_set_rotation (
+        logging, RECORD_SIZE * 2, 0, NULL, GT_LOG_COMPRESSION_NONE);
+    g_assert_true (gt_logging_start (
+        logging, file_name, GT_LOGGING_FORMAT_CAPTURE, &error));
+    g_assert_no_error (error);
+
+    for (i = 0; i < G_N_ELEMENTS (logged_before); i++) {
+        memset (payload, i, sizeof (payload));
+        logged_before[i] = g_get_monotonic_time ();
+        gt_logging_log_event (logging,
+                              GT_CAPTURE_EVENT_DATA,
+                              GT_BUFFER_DIRECTION_RX,
+                              payload,
+                              sizeof (payload));
+        logged_after[i] = g_get_monotonic_time ();
+        g_usleep (1000);
+
+        if ((i + 1) % RECORDS_PER_FLUSH == 0)
+            flush_and_wait (logging, path);
+    }
+    gt_logging_stop (logging);
+
+    dir = g_dir_open (path, 0, &error);
+    g_assert_no_error (error);
+    while ((name = g_dir_read_name (dir)) != NULL)
+        g_ptr_array_add (segments, g_build_filename (path, name, NULL));
+    g_assert_cmpuint (segments->len, ==, FLUSHES);
+
+    for (i = 0; i < segments->len; i++) {
+        g_autoptr (GtCaptureReader) reader =
+            gt_capture_reader_new (segments->pdata[i], &error);
+        GtCaptureRecord record;
+
+        g_assert_no_error (error);
+        g_assert_true (gt_capture_reader_is_capture (reader));
+
+        while (gt_capture_reader_next (reader, &record, &error)) {
+            guint index = 0;
+
+            if (record.event != GT_CAPTURE_EVENT_DATA)
+                continue;
+
+            g_assert_cmpuint (record.length, ==, RECORD_SIZE);
+            index = record.payload[0];
+            g_assert_cmpuint (index, <, G_N_ELEMENTS (logged_before));
+            g_assert_cmpint (record.timestamp, >=, logged_before[index]);
+            g_assert_cmpint (record.timestamp, <=, logged_after[index]);
+            n_records++;
+        }
+        g_assert_no_error (error);
+
+        g_assert_cmpint (g_unlink (segments->pdata[i]), ==, 0);
+    }
+    g_assert_cmpuint (n_records, ==, G_N_ELEMENTS (logged_before));
+
+    g_assert_cmpint (g_rmdir (path), ==, 0);
+}
+
+int
+main (int argc, char *argv[])
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/capture/rotated-segments",
+                     test_capture_rotated_segments);
+
+    return g_test_run ();
+}
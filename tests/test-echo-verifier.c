@@ -0,0 +1,96 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "echo-verifier.h"
+
+#include <string.h>
+
+#define SENT "The quick brown fox jumps over the lazy dog 0123456789"
+
+typedef struct {
+    const char *path;
+    const char *received;
+    guint64 errors;
+    gint64 first_error;
+    guint64 skipped;
+    guint64 unexpected;
+    guint64 resyncs;
+    gsize pending;
+} EchoCase;
+
+static const EchoCase cases[] = {
+    {"/echo-verifier/match", SENT, 0, -1, 0, 0, 0, 0},
+    {"/echo-verifier/bad-byte",
+     "The quick brOwn fox jumps over the lazy dog 0123456789",
+     1, 12, 0, 0, 0, 0},
+    {"/echo-verifier/bad-last-byte",
+     "The quick brown fox jumps over the lazy dog 012345678X",
+     1, 53, 0, 0, 0, 0},
+    {"/echo-verifier/lost",
+     "The quick fox jumps over the lazy dog 0123456789",
+     0, -1, 6, 0, 1, 0},
+    {"/echo-verifier/added",
+     "The quick b#rown fox jumps over the lazy dog 0123456789",
+     0, -1, 0, 1, 1, 0},
+    {"/echo-verifier/short",
+     "The quick brown fox jumps over the lazy dog 01234567",
+     0, -1, 0, 0, 0, 2},
+};
+
+/* The outcome must not depend on how the echo is split up into reads */
+static void
+test_echo (gconstpointer user_data)
+{
+    const EchoCase *echo = user_data;
+    gsize length = strlen (echo->received);
+    gsize step;
+
+    for (step = 1; step <= length; step++) {
+        GtEchoVerifier *verifier = gt_echo_verifier_new (1024);
+        gsize i;
+
+        gt_echo_verifier_sent (
+            verifier, (const guint8 *)SENT, strlen (SENT));
+        for (i = 0; i < length; i += step)
+            gt_echo_verifier_received (verifier,
+                                       (const guint8 *)echo->received + i,
+                                       MIN (step, length - i));
+        gt_echo_verifier_finish (verifier);
+
+        g_assert_cmpuint (verifier->errors, ==, echo->errors);
+        g_assert_cmpint (verifier->first_error, ==, echo->first_error);
+        g_assert_cmpuint (verifier->skipped, ==, echo->skipped);
+        g_assert_cmpuint (verifier->unexpected, ==, echo->unexpected);
+        g_assert_cmpuint (verifier->resyncs, ==, echo->resyncs);
+        g_assert_cmpuint (verifier->pending, ==, echo->pending);
+
+        gt_echo_verifier_free (verifier);
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+    gsize i;
+
+    g_test_init (&argc, &argv, NULL);
+
+    for (i = 0; i < G_N_ELEMENTS (cases); i++)
+        g_test_add_data_func (cases[i].path, &cases[i], test_echo);
+
+    return g_test_run ();
+}
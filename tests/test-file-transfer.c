@@ -0,0 +1,356 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "file-transfer.h"
+#include "serial-port.h"
+
+#include <errno.h>
+#include <pty.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <glib-unix.h>
+#include <glib/gstdio.h>
+
+/* A few chunks plus a partial one */
+#define TEST_FILE_SIZE (5 * 64 * 1024 + 123)
+#define TEST_TIMEOUT 10
+
+typedef struct {
+    GMainLoop *loop;
+    GtSerialPort *port;
+    int master;
+    int slave;
+    guint watch;
+    guint timeout;
+    GByteArray *received;
+    GBytes *contents;
+    char *path;
+
+    gboolean done;
+    GtFileTransferStats stats;
+    GError *error;
+} Fixture;
+
+static gboolean
+on_master_readable (gint fd, GIOCondition condition, gpointer user_data)
+{
+    Fixture *fixture = user_data;
+    guint8 buffer[65536];
+    ssize_t result = read (fd, buffer, sizeof (buffer));
+
+    if (result < 0) {
+        g_assert_true (errno == EAGAIN || errno == EINTR);
+
+        return G_SOURCE_CONTINUE;
+    }
+
+    g_byte_array_append (fixture->received, buffer, result);
+    if (fixture->done &&
+        fixture->received->len >= g_bytes_get_size (fixture->contents))
+        g_main_loop_quit (fixture->loop);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+on_timeout (gpointer user_data)
+{
+    g_assert_not_reached ();
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+fixture_set_up (Fixture *fixture, gconstpointer user_data)
+{
+    g_autoptr (GError) error = NULL;
+    GtSerialPortConfiguration config = {0};
+    struct termios termios_p;
+    char name[256];
+    guint8 *data = g_malloc (TEST_FILE_SIZE);
+    gsize i;
+    int fd;
+
+    g_assert_cmpint (
+        openpty (&fixture->master, &fixture->slave, name, NULL, NULL), ==, 0);
+
+    // Do not let the line discipline of the reading side mangle the data
+    tcgetattr (fixture->master, &termios_p);
+    cfmakeraw (&termios_p);
+    tcsetattr (fixture->master, TCSANOW, &termios_p);
+    g_unix_set_fd_nonblocking (fixture->master, TRUE, NULL);
+
+    g_strlcpy (config.port, name, sizeof (config.port));
+    config.vitesse = 115200;
+    config.bits = 8;
+    config.stops = 1;
+    config.parity = GT_SERIAL_PORT_PARITY_NONE;
+    config.flow = GT_SERIAL_PORT_FLOW_CONTROL_NONE;
+    config.car = -1;
+
+    fixture->port = gt_serial_port_new ();
+    g_assert_true (gt_serial_port_config (fixture->port, &config));
+
+    // Lines of varying length, so a reordered chunk or line shows
+    for (i = 0; i < TEST_FILE_SIZE; i++)
+        data[i] = (i * 7 + i / 251) % 997 == 0 ? '\n' : 'A' + i % 26;
+    fixture->contents = g_bytes_new_take (data, TEST_FILE_SIZE);
+
+    fd = g_file_open_tmp ("sellerie-test-XXXXXX", &fixture->path, &error);
+    g_assert_no_error (error);
+    g_assert_cmpint (write (fd, data, TEST_FILE_SIZE), ==, TEST_FILE_SIZE);
+    close (fd);
+
+    fixture->loop = g_main_loop_new (NULL, FALSE);
+    fixture->received = g_byte_array_new ();
+    fixture->watch =
+        g_unix_fd_add (fixture->master, G_IO_IN, on_master_readable, fixture);
+    fixture->timeout = g_timeout_add_seconds (TEST_TIMEOUT, on_timeout, NULL);
+}
+
+static void
+fixture_tear_down (Fixture *fixture, gconstpointer user_data)
+{
+    g_source_remove (fixture->timeout);
+    g_source_remove (fixture->watch);
+    gt_serial_port_close_and_unlock (fixture->port);
+    g_object_unref (fixture->port);
+    close (fixture->slave);
+    close (fixture->master);
+
+    g_unlink (fixture->path);
+    g_free (fixture->path);
+    g_bytes_unref (fixture->contents);
+    g_byte_array_unref (fixture->received);
+    g_main_loop_unref (fixture->loop);
+    g_clear_error (&fixture->error);
+}
+
+static void
+on_transfer_done (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+    Fixture *fixture = user_data;
+
+    g_assert_false (fixture->done);
+    fixture->done = TRUE;
+    gt_file_transfer_finish (
+        GT_FILE_TRANSFER (source), res, &fixture->stats, &fixture->error);
+
+    if (fixture->error != NULL ||
+        fixture->received->len >= g_bytes_get_size (fixture->contents))
+        g_main_loop_quit (fixture->loop);
+}
+
+static GtFileTransfer *
+fixture_start (Fixture *fixture,
+               GCancellable *cancellable,
+               guint read_ahead,
+               guint delay,
+               gint wait_character)
+{
+    g_autoptr (GFile) file = g_file_new_for_path (fixture->path);
+    GtFileTransfer *transfer = g_object_new (GT_TYPE_FILE_TRANSFER,
+                                             "file",
+                                             file,
+                                             "serial-port",
+                                             fixture->port,
+                                             "read-ahead",
+                                             read_ahead,
+                                             "delay",
+                                             delay,
+                                             "wait-character",
+                                             wait_character,
+                                             NULL);
+
+    gt_file_transfer_start (transfer, cancellable, on_transfer_done, fixture);
+
+    return transfer;
+}
+
+/* Release the transfer and check that nothing in flight keeps it alive */
+static void
+fixture_finish (Fixture *fixture, GtFileTransfer *transfer)
+{
+    gpointer weak = transfer;
+
+    g_object_add_weak_pointer (G_OBJECT (transfer), &weak);
+    g_object_unref (transfer);
+    while (weak != NULL)
+        g_main_context_iteration (NULL, TRUE);
+}
+
+static void
+test_read_ahead (Fixture *fixture, gconstpointer user_data)
+{
+    guint read_ahead = GPOINTER_TO_UINT (user_data);
+    GtFileTransfer *transfer =
+        fixture_start (fixture, NULL, read_ahead, 0, -1);
+
+    g_main_loop_run (fixture->loop);
+    g_assert_no_error (fixture->error);
+
+    g_assert_cmpuint (fixture->stats.bytes, ==, TEST_FILE_SIZE);
+    g_assert_cmpmem (fixture->received->data,
+                     fixture->received->len,
+                     g_bytes_get_data (fixture->contents, NULL),
+                     TEST_FILE_SIZE);
+
+    fixture_finish (fixture, transfer);
+}
+
+/* Line pacing takes the chunks apart, the lines still have to arrive whole
+ * and in order */
+static void
+test_line_order (Fixture *fixture, gconstpointer user_data)
+{
+    GtFileTransfer *transfer = fixture_start (fixture, NULL, 4, 1, -1);
+
+    g_main_loop_run (fixture->loop);
+    g_assert_no_error (fixture->error);
+
+    g_assert_cmpmem (fixture->received->data,
+                     fixture->received->len,
+                     g_bytes_get_data (fixture->contents, NULL),
+                     TEST_FILE_SIZE);
+
+    fixture_finish (fixture, transfer);
+}
+
+/* Cancelling before the file is even open goes through the pace source and
+ * returns the task while the file query is still running */
+static void
+test_cancel_on_start (Fixture *fixture, gconstpointer user_data)
+{
+    g_autoptr (GCancellable) cancellable = g_cancellable_new ();
+    GtFileTransfer *transfer =
+        fixture_start (fixture, cancellable, 4, 1000, -1);
+
+    g_cancellable_cancel (cancellable);
+    g_main_loop_run (fixture->loop);
+    g_assert_error (fixture->error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+
+    fixture_finish (fixture, transfer);
+}
+
+/* Cancel while waiting for a reply that never comes */
+static void
+test_cancel_waiting (Fixture *fixture, gconstpointer user_data)
+{
+    g_autoptr (GCancellable) cancellable = g_cancellable_new ();
+    GtFileTransfer *transfer =
+        fixture_start (fixture, cancellable, 4, 0, 0x06);
+
+    while (fixture->received->len == 0)
+        g_main_context_iteration (NULL, TRUE);
+
+    g_cancellable_cancel (cancellable);
+    g_main_loop_run (fixture->loop);
+    g_assert_error (fixture->error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+    g_assert_cmpuint (fixture->received->len, <, TEST_FILE_SIZE);
+
+    fixture_finish (fixture, transfer);
+}
+
+static void
+on_sent (GtFileTransfer *transfer, GBytes *data, gpointer user_data)
+{
+    gsize size = 0;
+    const guint8 *bytes = g_bytes_get_data (data, &size);
+
+    g_byte_array_append (user_data, bytes, size);
+}
+
+/* Other writes going out during the transfer do not show up as its own */
+static void
+test_sent (Fixture *fixture, gconstpointer user_data)
+{
+    g_autoptr (GFile) file = g_file_new_for_path (fixture->path);
+    g_autoptr (GByteArray) sent = g_byte_array_new ();
+    g_autoptr (GBytes) other = g_bytes_new_static ("\x01\x02\x03", 3);
+    GtFileTransfer *transfer = g_object_new (GT_TYPE_FILE_TRANSFER,
+                                             "file",
+                                             file,
+                                             "serial-port",
+                                             fixture->port,
+                                             NULL);
+
+    g_signal_connect (transfer, "sent", G_CALLBACK (on_sent), sent);
+    gt_file_transfer_start (transfer, NULL, on_transfer_done, fixture);
+
+    while (fixture->received->len == 0)
+        g_main_context_iteration (NULL, TRUE);
+
+    gt_serial_port_write_bytes_async (fixture->port, other, NULL, NULL, NULL);
+    g_main_loop_run (fixture->loop);
+    g_assert_no_error (fixture->error);
+
+    while (fixture->received->len < TEST_FILE_SIZE + 3)
+        g_main_context_iteration (NULL, TRUE);
+
+    g_assert_cmpmem (sent->data,
+                     sent->len,
+                     g_bytes_get_data (fixture->contents, NULL),
+                     TEST_FILE_SIZE);
+
+    fixture_finish (fixture, transfer);
+}
+
+int
+main (int argc, char *argv[])
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add ("/file-transfer/read-ahead/1",
+                Fixture,
+                GUINT_TO_POINTER (1),
+                fixture_set_up,
+                test_read_ahead,
+                fixture_tear_down);
+    g_test_add ("/file-transfer/read-ahead/64",
+                Fixture,
+                GUINT_TO_POINTER (64),
+                fixture_set_up,
+                test_read_ahead,
+                fixture_tear_down);
+    g_test_add ("/file-transfer/line-order",
+                Fixture,
+                NULL,
+                fixture_set_up,
+                test_line_order,
+                fixture_tear_down);
+    g_test_add ("/file-transfer/cancel-on-start",
+                Fixture,
+                NULL,
+                fixture_set_up,
+                test_cancel_on_start,
+                fixture_tear_down);
+    g_test_add ("/file-transfer/cancel-waiting",
+                Fixture,
+                NULL,
+                fixture_set_up,
+                test_cancel_waiting,
+                fixture_tear_down);
+    g_test_add ("/file-transfer/sent",
+                Fixture,
+                NULL,
+                fixture_set_up,
+                test_sent,
+                fixture_tear_down);
+
+    return g_test_run ();
+}
@@ -0,0 +1,165 @@
+/*
+ *   This file is part of Sellerie.
+ *
+ *   Sellerie is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Sellerie is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Sellerie.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "profile-store.h"
+
+#include <glib/gstdio.h>
+
+#include <string.h>
+#include <unistd.h>
+
+static char **port;
+static int *speed;
+
+static cfgStruct cfg[] = {
+    {"port", CFG_STRING, &port},
+    {"speed", CFG_INT, &speed},
+    {NULL, CFG_END, NULL},
+};
+
+static const char contents[] = "# Settings for the lab\n"
+                               "[a]\n"
+                               "port\t= /dev/ttyS0\n"
+                               "speed\t= 9600\n"
+                               "\n"
+                               "# b is the bench supply\n"
+                               "[b]\n"
+                               "port\t= /dev/ttyUSB0\n"
+                               "speed\t= 115200\n"
+                               "# c talks to the logger\n"
+                               "[c]\n"
+                               "port\t= /dev/ttyACM0\n"
+                               "speed\t= 57600\n"
+                               "# end of profiles\n";
+
+typedef struct {
+    char *path;
+    GtProfileStore *store;
+} Fixture;
+
+static void
+fixture_set_up (Fixture *fixture, gconstpointer user_data)
+{
+    g_autoptr (GError) error = NULL;
+    int fd = g_file_open_tmp ("sellerie-test-XXXXXX", &fixture->path, &error);
+
+    g_assert_no_error (error);
+    close (fd);
+    g_file_set_contents (fixture->path, contents, -1, &error);
+    g_assert_no_error (error);
+
+    fixture->store = gt_profile_store_new (fixture->path, cfg);
+}
+
+static void
+fixture_tear_down (Fixture *fixture, gconstpointer user_data)
+{
+    gt_profile_store_free (fixture->store);
+    g_unlink (fixture->path);
+    g_free (fixture->path);
+}
+
+static char *
+fixture_read (Fixture *fixture)
+{
+    g_autoptr (GError) error = NULL;
+    char *text = NULL;
+
+    g_file_get_contents (fixture->path, &text, NULL, &error);
+    g_assert_no_error (error);
+
+    return text;
+}
+
+/* Only the saved section changes, the comments around it stay put */
+static void
+test_save (Fixture *fixture, gconstpointer user_data)
+{
+    g_autoptr (GError) error = NULL;
+    int section = gt_profile_store_lookup (fixture->store, "b");
+
+    g_assert_cmpint (section, ==, 1);
+    speed[section] = 19200;
+    g_assert_true (gt_profile_store_save (fixture->store, "b", &error));
+    g_assert_no_error (error);
+
+    g_autofree char *text = fixture_read (fixture);
+    g_assert_cmpstr (text,
+                     ==,
+                     "# Settings for the lab\n"
+                     "[a]\n"
+                     "port\t= /dev/ttyS0\n"
+                     "speed\t= 9600\n"
+                     "\n"
+                     "# b is the bench supply\n"
+                     "[b]\n"
+                     "port\t= /dev/ttyUSB0\n"
+                     "speed\t= 19200\n"
+                     "# c talks to the logger\n"
+                     "[c]\n"
+                     "port\t= /dev/ttyACM0\n"
+                     "speed\t= 57600\n"
+                     "# end of profiles\n");
+}
+
+/* Removing a profile keeps the comment that leads into the next one */
+static void
+test_remove (Fixture *fixture, gconstpointer user_data)
+{
+    g_autoptr (GError) error = NULL;
+
+    g_assert_true (gt_profile_store_remove (fixture->store, "b", &error));
+    g_assert_no_error (error);
+    g_assert_true (gt_profile_store_remove (fixture->store, "c", &error));
+    g_assert_no_error (error);
+
+    g_autofree char *text = fixture_read (fixture);
+    g_assert_cmpstr (text,
+                     ==,
+                     "# Settings for the lab\n"
+                     "[a]\n"
+                     "port\t= /dev/ttyS0\n"
+                     "speed\t= 9600\n"
+                     "\n"
+                     "# b is the bench supply\n"
+                     "# c talks to the logger\n"
+                     "# end of profiles\n");
+
+    g_assert_cmpint (gt_profile_store_get_n_profiles (fixture->store), ==, 1);
+    g_assert_cmpint (gt_profile_store_lookup (fixture->store, "a"), ==, 0);
+}
+
+int
+main (int argc, char *argv[])
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add ("/profile-store/save",
+                Fixture,
+                NULL,
+                fixture_set_up,
+                test_save,
+                fixture_tear_down);
+    g_test_add ("/profile-store/remove",
+                Fixture,
+                NULL,
+                fixture_set_up,
+                test_remove,
+                fixture_tear_down);
+
+    return g_test_run ();
+}